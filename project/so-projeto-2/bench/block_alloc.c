@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*Microbenchmark of the inode and data block allocators: each thread repeatedly
+ * allocates a batch of blocks and inodes and frees them again, with 1 to 32
+ * threads, using both the global and the per-thread allocation modes*/
+
+#define MAX_THREADS (32)
+#define BATCH (64)   // Blocks held by a thread at a time
+#define ROUNDS (32)  // Batches allocated and freed by each thread
+
+void *worker(void *arg) {
+    (void)arg;
+    int blocks[BATCH];
+    int inodes[BATCH];
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            blocks[i] = data_block_alloc();
+            assert(blocks[i] != -1);
+            inodes[i] = inode_create(T_FILE);
+            assert(inodes[i] != -1);
+        }
+        for (int i = 0; i < BATCH; i++) {
+            data_block_free(blocks[i]);
+            inode_delete(inodes[i]);
+        }
+    }
+
+    return NULL;
+}
+
+void run(tfs_alloc_mode_t mode, char const *mode_name) {
+    tfs_params params = tfs_default_params();
+    params.alloc_mode = mode;
+    // Enough blocks and inodes for every thread, while keeping the FS half full
+    params.max_block_count = 4 * MAX_THREADS * BATCH;
+    params.max_inode_count = 4 * MAX_THREADS * BATCH;
+    assert(tfs_init(&params) != -1);
+
+    // Fragments the first half of the FS, so that searches are not trivial
+    int used[params.max_block_count / 2];
+    for (size_t i = 0; i < params.max_block_count / 2; i++) {
+        used[i] = data_block_alloc();
+        assert(used[i] != -1);
+    }
+    for (size_t i = 0; i < params.max_block_count / 2; i += 2) {
+        data_block_free(used[i]);
+    }
+
+    for (int n_threads = 1; n_threads <= MAX_THREADS; n_threads *= 2) {
+        pthread_t threads[MAX_THREADS];
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n_threads; i++) {
+            assert(pthread_create(&threads[i], NULL, worker, NULL) == 0);
+        }
+        for (int i = 0; i < n_threads; i++) {
+            assert(pthread_join(threads[i], NULL) == 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double time = (double)(end.tv_sec - start.tv_sec) +
+                      (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        // allocs and frees, of both blocks and inodes
+        double ops = 4.0 * n_threads * ROUNDS * BATCH;
+        printf("%12s %8d %14.3f\n", mode_name, n_threads, ops / time / 1e6);
+    }
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    printf("%12s %8s %14s\n", "mode", "threads", "Mops/s");
+
+    run(TFS_ALLOC_GLOBAL, "global");
+    run(TFS_ALLOC_PER_THREAD, "per-thread");
+
+    return 0;
+}
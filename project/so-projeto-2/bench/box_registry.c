@@ -0,0 +1,115 @@
+#include "mbroker/registry.h"
+#include "protocol.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark of looking up boxes by their names, with BOXES boxes: the linear
+ * scan of the box names the broker used to do (building the name with its /,
+ * and comparing it with each box in use), versus the registry (a hash table
+ * whose lookups only take the read lock of their stripe), with several
+ * threads looking up at once. Then boxes are created and removed in turns, as
+ * managers do. Reports the lookups (and creations with removals) per second*/
+
+#define BOXES (100000)
+#define LINEAR_LOOKUPS (2000) // The scan is too slow for more
+#define LOOKUPS (2000000)     // Split across the threads
+#define CHURN (200000)        // Creations and removals
+
+static char names[BOXES][P_BOX_NAME_SIZE];
+static char slashed[BOXES][P_BOX_NAME_SIZE + 1]; // As box_info kept them
+static int taken[BOXES];
+
+double elapsed(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// The lookup the broker used to do
+int linear_lookup(char const *box_name) {
+    char box_name_slash[P_BOX_NAME_SIZE + 1];
+    sprintf(box_name_slash, "/%s", box_name);
+    for (int i = 0; i < BOXES; i++) {
+        if (taken[i] && !strcmp(box_name_slash, slashed[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void *lookup(void *arg) {
+    size_t lookups = *(size_t *)arg;
+    unsigned int seed = (unsigned int)lookups;
+    for (size_t i = 0; i < lookups; i++) {
+        int box = rand_r(&seed) % BOXES;
+        assert(registry_lookup(names[box]) != -1);
+    }
+    return NULL;
+}
+
+double run_lookups(size_t threads) {
+    pthread_t tids[64];
+    size_t lookups = LOOKUPS / threads;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < threads; i++) {
+        assert(pthread_create(&tids[i], NULL, lookup, &lookups) == 0);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        assert(pthread_join(tids[i], NULL) == 0);
+    }
+    return (double)(lookups * threads) / elapsed(start);
+}
+
+int main() {
+    assert(registry_init(BOXES) == 0);
+    for (int i = 0; i < BOXES; i++) {
+        snprintf(names[i], P_BOX_NAME_SIZE, "box%d", i);
+        snprintf(slashed[i], P_BOX_NAME_SIZE + 1, "/%s", names[i]);
+        taken[i] = 1;
+
+        int box_id = registry_alloc();
+        assert(box_id == i);
+        assert(registry_reserve(names[i], box_id) == 0);
+        registry_publish(box_id);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < LINEAR_LOOKUPS; i++) {
+        int box = rand_r(&seed) % BOXES;
+        assert(linear_lookup(names[box]) == box);
+    }
+    double linear = LINEAR_LOOKUPS / elapsed(start);
+
+    printf("%d boxes\n", BOXES);
+    printf("%10s %16s\n", "threads", "lookups/s");
+    printf("%10s %16.0f\n", "linear", linear);
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        printf("%10zu %16.0f\n", threads, run_lookups(threads));
+    }
+
+    // Boxes removed and created again, each taking the index given back
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < CHURN; i++) {
+        char const *name = names[i % BOXES];
+        int box_id = registry_remove(name);
+        assert(box_id != -1);
+        registry_free(box_id);
+        assert(registry_alloc() == box_id);
+        assert(registry_reserve(name, box_id) == 0);
+        registry_publish(box_id);
+    }
+    printf("%10s %16.0f\n", "churn", CHURN / elapsed(start));
+
+    registry_destroy();
+
+    return 0;
+}
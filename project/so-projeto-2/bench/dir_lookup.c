@@ -0,0 +1,68 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*Benchmark of the latency of tfs_open and tfs_unlink on existing files, in a
+ * root directory with 64, 1k and 64k entries*/
+
+#define SAMPLES (1000) // Files opened (and then unlinked) per directory size
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void run(size_t n_entries) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = n_entries + 1;
+    // Directory blocks (44 bytes per entry) and their indirect blocks
+    params.max_block_count = n_entries / 16 + 64;
+    assert(tfs_init(&params) != -1);
+
+    char name[MAX_FILE_NAME];
+    for (size_t i = 0; i < n_entries; i++) {
+        snprintf(name, sizeof(name), "/file%zu", i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    // Picks distinct files spread over the whole directory
+    size_t samples = n_entries < SAMPLES ? n_entries : SAMPLES;
+    size_t stride = n_entries / samples;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < samples; i++) {
+        snprintf(name, sizeof(name), "/file%zu", i * stride);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    double open_ns = elapsed_ns(start) / (double)samples;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < samples; i++) {
+        snprintf(name, sizeof(name), "/file%zu", i * stride);
+        assert(tfs_unlink(name) != -1);
+    }
+    double unlink_ns = elapsed_ns(start) / (double)samples;
+
+    printf("%8zu %14.0f %14.0f\n", n_entries, open_ns, unlink_ns);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    printf("%8s %14s %14s\n", "entries", "open ns/op", "unlink ns/op");
+
+    run(64);
+    run(1024);
+    run(64 * 1024);
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*Benchmark of the throughput of concurrent create, lookup and unlink
+ * operations on the root directory, with 1 to 32 threads, each working on its
+ * own names*/
+
+#define FILES_PER_THREAD (64) // Live files of each thread in every round
+#define ROUNDS (16)           // Rounds of create, lookup and unlink per thread
+#define MAX_THREADS (32)
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void *worker(void *arg) {
+    size_t id = (size_t)arg;
+    char name[MAX_FILE_NAME];
+
+    for (size_t r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < FILES_PER_THREAD; i++) {
+            snprintf(name, sizeof(name), "/t%zu_f%zu", id, i);
+            int f = tfs_open(name, TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_close(f) != -1);
+        }
+
+        for (size_t i = 0; i < FILES_PER_THREAD; i++) {
+            snprintf(name, sizeof(name), "/t%zu_f%zu", id, i);
+            int f = tfs_open(name, 0);
+            assert(f != -1);
+            assert(tfs_close(f) != -1);
+        }
+
+        for (size_t i = 0; i < FILES_PER_THREAD; i++) {
+            snprintf(name, sizeof(name), "/t%zu_f%zu", id, i);
+            assert(tfs_unlink(name) != -1);
+        }
+    }
+
+    return NULL;
+}
+
+void run(size_t n_threads) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = n_threads * FILES_PER_THREAD + 1;
+    params.max_open_files_count = n_threads;
+    // Directory blocks (44 bytes per entry) and their indirect blocks
+    params.max_block_count = n_threads * FILES_PER_THREAD / 16 + 64;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t threads[MAX_THREADS];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t t = 0; t < n_threads; t++) {
+        assert(pthread_create(&threads[t], NULL, worker, (void *)t) == 0);
+    }
+    for (size_t t = 0; t < n_threads; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+    double ns = elapsed_ns(start);
+
+    double ops = (double)(n_threads * ROUNDS * FILES_PER_THREAD * 3);
+    printf("%8zu %14.0f\n", n_threads, ops / ns * 1e9);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    printf("%8s %14s\n", "threads", "ops/s");
+
+    for (size_t n_threads = 1; n_threads <= MAX_THREADS; n_threads *= 2) {
+        run(n_threads);
+    }
+
+    return 0;
+}
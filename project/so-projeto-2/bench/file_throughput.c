@@ -0,0 +1,73 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark that appends files of 1 KiB up to 64 MiB to TFS and reads them
+ * back, reporting the throughput of each operation*/
+
+#define KIB (1024)
+#define MIB (1024 * KIB)
+#define CHUNK_SIZE (4 * KIB) // Size of each tfs_write/tfs_read
+
+char const path[] = "/bench";
+
+double elapsed(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    // Enough blocks for a 64 MiB file, plus its indirect blocks
+    params.max_block_count = 64 * MIB / params.block_size + 512;
+    assert(tfs_init(&params) != -1);
+
+    char chunk[CHUNK_SIZE];
+    for (size_t i = 0; i < CHUNK_SIZE; i++) {
+        chunk[i] = (char)('a' + i % 26);
+    }
+    char buffer[CHUNK_SIZE];
+
+    printf("%10s %14s %14s\n", "size", "append MiB/s", "read MiB/s");
+
+    for (size_t size = KIB; size <= 64 * MIB; size *= 4) {
+        struct timespec start;
+
+        int f = tfs_open(path, TFS_O_CREAT | TFS_O_APPEND);
+        assert(f != -1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t done = 0; done < size; done += CHUNK_SIZE) {
+            size_t len = size - done < CHUNK_SIZE ? size - done : CHUNK_SIZE;
+            assert(tfs_write(f, chunk, len) == len);
+        }
+        double write_time = elapsed(start);
+        assert(tfs_close(f) != -1);
+
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t total = 0;
+        ssize_t bytes_read;
+        while ((bytes_read = tfs_read(f, buffer, CHUNK_SIZE)) > 0) {
+            assert(memcmp(buffer, chunk, (size_t)bytes_read) == 0);
+            total += (size_t)bytes_read;
+        }
+        double read_time = elapsed(start);
+        assert(total == size);
+        assert(tfs_close(f) != -1);
+
+        assert(tfs_unlink(path) != -1);
+
+        printf("%7zu KiB %14.1f %14.1f\n", size / KIB,
+               (double)size / MIB / write_time, (double)size / MIB / read_time);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the time to start TécnicoFS (initialize it and open a file) from
+ * an image in a backing file of 1 MiB up to 1 GiB, compared to initializing an
+ * in-memory FS of the same size*/
+
+#define BLOCK_SIZE (1024)
+#define RUNS (5) // Startups per image size (the fastest is reported)
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+double startup_ns(tfs_params const *params) {
+    double best = 0;
+    for (int r = 0; r < RUNS; r++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        assert(tfs_init(params) != -1);
+        int f = tfs_open("/box", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+
+        double ns = elapsed_ns(start);
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+
+        assert(tfs_destroy() != -1);
+    }
+    return best;
+}
+
+void run(size_t image_mib, char const *image_path) {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = image_mib * 1024 * 1024 / BLOCK_SIZE;
+    params.max_inode_count = params.max_block_count / 16;
+    params.block_size = BLOCK_SIZE;
+
+    double memory = startup_ns(&params);
+
+    assert(tfs_mkfs(image_path, &params) != -1);
+    params.image_path = image_path;
+    double image = startup_ns(&params);
+
+    printf("%10zu %18.0f %18.0f\n", image_mib, memory / 1e3, image / 1e3);
+
+    assert(unlink(image_path) != -1);
+}
+
+int main() {
+    char image_path[64];
+    sprintf(image_path, "/tmp/tfs_image_bench_%d", getpid());
+
+    printf("%10s %18s %18s\n", "image MiB", "in-memory us", "image us");
+
+    for (size_t image_mib = 1; image_mib <= 1024; image_mib *= 4) {
+        run(image_mib, image_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the messages per second appended to a journaled image versus the
+ * commit interval, with writers that wait for each message to be durable
+ * (tfs_sync) and with writers that do not, compared to an image without a
+ * journal*/
+
+#define WRITERS (8)
+#define MESSAGE_SIZE (256)
+#define FILE_LIMIT (1024 * 1024) // Files are truncated once they reach this
+#define DURATION_NS (500e6)
+
+typedef struct {
+    size_t id;
+    int sync;
+    size_t messages;
+} writer_t;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void *writer(void *arg) {
+    writer_t *w = arg;
+    char name[MAX_FILE_NAME];
+    char message[MESSAGE_SIZE] = {0};
+    snprintf(name, sizeof(name), "/box%zu", w->id);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int f = tfs_open(name, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    size_t size = 0;
+    while (elapsed_ns(start) < DURATION_NS) {
+        if (size + MESSAGE_SIZE > FILE_LIMIT) {
+            assert(tfs_close(f) != -1);
+            f = tfs_open(name, TFS_O_TRUNC);
+            assert(f != -1);
+            size = 0;
+        }
+        assert(tfs_write(f, message, MESSAGE_SIZE) == MESSAGE_SIZE);
+        size += MESSAGE_SIZE;
+        if (w->sync) {
+            assert(tfs_sync() != -1);
+        }
+        w->messages++;
+    }
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}
+
+double messages_per_second(tfs_params const *params, int sync) {
+    assert(tfs_init(params) != -1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t threads[WRITERS];
+    writer_t writers[WRITERS];
+    for (size_t t = 0; t < WRITERS; t++) {
+        writers[t] = (writer_t){.id = t, .sync = sync, .messages = 0};
+        assert(pthread_create(&threads[t], NULL, writer, &writers[t]) == 0);
+    }
+    size_t messages = 0;
+    for (size_t t = 0; t < WRITERS; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+        messages += writers[t].messages;
+    }
+    double ns = elapsed_ns(start);
+
+    assert(tfs_destroy() != -1);
+
+    return (double)messages / (ns / 1e9);
+}
+
+int main() {
+    char image_path[64];
+    char journal_path[80];
+    sprintf(image_path, "/tmp/tfs_journal_bench_%d", getpid());
+    sprintf(journal_path, "%s.journal", image_path);
+
+    tfs_params params = tfs_default_params();
+    params.max_block_count = WRITERS * (FILE_LIMIT / 1024 + 16);
+    params.journal_path = journal_path;
+    assert(tfs_mkfs(image_path, &params) != -1);
+    params.image_path = image_path;
+
+    printf("%12s %14s %14s\n", "interval us", "sync msgs/s", "async msgs/s");
+
+    size_t intervals[] = {0, 100, 1000, 10000};
+    for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+        params.journal_commit_interval_us = intervals[i];
+        double sync = messages_per_second(&params, 1);
+        double async = messages_per_second(&params, 0);
+        printf("%12zu %14.0f %14.0f\n", intervals[i], sync, async);
+    }
+
+    params.journal_path = NULL;
+    printf("%12s %14s %14.0f\n", "no journal", "-",
+           messages_per_second(&params, 0));
+
+    assert(unlink(image_path) != -1);
+    assert(unlink(journal_path) != -1);
+
+    return 0;
+}
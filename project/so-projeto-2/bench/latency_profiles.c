@@ -0,0 +1,91 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark of a broker-like workload (messages appended to boxes, and read
+ * back by a subscriber of each box) under several storage latency profiles,
+ * with the stall time simulated for each class of access*/
+
+#define BOXES (8)
+#define MESSAGES (2000) // Per box
+#define MESSAGE_SIZE (64)
+
+typedef struct {
+    char const *name;
+    tfs_latency_model_t model;
+    size_t fixed_ns;
+    size_t class_ns[TFS_ACCESS_CLASSES];
+} profile_t;
+
+static profile_t const profiles[] = {
+    {"none", TFS_LATENCY_NONE, 0, {0}},
+    {"fixed", TFS_LATENCY_FIXED, 1000, {0}},
+    {"nvme", TFS_LATENCY_DEVICE, 0, {100, 1000, 200, 2000}},
+    {"sata-ssd", TFS_LATENCY_DEVICE, 0, {200, 5000, 500, 10000}},
+    {"hdd", TFS_LATENCY_DEVICE, 0, {500, 20000, 1000, 40000}},
+};
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void run(profile_t const *profile) {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 4096;
+    params.latency_model = profile->model;
+    params.latency_ns = profile->fixed_ns;
+    memcpy(params.latency_class_ns, profile->class_ns,
+           sizeof(params.latency_class_ns));
+    assert(tfs_init(&params) != -1);
+
+    char message[MESSAGE_SIZE] = {0};
+    char name[MAX_FILE_NAME];
+    int publishers[BOXES];
+    int subscribers[BOXES];
+    for (int b = 0; b < BOXES; b++) {
+        snprintf(name, sizeof(name), "/box%d", b);
+        publishers[b] = tfs_open(name, TFS_O_CREAT | TFS_O_APPEND);
+        subscribers[b] = tfs_open(name, 0);
+        assert(publishers[b] != -1 && subscribers[b] != -1);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Messages of the boxes are interleaved, as the broker's workers do
+    for (int m = 0; m < MESSAGES; m++) {
+        for (int b = 0; b < BOXES; b++) {
+            assert(tfs_write(publishers[b], message, MESSAGE_SIZE) ==
+                   MESSAGE_SIZE);
+            assert(tfs_read(subscribers[b], message, MESSAGE_SIZE) ==
+                   MESSAGE_SIZE);
+        }
+    }
+
+    double ns = elapsed_ns(start);
+    tfs_stall_stats stats = tfs_get_stall_stats();
+
+    printf("%10s %12.0f", profile->name, BOXES * MESSAGES / (ns / 1e9));
+    for (int c = 0; c < TFS_ACCESS_CLASSES; c++) {
+        printf(" %14.2f", (double)stats.stall_ns[c] / 1e6);
+    }
+    printf("\n");
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    printf("%10s %12s %14s %14s %14s %14s\n", "profile", "msgs/s",
+           "meta seq ms", "meta rand ms", "data seq ms", "data rand ms");
+
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        run(&profiles[p]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark of several publishers appending to one box at once, each a thread
+ * appending batches of messages to the file of the box: through one shared
+ * handle opened with TFS_O_APPEND (so one tfs_write at a time, copies
+ * included), versus each through its own handle with tfs_append (which copy in
+ * parallel, and only commit in order). Reports the messages per second
+ * appended by all publishers*/
+
+#define KIB (1024)
+#define MIB (1024 * KIB)
+#define MESSAGES (256 * KIB)
+#define MESSAGE_SIZE (256) // Including the \0
+#define BATCH (16)         // Messages appended at a time
+
+char const path[] = "/box";
+
+typedef struct {
+    int fhandle; // Shared by all publishers, or their own
+    int use_append;
+    size_t batches;
+} publisher_t;
+
+double elapsed(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void *publish(void *arg) {
+    publisher_t *pub = arg;
+    char batch[BATCH * MESSAGE_SIZE];
+    memset(batch, 'x', sizeof(batch));
+    for (size_t i = 0; i < BATCH; i++) {
+        batch[i * MESSAGE_SIZE + MESSAGE_SIZE - 1] = '\0';
+    }
+
+    for (size_t i = 0; i < pub->batches; i++) {
+        if (pub->use_append) {
+            assert(tfs_append(pub->fhandle, batch, sizeof(batch), NULL,
+                              NULL) == sizeof(batch));
+        } else {
+            assert(tfs_write(pub->fhandle, batch, sizeof(batch)) ==
+                   sizeof(batch));
+        }
+    }
+
+    return NULL;
+}
+
+double run(size_t publishers, int use_append) {
+    int shared = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC | TFS_O_APPEND);
+    assert(shared != -1);
+
+    publisher_t *pubs = calloc(publishers, sizeof(publisher_t));
+    pthread_t *threads = calloc(publishers, sizeof(pthread_t));
+    assert(pubs != NULL && threads != NULL);
+    for (size_t i = 0; i < publishers; i++) {
+        pubs[i].fhandle = use_append ? tfs_open(path, TFS_O_APPEND) : shared;
+        assert(pubs[i].fhandle != -1);
+        pubs[i].use_append = use_append;
+        pubs[i].batches = MESSAGES / BATCH / publishers;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < publishers; i++) {
+        assert(pthread_create(&threads[i], NULL, publish, &pubs[i]) == 0);
+    }
+    for (size_t i = 0; i < publishers; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    double seconds = elapsed(start);
+
+    size_t messages = publishers * pubs[0].batches * BATCH;
+    assert(tfs_file_size(path) == (ssize_t)(messages * MESSAGE_SIZE));
+
+    for (size_t i = 0; use_append && i < publishers; i++) {
+        assert(tfs_close(pubs[i].fhandle) != -1);
+    }
+    assert(tfs_close(shared) != -1);
+    free(pubs);
+    free(threads);
+
+    return (double)messages / seconds;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    // Enough blocks for the box, plus its indirect blocks
+    params.max_block_count = MESSAGES * MESSAGE_SIZE / params.block_size + 512;
+    params.max_open_files_count = 32;
+    assert(tfs_init(&params) != -1);
+
+    run(1, 0); // Warms up the blocks of the FS
+
+    printf("%12s %16s %16s\n", "publishers", "write msgs/s", "append msgs/s");
+
+    for (size_t publishers = 1; publishers <= 16; publishers *= 2) {
+        double locked = run(publishers, 0);
+        double appended = run(publishers, 1);
+        printf("%12zu %16.0f %16.0f\n", publishers, locked, appended);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    return 0;
+}
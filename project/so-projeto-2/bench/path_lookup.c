@@ -0,0 +1,67 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark of the latency of tfs_open on files 1 to 8 directories deep, with
+ * and without the dentry cache*/
+
+#define SAMPLES (1000) // Opens per depth
+#define FILES (64)     // Files in the deepest directory
+#define MAX_DEPTH (8)
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+double run(size_t depth, size_t cache_size) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = MAX_DEPTH + FILES + 1;
+    params.dentry_cache_size = cache_size;
+    assert(tfs_init(&params) != -1);
+
+    char dir[256] = "";
+    for (size_t d = 0; d < depth; d++) {
+        size_t len = strlen(dir);
+        snprintf(dir + len, sizeof(dir) - len, "/dir%zu", d);
+        assert(tfs_mkdir(dir) != -1);
+    }
+
+    char name[300];
+    for (size_t i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "%s/file%zu", dir, i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < SAMPLES; i++) {
+        snprintf(name, sizeof(name), "%s/file%zu", dir, i % FILES);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    double ns = elapsed_ns(start) / SAMPLES;
+
+    assert(tfs_destroy() != -1);
+
+    return ns;
+}
+
+int main() {
+    printf("%8s %18s %18s\n", "depth", "no cache ns/op", "cache ns/op");
+
+    for (size_t depth = 1; depth <= MAX_DEPTH; depth *= 2) {
+        double uncached = run(depth, 0);
+        double cached = run(depth, 1024);
+        printf("%8zu %18.0f %18.0f\n", depth, uncached, cached);
+    }
+
+    return 0;
+}
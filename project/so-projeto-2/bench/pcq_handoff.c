@@ -0,0 +1,93 @@
+#include "pcq-wait.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*Benchmark of the handoffs of the producer-consumer queue, as the broker hands
+ * requests to its dispatchers: two threads bounce ROUNDS elements through two
+ * queues (one each way), so each handoff finds the other thread waiting, with
+ * threads that park right away or after spinning for a while. Reports the
+ * round trips per second, the times the threads parked and made the system
+ * call to wake others, and the median and 99th percentile of the handoff
+ * times (the upper bounds of their buckets of the histogram)*/
+
+#define ROUNDS (100000)
+
+static size_t const spin_counts[] = {0, 64, PCQ_SPIN_DEFAULT, 4096};
+
+static pc_queue_t requests, replies;
+
+void *echo(void *arg) {
+    (void)arg;
+    void *elem;
+    while ((elem = pcq_dequeue(&requests)) != NULL) {
+        assert(pcq_enqueue(&replies, elem) == 0);
+    }
+    return NULL;
+}
+
+// Upper bound of the bucket of the handoff at the given fraction of them
+static unsigned long long percentile(pcq_wait_stats_t const *stats,
+                                     double fraction) {
+    size_t total = 0, count = 0;
+    for (size_t i = 0; i < PCQ_HANDOFF_BUCKETS; i++) {
+        total += stats->handoffs[i];
+    }
+    for (size_t i = 0; i < PCQ_HANDOFF_BUCKETS; i++) {
+        count += stats->handoffs[i];
+        if ((double)count >= fraction * (double)total) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (PCQ_HANDOFF_BUCKETS - 1);
+}
+
+void run(size_t spin_count) {
+    pcq_wait_params_t params = {.spin_count = spin_count,
+                                .handoff_histogram = true};
+    assert(pcq_create(&requests, 1) == 0 && pcq_create(&replies, 1) == 0);
+    pcq_set_wait_params(&requests, &params);
+    pcq_set_wait_params(&replies, &params);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, echo, NULL) == 0);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 1; i <= ROUNDS; i++) {
+        assert(pcq_enqueue(&requests, (void *)(uintptr_t)i) == 0);
+        assert(pcq_dequeue(&replies) == (void *)(uintptr_t)i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(pcq_enqueue(&requests, NULL) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+
+    pcq_wait_stats_t stats = pcq_get_wait_stats(&requests);
+    pcq_wait_stats_t back = pcq_get_wait_stats(&replies);
+    stats.parks += back.parks;
+    stats.wakes += back.wakes;
+    for (size_t i = 0; i < PCQ_HANDOFF_BUCKETS; i++) {
+        stats.handoffs[i] += back.handoffs[i];
+    }
+    assert(pcq_destroy(&requests) == 0 && pcq_destroy(&replies) == 0);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) +
+                     (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%10zu %14.0f %10zu %10zu %10llu %10llu\n", spin_count,
+           ROUNDS / seconds, stats.parks, stats.wakes,
+           percentile(&stats, 0.5), percentile(&stats, 0.99));
+}
+
+int main() {
+    printf("%d round trips\n", ROUNDS);
+    printf("%10s %14s %10s %10s %10s %10s\n", "spins", "trips/s", "parks",
+           "wakes", "p50 <ns", "p99 <ns");
+    for (size_t i = 0; i < sizeof(spin_counts) / sizeof(*spin_counts); i++) {
+        run(spin_counts[i]);
+    }
+
+    return 0;
+}
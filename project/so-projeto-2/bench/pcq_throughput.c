@@ -0,0 +1,200 @@
+#include "pcq-batch.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*Benchmark of the producer-consumer queue, as the broker uses it to hand
+ * requests to its dispatchers: as many producers as consumers (from 1 to 32
+ * of each) move ITEMS pointers through a queue of CAPACITY, with the queue
+ * the broker used before (a lock for each of its head, tail and size, and a
+ * condvar for each side, all taken on every operation) versus the lock-free
+ * ring of pcq_enqueue/pcq_dequeue, and the ring moving BATCH items at a time
+ * (pcq_enqueue_batch/pcq_dequeue_batch, as the broker's accept loop and
+ * dispatchers do). Reports the items moved per second*/
+
+#define ITEMS (400000)
+#define CAPACITY (64)
+#define MAX_THREADS (32)
+#define BATCH (16)
+
+typedef struct {
+    int (*enqueue)(pc_queue_t *, void *);
+    void *(*dequeue)(pc_queue_t *);
+    size_t batch; // Items moved at a time (with the batch operations if > 1)
+} queue_ops_t;
+
+typedef struct {
+    pc_queue_t *queue;
+    queue_ops_t const *ops;
+    size_t items;
+} worker_t;
+
+// The queue the broker used before (kept to compare with)
+int mutex_pcq_create(pc_queue_t *queue, size_t capacity) {
+    queue->pcq_buffer = (void **)malloc(capacity * sizeof(void *));
+    assert(queue->pcq_buffer != NULL);
+    queue->pcq_capacity = capacity;
+    queue->pcq_current_size = 0;
+    queue->pcq_head = 0;
+    queue->pcq_tail = 0;
+    assert(pthread_mutex_init(&queue->pcq_current_size_lock, NULL) == 0);
+    assert(pthread_mutex_init(&queue->pcq_head_lock, NULL) == 0);
+    assert(pthread_mutex_init(&queue->pcq_tail_lock, NULL) == 0);
+    assert(pthread_mutex_init(&queue->pcq_pusher_condvar_lock, NULL) == 0);
+    assert(pthread_cond_init(&queue->pcq_pusher_condvar, NULL) == 0);
+    assert(pthread_mutex_init(&queue->pcq_popper_condvar_lock, NULL) == 0);
+    assert(pthread_cond_init(&queue->pcq_popper_condvar, NULL) == 0);
+    return 0;
+}
+
+int mutex_pcq_enqueue(pc_queue_t *queue, void *elem) {
+    pthread_mutex_lock(&queue->pcq_pusher_condvar_lock);
+    while (queue->pcq_current_size == queue->pcq_capacity)
+        pthread_cond_wait(&queue->pcq_pusher_condvar,
+                          &queue->pcq_pusher_condvar_lock);
+
+    pthread_mutex_lock(&queue->pcq_head_lock);
+    queue->pcq_buffer[queue->pcq_head] = elem;
+    queue->pcq_head = (queue->pcq_head + 1) % queue->pcq_capacity;
+    pthread_mutex_unlock(&queue->pcq_head_lock);
+
+    pthread_mutex_lock(&queue->pcq_current_size_lock);
+    queue->pcq_current_size++;
+    pthread_mutex_unlock(&queue->pcq_current_size_lock);
+
+    pthread_cond_signal(&queue->pcq_popper_condvar);
+    pthread_mutex_unlock(&queue->pcq_pusher_condvar_lock);
+    return 0;
+}
+
+void *mutex_pcq_dequeue(pc_queue_t *queue) {
+    pthread_mutex_lock(&queue->pcq_popper_condvar_lock);
+    while (queue->pcq_current_size == 0)
+        pthread_cond_wait(&queue->pcq_popper_condvar,
+                          &queue->pcq_popper_condvar_lock);
+
+    pthread_mutex_lock(&queue->pcq_tail_lock);
+    void *res = queue->pcq_buffer[queue->pcq_tail];
+    queue->pcq_tail = (queue->pcq_tail + 1) % queue->pcq_capacity;
+    pthread_mutex_unlock(&queue->pcq_tail_lock);
+
+    pthread_mutex_lock(&queue->pcq_current_size_lock);
+    queue->pcq_current_size--;
+    pthread_mutex_unlock(&queue->pcq_current_size_lock);
+
+    pthread_cond_signal(&queue->pcq_pusher_condvar);
+    pthread_mutex_unlock(&queue->pcq_popper_condvar_lock);
+    return res;
+}
+
+static queue_ops_t const mutex_ops = {mutex_pcq_enqueue, mutex_pcq_dequeue,
+                                       1};
+static queue_ops_t const ring_ops = {pcq_enqueue, pcq_dequeue, 1};
+static queue_ops_t const batch_ops = {pcq_enqueue, pcq_dequeue, BATCH};
+
+void *producer(void *arg) {
+    worker_t *w = arg;
+    void *batch[BATCH];
+    for (size_t i = 1; i <= w->items; i += w->ops->batch) {
+        if (w->ops->batch == 1) {
+            assert(w->ops->enqueue(w->queue, (void *)(uintptr_t)i) == 0);
+            continue;
+        }
+
+        size_t n = 0;
+        while (n < w->ops->batch && i + n <= w->items) {
+            batch[n] = (void *)(uintptr_t)(i + n);
+            n++;
+        }
+        assert(pcq_enqueue_batch(w->queue, batch, n) == 0);
+    }
+    return NULL;
+}
+
+void *consumer(void *arg) {
+    worker_t *w = arg;
+    // Each consumer ends at the NULL enqueued for it once all items were
+    if (w->ops->batch == 1) {
+        while (w->ops->dequeue(w->queue) != NULL) {
+            w->items++;
+        }
+        return NULL;
+    }
+
+    void *batch[BATCH];
+    while (1) {
+        size_t n = pcq_dequeue_batch(w->queue, batch, w->ops->batch);
+        for (size_t i = 0; i < n; i++) {
+            if (batch[i] == NULL) { // Those taken after it end others
+                for (i++; i < n; i++) {
+                    assert(pcq_enqueue(w->queue, NULL) == 0);
+                }
+                return NULL;
+            }
+            w->items++;
+        }
+    }
+}
+
+double run(queue_ops_t const *ops, size_t threads) {
+    pc_queue_t queue;
+    if (ops == &mutex_ops) {
+        assert(mutex_pcq_create(&queue, CAPACITY) == 0);
+    } else {
+        assert(pcq_create(&queue, CAPACITY) == 0);
+    }
+
+    pthread_t producers[MAX_THREADS], consumers[MAX_THREADS];
+    worker_t produced[MAX_THREADS], consumed[MAX_THREADS];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < threads; i++) {
+        consumed[i] = (worker_t){&queue, ops, 0};
+        produced[i] = (worker_t){&queue, ops, ITEMS / threads};
+        assert(pthread_create(&consumers[i], NULL, consumer, &consumed[i]) ==
+               0);
+        assert(pthread_create(&producers[i], NULL, producer, &produced[i]) ==
+               0);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        assert(pthread_join(producers[i], NULL) == 0);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        assert(ops->enqueue(&queue, NULL) == 0);
+    }
+    size_t items = 0;
+    for (size_t i = 0; i < threads; i++) {
+        assert(pthread_join(consumers[i], NULL) == 0);
+        items += consumed[i].items;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(items == threads * (ITEMS / threads));
+
+    if (ops == &mutex_ops) {
+        free(queue.pcq_buffer); // Its locks are left, unused
+    } else {
+        assert(pcq_destroy(&queue) == 0);
+    }
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) +
+                     (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    return (double)items / seconds;
+}
+
+int main() {
+    printf("%d items, capacity %d, batches of %d\n", ITEMS, CAPACITY, BATCH);
+    printf("%10s %16s %16s %16s\n", "threads", "mutex ops/s", "ring ops/s",
+           "batch ops/s");
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        double mutex = run(&mutex_ops, threads);
+        double ring = run(&ring_ops, threads);
+        double batch = run(&batch_ops, threads);
+        printf("%10zu %16.0f %16.0f %16.0f\n", threads, mutex, ring, batch);
+    }
+
+    return 0;
+}
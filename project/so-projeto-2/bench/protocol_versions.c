@@ -0,0 +1,226 @@
+#include "protocol.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the versions of the protocol, through the broker
+ * (./mbroker/mbroker, run as a separate process): a publisher sends messages
+ * of a small and of a large payload to a box, one frame per write (as the
+ * publisher client does), and a subscriber reads them as they arrive. As the
+ * TFS of the broker is small, the messages are sent in rounds, each to a new
+ * box (removed after it). Reports the messages per second reaching the
+ * subscriber, and the bytes each message takes in the pipes, for v1 and v2*/
+
+#define MESSAGES (50000)
+#define BOX_BYTES (256 * 1024) // Of messages in a box, for each round
+
+typedef struct {
+    char pipe_name[P_PIPE_NAME_SIZE];
+    int fd;
+} client_t;
+
+typedef struct {
+    client_t client;
+    int version;
+    size_t payload;
+    size_t messages;
+} publisher_t;
+
+static char register_name[P_PIPE_NAME_SIZE];
+static int register_fd;
+static int runs;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void make_pipe(client_t *c, char const *kind) {
+    snprintf(c->pipe_name, sizeof(c->pipe_name), "bench%d_%s%d", getpid(),
+             kind, runs);
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    unlink(path);
+    assert(mkfifo(path, 0640) == 0);
+}
+
+int open_pipe(client_t const *c, int flags) {
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    int fd = open(path, flags);
+    assert(fd != -1);
+    assert(unlink(path) == 0); // Both ends are open, or will be
+    return fd;
+}
+
+// Sends a request in the given version
+void send_request(int version, uint8_t code, char const *pipe_name,
+                  char *box_name) {
+    char request[P_V2_FRAME_MAX_SIZE];
+    size_t size;
+    if (version == P_V2) {
+        size = p_v2_build_request(request, code, pipe_name, box_name);
+    } else {
+        char name[P_PIPE_NAME_SIZE] = {0};
+        strcpy(name, pipe_name);
+        if (code == P_PUB_REGISTER_CODE) {
+            p_build_pub_register(request, name, box_name);
+        } else if (code == P_SUB_REGISTER_CODE) {
+            p_build_sub_register(request, name, box_name);
+        } else if (code == P_BOX_CREATION_CODE) {
+            p_build_box_creation(request, name, box_name);
+        } else {
+            p_build_box_removal(request, name, box_name);
+        }
+        size = P_PUB_REGISTER_SIZE; // All of the same size
+    }
+    assert(write(register_fd, request, size) == (ssize_t)size);
+}
+
+// Creates or removes a box
+void manage_box(uint8_t code, char *box_name) {
+    client_t manager;
+    make_pipe(&manager, "m");
+    send_request(P_V1, code, manager.pipe_name, box_name);
+
+    int fd = open_pipe(&manager, O_RDONLY);
+    p_response response;
+    assert(read(fd, &response, sizeof(response)) == sizeof(response));
+    assert(response.return_code == 0);
+    close(fd);
+}
+
+// Size of a message (of payload bytes) in the pipes
+size_t frame_size(int version, size_t payload) {
+    return version == P_V2 ? P_V2_HEADER_SIZE + payload : P_PUB_MESSAGE_SIZE;
+}
+
+void *publish(void *arg) {
+    publisher_t *pub = arg;
+    char message[P_MESSAGE_SIZE] = {0};
+    char frame[P_V2_FRAME_MAX_SIZE];
+
+    memset(message, 'x', pub->payload);
+    for (size_t i = 0; i < pub->messages; i++) {
+        size_t size = P_PUB_MESSAGE_SIZE;
+        if (pub->version == P_V2) {
+            size = p_v2_build_message(frame, P_PUB_MESSAGE_CODE, message);
+        } else {
+            p_build_pub_message(frame, message);
+        }
+        assert(write(pub->client.fd, frame, size) == (ssize_t)size);
+    }
+    close(pub->client.fd);
+
+    return NULL;
+}
+
+// Sends a round of messages to a new box, returning how long they took to
+// reach the subscriber
+double round_ns(int version, size_t payload, size_t messages) {
+    char box_name[P_BOX_NAME_SIZE] = {0};
+    snprintf(box_name, sizeof(box_name), "box%d", runs++);
+    manage_box(P_BOX_CREATION_CODE, box_name);
+
+    client_t sub;
+    make_pipe(&sub, "s");
+    send_request(version, P_SUB_REGISTER_CODE, sub.pipe_name, box_name);
+    sub.fd = open_pipe(&sub, O_RDONLY);
+
+    publisher_t pub = {
+        .version = version, .payload = payload, .messages = messages};
+    make_pipe(&pub.client, "p");
+    send_request(version, P_PUB_REGISTER_CODE, pub.client.pipe_name,
+                 box_name);
+    pub.client.fd = open_pipe(&pub.client, O_WRONLY);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, publish, &pub) == 0);
+
+    // The messages are all of the same size, so they are only counted
+    static char buffer[64 * 1024];
+    size_t expected = messages * frame_size(version, payload);
+    size_t received = 0;
+    while (received < expected) {
+        ssize_t bytes_read = read(sub.fd, buffer, sizeof(buffer));
+        assert(bytes_read > 0);
+        received += (size_t)bytes_read;
+    }
+    assert(received == expected);
+    double ns = elapsed_ns(start);
+
+    assert(pthread_join(thread, NULL) == 0);
+    close(sub.fd);
+    manage_box(P_BOX_REMOVAL_CODE, box_name);
+
+    return ns;
+}
+
+double run(int version, size_t payload) {
+    size_t per_round = BOX_BYTES / (payload + 1);
+    double ns = 0;
+    for (size_t sent = 0; sent < MESSAGES; sent += per_round) {
+        size_t messages =
+            MESSAGES - sent < per_round ? MESSAGES - sent : per_round;
+        ns += round_ns(version, payload, messages);
+    }
+    return MESSAGES / (ns / 1e9);
+}
+
+int main() {
+    if (access("./mbroker/mbroker", X_OK) != 0) {
+        fprintf(stderr, "run from the project directory, after make\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(register_name, sizeof(register_name), "bench%d_register",
+             getpid());
+    char register_path[P_PIPE_NAME_SIZE + 5];
+    snprintf(register_path, sizeof(register_path), "/tmp/%s", register_name);
+    unlink(register_path);
+
+    pid_t broker = fork();
+    assert(broker != -1);
+    if (broker == 0) {
+        execl("./mbroker/mbroker", "mbroker", register_name, "16",
+              (char *)NULL);
+        _exit(1);
+    }
+    while ((register_fd = open(register_path, O_WRONLY | O_NONBLOCK)) == -1) {
+        // Until the broker is listening
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    assert(fcntl(register_fd, F_SETFL, 0) == 0);
+
+    printf("%8s %14s %14s %10s %10s\n", "payload", "v1 msgs/s", "v2 msgs/s",
+           "v1 bytes", "v2 bytes");
+
+    size_t payloads[] = {8, 1000};
+    for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+        double v1 = run(P_V1, payloads[i]);
+        double v2 = run(P_V2, payloads[i]);
+        printf("%8zu %14.0f %14.0f %10zu %10zu\n", payloads[i], v1, v2,
+               frame_size(P_V1, payloads[i]), frame_size(P_V2, payloads[i]));
+    }
+
+    close(register_fd);
+    assert(kill(broker, SIGKILL) == 0);
+    assert(waitpid(broker, NULL, 0) == broker);
+    unlink(register_path);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "protocol.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the batches of publisher messages, through the broker
+ * (./mbroker/mbroker, run as a separate process): a publisher sends small
+ * messages to a box, each in its own frame or in batches of up to a number of
+ * bytes (as the publisher client does with -b), and a subscriber reads them as
+ * they arrive. As the TFS of the broker is small, the messages are sent in
+ * rounds, each to a new box (removed after it). Reports the messages per
+ * second reaching the subscriber, and the writes of the publisher and the
+ * system calls of the broker (from /proc/<pid>/io) for each message*/
+
+#define MESSAGES (100000)
+#define PAYLOAD (16)
+#define BOX_BYTES (256 * 1024) // Of messages in a box, for each round
+
+typedef struct {
+    char pipe_name[P_PIPE_NAME_SIZE];
+    int fd;
+} client_t;
+
+typedef struct {
+    client_t client;
+    size_t batch_size; // 0 to send each message in its own frame
+    size_t messages;
+    size_t writes;
+} publisher_t;
+
+static char register_name[P_PIPE_NAME_SIZE];
+static int register_fd;
+static int runs;
+static pid_t broker;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void make_pipe(client_t *c, char const *kind) {
+    snprintf(c->pipe_name, sizeof(c->pipe_name), "bench%d_%s%d", getpid(),
+             kind, runs);
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    unlink(path);
+    assert(mkfifo(path, 0640) == 0);
+}
+
+int open_pipe(client_t const *c, int flags) {
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    int fd = open(path, flags);
+    assert(fd != -1);
+    assert(unlink(path) == 0); // Both ends are open, or will be
+    return fd;
+}
+
+void send_request(uint8_t code, char const *pipe_name, char *box_name) {
+    char request[P_V2_FRAME_MAX_SIZE];
+    size_t size = p_v2_build_request(request, code, pipe_name, box_name);
+    assert(write(register_fd, request, size) == (ssize_t)size);
+}
+
+// Creates or removes a box
+void manage_box(uint8_t code, char *box_name) {
+    client_t manager;
+    make_pipe(&manager, "m");
+    send_request(code, manager.pipe_name, box_name);
+
+    int fd = open_pipe(&manager, O_RDONLY);
+    char frame[P_V2_FRAME_MAX_SIZE];
+    assert(read(fd, frame, sizeof(frame)) > P_V2_HEADER_SIZE);
+    p_v2_header header;
+    memcpy(&header, frame, P_V2_HEADER_SIZE);
+    p_response response;
+    assert(p_v2_parse_response(frame + P_V2_HEADER_SIZE, header.length,
+                               header.protocol_code, &response) == 0);
+    assert(response.return_code == 0);
+    close(fd);
+}
+
+// System calls the broker made so far, reads and writes
+size_t broker_syscalls() {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/io", broker);
+    FILE *io = fopen(path, "r");
+    assert(io != NULL);
+
+    char key[32];
+    size_t value, syscalls = 0;
+    while (fscanf(io, "%31s %zu", key, &value) == 2) {
+        if (strcmp(key, "syscr:") == 0 || strcmp(key, "syscw:") == 0) {
+            syscalls += value;
+        }
+    }
+    fclose(io);
+    return syscalls;
+}
+
+void *publish(void *arg) {
+    publisher_t *pub = arg;
+    char message[P_MESSAGE_SIZE] = {0};
+    char frame[P_V2_FRAME_MAX_SIZE];
+    static p_pub_batch batch;
+
+    memset(message, 'x', PAYLOAD);
+    p_pub_batch_init(&batch);
+    for (size_t i = 0; i < pub->messages; i++) {
+        if (pub->batch_size == 0) {
+            size_t size = p_v2_build_message(frame, P_PUB_MESSAGE_CODE, message);
+            assert(write(pub->client.fd, frame, size) == (ssize_t)size);
+            pub->writes++;
+            continue;
+        }
+
+        assert(p_pub_batch_add(&batch, message) == 0);
+        if (batch.length + PAYLOAD + 1 > pub->batch_size ||
+            i == pub->messages - 1) {
+            size_t size = p_pub_batch_finish(&batch);
+            assert(write(pub->client.fd, batch.frame, size) == (ssize_t)size);
+            pub->writes++;
+            p_pub_batch_init(&batch);
+        }
+    }
+    close(pub->client.fd);
+
+    return NULL;
+}
+
+// Sends a round of messages to a new box, returning how long they took to
+// reach the subscriber
+double round_ns(size_t batch_size, size_t messages, size_t *writes) {
+    char box_name[P_BOX_NAME_SIZE] = {0};
+    snprintf(box_name, sizeof(box_name), "box%d", runs++);
+    manage_box(P_BOX_CREATION_CODE, box_name);
+
+    client_t sub;
+    make_pipe(&sub, "s");
+    send_request(P_SUB_REGISTER_CODE, sub.pipe_name, box_name);
+    sub.fd = open_pipe(&sub, O_RDONLY);
+
+    publisher_t pub = {.batch_size = batch_size, .messages = messages};
+    make_pipe(&pub.client, "p");
+    send_request(P_PUB_REGISTER_CODE, pub.client.pipe_name, box_name);
+    pub.client.fd = open_pipe(&pub.client, O_WRONLY);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, publish, &pub) == 0);
+
+    // The messages are all of the same size, so they are only counted
+    static char buffer[64 * 1024];
+    size_t expected = messages * (P_V2_HEADER_SIZE + PAYLOAD);
+    size_t received = 0;
+    while (received < expected) {
+        ssize_t bytes_read = read(sub.fd, buffer, sizeof(buffer));
+        assert(bytes_read > 0);
+        received += (size_t)bytes_read;
+    }
+    assert(received == expected);
+    double ns = elapsed_ns(start);
+
+    assert(pthread_join(thread, NULL) == 0);
+    close(sub.fd);
+    manage_box(P_BOX_REMOVAL_CODE, box_name);
+
+    *writes += pub.writes;
+    return ns;
+}
+
+void run(size_t batch_size) {
+    size_t per_round = BOX_BYTES / (PAYLOAD + 1);
+    size_t writes = 0;
+    size_t syscalls = broker_syscalls();
+    double ns = 0;
+    for (size_t sent = 0; sent < MESSAGES; sent += per_round) {
+        size_t messages =
+            MESSAGES - sent < per_round ? MESSAGES - sent : per_round;
+        ns += round_ns(batch_size, messages, &writes);
+    }
+    syscalls = broker_syscalls() - syscalls;
+
+    printf("%8zu %14.0f %14.3f %14.3f\n", batch_size, MESSAGES / (ns / 1e9),
+           (double)writes / MESSAGES, (double)syscalls / MESSAGES);
+}
+
+int main() {
+    if (access("./mbroker/mbroker", X_OK) != 0) {
+        fprintf(stderr, "run from the project directory, after make\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(register_name, sizeof(register_name), "bench%d_register",
+             getpid());
+    char register_path[P_PIPE_NAME_SIZE + 5];
+    snprintf(register_path, sizeof(register_path), "/tmp/%s", register_name);
+    unlink(register_path);
+
+    broker = fork();
+    assert(broker != -1);
+    if (broker == 0) {
+        execl("./mbroker/mbroker", "mbroker", register_name, "16",
+              (char *)NULL);
+        _exit(1);
+    }
+    while ((register_fd = open(register_path, O_WRONLY | O_NONBLOCK)) == -1) {
+        // Until the broker is listening
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    assert(fcntl(register_fd, F_SETFL, 0) == 0);
+
+    printf("%8s %14s %14s %14s\n", "batch", "msgs/s", "pub writes/msg",
+           "broker sys/msg");
+
+    size_t batch_sizes[] = {0, 1024, 4 * 1024, 16 * 1024};
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        run(batch_sizes[i]);
+    }
+
+    close(register_fd);
+    assert(kill(broker, SIGKILL) == 0);
+    assert(waitpid(broker, NULL, 0) == broker);
+    unlink(register_path);
+
+    return 0;
+}
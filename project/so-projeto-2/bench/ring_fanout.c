@@ -0,0 +1,146 @@
+#include "fs/operations.h"
+#include "mbroker/ring.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*Benchmark of the fan-out of a box to its subscribers, as a publisher appends
+ * messages to it: subscribers following the box through views of its blocks,
+ * versus subscribers taking the messages from the ring of the box (and from
+ * the box only for those that fell out of it). Reports the messages read per
+ * second by all subscribers, and the share taken from the ring*/
+
+#define MESSAGES (20000)
+#define MESSAGE_SIZE (64) // Including the \0, so that blocks hold whole ones
+#define BLOCK_SIZE (4096)
+#define BURST (16) // Messages published at a time
+
+typedef struct {
+    box_ring_t *ring;
+    int use_ring;
+    size_t from_ring;
+    long checksum;
+} subscriber_t;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void *subscriber(void *arg) {
+    subscriber_t *sub = arg;
+    int f = tfs_open("/box", 0);
+    assert(f != -1);
+
+    uint64_t seq = 0;
+    size_t cursor = 0;
+    while (seq < MESSAGES) {
+        if (seq >= atomic_load(&sub->ring->head)) {
+            sched_yield(); // Waits for the publisher
+            continue;
+        }
+
+        if (sub->use_ring) {
+            ring_slot_t *slot = ring_pin(sub->ring, seq);
+            if (slot != NULL) {
+                sub->checksum += slot->frame[1];
+                cursor += slot->len;
+                ring_unpin(slot);
+                seq++;
+                sub->from_ring++;
+                continue;
+            }
+        }
+
+        tfs_view view;
+        assert(tfs_read_view(f, cursor, SIZE_MAX, &view) > 0);
+        size_t messages = view.len / MESSAGE_SIZE;
+        for (size_t i = 0; i < messages; i++) {
+            sub->checksum += ((char const *)view.data)[i * MESSAGE_SIZE];
+        }
+        tfs_release_view(&view);
+        cursor += messages * MESSAGE_SIZE;
+        seq += messages;
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+void run(size_t subscribers, int use_ring, double *messages_per_second,
+         double *from_ring) {
+    box_ring_t *ring = ring_create();
+    assert(ring != NULL);
+    ring_open(ring, 0, 0);
+
+    int f = tfs_open("/box", TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+
+    subscriber_t *subs = calloc(subscribers, sizeof(subscriber_t));
+    pthread_t *threads = calloc(subscribers, sizeof(pthread_t));
+    assert(subs != NULL && threads != NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < subscribers; i++) {
+        subs[i] = (subscriber_t){.ring = ring, .use_ring = use_ring};
+        assert(pthread_create(&threads[i], NULL, subscriber, &subs[i]) == 0);
+    }
+
+    char message[MESSAGE_SIZE] = {0};
+    for (int i = 0; i < MESSAGES; i++) {
+        snprintf(message, sizeof(message), "message %d", i);
+        assert(tfs_write(f, message, MESSAGE_SIZE) == MESSAGE_SIZE);
+        ring_publish(ring, message, MESSAGE_SIZE);
+        if (i % BURST == BURST - 1) {
+            sched_yield(); // Lets the subscribers follow
+        }
+    }
+
+    size_t ring_reads = 0;
+    for (size_t i = 0; i < subscribers; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        assert(subs[i].checksum == subs[0].checksum);
+        ring_reads += subs[i].from_ring;
+    }
+    double ns = elapsed_ns(start);
+
+    *messages_per_second = (double)(subscribers * MESSAGES) / (ns / 1e9);
+    *from_ring = (double)ring_reads / (double)(subscribers * MESSAGES);
+
+    assert(tfs_close(f) != -1);
+    free(subs);
+    free(threads);
+    free(ring);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = MESSAGES * MESSAGE_SIZE / BLOCK_SIZE + 64;
+    params.max_open_files_count = 128;
+    assert(tfs_init(&params) != -1);
+
+    printf("%12s %16s %16s %10s\n", "subscribers", "views msgs/s",
+           "ring msgs/s", "from ring");
+
+    size_t subscribers[] = {1, 4, 16, 64};
+    for (size_t i = 0; i < sizeof(subscribers) / sizeof(subscribers[0]); i++) {
+        double views, ring, ring_share, unused;
+        run(subscribers[i], 0, &views, &unused);
+        run(subscribers[i], 1, &ring, &ring_share);
+        printf("%12zu %16.0f %16.0f %9.0f%%\n", subscribers[i], views, ring,
+               ring_share * 100);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+#include "protocol.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the broker (./mbroker/mbroker, run as a separate process) with
+ * 10 to 10,000 concurrent sessions: a publisher for each of a few boxes, and
+ * the remaining sessions subscribed to them, all idle until the publishers
+ * send their messages. Reports how fast the sessions are set up, how fast the
+ * messages reach every subscriber, how many times subscribers were woken up
+ * per message delivered (from the statistics the broker prints on SIGUSR1),
+ * and the threads and memory of the broker*/
+
+#define MAX_BOXES (10)
+#define MESSAGES (64) // Per box
+#define SUB_BYTES (MESSAGES * P_SUB_MESSAGE_SIZE)
+
+typedef struct {
+    char pipe_name[P_PIPE_NAME_SIZE];
+    int fd;
+    size_t bytes_read;
+} client_t;
+
+static char register_name[P_PIPE_NAME_SIZE];
+static int register_fd;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void make_pipe(client_t *c, char const *kind, size_t i) {
+    snprintf(c->pipe_name, sizeof(c->pipe_name), "bench%d_%s%zu", getpid(),
+             kind, i);
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    unlink(path);
+    assert(mkfifo(path, 0640) == 0);
+}
+
+void unlink_pipe(client_t const *c) {
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    assert(unlink(path) == 0);
+}
+
+int open_pipe(client_t const *c, int flags) {
+    char path[P_PIPE_NAME_SIZE + 5];
+    snprintf(path, sizeof(path), "/tmp/%s", c->pipe_name);
+    int fd = open(path, flags);
+    assert(fd != -1);
+    return fd;
+}
+
+void send_request(char const *request, size_t size) {
+    assert(write(register_fd, request, size) == (ssize_t)size);
+}
+
+void create_box(char *box_name) {
+    client_t manager;
+    make_pipe(&manager, "m", 0);
+
+    char request[P_BOX_CREATION_SIZE];
+    p_build_box_creation(request, manager.pipe_name, box_name);
+    send_request(request, sizeof(request));
+
+    int fd = open_pipe(&manager, O_RDONLY);
+    p_response response;
+    assert(read(fd, &response, sizeof(response)) == sizeof(response));
+    assert(response.return_code == 0);
+    close(fd);
+    unlink_pipe(&manager);
+}
+
+void *publish(void *arg) {
+    client_t *pub = arg;
+    char message[P_MESSAGE_SIZE] = {0};
+    char frame[P_PUB_MESSAGE_SIZE];
+
+    for (int i = 0; i < MESSAGES; i++) {
+        snprintf(message, sizeof(message), "message %d", i);
+        p_build_pub_message(frame, message);
+        assert(write(pub->fd, frame, sizeof(frame)) == sizeof(frame));
+    }
+
+    return NULL;
+}
+
+// Reads a field of /proc/<pid>/status
+long broker_status(pid_t pid, char const *field) {
+    char path[64];
+    char line[256];
+    long value = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *status = fopen(path, "r");
+    assert(status != NULL);
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            sscanf(line + strlen(field) + 1, "%ld", &value);
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+// Asks the broker for its statistics, and returns its wakeups per message
+double broker_wakeups(pid_t pid, FILE *stats) {
+    char line[256];
+    double wakeups = -1;
+    assert(kill(pid, SIGUSR1) == 0);
+    while (fgets(line, sizeof(line), stats) != NULL) {
+        char *field = strstr(line, "wakeups/message ");
+        if (strncmp(line, "[STATS]:", 8) == 0 && field != NULL) {
+            sscanf(field + strlen("wakeups/message "), "%lf", &wakeups);
+            break;
+        }
+    }
+    return wakeups;
+}
+
+void run(size_t sessions) {
+    size_t boxes = sessions / 2 < MAX_BOXES ? sessions / 2 : MAX_BOXES;
+    size_t subscribers = sessions - boxes;
+
+    snprintf(register_name, sizeof(register_name), "bench%d_register",
+             getpid());
+    char register_path[P_PIPE_NAME_SIZE + 5];
+    snprintf(register_path, sizeof(register_path), "/tmp/%s", register_name);
+
+    unlink(register_path);
+
+    char max_sessions[32];
+    snprintf(max_sessions, sizeof(max_sessions), "%zu", sessions);
+    int stats_pipe[2]; // The stderr of the broker
+    assert(pipe(stats_pipe) == 0);
+    pid_t broker = fork();
+    assert(broker != -1);
+    if (broker == 0) {
+        dup2(stats_pipe[1], STDERR_FILENO);
+        close(stats_pipe[0]);
+        close(stats_pipe[1]);
+        execl("./mbroker/mbroker", "mbroker", register_name, max_sessions,
+              (char *)NULL);
+        _exit(1);
+    }
+    close(stats_pipe[1]);
+    FILE *stats = fdopen(stats_pipe[0], "r");
+    assert(stats != NULL);
+    while ((register_fd = open(register_path, O_WRONLY | O_NONBLOCK)) == -1) {
+        // Until the broker is listening
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    assert(fcntl(register_fd, F_SETFL, 0) == 0);
+
+    client_t *pubs = calloc(boxes, sizeof(client_t));
+    client_t *subs = calloc(subscribers, sizeof(client_t));
+    pthread_t *threads = calloc(boxes, sizeof(pthread_t));
+    assert(pubs != NULL && subs != NULL && threads != NULL);
+
+    char box_names[MAX_BOXES][P_BOX_NAME_SIZE];
+    for (size_t b = 0; b < boxes; b++) {
+        snprintf(box_names[b], P_BOX_NAME_SIZE, "box%zu", b);
+        create_box(box_names[b]);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The subscribers open their pipes before registering, so that the
+    // broker never waits for them
+    int epoll_fd = epoll_create1(0);
+    assert(epoll_fd != -1);
+    char request[P_SUB_REGISTER_SIZE];
+    for (size_t i = 0; i < subscribers; i++) {
+        make_pipe(&subs[i], "s", i);
+        subs[i].fd = open_pipe(&subs[i], O_RDONLY | O_NONBLOCK);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = &subs[i]};
+        assert(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, subs[i].fd, &event) == 0);
+
+        p_build_sub_register(request, subs[i].pipe_name,
+                             box_names[i % boxes]);
+        send_request(request, sizeof(request));
+    }
+    for (size_t b = 0; b < boxes; b++) {
+        make_pipe(&pubs[b], "p", b);
+        p_build_pub_register(request, pubs[b].pipe_name, box_names[b]);
+        send_request(request, sizeof(request));
+        pubs[b].fd = open_pipe(&pubs[b], O_WRONLY);
+    }
+    double setup_ns = elapsed_ns(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t b = 0; b < boxes; b++) {
+        assert(pthread_create(&threads[b], NULL, publish, &pubs[b]) == 0);
+    }
+
+    static char buffer[64 * 1024];
+    struct epoll_event events[64];
+    size_t done = 0;
+    while (done < subscribers) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        assert(n != -1 || errno == EINTR);
+        for (int i = 0; i < n; i++) {
+            client_t *sub = events[i].data.ptr;
+            ssize_t bytes_read = read(sub->fd, buffer, sizeof(buffer));
+            if (bytes_read <= 0) {
+                assert(bytes_read == -1 && errno == EAGAIN);
+                continue;
+            }
+            sub->bytes_read += (size_t)bytes_read;
+            assert(sub->bytes_read <= SUB_BYTES);
+            if (sub->bytes_read == SUB_BYTES) {
+                assert(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sub->fd, NULL) == 0);
+                done++;
+            }
+        }
+    }
+    double delivery_ns = elapsed_ns(start);
+
+    long threads_count = broker_status(broker, "Threads");
+    long rss_kb = broker_status(broker, "VmRSS");
+    double wakeups = broker_wakeups(broker, stats);
+    printf("%9zu %14.0f %14.0f %12.4f %8ld %10ld\n", sessions,
+           (double)sessions / (setup_ns / 1e9),
+           (double)(subscribers * MESSAGES) / (delivery_ns / 1e9), wakeups,
+           threads_count, rss_kb);
+
+    for (size_t b = 0; b < boxes; b++) {
+        assert(pthread_join(threads[b], NULL) == 0);
+        close(pubs[b].fd);
+        unlink_pipe(&pubs[b]);
+    }
+    for (size_t i = 0; i < subscribers; i++) {
+        close(subs[i].fd);
+        unlink_pipe(&subs[i]);
+    }
+    close(epoll_fd);
+    close(register_fd);
+    assert(kill(broker, SIGKILL) == 0);
+    assert(waitpid(broker, NULL, 0) == broker);
+    fclose(stats);
+    unlink(register_path);
+
+    free(pubs);
+    free(subs);
+    free(threads);
+}
+
+int main() {
+    if (access("./mbroker/mbroker", X_OK) != 0) {
+        fprintf(stderr, "run from the project directory, after make\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%9s %14s %14s %12s %8s %10s\n", "sessions", "sessions/s",
+           "msgs/s", "wakeups/msg", "threads", "rss KiB");
+
+    size_t sessions[] = {10, 100, 1000, 10000};
+    for (size_t i = 0; i < sizeof(sessions) / sizeof(sessions[0]); i++) {
+        run(sessions[i]);
+    }
+
+    return 0;
+}
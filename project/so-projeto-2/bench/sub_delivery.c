@@ -0,0 +1,173 @@
+#include "delivery.h"
+#include "fs/operations.h"
+#include "mbroker/mbroker.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*Benchmark of the delivery of a box to its subscribers, straight from the views
+ * of its blocks as the broker does, with a write per message (the former path),
+ * with batches written with writev and with batches spliced with vmsplice; each
+ * subscriber drains its own pipe*/
+
+#define MESSAGES (2048)    // In the box
+#define MESSAGE_SIZE (128) // Including the \0, so that blocks hold whole ones
+#define BLOCK_SIZE (4096)
+
+typedef struct {
+    int box_fd;
+    int pipe[2];
+    delivery_t delivery;
+    size_t bytes_read;
+} session_t;
+
+double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+void *sender(void *arg) {
+    session_t *s = arg;
+    tfs_view views[SUB_BATCH_VIEWS];
+    size_t n_views = 0;
+    size_t cursor = 0;
+
+    while (1) {
+        tfs_view *view = &views[n_views];
+        ssize_t bytes_read = tfs_read_view(s->box_fd, cursor, SIZE_MAX, view);
+        assert(bytes_read != -1);
+        if (bytes_read > 0) {
+            cursor += view->len;
+            n_views++;
+
+            char const *data = view->data;
+            for (size_t i = 0; i < view->len; i += MESSAGE_SIZE) {
+                struct iovec piece = {(void *)(data + i), MESSAGE_SIZE - 1};
+                if (!delivery_room(&s->delivery, 1)) {
+                    assert(delivery_flush(&s->delivery) == 0);
+                }
+                assert(delivery_add(&s->delivery, &piece, 1, piece.iov_len) !=
+                       -1);
+            }
+        }
+
+        if (bytes_read == 0 || n_views == SUB_BATCH_VIEWS) {
+            assert(delivery_flush(&s->delivery) != -1);
+            for (size_t i = 0; i < n_views; i++) {
+                tfs_release_view(&views[i]);
+            }
+            n_views = 0;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+    }
+    assert(close(s->pipe[1]) != -1);
+
+    return NULL;
+}
+
+void *reader(void *arg) {
+    session_t *s = arg;
+    static _Thread_local char buffer[64 * 1024];
+
+    ssize_t bytes_read;
+    while ((bytes_read = read(s->pipe[0], buffer, sizeof(buffer))) > 0) {
+        s->bytes_read += (size_t)bytes_read;
+    }
+    assert(bytes_read == 0);
+    assert(close(s->pipe[0]) != -1);
+
+    return NULL;
+}
+
+void run(delivery_mode_t mode, size_t subscribers, double *bytes_per_second,
+         double *syscalls_per_message) {
+    session_t *sessions = calloc(subscribers, sizeof(session_t));
+    pthread_t *threads = calloc(2 * subscribers, sizeof(pthread_t));
+    assert(sessions != NULL && threads != NULL);
+
+    for (size_t i = 0; i < subscribers; i++) {
+        sessions[i].box_fd = tfs_open("/box", 0);
+        assert(sessions[i].box_fd != -1);
+        assert(pipe(sessions[i].pipe) != -1);
+        delivery_init(&sessions[i].delivery, sessions[i].pipe[1], mode,
+                      P_V1);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < subscribers; i++) {
+        assert(pthread_create(&threads[2 * i], NULL, reader, &sessions[i]) ==
+               0);
+        assert(pthread_create(&threads[2 * i + 1], NULL, sender,
+                              &sessions[i]) == 0);
+    }
+    for (size_t i = 0; i < 2 * subscribers; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    double ns = elapsed_ns(start);
+
+    size_t bytes = 0;
+    size_t messages = 0;
+    size_t syscalls = 0;
+    for (size_t i = 0; i < subscribers; i++) {
+        assert(sessions[i].bytes_read == MESSAGES * P_SUB_MESSAGE_SIZE);
+        bytes += sessions[i].bytes_read;
+        messages += sessions[i].delivery.messages;
+        syscalls += sessions[i].delivery.syscalls;
+        assert(tfs_close(sessions[i].box_fd) != -1);
+    }
+    *bytes_per_second = (double)bytes / (ns / 1e9);
+    *syscalls_per_message = (double)syscalls / (double)messages;
+
+    free(sessions);
+    free(threads);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = MESSAGES * MESSAGE_SIZE / BLOCK_SIZE + 16;
+    params.max_open_files_count = 257;
+    assert(tfs_init(&params) != -1);
+
+    int box = tfs_open("/box", TFS_O_CREAT);
+    assert(box != -1);
+    char message[MESSAGE_SIZE] = {0};
+    for (int i = 0; i < MESSAGES; i++) {
+        snprintf(message, sizeof(message), "message %d", i);
+        assert(tfs_write(box, message, MESSAGE_SIZE) == MESSAGE_SIZE);
+    }
+    assert(tfs_close(box) != -1);
+
+    char const *modes[] = {"write", "batch", "splice"};
+    size_t subscribers[] = {1, 16, 256};
+
+    printf("%12s %8s %12s %14s\n", "subscribers", "mode", "MB/s",
+           "syscalls/msg");
+    for (size_t s = 0; s < sizeof(subscribers) / sizeof(subscribers[0]); s++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            delivery_mode_t mode;
+            assert(delivery_mode_parse(modes[m], &mode) != -1);
+
+            double bytes_per_second;
+            double syscalls_per_message;
+            run(mode, subscribers[s], &bytes_per_second,
+                &syscalls_per_message);
+            printf("%12zu %8s %12.1f %14.3f\n", subscribers[s], modes[m],
+                   bytes_per_second / 1e6, syscalls_per_message);
+        }
+    }
+
+    assert(tfs_destroy() != -1);
+
+    return 0;
+}
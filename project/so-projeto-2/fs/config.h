@@ -6,6 +6,8 @@
 
 #define MAX_FILE_NAME (40)
 
-#define DELAY (5000)
+// Number of data blocks referenced directly by an inode; the remaining ones
+// are reached through a single and a double indirect block
+#define INODE_DIRECT_BLOCKS (12)
 
 #endif // CONFIG_H
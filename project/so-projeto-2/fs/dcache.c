@@ -0,0 +1,309 @@
+#include "dcache.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Buckets are split among shards (by bucket number), each with its own lock
+#define DCACHE_SHARDS (16)
+// Longest chain of a bucket; inserting into a full bucket evicts its oldest
+// entry, which bounds the memory used by the cache
+#define DCACHE_CHAIN_MAX (2)
+
+typedef struct dcache_entry {
+    char *path;
+    size_t len;
+    uint64_t hash;
+    int inumber;
+    struct dcache_entry *next;
+} dcache_entry_t;
+
+static dcache_entry_t **buckets;
+static size_t n_buckets; // power of two, 0 if the cache is disabled
+static pthread_rwlock_t shard_locks[DCACHE_SHARDS];
+
+// Incremented at the start and at the end of every invalidation
+static atomic_uint_fast64_t generation;
+// Invalidations in progress
+static atomic_uint_fast64_t invalidating;
+
+/**
+ * Hash a path name (FNV-1a).
+ */
+static uint64_t dcache_hash(char const *path, size_t len) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static inline pthread_rwlock_t *dcache_shard_lock(size_t bucket) {
+    return &shard_locks[bucket & (DCACHE_SHARDS - 1)];
+}
+
+/**
+ * Initialize the dentry cache.
+ *
+ * Input:
+ *   - size: number of paths the cache is sized for (0 disables the cache)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int dcache_init(size_t size) {
+    n_buckets = 0;
+    if (size == 0) {
+        return 0;
+    }
+
+    size_t n = DCACHE_SHARDS;
+    while (n < size) {
+        n *= 2;
+    }
+
+    buckets = calloc(n, sizeof(dcache_entry_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+    n_buckets = n;
+
+    for (size_t i = 0; i < DCACHE_SHARDS; i++) {
+        pthread_rwlock_init(&shard_locks[i], NULL);
+    }
+
+    return 0;
+}
+
+/**
+ * Destroy the dentry cache.
+ */
+void dcache_destroy(void) {
+    if (n_buckets == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < n_buckets; i++) {
+        dcache_entry_t *entry = buckets[i];
+        while (entry != NULL) {
+            dcache_entry_t *next = entry->next;
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(buckets);
+
+    for (size_t i = 0; i < DCACHE_SHARDS; i++) {
+        pthread_rwlock_destroy(&shard_locks[i]);
+    }
+
+    buckets = NULL;
+    n_buckets = 0;
+}
+
+/**
+ * Obtain the current invalidation generation, to be passed to dcache_insert.
+ */
+uint64_t dcache_generation(void) { return atomic_load(&generation); }
+
+/**
+ * Look a path name up in the dentry cache.
+ *
+ * Input:
+ *   - path: path name (not necessarily null-terminated)
+ *   - len: length of the path name
+ *
+ * Returns the inumber of the path if it is cached, -1 otherwise.
+ */
+int dcache_lookup(char const *path, size_t len) {
+    if (n_buckets == 0) {
+        return -1;
+    }
+
+    uint64_t hash = dcache_hash(path, len);
+    size_t bucket = hash & (n_buckets - 1);
+    int inumber = -1;
+
+    pthread_rwlock_rdlock(dcache_shard_lock(bucket));
+
+    for (dcache_entry_t *entry = buckets[bucket]; entry != NULL;
+         entry = entry->next) {
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(entry->path, path, len) == 0) {
+            inumber = entry->inumber;
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(dcache_shard_lock(bucket));
+
+    return inumber;
+}
+
+/**
+ * Cache the resolution of a path name.
+ *
+ * The entry is discarded if an invalidation overlapped the resolution, as it
+ * may be stale. Allocation failures are ignored.
+ *
+ * Input:
+ *   - path: path name (not necessarily null-terminated)
+ *   - len: length of the path name
+ *   - inumber: inumber the path resolved to
+ *   - generation_before: value of dcache_generation() before resolving the
+ *     path
+ */
+void dcache_insert(char const *path, size_t len, int inumber,
+                   uint64_t generation_before) {
+    if (n_buckets == 0) {
+        return;
+    }
+
+    dcache_entry_t *entry = malloc(sizeof(dcache_entry_t));
+    char *copy = malloc(len);
+    if (entry == NULL || copy == NULL) {
+        free(entry);
+        free(copy);
+        return;
+    }
+    memcpy(copy, path, len);
+
+    entry->path = copy;
+    entry->len = len;
+    entry->hash = dcache_hash(path, len);
+    entry->inumber = inumber;
+
+    size_t bucket = entry->hash & (n_buckets - 1);
+    dcache_entry_t *evicted = NULL;
+
+    pthread_rwlock_wrlock(dcache_shard_lock(bucket));
+
+    // Invalidations change the directories before starting; a resolution that
+    // overlapped one may have used a (since removed) stale entry
+    bool stale = atomic_load(&generation) != generation_before ||
+                 atomic_load(&invalidating) != 0;
+
+    size_t chain = 0;
+    dcache_entry_t **link = &buckets[bucket];
+    while (!stale && *link != NULL) {
+        if ((*link)->hash == entry->hash && (*link)->len == len &&
+            memcmp((*link)->path, path, len) == 0) {
+            stale = true; // already cached by a concurrent resolver
+        } else if (++chain == DCACHE_CHAIN_MAX) {
+            evicted = *link;
+            *link = NULL;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+
+    if (!stale) {
+        entry->next = buckets[bucket];
+        buckets[bucket] = entry;
+    }
+
+    pthread_rwlock_unlock(dcache_shard_lock(bucket));
+
+    if (stale) {
+        free(entry->path);
+        free(entry);
+    }
+    while (evicted != NULL) {
+        dcache_entry_t *next = evicted->next;
+        free(evicted->path);
+        free(evicted);
+        evicted = next;
+    }
+}
+
+/**
+ * Remove the entries of a bucket for a path name (and, if tree is set, for
+ * every path below it).
+ *
+ * The shard of the bucket must be locked for writing.
+ */
+static void dcache_remove_if(size_t bucket, char const *path, size_t len,
+                             bool tree) {
+    dcache_entry_t **link = &buckets[bucket];
+    while (*link != NULL) {
+        dcache_entry_t *entry = *link;
+
+        bool match;
+        if (tree) {
+            // path itself and every path below it
+            match = entry->len >= len && memcmp(entry->path, path, len) == 0 &&
+                    (entry->len == len || entry->path[len] == '/');
+        } else {
+            match = entry->len == len && memcmp(entry->path, path, len) == 0;
+        }
+
+        if (match) {
+            *link = entry->next;
+            free(entry->path);
+            free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+}
+
+/**
+ * Invalidate the cached resolution of a path name (its directory entry was
+ * removed).
+ *
+ * Input:
+ *   - path: path name
+ */
+void dcache_invalidate(char const *path) {
+    if (n_buckets == 0) {
+        return;
+    }
+
+    atomic_fetch_add(&invalidating, 1);
+    atomic_fetch_add(&generation, 1);
+
+    size_t len = strlen(path);
+    size_t bucket = dcache_hash(path, len) & (n_buckets - 1);
+
+    pthread_rwlock_wrlock(dcache_shard_lock(bucket));
+    dcache_remove_if(bucket, path, len, false);
+    pthread_rwlock_unlock(dcache_shard_lock(bucket));
+
+    atomic_fetch_add(&generation, 1);
+    atomic_fetch_sub(&invalidating, 1);
+}
+
+/**
+ * Invalidate the cached resolutions of a path name and of every path below it
+ * (a directory was moved or removed).
+ *
+ * This scans the whole cache.
+ *
+ * Input:
+ *   - path: path name
+ */
+void dcache_invalidate_tree(char const *path) {
+    if (n_buckets == 0) {
+        return;
+    }
+
+    atomic_fetch_add(&invalidating, 1);
+    atomic_fetch_add(&generation, 1);
+
+    size_t len = strlen(path);
+
+    for (size_t shard = 0; shard < DCACHE_SHARDS; shard++) {
+        pthread_rwlock_wrlock(&shard_locks[shard]);
+        for (size_t bucket = shard; bucket < n_buckets;
+             bucket += DCACHE_SHARDS) {
+            dcache_remove_if(bucket, path, len, true);
+        }
+        pthread_rwlock_unlock(&shard_locks[shard]);
+    }
+
+    atomic_fetch_add(&generation, 1);
+    atomic_fetch_sub(&invalidating, 1);
+}
@@ -0,0 +1,31 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Dentry cache: memoizes the resolution of absolute path names (and of their
+ * prefixes) to inumbers, so that resolving a path does not walk every
+ * directory in it again.
+ *
+ * Invalidation protocol: a resolver takes dcache_generation() before walking
+ * the directories and passes it to dcache_insert(), which discards the entry if
+ * any invalidation overlapped the walk. Whoever removes or moves a directory
+ * entry must call dcache_invalidate() (or dcache_invalidate_tree()) after
+ * changing the directory.
+ */
+
+int dcache_init(size_t size);
+void dcache_destroy(void);
+
+uint64_t dcache_generation(void);
+
+int dcache_lookup(char const *path, size_t len);
+void dcache_insert(char const *path, size_t len, int inumber,
+                   uint64_t generation);
+
+void dcache_invalidate(char const *path);
+void dcache_invalidate_tree(char const *path);
+
+#endif // DCACHE_H
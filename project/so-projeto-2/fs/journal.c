@@ -0,0 +1,542 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Granularity (in bytes) at which changes to the image are tracked and logged
+#define JOURNAL_UNIT (128)
+// Size the journal grows to before being checkpointed
+#define JOURNAL_CHECKPOINT_BYTES (64 * 1024 * 1024)
+#define JOURNAL_MAGIC UINT64_C(0x314C4E524A534654) // "TFSJRNL1"
+
+/*
+ * Journal file: a sequence of batches, each made of a header, the offsets of
+ * the units in the image, and the contents of the units.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t sequence; // consecutive batches have consecutive numbers
+    uint64_t count;    // number of units
+    uint64_t checksum; // of the whole batch, with this field at 0
+} journal_batch_t;
+
+static bool journaling;
+static int journal_fd = -1;
+static int image_fd = -1;
+static char *image;
+static size_t image_size;
+static uint64_t next_sequence;
+static size_t journal_size;
+
+// Dirty units: a bit per unit of the image, and the list of the set bits
+static uint64_t *dirty_bits;
+static size_t *dirty_units;
+static size_t n_dirty_units;
+static size_t dirty_units_capacity;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Operation gate: batches are only taken when no operation is in progress
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_closed;
+static size_t active_ops;
+static _Thread_local unsigned op_depth;
+
+// Flusher thread and group commit
+static pthread_t flusher;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t durable_cond = PTHREAD_COND_INITIALIZER;
+static size_t commit_interval_us;
+static size_t commit_bytes;
+static bool commit_requested;
+static bool stopping;
+static bool failed;           // a write to the journal failed
+static uint64_t open_epoch;    // epoch the operations in progress belong to
+static uint64_t durable_epoch; // last epoch written to the journal
+static size_t sync_waiters;
+
+static char *batch;
+static size_t batch_capacity;
+
+/**
+ * Checksum a buffer whose size is a multiple of 8 bytes (FNV-1a, a word at a
+ * time).
+ */
+static uint64_t journal_checksum(uint64_t hash, void const *buffer,
+                                 size_t size) {
+    uint64_t const *words = buffer;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+        hash ^= words[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static uint64_t batch_checksum(journal_batch_t header, void const *body,
+                               size_t body_size) {
+    header.checksum = 0;
+    uint64_t hash = UINT64_C(14695981039346656037);
+    hash = journal_checksum(hash, &header, sizeof(header));
+    return journal_checksum(hash, body, body_size);
+}
+
+static size_t batch_body_size(size_t count) {
+    return count * (sizeof(uint64_t) + JOURNAL_UNIT);
+}
+
+/**
+ * Write a whole buffer to a file, retrying on partial writes.
+ */
+static int write_all(int fd, char const *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/**
+ * Apply the complete batches in the journal to the image file.
+ *
+ * Replay stops at the first batch that is incomplete, corrupted, or out of
+ * sequence (the tail of a crashed commit).
+ *
+ * Returns 0 if successful, -1 if the image file could not be written.
+ */
+static int journal_replay(void) {
+    char *body = NULL;
+    size_t body_capacity = 0;
+    off_t offset = 0;
+    bool first = true;
+
+    while (true) {
+        journal_batch_t header;
+        if (pread(journal_fd, &header, sizeof(header), offset) !=
+                sizeof(header) ||
+            header.magic != JOURNAL_MAGIC ||
+            header.count > image_size / JOURNAL_UNIT + 1 ||
+            (!first && header.sequence != next_sequence)) {
+            break;
+        }
+
+        size_t body_size = batch_body_size(header.count);
+        if (body_size > body_capacity) {
+            char *grown = realloc(body, body_size);
+            if (grown == NULL) {
+                break;
+            }
+            body = grown;
+            body_capacity = body_size;
+        }
+        if (pread(journal_fd, body, body_size,
+                  offset + (off_t)sizeof(header)) != (ssize_t)body_size ||
+            batch_checksum(header, body, body_size) != header.checksum) {
+            break;
+        }
+
+        uint64_t const *units = (uint64_t const *)body;
+        char const *data = body + header.count * sizeof(uint64_t);
+        for (size_t i = 0; i < header.count; i++) {
+            if (units[i] >= image_size) {
+                continue;
+            }
+            size_t len = image_size - units[i] < JOURNAL_UNIT
+                             ? image_size - units[i]
+                             : JOURNAL_UNIT;
+            if (pwrite(image_fd, data + i * JOURNAL_UNIT, len,
+                       (off_t)units[i]) != (ssize_t)len) {
+                free(body);
+                return -1;
+            }
+        }
+
+        first = false;
+        next_sequence = header.sequence + 1;
+        offset += (off_t)(sizeof(header) + body_size);
+    }
+
+    free(body);
+    return 0;
+}
+
+/**
+ * Apply the journal to the image file, and empty it.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int journal_checkpoint(void) {
+    if (journal_replay() == -1 || fdatasync(image_fd) == -1 ||
+        ftruncate(journal_fd, 0) == -1 || fdatasync(journal_fd) == -1) {
+        return -1;
+    }
+    journal_size = 0;
+    return 0;
+}
+
+/**
+ * Open the journal of an image, and recover the image from it.
+ *
+ * Must be called before the image file is mapped.
+ *
+ * Input:
+ *   - journal_path: path of the journal (in the OS' file system), which is
+ *     created if it does not exist
+ *   - fd: file descriptor of the image file (kept for checkpoints)
+ *   - size: size of the image
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int journal_recover(char const *journal_path, int fd, size_t size) {
+    journal_fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND, 0640);
+    if (journal_fd == -1) {
+        return -1;
+    }
+
+    image_fd = fd;
+    image_size = size;
+    next_sequence = 0;
+
+    if (journal_checkpoint() == -1) {
+        close(journal_fd);
+        journal_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the changes of the current epoch to the journal, as one batch.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int journal_commit(void) {
+    // Closes the gate, and waits for the operations in progress
+    pthread_mutex_lock(&gate_lock);
+    gate_closed = true;
+    while (active_ops > 0) {
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    }
+
+    size_t count = n_dirty_units;
+    size_t size = sizeof(journal_batch_t) + batch_body_size(count);
+    if (size > batch_capacity) {
+        char *grown = realloc(batch, size);
+        if (grown == NULL) {
+            // Keeps the units dirty, for the next attempt
+            gate_closed = false;
+            pthread_cond_broadcast(&gate_cond);
+            pthread_mutex_unlock(&gate_lock);
+            return -1;
+        }
+        batch = grown;
+        batch_capacity = size;
+    }
+
+    uint64_t *units = (uint64_t *)(batch + sizeof(journal_batch_t));
+    char *data = (char *)(units + count);
+    for (size_t i = 0; i < count; i++) {
+        size_t unit = dirty_units[i];
+        size_t offset = unit * JOURNAL_UNIT;
+        size_t len = image_size - offset < JOURNAL_UNIT ? image_size - offset
+                                                        : JOURNAL_UNIT;
+
+        units[i] = offset;
+        memcpy(data + i * JOURNAL_UNIT, image + offset, len);
+        memset(data + i * JOURNAL_UNIT + len, 0, JOURNAL_UNIT - len);
+        dirty_bits[unit / 64] &= ~(UINT64_C(1) << (unit % 64));
+    }
+    n_dirty_units = 0;
+
+    pthread_mutex_lock(&flush_lock);
+    uint64_t epoch = open_epoch++;
+    pthread_mutex_unlock(&flush_lock);
+
+    gate_closed = false;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+
+    // The batch is written outside the gate; operations go on meanwhile
+    int ret = 0;
+    if (count > 0) {
+        journal_batch_t *header = (journal_batch_t *)batch;
+        header->magic = JOURNAL_MAGIC;
+        header->sequence = next_sequence++;
+        header->count = count;
+        header->checksum = batch_checksum(
+            *header, batch + sizeof(journal_batch_t), size - sizeof(*header));
+
+        if (write_all(journal_fd, batch, size) == -1 ||
+            fdatasync(journal_fd) == -1) {
+            ret = -1;
+        }
+        journal_size += size;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    if (ret == -1) {
+        failed = true;
+    } else {
+        durable_epoch = epoch;
+    }
+    pthread_cond_broadcast(&durable_cond);
+    pthread_mutex_unlock(&flush_lock);
+
+    if (ret == 0 && journal_size >= JOURNAL_CHECKPOINT_BYTES) {
+        ret = journal_checkpoint();
+    }
+
+    return ret;
+}
+
+/**
+ * Flusher thread: commits every commit_interval_us (or as soon as a commit is
+ * requested, if the interval is 0), or once commit_bytes are dirty.
+ */
+static void *journal_flusher(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&flush_lock);
+    while (!stopping) {
+        if (commit_interval_us == 0) {
+            while (!stopping && !commit_requested && sync_waiters == 0) {
+                pthread_cond_wait(&flush_cond, &flush_lock);
+            }
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)(commit_interval_us / 1000000);
+            deadline.tv_nsec += (long)(commit_interval_us % 1000000 * 1000);
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            while (!stopping && !commit_requested &&
+                   pthread_cond_timedwait(&flush_cond, &flush_lock,
+                                          &deadline) != ETIMEDOUT) {
+            }
+        }
+        commit_requested = false;
+
+        pthread_mutex_unlock(&flush_lock);
+        journal_commit();
+        pthread_mutex_lock(&flush_lock);
+    }
+    pthread_mutex_unlock(&flush_lock);
+
+    return NULL;
+}
+
+/**
+ * Start journaling the changes to an image.
+ *
+ * Input:
+ *   - mapped_image: the image, privately mapped from the image file
+ *   - size: size of the image
+ *   - interval_us: group commit interval (0 to commit as soon as possible)
+ *   - bytes: amount of dirty data that triggers a commit before the interval
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int journal_start(char *mapped_image, size_t size, size_t interval_us,
+                  size_t bytes) {
+    image = mapped_image;
+    image_size = size;
+    commit_interval_us = interval_us;
+    commit_bytes = bytes;
+
+    size_t n_units = (size + JOURNAL_UNIT - 1) / JOURNAL_UNIT;
+    dirty_bits = calloc((n_units + 63) / 64, sizeof(uint64_t));
+    if (dirty_bits == NULL) {
+        return -1;
+    }
+    n_dirty_units = 0;
+
+    open_epoch = 1;
+    durable_epoch = 0;
+    stopping = false;
+    failed = false;
+    commit_requested = false;
+
+    journaling = true;
+    if (pthread_create(&flusher, NULL, journal_flusher, NULL) != 0) {
+        journaling = false;
+        free(dirty_bits);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop journaling: commit what is left, checkpoint the journal (so the image
+ * file is up to date) and close it.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int journal_stop(void) {
+    if (!journaling) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    stopping = true;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+    pthread_join(flusher, NULL);
+
+    int ret = 0;
+    if (journal_commit() == -1 || failed || journal_checkpoint() == -1) {
+        ret = -1;
+    }
+
+    journaling = false;
+    close(journal_fd);
+    journal_fd = -1;
+    image_fd = -1;
+    image = NULL;
+
+    free(dirty_bits);
+    free(dirty_units);
+    free(batch);
+    dirty_bits = NULL;
+    dirty_units = NULL;
+    dirty_units_capacity = 0;
+    batch = NULL;
+    batch_capacity = 0;
+
+    return ret;
+}
+
+/**
+ * Mark a range of the image as changed, to be written in the next batch.
+ *
+ * Must be called (after changing the range) between journal_op_begin and
+ * journal_op_end.
+ *
+ * Input:
+ *   - ptr: start of the range, inside the image
+ *   - len: length of the range
+ */
+void journal_dirty(void const *ptr, size_t len) {
+    if (!journaling || len == 0) {
+        return;
+    }
+
+    size_t offset = (size_t)((char const *)ptr - image);
+    size_t first = offset / JOURNAL_UNIT;
+    size_t last = (offset + len - 1) / JOURNAL_UNIT;
+
+    for (size_t unit = first; unit <= last; unit++) {
+        uint64_t mask = UINT64_C(1) << (unit % 64);
+        if (__atomic_fetch_or(&dirty_bits[unit / 64], mask, __ATOMIC_RELAXED) &
+            mask) {
+            continue; // already in this batch
+        }
+
+        pthread_mutex_lock(&dirty_lock);
+        if (n_dirty_units == dirty_units_capacity) {
+            size_t capacity =
+                dirty_units_capacity == 0 ? 1024 : 2 * dirty_units_capacity;
+            size_t *grown = realloc(dirty_units, capacity * sizeof(size_t));
+            if (grown == NULL) {
+                pthread_mutex_unlock(&dirty_lock);
+                pthread_mutex_lock(&flush_lock);
+                failed = true;
+                pthread_mutex_unlock(&flush_lock);
+                return;
+            }
+            dirty_units = grown;
+            dirty_units_capacity = capacity;
+        }
+        dirty_units[n_dirty_units++] = unit;
+        // Requests a commit once commit_bytes are dirty (or right away)
+        bool request = (n_dirty_units * JOURNAL_UNIT >= commit_bytes &&
+                        (n_dirty_units - 1) * JOURNAL_UNIT < commit_bytes) ||
+                       (commit_interval_us == 0 && n_dirty_units == 1);
+        pthread_mutex_unlock(&dirty_lock);
+
+        if (request) {
+            pthread_mutex_lock(&flush_lock);
+            commit_requested = true;
+            pthread_cond_signal(&flush_cond);
+            pthread_mutex_unlock(&flush_lock);
+        }
+    }
+}
+
+/**
+ * Begin an operation that changes the image (operations may nest).
+ *
+ * Waits while a batch is being taken.
+ */
+void journal_op_begin(void) {
+    if (!journaling || op_depth++ > 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&gate_lock);
+    while (gate_closed) {
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    }
+    active_ops++;
+    pthread_mutex_unlock(&gate_lock);
+}
+
+/**
+ * End an operation that changes the image.
+ */
+void journal_op_end(void) {
+    if (!journaling || --op_depth > 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&gate_lock);
+    if (--active_ops == 0 && gate_closed) {
+        pthread_cond_broadcast(&gate_cond);
+    }
+    pthread_mutex_unlock(&gate_lock);
+}
+
+/**
+ * Wait until every operation that ended before the call is in the journal
+ * (and would survive a crash). Joins the next group commit.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int journal_sync(void) {
+    if (!journaling) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    uint64_t target = open_epoch;
+    sync_waiters++;
+    if (commit_interval_us == 0) {
+        pthread_cond_signal(&flush_cond);
+    }
+    while (durable_epoch < target && !failed) {
+        pthread_cond_wait(&durable_cond, &flush_lock);
+    }
+    sync_waiters--;
+    int ret = failed ? -1 : 0;
+    pthread_mutex_unlock(&flush_lock);
+
+    return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+/*
+ * Write-ahead journal of the TFS image (redo log).
+ *
+ * While journaling, the image is mapped privately, so changes only reach the
+ * backing file through the journal. Changes are tracked in small units of the
+ * image (journal_dirty), and a flusher thread periodically writes every dirty
+ * unit to the journal as one checksummed batch (group commit). Batches are
+ * only taken between operations (see journal_op_begin), so each one holds a
+ * consistent state of the FS. Once the journal grows large enough, it is
+ * checkpointed (applied to the image file) and emptied.
+ *
+ * On attach, the complete batches in the journal are replayed onto the image
+ * file; a batch torn by a crash is discarded.
+ */
+
+int journal_recover(char const *journal_path, int image_fd, size_t image_size);
+int journal_start(char *image, size_t image_size, size_t commit_interval_us,
+                  size_t commit_bytes);
+int journal_stop(void);
+
+void journal_dirty(void const *ptr, size_t len);
+
+void journal_op_begin(void);
+void journal_op_end(void);
+
+int journal_sync(void);
+
+#endif // JOURNAL_H
@@ -0,0 +1,92 @@
+#include "latency.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+tfs_latency_model_t latency_model = TFS_LATENCY_NONE;
+static size_t costs[TFS_ACCESS_CLASSES];
+
+static atomic_size_t accesses[TFS_ACCESS_CLASSES];
+static atomic_size_t stall_ns[TFS_ACCESS_CLASSES];
+
+// Position of the previous access of the thread to each kind of state
+static _Thread_local size_t last_position[2] = {SIZE_MAX, SIZE_MAX};
+
+/**
+ * Select the latency model, and reset the stall counters.
+ *
+ * Input:
+ *   - model: latency model
+ *   - fixed_ns: cost of every access (only with TFS_LATENCY_FIXED)
+ *   - class_ns: cost of each class of access (only with TFS_LATENCY_DEVICE)
+ *
+ * Returns 0 if successful, -1 if the model is unknown.
+ */
+int latency_init(tfs_latency_model_t model, size_t fixed_ns,
+                 size_t const class_ns[TFS_ACCESS_CLASSES]) {
+    for (size_t i = 0; i < TFS_ACCESS_CLASSES; i++) {
+        switch (model) {
+        case TFS_LATENCY_NONE:
+            costs[i] = 0;
+            break;
+        case TFS_LATENCY_FIXED:
+            costs[i] = fixed_ns;
+            break;
+        case TFS_LATENCY_DEVICE:
+            costs[i] = class_ns[i];
+            break;
+        default:
+            return -1;
+        }
+        atomic_store(&accesses[i], 0);
+        atomic_store(&stall_ns[i], 0);
+    }
+
+    latency_model = model;
+    return 0;
+}
+
+/**
+ * Busy wait for the cost of an access.
+ *
+ * Input:
+ *   - kind: LATENCY_META or LATENCY_DATA
+ *   - position: number of the block of the image accessed
+ */
+void latency_stall(int kind, size_t position) {
+    size_t last = last_position[kind];
+    bool sequential =
+        last != SIZE_MAX && (position == last || position == last + 1);
+    last_position[kind] = position;
+
+    size_t class = (size_t)kind * 2 + (sequential ? 0 : 1);
+    size_t cost = costs[class];
+
+    atomic_fetch_add_explicit(&accesses[class], 1, memory_order_relaxed);
+    if (cost == 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stall_ns[class], cost, memory_order_relaxed);
+
+    // Sleeping is far too coarse for the costs of an access
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((size_t)((now.tv_sec - start.tv_sec) * 1000000000 +
+                      (now.tv_nsec - start.tv_nsec)) < cost);
+}
+
+/**
+ * Obtain the stall counters.
+ */
+tfs_stall_stats latency_stats(void) {
+    tfs_stall_stats stats;
+    for (size_t i = 0; i < TFS_ACCESS_CLASSES; i++) {
+        stats.accesses[i] = atomic_load(&accesses[i]);
+        stats.stall_ns[i] = atomic_load(&stall_ns[i]);
+    }
+    return stats;
+}
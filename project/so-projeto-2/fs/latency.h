@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "operations.h"
+#include <stddef.h>
+
+/*
+ * Storage latency model: every access to the FS state is reported with the
+ * kind of state it touches and its position (the number of the block of the
+ * image it is in), and the model busy waits for the cost of its class.
+ *
+ * With TFS_LATENCY_NONE, reporting an access is a single (predictable) branch.
+ */
+
+// Kinds of state
+#define LATENCY_META (0)
+#define LATENCY_DATA (1)
+
+extern tfs_latency_model_t latency_model;
+
+int latency_init(tfs_latency_model_t model, size_t fixed_ns,
+                 size_t const class_ns[TFS_ACCESS_CLASSES]);
+
+void latency_stall(int kind, size_t position);
+
+static inline void latency_access(int kind, size_t position) {
+    if (latency_model != TFS_LATENCY_NONE) {
+        latency_stall(kind, position);
+    }
+}
+
+tfs_stall_stats latency_stats(void);
+
+#endif // LATENCY_H
@@ -1,8 +1,12 @@
 #include "operations.h"
 #include "config.h"
+#include "dcache.h"
+#include "journal.h"
+#include "latency.h"
 #include "state.h"
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,16 +15,31 @@
 
 #include "betterassert.h"
 
+// Serializes renames (see tfs_rename)
+static pthread_mutex_t rename_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 tfs_params tfs_default_params() {
     tfs_params params = {
         .max_inode_count = 64,
         .max_block_count = 1024,
         .max_open_files_count = 16,
         .block_size = 1024,
+        .alloc_mode = TFS_ALLOC_GLOBAL,
+        .alloc_batch_size = 32,
+        .dentry_cache_size = 1024,
+        .image_path = NULL,
+        .journal_path = NULL,
+        .journal_commit_interval_us = 1000,
+        .journal_commit_bytes = 1024 * 1024,
+        .latency_model = TFS_LATENCY_NONE,
+        .latency_ns = 0,
+        .latency_class_ns = {0},
     };
     return params;
 }
 
+size_t tfs_min_block_size() { return sizeof(dir_entry_t); }
+
 int tfs_init(tfs_params const *params_ptr) {
     tfs_params params;
     if (params_ptr != NULL) {
@@ -29,67 +48,219 @@ int tfs_init(tfs_params const *params_ptr) {
         params = tfs_default_params();
     }
 
-    if (state_init(params) != 0) {
+    if (latency_init(params.latency_model, params.latency_ns,
+                     params.latency_class_ns) != 0 ||
+        state_init(params) != 0 || dcache_init(params.dentry_cache_size) != 0) {
         return -1;
     }
 
-    // create root inode
-    int root = inode_create(T_DIRECTORY);
-    if (root != ROOT_DIR_INUM) {
-        return -1;
+    // create root inode (an image that was formatted already has one)
+    if (state_is_empty()) {
+        journal_op_begin();
+        int root = inode_create(T_DIRECTORY);
+        journal_op_end();
+        if (root != ROOT_DIR_INUM) {
+            return -1;
+        }
     }
 
     return 0;
 }
 
 int tfs_destroy() {
+    dcache_destroy();
     if (state_destroy() != 0) {
         return -1;
     }
     return 0;
 }
 
+int tfs_mkfs(char const *path, tfs_params const *params_ptr) {
+    tfs_params params;
+    if (params_ptr != NULL) {
+        params = *params_ptr;
+    } else {
+        params = tfs_default_params();
+    }
+
+    if (state_format(path, params) != 0) {
+        return -1;
+    }
+
+    // A stale journal would be replayed onto the new image
+    if (params.journal_path != NULL) {
+        int fd = open(params.journal_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+        if (fd == -1 || close(fd) == -1) {
+            return -1;
+        }
+    }
+
+    // Attaches to the new image, just to create the root directory
+    params.image_path = path;
+    if (tfs_init(&params) != 0) {
+        return -1;
+    }
+    return tfs_destroy();
+}
+
+int tfs_sync() { return journal_sync(); }
+
+tfs_stall_stats tfs_get_stall_stats() { return latency_stats(); }
+
+tfs_params tfs_get_params() { return state_params(); }
+
+/*
+ * The operations that change the FS are journal operations (see
+ * journal_op_begin): each public function wraps the static *_op function that
+ * does the work.
+ */
+
+/**
+ * Checks that a path name is absolute, with non-empty components that fit in a
+ * directory entry (no trailing '/').
+ */
 static bool valid_pathname(char const *name) {
-    return name != NULL && strlen(name) > 1 && name[0] == '/';
+    if (name == NULL || name[0] != '/' || name[1] == '\0') {
+        return false;
+    }
+
+    size_t component = 0;
+    for (char const *c = name + 1;; c++) {
+        if (*c != '/' && *c != '\0') {
+            component++;
+            continue;
+        }
+
+        if (component == 0 || component > MAX_FILE_NAME - 1) {
+            return false;
+        }
+        if (*c == '\0') {
+            return true;
+        }
+        component = 0;
+    }
 }
 
 /**
- * Looks for a file.
+ * Obtain the length of the path of the directory that holds a path (the
+ * position of its last '/').
+ */
+static size_t parent_path_len(char const *path, size_t len) {
+    while (path[len - 1] != '/') {
+        len--;
+    }
+    return len - 1;
+}
+
+/**
+ * Resolves a path, going through the dentry cache.
  *
- * Note: as a simplification, only a plain directory space (root directory only)
- * is supported.
+ * On a cache miss, the parent directory is resolved (recursively, so that each
+ * prefix of the path is cached too) and the last component is looked up in it.
+ *
+ * Input:
+ *   - path: valid absolute path name
+ *   - len: length of the prefix of path to resolve (0 for the root directory)
+ * Returns the inumber of the file, -1 if unsuccessful.
+ */
+static int tfs_resolve(char const *path, size_t len) {
+    if (len == 0) {
+        return ROOT_DIR_INUM;
+    }
+
+    int inum = dcache_lookup(path, len);
+    if (inum != -1) {
+        return inum;
+    }
+
+    uint64_t generation = dcache_generation();
+
+    size_t parent_len = parent_path_len(path, len);
+    int parent = tfs_resolve(path, parent_len);
+    if (parent == -1) {
+        return -1;
+    }
+
+    char sub_name[MAX_FILE_NAME];
+    size_t sub_len = len - parent_len - 1;
+    memcpy(sub_name, path + parent_len + 1, sub_len);
+    sub_name[sub_len] = '\0';
+
+    inode_t const *parent_inode = inode_get(parent);
+    ALWAYS_ASSERT(parent_inode != NULL,
+                  "tfs_resolve: directory files must have an inode");
+
+    inum = find_in_dir(parent_inode, sub_name);
+    if (inum != -1) {
+        dcache_insert(path, len, inum, generation);
+    }
+
+    return inum;
+}
+
+/**
+ * Looks for a file.
  *
  * Input:
  *   - name: absolute path name
- *   - root_inode: the root directory inode
  * Returns the inumber of the file, -1 if unsuccessful.
  */
-static int tfs_lookup(char const *name, inode_t const *root_inode) {
+static int tfs_lookup(char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
 
-    ALWAYS_ASSERT(
-        root_inode == inode_get(ROOT_DIR_INUM),
-        "tfs_lookup: root_inode must be the inode of the root directory");
+    return tfs_resolve(name, strlen(name));
+}
 
+/**
+ * Looks for the directory that holds a file.
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - sub_name: where to store the last component of name
+ * Returns the inumber of the directory, -1 if unsuccessful.
+ */
+static int tfs_lookup_parent(char const *name, char *sub_name) {
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    // skip the initial '/' character
-    name++;
+    size_t len = strlen(name);
+    size_t parent_len = parent_path_len(name, len);
+    strcpy(sub_name, name + parent_len + 1);
 
-    return find_in_dir(root_inode, name);
+    return tfs_resolve(name, parent_len);
 }
 
-int tfs_open(char const *name, tfs_file_mode_t mode) {
+/**
+ * Read-locks the directory that holds a file, so that it is not removed while
+ * an entry is added to it.
+ *
+ * Input:
+ *   - name: absolute path name of the file
+ *   - parent: inumber of the directory (from tfs_lookup_parent)
+ * Returns 0 if successful, -1 (with the directory unlocked) if the directory
+ * was removed or moved since it was looked up.
+ */
+static int tfs_lock_parent(char const *name, int parent) {
+    pthread_rwlock_rdlock(&inode_rwlocks[parent]);
+
+    if (tfs_resolve(name, parent_path_len(name, strlen(name))) != parent) {
+        pthread_rwlock_unlock(&inode_rwlocks[parent]);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int tfs_open_op(char const *name, tfs_file_mode_t mode) {
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_open: root dir inode must exist");
-    int inum = tfs_lookup(name, root_dir_inode);
+    int inum = tfs_lookup(name);
     size_t offset;
 
     if (inum >= 0) {
@@ -98,10 +269,14 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
 
+        if (inode->i_node_type == T_DIRECTORY) {
+            return -1; // directories are not opened as files
+        }
+
         if (inode->i_node_type == T_SYMLINK) {
             char path[inode->i_size + 1];
 
-            void *data = data_block_get(inode->i_data_block);
+            void *data = data_block_get(inode_block_get(inode, 0));
             ALWAYS_ASSERT(data != NULL,
                           "tfs_open: data block deleted mid-write");
 
@@ -119,30 +294,48 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         // Truncate (if requested)
         if (mode & TFS_O_TRUNC) {
             pthread_rwlock_wrlock(&inode_rwlocks[inum]);
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
-            }
+            inode_blocks_free(inode);
+            inode->i_size = 0;
+            journal_dirty(&inode->i_size, sizeof(size_t));
+            inode_appends_reset(inum, 0);
             pthread_rwlock_unlock(&inode_rwlocks[inum]);
         }
 
         // Determine initial offset
         if (mode & TFS_O_APPEND) {
+            // The file may be growing meanwhile (see tfs_append)
+            pthread_rwlock_rdlock(&inode_rwlocks[inum]);
             offset = inode->i_size;
+            pthread_rwlock_unlock(&inode_rwlocks[inum]);
         } else {
             offset = 0;
         }
     } else if (mode & TFS_O_CREAT) {
         // The file does not exist; the mode specified that it should be created
+        char sub_name[MAX_FILE_NAME];
+        int parent = tfs_lookup_parent(name, sub_name);
+        if (parent == -1) {
+            return -1; // no such directory
+        }
+
         // Create inode
         inum = inode_create(T_FILE);
         if (inum == -1) {
             return -1; // no space in inode table
         }
 
-        // Add entry in the root directory
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
+        // Add entry in the parent directory
+        int added = -1;
+        if (tfs_lock_parent(name, parent) != -1) {
+            added = add_dir_entry(inode_get(parent), sub_name, inum);
+            pthread_rwlock_unlock(&inode_rwlocks[parent]);
+        }
+        if (added == -1) {
             inode_delete(inum);
+            if (tfs_lookup(name) >= 0) {
+                // Lost a race with another thread creating the same file
+                return tfs_open(name, mode);
+            }
             return -1; // no space in directory
         }
 
@@ -160,36 +353,76 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
     // opened but it remains created
 }
 
-int tfs_sym_link(char const *target, char const *link_name) {
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_sym_link: root dir inode must exist");
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    journal_op_begin();
+    int ret = tfs_open_op(name, mode);
+    journal_op_end();
+    return ret;
+}
 
-    if (tfs_lookup(target, root_dir_inode) == -1) {
+static int tfs_mkdir_op(char const *name) {
+    char sub_name[MAX_FILE_NAME];
+    int parent = tfs_lookup_parent(name, sub_name);
+    if (parent == -1) {
         return -1;
     }
 
-    if (tfs_lookup(link_name, root_dir_inode) != -1) {
+    int inum = inode_create(T_DIRECTORY);
+    if (inum == -1) {
         return -1;
     }
 
-    int inum = inode_create(T_SYMLINK);
-    if (inum == -1) {
+    int added = -1;
+    if (tfs_lock_parent(name, parent) != -1) {
+        added = add_dir_entry(inode_get(parent), sub_name, inum);
+        pthread_rwlock_unlock(&inode_rwlocks[parent]);
+    }
+    if (added == -1) {
+        inode_delete(inum);
         return -1;
     }
 
-    int dblock = data_block_alloc();
-    if (dblock == -1) {
-        inode_delete(inum);
+    return 0;
+}
+
+int tfs_mkdir(char const *name) {
+    journal_op_begin();
+    int ret = tfs_mkdir_op(name);
+    journal_op_end();
+    return ret;
+}
+
+static int tfs_sym_link_op(char const *target, char const *link_name) {
+    if (tfs_lookup(target) == -1) {
+        return -1;
+    }
+
+    char sub_name[MAX_FILE_NAME];
+    int parent = tfs_lookup_parent(link_name, sub_name);
+    if (parent == -1) {
+        return -1;
+    }
+
+    if (tfs_lookup(link_name) != -1) {
+        return -1;
+    }
+
+    int inum = inode_create(T_SYMLINK);
+    if (inum == -1) {
         return -1;
     }
 
     inode_t *sym_link_inode = inode_get(inum);
     pthread_rwlock_wrlock(&inode_rwlocks[inum]);
 
-    sym_link_inode->i_data_block = dblock;
+    int dblock = inode_block_alloc(sym_link_inode, 0);
+    if (dblock == -1) {
+        inode_delete(inum);
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return -1;
+    }
 
-    void *data = data_block_get(sym_link_inode->i_data_block);
+    void *data = data_block_get(dblock);
     ALWAYS_ASSERT(data != NULL, "tfs_sym_link: data block deleted mid-write");
 
     size_t name_size = strlen(target);
@@ -197,47 +430,161 @@ int tfs_sym_link(char const *target, char const *link_name) {
     memcpy(data, target, name_size);
 
     sym_link_inode->i_size = name_size;
+    journal_dirty(data, name_size);
+    journal_dirty(&sym_link_inode->i_size, sizeof(size_t));
 
     pthread_rwlock_unlock(&inode_rwlocks[inum]);
 
-    add_dir_entry(root_dir_inode, link_name + 1, inum);
+    int added = -1;
+    if (tfs_lock_parent(link_name, parent) != -1) {
+        added = add_dir_entry(inode_get(parent), sub_name, inum);
+        pthread_rwlock_unlock(&inode_rwlocks[parent]);
+    }
+    if (added == -1) {
+        inode_delete(inum);
+        return -1;
+    }
 
     return 0;
 }
 
-int tfs_link(char const *target, char const *link_name) {
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_link: root dir inode must exist");
+int tfs_sym_link(char const *target, char const *link_name) {
+    journal_op_begin();
+    int ret = tfs_sym_link_op(target, link_name);
+    journal_op_end();
+    return ret;
+}
 
-    int inumber = tfs_lookup(target, root_dir_inode);
+static int tfs_link_op(char const *target, char const *link_name) {
+    int inumber = tfs_lookup(target);
 
     if (inumber == -1) {
         return -1;
     }
 
-    if (tfs_lookup(link_name, root_dir_inode) != -1) {
+    char sub_name[MAX_FILE_NAME];
+    int parent = tfs_lookup_parent(link_name, sub_name);
+    if (parent == -1) {
+        return -1;
+    }
+
+    if (tfs_lookup(link_name) != -1) {
         return -1;
     }
 
     inode_t *file_inode = inode_get(inumber);
     ALWAYS_ASSERT(file_inode != NULL, "tfs_link: target inode must exist");
 
-    if (file_inode->i_node_type == T_SYMLINK) {
+    if (file_inode->i_node_type != T_FILE) {
+        return -1; // no hard links to symbolic links or directories
+    }
+
+    if (tfs_lock_parent(link_name, parent) == -1) {
         return -1;
     }
+    int added = add_dir_entry(inode_get(parent), sub_name, inumber);
+    pthread_rwlock_unlock(&inode_rwlocks[parent]);
 
-    if (add_dir_entry(root_dir_inode, link_name + 1, inumber) == -1) {
+    if (added == -1) {
         return -1;
     }
 
     pthread_rwlock_wrlock(&inode_rwlocks[inumber]);
     file_inode->number_hard_links++;
+    journal_dirty(&file_inode->number_hard_links,
+                  sizeof(file_inode->number_hard_links));
     pthread_rwlock_unlock(&inode_rwlocks[inumber]);
 
     return 0;
 }
 
+int tfs_link(char const *target, char const *link_name) {
+    journal_op_begin();
+    int ret = tfs_link_op(target, link_name);
+    journal_op_end();
+    return ret;
+}
+
+static int tfs_rename_op(char const *old_name, char const *new_name) {
+    char old_sub_name[MAX_FILE_NAME];
+    char new_sub_name[MAX_FILE_NAME];
+
+    if (!valid_pathname(old_name) || !valid_pathname(new_name)) {
+        return -1;
+    }
+
+    // A directory cannot be moved into itself
+    size_t old_len = strlen(old_name);
+    if (strncmp(new_name, old_name, old_len) == 0 &&
+        (new_name[old_len] == '\0' || new_name[old_len] == '/')) {
+        return -1;
+    }
+
+    // Renames are serialized, so that the checks above hold until it is done
+    pthread_mutex_lock(&rename_mutex);
+
+    int old_parent = tfs_lookup_parent(old_name, old_sub_name);
+    int new_parent = tfs_lookup_parent(new_name, new_sub_name);
+    int inumber = tfs_lookup(old_name);
+    if (old_parent == -1 || new_parent == -1 || inumber == -1) {
+        pthread_mutex_unlock(&rename_mutex);
+        return -1;
+    }
+
+    // Both directories are locked (in inumber order) against removal
+    char const *first = old_parent < new_parent ? old_name : new_name;
+    char const *second = old_parent < new_parent ? new_name : old_name;
+    int first_parent = old_parent < new_parent ? old_parent : new_parent;
+    int second_parent = old_parent < new_parent ? new_parent : old_parent;
+
+    if (tfs_lock_parent(first, first_parent) == -1) {
+        pthread_mutex_unlock(&rename_mutex);
+        return -1;
+    }
+    if (second_parent != first_parent &&
+        tfs_lock_parent(second, second_parent) == -1) {
+        pthread_rwlock_unlock(&inode_rwlocks[first_parent]);
+        pthread_mutex_unlock(&rename_mutex);
+        return -1;
+    }
+
+    // Keeps the file from being unlinked (or, if a directory, removed) meanwhile
+    pthread_rwlock_wrlock(&inode_rwlocks[inumber]);
+
+    inode_t *inode = inode_get(inumber);
+    int ret = -1;
+    if (add_dir_entry(inode_get(new_parent), new_sub_name, inumber) != -1) {
+        if (clear_dir_entry(inode_get(old_parent), old_sub_name) != -1) {
+            if (inode->i_node_type == T_DIRECTORY) {
+                dcache_invalidate_tree(old_name);
+            } else {
+                dcache_invalidate(old_name);
+            }
+            ret = 0;
+        } else {
+            // The old name is gone, so the new one must not remain either
+            clear_dir_entry(inode_get(new_parent), new_sub_name);
+            dcache_invalidate(new_name);
+        }
+    }
+
+    pthread_rwlock_unlock(&inode_rwlocks[inumber]);
+    if (second_parent != first_parent) {
+        pthread_rwlock_unlock(&inode_rwlocks[second_parent]);
+    }
+    pthread_rwlock_unlock(&inode_rwlocks[first_parent]);
+    pthread_mutex_unlock(&rename_mutex);
+
+    return ret;
+}
+
+int tfs_rename(char const *old_name, char const *new_name) {
+    journal_op_begin();
+    int ret = tfs_rename_op(old_name, new_name);
+    journal_op_end();
+    return ret;
+}
+
 int tfs_close(int fhandle) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
@@ -249,104 +596,535 @@ int tfs_close(int fhandle) {
     return 0;
 }
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+/**
+ * Get the block of a file that a chunk of a write falls in, allocating it if
+ * the file does not reach it yet; its inode must be locked for writing.
+ *
+ * Returns the block, or NULL if there is no space.
+ */
+static char *file_block_for_write(inode_t *inode, size_t position,
+                                  size_t chunk) {
+    size_t block_size = state_block_size();
+    size_t block_offset = position % block_size;
+
+    // Allocates the block if the file does not reach it yet
+    bool fresh = inode_block_get(inode, position / block_size) == -1;
+    int bnum = inode_block_alloc(inode, position / block_size);
+    if (bnum == -1) {
+        return NULL; // no space
+    }
+
+    char *block = data_block_get(bnum);
+    ALWAYS_ASSERT(block != NULL, "file_write: data block deleted mid-write");
+
+    // A new block may hold stale data, which must not show through the
+    // parts of it this write skips
+    if (fresh && chunk < block_size) {
+        memset(block, 0, block_offset);
+        memset(block + block_offset + chunk, 0,
+               block_size - block_offset - chunk);
+        journal_dirty(block, block_offset);
+        journal_dirty(block + block_offset + chunk,
+                      block_size - block_offset - chunk);
+    }
+
+    return block;
+}
+
+/**
+ * Write to a file at an offset, extending it as needed; its inode must be
+ * locked for writing.
+ *
+ * Returns the number of bytes written, or -1 if none could be written (no
+ * space).
+ */
+static ssize_t file_write(inode_t *inode, size_t offset, void const *buffer,
+                          size_t to_write) {
+    // Determine how many bytes to write
+    size_t max_size = state_max_file_size();
+    if (offset >= max_size) {
+        return 0;
+    }
+    if (to_write > max_size - offset) {
+        to_write = max_size - offset;
+    }
+    if (to_write == 0) {
+        return 0;
+    }
+
+    size_t block_size = state_block_size();
+    size_t written = 0;
+
+    // Walks the block map, one block at a time
+    while (written < to_write) {
+        size_t position = offset + written;
+        size_t block_offset = position % block_size;
+        size_t chunk = block_size - block_offset;
+        if (chunk > to_write - written) {
+            chunk = to_write - written;
+        }
+
+        char *block = file_block_for_write(inode, position, chunk);
+        if (block == NULL) {
+            break; // no space
+        }
+
+        // Perform the actual write
+        memcpy(block + block_offset, (char const *)buffer + written, chunk);
+        journal_dirty(block + block_offset, chunk);
+        written += chunk;
+    }
+
+    if (written == 0) {
+        return -1; // no space
+    }
+
+    if (offset + written > inode->i_size) {
+        inode->i_size = offset + written;
+        journal_dirty(&inode->i_size, sizeof(size_t));
+    }
+
+    return (ssize_t)written;
+}
+
+/**
+ * Read from a file at an offset; its inode must be locked (for reading).
+ *
+ * Returns the number of bytes read (0 at or beyond the end of the file).
+ */
+static size_t file_read(inode_t const *inode, size_t offset, void *buffer,
+                        size_t len) {
+    // Determine how many bytes to read
+    if (offset >= inode->i_size) {
+        return 0;
+    }
+    size_t to_read = inode->i_size - offset;
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    size_t block_size = state_block_size();
+    for (size_t done = 0; done < to_read;) {
+        size_t position = offset + done;
+        size_t block_offset = position % block_size;
+        size_t chunk = block_size - block_offset;
+        if (chunk > to_read - done) {
+            chunk = to_read - done;
+        }
+
+        // Blocks skipped by a write past the end of the file read as zeros
+        int bnum = inode_block_get(inode, position / block_size);
+        if (bnum == -1) {
+            memset((char *)buffer + done, 0, chunk);
+        } else {
+            // Perform the actual read
+            void *block = data_block_get(bnum);
+            memcpy((char *)buffer + done, (char const *)block + block_offset,
+                   chunk);
+        }
+        done += chunk;
+    }
+
+    return to_read;
+}
+
+/**
+ * Write several buffers to a file, from an offset; its inode must be locked
+ * for writing.
+ *
+ * Returns the total number of bytes written, or -1 if none could be written.
+ */
+static ssize_t file_writev(inode_t *inode, size_t offset,
+                           struct iovec const *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t written =
+            file_write(inode, offset + total, iov[i].iov_base, iov[i].iov_len);
+        if (written == -1) {
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)written;
+        if ((size_t)written < iov[i].iov_len) {
+            break; // the file or the FS is full
+        }
+    }
+    return (ssize_t)total;
+}
+
+static ssize_t tfs_writev_op(int fhandle, struct iovec const *iov,
+                             int iovcnt) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+    if (file == NULL || iovcnt < 0) {
         return -1;
     }
 
-    pthread_mutex_lock(&open_file_entry_mutex[fhandle]);
+    pthread_mutex_lock(&file->of_mutex);
 
     int inum = file->of_inumber;
 
     //  From the open file table entry, we get the inode
     inode_t *inode = inode_get(inum);
-    ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    ALWAYS_ASSERT(inode != NULL, "tfs_writev: inode of open file deleted");
 
-    // Determine how many bytes to write
+    pthread_rwlock_wrlock(&inode_rwlocks[inum]);
+    ssize_t written = file_writev(inode, file->of_offset, iov, iovcnt);
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    // The offset associated with the file handle is incremented accordingly
+    if (written > 0) {
+        file->of_offset += (size_t)written;
+    }
+
+    pthread_mutex_unlock(&file->of_mutex);
+
+    return written;
+}
+
+ssize_t tfs_writev(int fhandle, struct iovec const *iov, int iovcnt) {
+    journal_op_begin();
+    ssize_t ret = tfs_writev_op(fhandle, iov, iovcnt);
+    journal_op_end();
+    return ret;
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    struct iovec iov = {.iov_base = (void *)buffer, .iov_len = to_write};
+    return tfs_writev(fhandle, &iov, 1);
+}
+
+static ssize_t tfs_pwrite_op(int fhandle, void const *buffer, size_t len,
+                             size_t offset) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    // The handle is only used to find the inode; its offset is left alone
+    int inum = file->of_inumber;
+    inode_t *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_pwrite: inode of open file deleted");
+
+    pthread_rwlock_wrlock(&inode_rwlocks[inum]);
+    ssize_t written = file_write(inode, offset, buffer, len);
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    return written;
+}
+
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t len, size_t offset) {
+    journal_op_begin();
+    ssize_t ret = tfs_pwrite_op(fhandle, buffer, len, offset);
+    journal_op_end();
+    return ret;
+}
+
+/**
+ * Check whether every block of a range of a file is allocated; its inode must
+ * be locked.
+ */
+static bool file_range_mapped(inode_t const *inode, size_t offset,
+                              size_t len) {
     size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
+    for (size_t b = offset / block_size; b <= (offset + len - 1) / block_size;
+         b++) {
+        if (inode_block_get(inode, b) == -1) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (to_write > 0) {
-        pthread_rwlock_wrlock(&inode_rwlocks[inum]);
+/**
+ * Allocate the blocks of a range of a file the file does not reach yet; its
+ * inode must be locked for writing.
+ *
+ * Returns false if there is no space.
+ */
+static bool file_range_alloc(inode_t *inode, size_t offset, size_t len) {
+    size_t block_size = state_block_size();
+    for (size_t done = 0; done < len;) {
+        size_t chunk = block_size - (offset + done) % block_size;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (file_block_for_write(inode, offset + done, chunk) == NULL) {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
 
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                pthread_rwlock_unlock(&inode_rwlocks[inum]);
-                pthread_mutex_unlock(&open_file_entry_mutex[fhandle]);
+/**
+ * Check that a handle is still open on an inode, which is locked (so that the
+ * file cannot be unlinked meanwhile).
+ */
+static bool handle_on(int fhandle, int inum) {
+    open_file_entry_t const *file = get_open_file_entry(fhandle);
+    return file != NULL && file->of_inumber == inum;
+}
 
-                return -1; // no space
-            }
+// Times an append yields while waiting for its turn, before sleeping
+#define APPEND_SPINS (64)
 
-            inode->i_data_block = bnum;
+/**
+ * Wait for the turn of an append to commit its range, which is when the
+ * ranges reserved before it are all committed (or given up).
+ *
+ * Returns false if the appends were reset meanwhile.
+ */
+static bool append_wait_turn(inode_appends_t *appends, size_t offset,
+                             unsigned generation) {
+    // The appends before it are copying, so it is usually soon
+    for (int i = 0; i < APPEND_SPINS; i++) {
+        if (atomic_load(&appends->committed) == offset) {
+            return atomic_load(&appends->generation) == generation;
         }
+        sched_yield();
+    }
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+    pthread_mutex_lock(&appends->mutex);
+    appends->waiters++;
+    while (atomic_load(&appends->committed) != offset &&
+           atomic_load(&appends->generation) == generation) {
+        pthread_cond_wait(&appends->turn, &appends->mutex);
+    }
+    appends->waiters--;
+    pthread_mutex_unlock(&appends->mutex);
 
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+    return atomic_load(&appends->generation) == generation;
+}
+
+/**
+ * Pass the turn to commit to the append after one, once it is committed (or
+ * given up, in which case so are the appends after it, until no more are in
+ * progress and the next one starts at the end of the file).
+ */
+static void append_pass_turn(inode_appends_t *appends, size_t end, bool ok,
+                             size_t size) {
+    pthread_mutex_lock(&appends->mutex);
+    if (!ok) {
+        appends->failed = true;
+    }
+    size_t last = end;
+    if (appends->failed &&
+        atomic_compare_exchange_strong(&appends->reserved, &last, size)) {
+        appends->failed = false;
+        end = size;
+    }
+    atomic_store(&appends->committed, end);
+    if (appends->waiters > 0) {
+        pthread_cond_broadcast(&appends->turn);
+    }
+    pthread_mutex_unlock(&appends->mutex);
+}
 
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+static ssize_t tfs_append_op(int fhandle, void const *buffer, size_t len,
+                             void (*on_commit)(void *), void *arg) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || len == 0) {
+        return -1;
+    }
+
+    int inum = file->of_inumber;
+    inode_t *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_append: inode of open file deleted");
+    inode_appends_t *appends = &inode_appends[inum];
+
+    // Reserves the range; resets exclude this, as they lock the inode for
+    // writing
+    pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+    if (!handle_on(fhandle, inum)) {
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return -1;
+    }
+    unsigned generation = atomic_load(&appends->generation);
+    size_t offset = atomic_fetch_add(&appends->reserved, len);
+    bool ok = offset + len <= state_max_file_size();
+
+    // Allocates the blocks of the range the file does not reach yet
+    if (ok && !file_range_mapped(inode, offset, len)) {
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        pthread_rwlock_wrlock(&inode_rwlocks[inum]);
+        ok = atomic_load(&appends->generation) == generation &&
+             file_range_alloc(inode, offset, len);
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+    }
+    if (atomic_load(&appends->generation) != generation) {
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return -1; // its range is no longer in the file
+    }
+
+    // Copies to the range, in parallel with the other appends
+    size_t block_size = state_block_size();
+    for (size_t done = 0; ok && done < len;) {
+        size_t position = offset + done;
+        size_t block_offset = position % block_size;
+        size_t chunk = block_size - block_offset;
+        if (chunk > len - done) {
+            chunk = len - done;
         }
+
+        char *block =
+            data_block_get(inode_block_get(inode, position / block_size));
+        memcpy(block + block_offset, (char const *)buffer + done, chunk);
+        journal_dirty(block + block_offset, chunk);
+        done += chunk;
+    }
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    // Commits the range, once those before it are, so that readers only see
+    // whole appends
+    if (!append_wait_turn(appends, offset, generation)) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&inode_rwlocks[inum]);
+    if (atomic_load(&appends->generation) != generation) {
         pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return -1;
+    }
+    ok = ok && !appends->failed && handle_on(fhandle, inum);
+    if (ok) {
+        inode->i_size = offset + len;
+        journal_dirty(&inode->i_size, sizeof(size_t));
     }
+    size_t size = inode->i_size;
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
 
-    pthread_mutex_unlock(&open_file_entry_mutex[fhandle]);
+    if (ok && on_commit != NULL) {
+        on_commit(arg);
+    }
+    append_pass_turn(appends, offset + len, ok, size);
 
-    return (ssize_t)to_write;
+    return ok ? (ssize_t)len : -1;
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+ssize_t tfs_append(int fhandle, void const *buffer, size_t len,
+                   void (*on_commit)(void *), void *arg) {
+    journal_op_begin();
+    ssize_t ret = tfs_append_op(fhandle, buffer, len, on_commit, arg);
+    journal_op_end();
+    return ret;
+}
+
+ssize_t tfs_readv(int fhandle, struct iovec const *iov, int iovcnt) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+    if (file == NULL || iovcnt < 0) {
         return -1;
     }
 
     // From the open file table entry, we get the inode
-    pthread_mutex_lock(&open_file_entry_mutex[fhandle]);
+    pthread_mutex_lock(&file->of_mutex);
 
     int inum = file->of_inumber;
 
     inode_t const *inode = inode_get(inum);
-    ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+    ALWAYS_ASSERT(inode != NULL, "tfs_readv: inode of open file deleted");
 
     pthread_rwlock_rdlock(&inode_rwlocks[inum]);
 
-    // Determine how many bytes to read
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t done = file_read(inode, file->of_offset + total,
+                                iov[i].iov_base, iov[i].iov_len);
+        total += done;
+        if (done < iov[i].iov_len) {
+            break; // end of the file
+        }
     }
+    // The offset associated with the file handle is incremented accordingly
+    file->of_offset += total;
+
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+    pthread_mutex_unlock(&file->of_mutex);
 
-    if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+    return (ssize_t)total;
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    struct iovec iov = {.iov_base = buffer, .iov_len = len};
+    return tfs_readv(fhandle, &iov, 1);
+}
 
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_read;
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
     }
 
-    pthread_mutex_unlock(&open_file_entry_mutex[fhandle]);
+    // The handle is only used to find the inode; its offset is left alone
+    int inum = file->of_inumber;
+    inode_t const *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_pread: inode of open file deleted");
+
+    pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+    size_t done = file_read(inode, offset, buffer, len);
     pthread_rwlock_unlock(&inode_rwlocks[inum]);
 
-    return (ssize_t)to_read;
+    return (ssize_t)done;
 }
 
-int tfs_unlink(char const *target) {
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_unlink: root dir inode must exist");
-    int inumber = tfs_lookup(target, root_dir_inode);
+ssize_t tfs_read_view(int fhandle, size_t offset, size_t len, tfs_view *view) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    int inum = file->of_inumber;
+    inode_t const *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_read_view: inode of open file deleted");
+
+    pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+
+    if (offset >= inode->i_size) {
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return 0;
+    }
+
+    // Up to the end of the block (or of the file)
+    size_t block_size = state_block_size();
+    size_t block_offset = offset % block_size;
+    if (len > block_size - block_offset) {
+        len = block_size - block_offset;
+    }
+    if (len > inode->i_size - offset) {
+        len = inode->i_size - offset;
+    }
+
+    int bnum = inode_block_get(inode, offset / block_size);
+    if (bnum == -1) {
+        pthread_rwlock_unlock(&inode_rwlocks[inum]);
+        return -1; // no block to view
+    }
+
+    // Pinned while the inode is locked, so the block cannot be freed first
+    data_block_pin(bnum);
+    view->data = (char const *)data_block_get(bnum) + block_offset;
+    view->len = len;
+    view->block = bnum;
+
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    return (ssize_t)len;
+}
+
+void tfs_release_view(tfs_view *view) {
+    data_block_unpin(view->block);
+    view->data = NULL;
+    view->len = 0;
+    view->block = -1;
+}
+
+static int tfs_unlink_op(char const *target) {
+    char sub_name[MAX_FILE_NAME];
+    int parent = tfs_lookup_parent(target, sub_name);
+    if (parent == -1) {
+        return -1;
+    }
+
+    int inumber = tfs_lookup(target);
     if (inumber == -1) {
         return -1;
     }
@@ -357,19 +1135,32 @@ int tfs_unlink(char const *target) {
     inode_t *file_inode = inode_get(inumber);
     ALWAYS_ASSERT(file_inode != NULL, "tfs_unlink: target inode must exist");
 
-    if (clear_dir_entry(root_dir_inode, target + 1) == -1) {
+    pthread_rwlock_wrlock(&inode_rwlocks[inumber]);
+
+    // Only empty directories are removed; holding the directory lock, no
+    // entries can be added to it meanwhile
+    if (file_inode->i_node_type == T_DIRECTORY &&
+        dir_entry_count(file_inode) > 0) {
+        pthread_rwlock_unlock(&inode_rwlocks[inumber]);
         return -1;
     }
 
-    pthread_rwlock_wrlock(&inode_rwlocks[inumber]);
-    if ((--file_inode->number_hard_links) == 0) {
+    if (clear_dir_entry(inode_get(parent), sub_name) == -1) {
+        pthread_rwlock_unlock(&inode_rwlocks[inumber]);
+        return -1;
+    }
 
-        if (file_inode->i_size > 0) {
-            size_t block_size = state_block_size();
-            void *block = data_block_get(file_inode->i_data_block);
-            memset(block, 0, block_size);
-        }
+    if (file_inode->i_node_type == T_DIRECTORY) {
+        dcache_invalidate_tree(target);
+    } else {
+        dcache_invalidate(target);
+    }
 
+    journal_dirty(&file_inode->number_hard_links,
+                  sizeof(file_inode->number_hard_links));
+    if ((--file_inode->number_hard_links) == 0) {
+        // The blocks are not cleared (they may still be viewed, see
+        // tfs_read_view); writes clear the parts of new blocks they skip
         inode_delete(inumber);
         remove_inode_from_open_file_table(inumber);
     }
@@ -379,6 +1170,52 @@ int tfs_unlink(char const *target) {
     return 0;
 }
 
+int tfs_unlink(char const *target) {
+    journal_op_begin();
+    int ret = tfs_unlink_op(target);
+    journal_op_end();
+    return ret;
+}
+
+int tfs_readdir(char const *name, size_t *cursor, char *entry_name) {
+    int inum = strcmp(name, "/") == 0 ? ROOT_DIR_INUM : tfs_lookup(name);
+    if (inum == -1) {
+        return -1;
+    }
+
+    inode_t const *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_readdir: directory must have an inode");
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    // The directory cannot be deleted while its entries are read
+    pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+    int found = dir_entry_next(inode, cursor, entry_name) != -1;
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    return found;
+}
+
+ssize_t tfs_file_size(char const *name) {
+    int inum = tfs_lookup(name);
+    if (inum == -1) {
+        return -1;
+    }
+
+    inode_t const *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_file_size: file must have an inode");
+    if (inode->i_node_type == T_DIRECTORY) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&inode_rwlocks[inum]);
+    size_t size = inode->i_size;
+    pthread_rwlock_unlock(&inode_rwlocks[inum]);
+
+    return (ssize_t)size;
+}
+
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
     int source_fd = open(source_path, O_RDONLY);
 
@@ -394,20 +1231,21 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
     }
 
     size_t size = state_block_size();
-    char *buffer[size];
+    char buffer[size];
 
-    memset(buffer, 0, sizeof(buffer));
-    ssize_t bytes_read = read(source_fd, buffer, size);
+    // Copies the file one block at a time
+    ssize_t bytes_read;
+    while ((bytes_read = read(source_fd, buffer, size)) > 0) {
+        ssize_t bytes_writen = tfs_write(dest_fd, buffer, (size_t)bytes_read);
 
-    if (bytes_read < 0) {
-        close(source_fd);
-        tfs_close(dest_fd);
-        return -1;
+        if (bytes_writen != bytes_read) {
+            close(source_fd);
+            tfs_close(dest_fd);
+            return -1;
+        }
     }
 
-    ssize_t bytes_writen = tfs_write(dest_fd, buffer, (size_t)bytes_read);
-
-    if (bytes_writen < 0) {
+    if (bytes_read < 0) {
         close(source_fd);
         tfs_close(dest_fd);
         return -1;
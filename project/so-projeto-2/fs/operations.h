@@ -3,6 +3,44 @@
 
 #include "config.h"
 #include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * TécnicoFS inode and data block allocation strategies.
+ */
+typedef enum {
+    // Every allocation goes through the global (single lock) free maps
+    TFS_ALLOC_GLOBAL = 0,
+    // Each thread keeps a magazine of free inodes and blocks, which it refills
+    // from (and drains to) the global free maps in batches
+    TFS_ALLOC_PER_THREAD = 1,
+} tfs_alloc_mode_t;
+
+/**
+ * TécnicoFS storage latency models, which simulate the cost of accessing the
+ * FS state as if it were in secondary memory.
+ */
+typedef enum {
+    // Accesses cost nothing (production)
+    TFS_LATENCY_NONE = 0,
+    // Every access costs latency_ns
+    TFS_LATENCY_FIXED = 1,
+    // Each class of access (see tfs_access_class_t) has its own cost
+    TFS_LATENCY_DEVICE = 2,
+} tfs_latency_model_t;
+
+/**
+ * Classes of accesses to the FS state: to metadata (inodes, free maps) or to
+ * data blocks, either sequential (to the same block as the previous access of
+ * the thread to that kind of state, or to the next one) or random.
+ */
+typedef enum {
+    TFS_ACCESS_META_SEQ = 0,
+    TFS_ACCESS_META_RANDOM = 1,
+    TFS_ACCESS_DATA_SEQ = 2,
+    TFS_ACCESS_DATA_RANDOM = 3,
+    TFS_ACCESS_CLASSES = 4,
+} tfs_access_class_t;
 
 /**
  * TécnicoFS parameters.
@@ -13,13 +51,60 @@ typedef struct {
     size_t max_open_files_count;
 
     size_t block_size;
+
+    tfs_alloc_mode_t alloc_mode;
+    // Inodes/blocks moved between a thread's magazine and the free maps at a
+    // time (only with TFS_ALLOC_PER_THREAD)
+    size_t alloc_batch_size;
+
+    // Number of path names the dentry cache is sized for (0 disables it)
+    size_t dentry_cache_size;
+
+    // Backing file holding a formatted image (see tfs_mkfs), which is mapped
+    // into memory and keeps the FS across restarts; NULL keeps the FS in
+    // memory only. With an image, the geometry (inode count, block count and
+    // block size) is the one it was formatted with.
+    char const *image_path;
+
+    // Write-ahead journal of the image (see tfs_sync), which makes changes
+    // durable in batches (group commit) and lets a crashed FS be recovered to
+    // the last committed batch; NULL writes the image back only on
+    // tfs_destroy. Requires image_path.
+    char const *journal_path;
+    // A batch is committed every journal_commit_interval_us microseconds (0
+    // commits as soon as there are changes), or once journal_commit_bytes of
+    // the image changed, whichever comes first
+    size_t journal_commit_interval_us;
+    size_t journal_commit_bytes;
+
+    // Simulated storage latency (busy waiting)
+    tfs_latency_model_t latency_model;
+    // Cost of an access with TFS_LATENCY_FIXED, in nanoseconds
+    size_t latency_ns;
+    // Cost of each class of access with TFS_LATENCY_DEVICE, in nanoseconds
+    size_t latency_class_ns[TFS_ACCESS_CLASSES];
 } tfs_params;
 
+/**
+ * Storage accesses simulated since tecnicofs was initialized, per class of
+ * access, and the time stalled on them (in nanoseconds).
+ */
+typedef struct {
+    size_t accesses[TFS_ACCESS_CLASSES];
+    size_t stall_ns[TFS_ACCESS_CLASSES];
+} tfs_stall_stats;
+
 /**
  * Return a sane default set of parameters for tecnicofs.
  */
 tfs_params tfs_default_params();
 
+/**
+ * Return the smallest block size tecnicofs works with (a block must hold a
+ * directory entry); tfs_init and tfs_mkfs fail with a smaller one.
+ */
+size_t tfs_min_block_size();
+
 /**
  * Initialize tecnicofs, optionally with a given configuration.
  * Returns 0 if successful, -1 otherwise.
@@ -32,6 +117,41 @@ int tfs_init(tfs_params const *params);
  */
 int tfs_destroy();
 
+/**
+ * Format a backing file with an empty tecnicofs image (holding only the root
+ * directory), to be used through tfs_params.image_path. If
+ * params->journal_path is set, the journal is emptied.
+ *
+ * Input:
+ *   - path: path name of the backing file (in the OS' file system), which is
+ *    created, and overwritten if it already exists
+ *   - params: geometry of the FS (NULL for the default parameters)
+ *
+ * Returns 0 if successful, -1 otherwise (including if tecnicofs is in use).
+ */
+int tfs_mkfs(char const *path, tfs_params const *params);
+
+/**
+ * Wait until every change made before the call is committed to the journal
+ * (a no-op without a journal).
+ *
+ * Returns 0 if successful, -1 otherwise (a commit failed, so changes may be
+ * lost in a crash).
+ */
+int tfs_sync();
+
+/**
+ * Obtain the storage accesses simulated by the latency model so far (all zero
+ * with TFS_LATENCY_NONE).
+ */
+tfs_stall_stats tfs_get_stall_stats();
+
+/**
+ * Obtain the parameters tecnicofs was initialized with (with the geometry of
+ * its image, if it has one).
+ */
+tfs_params tfs_get_params();
+
 /**
  * TécnicoFS file opening modes.
  */
@@ -51,10 +171,21 @@ typedef enum {
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
  *
- * Returns file handle of the opened file if successful, -1 otherwise.
+ * Returns file handle of the opened file if successful, -1 otherwise (including
+ * if name is a directory).
  */
 int tfs_open(char const *name, tfs_file_mode_t mode);
 
+/**
+ * Create a directory.
+ *
+ * Input:
+ *   - name: absolute path name of the directory (its parent must exist)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mkdir(char const *name);
+
 /**
  * Create a symbolic link to a file.
  *
@@ -96,7 +227,8 @@ int tfs_close(int fhandle);
  *   - len: length of the buffer contents (in bytes)
  *
  * Returns the number of bytes that were written (can be lower than 'len' if the
- * maximum file size is exceeded), or -1 in case of error.
+ * maximum file size is exceeded or the FS runs out of data blocks), or -1 in
+ * case of error.
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
@@ -113,9 +245,128 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/**
+ * Write to an open file at a given offset, without using or changing the
+ * current offset (so the handle can be shared by concurrent writers).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: buffer containing the contents to write
+ *   - len: length of the buffer contents (in bytes)
+ *   - offset: offset in the file
+ *
+ * Returns the same as tfs_write.
+ */
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t len, size_t offset);
+
+/**
+ * Append to the end of an open file, atomically: concurrent appends (through
+ * any handles) each reserve their own range of the file, copy to it in
+ * parallel, and then commit it in the order they reserved it, so that readers
+ * only see whole appends. The file must only grow through appends (other
+ * writes may only overwrite what it holds).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: buffer containing the contents to write
+ *   - len: length of the buffer contents (in bytes)
+ *   - on_commit: function called with arg once the append is committed, before
+ *     the appends after it (NULL for none)
+ *
+ * Returns len if successful, -1 otherwise (including if the maximum file size
+ * is exceeded or the FS runs out of data blocks, in which case nothing is
+ * appended, nor is anything by the appends in progress after it).
+ */
+ssize_t tfs_append(int fhandle, void const *buffer, size_t len,
+                   void (*on_commit)(void *), void *arg);
+
+/**
+ * Read from an open file at a given offset, without using or changing the
+ * current offset (so each reader can keep its own cursor).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: destination buffer
+ *   - len: length of the buffer
+ *   - offset: offset in the file
+ *
+ * Returns the same as tfs_read (0 if the offset is at or beyond the end of the
+ * file).
+ */
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset);
+
+/**
+ * Write the contents of several buffers to an open file, in order, starting at
+ * the current offset, as a single write (no other write to the file is
+ * interleaved with it).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - iov: buffers to write
+ *   - iovcnt: number of buffers
+ *
+ * Returns the total number of bytes written (lower than the total length of
+ * the buffers if the file or the FS is full), or -1 in case of error.
+ */
+ssize_t tfs_writev(int fhandle, struct iovec const *iov, int iovcnt);
+
+/**
+ * Read from an open file into several buffers, filling each one in order,
+ * starting at the current offset, as a single read (no write to the file is
+ * interleaved with it).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - iov: destination buffers
+ *   - iovcnt: number of buffers
+ *
+ * Returns the total number of bytes read (lower than the total length of the
+ * buffers if the file size was reached), or -1 in case of error.
+ */
+ssize_t tfs_readv(int fhandle, struct iovec const *iov, int iovcnt);
+
+/**
+ * Read-only view of the contents of a file, in place (see tfs_read_view).
+ */
+typedef struct {
+    void const *data;
+    size_t len;
+    int block; // pinned block
+} tfs_view;
+
+/**
+ * Obtain a view of the contents of an open file from a given offset, without
+ * copying them (and without using or changing the current offset).
+ *
+ * The view covers the file from the offset to the end of the block it is in
+ * (or to the end of the file, or len bytes, if sooner). Its block stays
+ * pinned until the view is released: it is not reused even if the file is
+ * truncated or unlinked meanwhile, although its contents change if that part
+ * of the file is overwritten. Views must be released before tfs_destroy.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: offset in the file
+ *   - len: maximum length of the view
+ *   - view: view to fill
+ *
+ * Returns the length of the view (0, and no view to release, if the offset is
+ * at or beyond the end of the file), or -1 in case of error (including if the
+ * offset is in a gap left by a write past the end of the file).
+ */
+ssize_t tfs_read_view(int fhandle, size_t offset, size_t len, tfs_view *view);
+
+/**
+ * Release a view obtained with tfs_read_view.
+ *
+ * Input:
+ *   - view: view to release (its data can no longer be used)
+ */
+void tfs_release_view(tfs_view *view);
+
 /**
  * Delete a link, or a file if the number of hard links reaches 0, that
- * exists in TécnicoFS.
+ * exists in TécnicoFS. Directories are only deleted if they are empty.
  *
  * Input:
  *   - target: path name of the target (in TécnicoFS)
@@ -124,6 +375,42 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * Move a file (or directory, with everything below it) to another path name.
+ *
+ * Input:
+ *   - old_name: absolute path name of the file
+ *   - new_name: absolute path name to move it to, which must not exist (and
+ *    must not be below old_name)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_rename(char const *old_name, char const *new_name);
+
+/**
+ * Read the next entry of a directory.
+ *
+ * Input:
+ *   - name: absolute path name of the directory ("/" for the root)
+ *   - cursor: position in the directory, 0 to start from the first entry
+ *   - entry_name: where to store the name of the entry (MAX_FILE_NAME bytes)
+ *
+ * Returns 1 if an entry was read (and cursor advanced), 0 if there are no more
+ * entries, or -1 in case of error.
+ */
+int tfs_readdir(char const *name, size_t *cursor, char *entry_name);
+
+/**
+ * Obtain the size of a file.
+ *
+ * Input:
+ *   - name: absolute path name of the file
+ *
+ * Returns the size (in bytes) if successful, -1 otherwise (including if name is
+ * a directory).
+ */
+ssize_t tfs_file_size(char const *name);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -1,10 +1,17 @@
 #include "state.h"
 #include "betterassert.h"
+#include "journal.h"
+#include "latency.h"
+#include "table.h"
 
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 /*
@@ -14,23 +21,118 @@
  */
 static tfs_params fs_params;
 
+// The persistent state lives in a single region (an image), which is either
+// allocated in memory or mapped from a backing file:
+//   superblock | inode table | inode free map | block bitmap | data blocks
+#define IMAGE_MAGIC UINT64_C(0x3145474D49534654) // "TFSIMGE1"
+#define IMAGE_VERSION (1)
+#define IMAGE_ALIGNMENT (4096) // of the data blocks (a page)
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t image_size;
+
+    uint64_t inode_count;
+    uint64_t block_count;
+    uint64_t block_size;
+
+    // Offsets from the start of the image
+    uint64_t inode_table_offset;
+    uint64_t free_inodes_offset;
+    uint64_t free_blocks_offset;
+    uint64_t data_offset;
+
+    uint64_t free_block_count;
+} superblock_t;
+
+static char *image;           // NULL if not initialized
+static int image_fd = -1;     // backing file, -1 if the image is in memory
+static superblock_t *superblock;
+
 // Inode table
 static inode_t *inode_table;
 pthread_rwlock_t *inode_rwlocks;
+inode_appends_t *inode_appends;
 static allocation_state_t *freeinode_ts;
+static size_t freeinode_ts_hint; // entry where the next search starts
 pthread_mutex_t freeinode_ts_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
+static char *fs_data;           // # blocks * block size
+static uint64_t *free_blocks;   // bitmap, a set bit means the block is taken
+static size_t free_blocks_hint; // word where the next search starts
 pthread_mutex_t free_blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Directory indexes: for each directory inode, a hash table from the name of
+// each entry to its slot in the directory blocks, and a stack of free slots.
+// The table is split in shards (chosen by name hash), each with its own lock,
+// so that operations on unrelated names do not contend.
+#define DIR_INDEX_SHARDS (16)
+
+typedef struct dir_index_entry {
+    char name[MAX_FILE_NAME];
+    int inumber;
+    size_t slot;
+    struct dir_index_entry *next;
+} dir_index_entry_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    dir_index_entry_t **buckets;
+    size_t n_buckets; // power of two
+    size_t n_entries;
+} dir_index_shard_t;
+
+typedef struct {
+    dir_index_shard_t shards[DIR_INDEX_SHARDS];
+    pthread_mutex_t slots_lock; // free slots and growth of the directory
+    size_t *free_slots;         // lowest free slot on top
+    size_t n_free_slots;
+    size_t n_slots; // capacity of free_slots
+} dir_index_t;
+
+static dir_index_t **dir_indexes; // by inumber, NULL if not (yet) indexed
+static pthread_mutex_t dir_indexes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Block pins (volatile): the number of views of each data block (see
+ * data_block_pin), and whether freeing the block was deferred until they are
+ * released
+ */
+#define BLOCK_FREE_DEFERRED (UINT32_C(1) << 31)
+static uint32_t *block_pins;
+
+/*
+ * Per-thread allocation pools (only used with TFS_ALLOC_PER_THREAD)
+ */
+typedef enum { MAGAZINE_INODES = 0, MAGAZINE_BLOCKS = 1 } magazine_kind_t;
+#define MAGAZINE_KINDS (2)
+
+typedef struct alloc_magazine {
+    pthread_mutex_t lock; // only contended when another thread steals
+    int *items[MAGAZINE_KINDS];
+    size_t count[MAGAZINE_KINDS];
+    struct alloc_magazine *prev, *next;
+} alloc_magazine_t;
+
+static pthread_key_t magazine_key;  // drains a magazine on exit
+static alloc_magazine_t *magazines; // every thread's magazine
+static pthread_mutex_t magazines_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long state_generation; // incremented by state_init
+static _Thread_local alloc_magazine_t *thread_magazine;
+static _Thread_local unsigned long thread_magazine_generation;
+
 /*
  * Volatile FS state
  */
-static open_file_entry_t *open_file_table;
-pthread_mutex_t *open_file_entry_mutex;
-static allocation_state_t *free_open_file_entries;
+typedef struct {
+    open_file_entry_t entry;
+    allocation_state_t state;
+} open_file_slot_t;
+
+// Grows as files are opened, up to max_open_files_count entries
+static table_t open_file_table;
 pthread_mutex_t free_open_file_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Convenience macros
@@ -38,7 +140,14 @@ pthread_mutex_t free_open_file_entries_mutex = PTHREAD_MUTEX_INITIALIZER;
 #define DATA_BLOCKS (fs_params.max_block_count)
 #define MAX_OPEN_FILES (fs_params.max_open_files_count)
 #define BLOCK_SIZE (fs_params.block_size)
+#define ALLOC_MODE (fs_params.alloc_mode)
+#define ALLOC_BATCH (fs_params.alloc_batch_size)
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
+#define BLOCK_MAP_ENTRIES (BLOCK_SIZE / sizeof(int))
+#define BITMAP_WORD_BITS (64)
+#define FREE_BLOCKS_WORDS                                                      \
+    ((DATA_BLOCKS + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+#define BITMAP_WORDS_PER_BLOCK (BLOCK_SIZE / sizeof(uint64_t))
 
 static inline bool valid_inumber(int inumber) {
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
@@ -49,40 +158,717 @@ static inline bool valid_block_number(int block_number) {
 }
 
 static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+    return file_handle >= 0 &&
+           (size_t)file_handle < table_size(&open_file_table);
+}
+
+static inline open_file_slot_t *open_file_slot(int file_handle) {
+    return table_at(&open_file_table, (size_t)file_handle);
+}
+
+static int open_file_slot_init(void *slot) {
+    open_file_entry_t *entry = &((open_file_slot_t *)slot)->entry;
+    return pthread_mutex_init(&entry->of_mutex, NULL) == 0 ? 0 : -1;
+}
+
+static void open_file_slot_fini(void *slot) {
+    pthread_mutex_destroy(&((open_file_slot_t *)slot)->entry.of_mutex);
 }
 
 size_t state_block_size(void) { return BLOCK_SIZE; }
 
+size_t state_max_file_size(void) {
+    return (INODE_DIRECT_BLOCKS + BLOCK_MAP_ENTRIES +
+            BLOCK_MAP_ENTRIES * BLOCK_MAP_ENTRIES) *
+           BLOCK_SIZE;
+}
+
+/**
+ * Simulate the latency of an access to the FS state (see latency.h).
+ *
+ * Input:
+ *   - kind: LATENCY_META or LATENCY_DATA
+ *   - ptr: location accessed, in the image
+ */
+static inline void storage_access(int kind, void const *ptr) {
+    latency_access(kind, (size_t)((char const *)ptr - image) / BLOCK_SIZE);
+}
+
+/**
+ * Obtain a pointer to the contents of a block that holds metadata (directory
+ * entries or a block map); unlike data_block_get, the access is simulated as
+ * an access to metadata.
+ */
+static void *metadata_block_get(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "metadata_block_get: invalid block number");
+
+    void *block = &fs_data[(size_t)block_number * BLOCK_SIZE];
+    storage_access(LATENCY_META, block);
+    return block;
+}
+
+static size_t inode_pool_take(int *inumbers, size_t n);
+static void inode_pool_put(int const *inumbers, size_t n);
+static size_t block_pool_take(int *blocks, size_t n);
+static void block_pool_put(int const *blocks, size_t n);
+
+// Global pool of each kind of magazine item
+static size_t (*const pool_take[MAGAZINE_KINDS])(int *, size_t) = {
+    [MAGAZINE_INODES] = inode_pool_take,
+    [MAGAZINE_BLOCKS] = block_pool_take,
+};
+static void (*const pool_put[MAGAZINE_KINDS])(int const *, size_t) = {
+    [MAGAZINE_INODES] = inode_pool_put,
+    [MAGAZINE_BLOCKS] = block_pool_put,
+};
+
+/**
+ * Return every item of a magazine to the global pools and release it.
+ *
+ * Called by the magazine_key destructor when a thread exits.
+ *
+ * Input:
+ *   - arg: the magazine
+ */
+static void magazine_release(void *arg) {
+    alloc_magazine_t *magazine = (alloc_magazine_t *)arg;
+
+    pthread_mutex_lock(&magazines_mutex);
+    if (magazine->prev != NULL) {
+        magazine->prev->next = magazine->next;
+    } else {
+        magazines = magazine->next;
+    }
+    if (magazine->next != NULL) {
+        magazine->next->prev = magazine->prev;
+    }
+    pthread_mutex_unlock(&magazines_mutex);
+
+    // Changes the free maps, like any operation
+    journal_op_begin();
+    for (int kind = 0; kind < MAGAZINE_KINDS; kind++) {
+        pool_put[kind](magazine->items[kind], magazine->count[kind]);
+        free(magazine->items[kind]);
+    }
+    journal_op_end();
+    pthread_mutex_destroy(&magazine->lock);
+    free(magazine);
+}
+
+/**
+ * Obtain the calling thread's magazine, creating it if needed.
+ *
+ * Each magazine holds up to 2 * ALLOC_BATCH items of each kind.
+ *
+ * Returns the magazine, or NULL if it could not be created.
+ */
+static alloc_magazine_t *magazine_get(void) {
+    if (thread_magazine != NULL &&
+        thread_magazine_generation == state_generation) {
+        return thread_magazine;
+    }
+
+    alloc_magazine_t *magazine = malloc(sizeof(alloc_magazine_t));
+    if (magazine == NULL) {
+        return NULL;
+    }
+
+    for (int kind = 0; kind < MAGAZINE_KINDS; kind++) {
+        magazine->items[kind] = malloc(2 * ALLOC_BATCH * sizeof(int));
+        magazine->count[kind] = 0;
+    }
+    if (!magazine->items[MAGAZINE_INODES] ||
+        !magazine->items[MAGAZINE_BLOCKS]) {
+        free(magazine->items[MAGAZINE_INODES]);
+        free(magazine->items[MAGAZINE_BLOCKS]);
+        free(magazine);
+        return NULL;
+    }
+    pthread_mutex_init(&magazine->lock, NULL);
+
+    pthread_mutex_lock(&magazines_mutex);
+    magazine->prev = NULL;
+    magazine->next = magazines;
+    if (magazines != NULL) {
+        magazines->prev = magazine;
+    }
+    magazines = magazine;
+    pthread_mutex_unlock(&magazines_mutex);
+
+    pthread_setspecific(magazine_key, magazine);
+    thread_magazine = magazine;
+    thread_magazine_generation = state_generation;
+
+    return magazine;
+}
+
+/**
+ * Take an item from another thread's magazine, for when the global pool is
+ * exhausted.
+ *
+ * Input:
+ *   - self: the calling thread's magazine
+ *   - kind: kind of item to take
+ *
+ * Returns the item, or -1 if no magazine holds one.
+ */
+static int magazine_steal(alloc_magazine_t *self, magazine_kind_t kind) {
+    int item = -1;
+
+    pthread_mutex_lock(&magazines_mutex);
+    for (alloc_magazine_t *m = magazines; m != NULL && item == -1;
+         m = m->next) {
+        if (m == self) {
+            continue;
+        }
+
+        pthread_mutex_lock(&m->lock);
+        if (m->count[kind] > 0) {
+            item = m->items[kind][--m->count[kind]];
+        }
+        pthread_mutex_unlock(&m->lock);
+    }
+    pthread_mutex_unlock(&magazines_mutex);
+
+    return item;
+}
+
+/**
+ * Allocate an item from the calling thread's magazine, refilling it from the
+ * global pool with a batch of ALLOC_BATCH items when it is empty.
+ *
+ * Input:
+ *   - magazine: the calling thread's magazine
+ *   - kind: kind of item to allocate
+ *
+ * Returns the item, or -1 if there are no free items left.
+ */
+static int magazine_alloc(alloc_magazine_t *magazine, magazine_kind_t kind) {
+    int *items = magazine->items[kind];
+
+    pthread_mutex_lock(&magazine->lock);
+
+    if (magazine->count[kind] == 0) {
+        size_t n = pool_take[kind](items, ALLOC_BATCH);
+
+        // Reverses the batch, so that the lowest numbers are handed out first
+        for (size_t i = 0; i < n / 2; i++) {
+            int tmp = items[i];
+            items[i] = items[n - 1 - i];
+            items[n - 1 - i] = tmp;
+        }
+        magazine->count[kind] = n;
+    }
+
+    if (magazine->count[kind] == 0) {
+        pthread_mutex_unlock(&magazine->lock);
+        return magazine_steal(magazine, kind);
+    }
+
+    int item = items[--magazine->count[kind]];
+
+    pthread_mutex_unlock(&magazine->lock);
+
+    return item;
+}
+
+/**
+ * Free an item into the calling thread's magazine, returning a batch of
+ * ALLOC_BATCH items to the global pool when it is full.
+ *
+ * Input:
+ *   - magazine: the calling thread's magazine
+ *   - kind: kind of item to free
+ *   - item: the item
+ */
+static void magazine_free(alloc_magazine_t *magazine, magazine_kind_t kind,
+                          int item) {
+    pthread_mutex_lock(&magazine->lock);
+
+    magazine->items[kind][magazine->count[kind]++] = item;
+    if (magazine->count[kind] == 2 * ALLOC_BATCH) {
+        magazine->count[kind] -= ALLOC_BATCH;
+        pool_put[kind](magazine->items[kind] + magazine->count[kind],
+                       ALLOC_BATCH);
+    }
+
+    pthread_mutex_unlock(&magazine->lock);
+}
+
+/**
+ * Hash a file name (FNV-1a).
+ */
+static uint64_t dir_name_hash(char const *name) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < MAX_FILE_NAME && name[i] != '\0'; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/**
+ * Obtain the shard of a directory index responsible for a name hash.
+ */
+static inline dir_index_shard_t *dir_index_shard(dir_index_t *index,
+                                                 uint64_t hash) {
+    // The top bits pick the shard, the bottom ones the bucket inside it
+    return &index->shards[hash >> 60 & (DIR_INDEX_SHARDS - 1)];
+}
+
+/**
+ * Find the link (bucket head or next field) that points to the entry with a
+ * given name in a directory index shard.
+ *
+ * Input:
+ *   - shard: directory index shard
+ *   - hash: hash of the name
+ *   - name: entry name
+ *
+ * Returns a pointer to the link, which points to NULL if there is no entry with
+ * that name.
+ */
+static dir_index_entry_t **dir_index_find(dir_index_shard_t *shard,
+                                          uint64_t hash, char const *name) {
+    size_t bucket = hash & (shard->n_buckets - 1);
+
+    dir_index_entry_t **link = &shard->buckets[bucket];
+    while (*link != NULL && strncmp((*link)->name, name, MAX_FILE_NAME) != 0) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+/**
+ * Double the number of buckets of a directory index shard.
+ *
+ * Input:
+ *   - shard: directory index shard
+ *
+ * Returns 0 if successful, -1 otherwise (the shard is left untouched).
+ */
+static int dir_index_grow(dir_index_shard_t *shard) {
+    size_t n_buckets = 2 * shard->n_buckets;
+    dir_index_entry_t **buckets =
+        calloc(n_buckets, sizeof(dir_index_entry_t *));
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shard->n_buckets; i++) {
+        dir_index_entry_t *entry = shard->buckets[i];
+        while (entry != NULL) {
+            dir_index_entry_t *next = entry->next;
+            size_t bucket = dir_name_hash(entry->name) & (n_buckets - 1);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->n_buckets = n_buckets;
+
+    return 0;
+}
+
+/**
+ * Insert an entry in a directory index shard.
+ *
+ * Input:
+ *   - shard: directory index shard
+ *   - hash: hash of the name
+ *   - name: entry name
+ *   - inumber: inumber of the entry
+ *   - slot: slot of the entry in the directory blocks
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int dir_index_insert(dir_index_shard_t *shard, uint64_t hash,
+                            char const *name, int inumber, size_t slot) {
+    dir_index_entry_t *entry = malloc(sizeof(dir_index_entry_t));
+    if (entry == NULL) {
+        return -1;
+    }
+
+    strncpy(entry->name, name, MAX_FILE_NAME - 1);
+    entry->name[MAX_FILE_NAME - 1] = '\0';
+    entry->inumber = inumber;
+    entry->slot = slot;
+
+    // Keeps chains short; if growing fails, the chains just get longer
+    if (shard->n_entries >= shard->n_buckets) {
+        dir_index_grow(shard);
+    }
+
+    size_t bucket = hash & (shard->n_buckets - 1);
+    entry->next = shard->buckets[bucket];
+    shard->buckets[bucket] = entry;
+    shard->n_entries++;
+
+    return 0;
+}
+
+/**
+ * Add a range of new (empty) slots to the free slots of a directory index.
+ *
+ * Input:
+ *   - index: directory index
+ *   - first: first slot
+ *   - n: number of slots
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int dir_index_add_slots(dir_index_t *index, size_t first, size_t n) {
+    size_t *free_slots =
+        realloc(index->free_slots, (index->n_slots + n) * sizeof(size_t));
+    if (free_slots == NULL) {
+        return -1;
+    }
+    index->free_slots = free_slots;
+    index->n_slots += n;
+
+    // Pushed in reverse, so that the lowest slot is used first
+    for (size_t i = n; i > 0; i--) {
+        index->free_slots[index->n_free_slots++] = first + i - 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Release the index of a directory, if it has one.
+ *
+ * Input:
+ *   - inumber: inumber of the directory
+ */
+static void dir_index_free(int inumber) {
+    dir_index_t *index = dir_indexes[inumber];
+    if (index == NULL) {
+        return;
+    }
+
+    for (size_t s = 0; s < DIR_INDEX_SHARDS; s++) {
+        dir_index_shard_t *shard = &index->shards[s];
+
+        for (size_t i = 0; i < shard->n_buckets; i++) {
+            dir_index_entry_t *entry = shard->buckets[i];
+            while (entry != NULL) {
+                dir_index_entry_t *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+
+        free(shard->buckets);
+        pthread_rwlock_destroy(&shard->lock);
+    }
+
+    pthread_mutex_destroy(&index->slots_lock);
+    free(index->free_slots);
+    free(index);
+    dir_indexes[inumber] = NULL;
+}
+
 /**
- * Do nothing, while preventing the compiler from performing any optimizations.
+ * Obtain a pointer to the directory entry in a given slot.
  *
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
+ * Input:
+ *   - inode: directory inode
+ *   - slot: slot of the entry in the directory blocks
  *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
+ * Returns pointer to the entry.
+ */
+static dir_entry_t *dir_slot_get(inode_t const *inode, size_t slot) {
+    int b = inode_block_get(inode, slot / MAX_DIR_ENTRIES);
+    ALWAYS_ASSERT(b != -1, "dir_slot_get: directory block missing");
+
+    dir_entry_t *dir_entry = (dir_entry_t *)metadata_block_get(b);
+    return &dir_entry[slot % MAX_DIR_ENTRIES];
+}
+
+/**
+ * Build the index of a directory from the entries in its blocks.
  *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ * Input:
+ *   - inumber: inumber of the directory
  *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
+ * Returns 0 if successful, -1 otherwise.
  */
-static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
+static int dir_index_build(int inumber) {
+    inode_t const *inode = &inode_table[inumber];
+
+    dir_index_t *index = calloc(1, sizeof(dir_index_t));
+    if (index == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_init(&index->slots_lock, NULL);
+    for (size_t s = 0; s < DIR_INDEX_SHARDS; s++) {
+        dir_index_shard_t *shard = &index->shards[s];
+
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->n_buckets = 4;
+        shard->buckets = calloc(shard->n_buckets, sizeof(dir_index_entry_t *));
+        if (shard->buckets == NULL) {
+            dir_indexes[inumber] = index;
+            dir_index_free(inumber);
+            return -1;
+        }
+    }
+
+    size_t n_slots = inode->i_size / BLOCK_SIZE * MAX_DIR_ENTRIES;
+    index->free_slots = malloc(n_slots * sizeof(size_t));
+    if (n_slots > 0 && index->free_slots == NULL) {
+        dir_indexes[inumber] = index;
+        dir_index_free(inumber);
+        return -1;
+    }
+    index->n_slots = n_slots;
+
+    // Scans backwards, so that the lowest free slot ends up on top
+    for (size_t slot = n_slots; slot > 0; slot--) {
+        dir_entry_t const *dir_entry = dir_slot_get(inode, slot - 1);
+
+        if (dir_entry->d_inumber == -1) {
+            index->free_slots[index->n_free_slots++] = slot - 1;
+        } else {
+            uint64_t hash = dir_name_hash(dir_entry->d_name);
+            if (dir_index_insert(dir_index_shard(index, hash), hash,
+                                 dir_entry->d_name, dir_entry->d_inumber,
+                                 slot - 1) == -1) {
+                dir_indexes[inumber] = index;
+                dir_index_free(inumber);
+                return -1;
+            }
+        }
+    }
+
+    // Only published once complete (see dir_index_get)
+    __atomic_store_n(&dir_indexes[inumber], index, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * Obtain the index of a directory, building it on first use.
+ *
+ * Directories in an image mapped from a backing file are only indexed when
+ * they are first accessed, so that attaching to an image takes constant time.
+ *
+ * Input:
+ *   - inode: directory inode
+ *
+ * Returns the index, or NULL if it could not be built.
+ */
+static dir_index_t *dir_index_get(inode_t const *inode) {
+    int inumber = (int)(inode - inode_table);
+
+    dir_index_t *index =
+        __atomic_load_n(&dir_indexes[inumber], __ATOMIC_ACQUIRE);
+    if (index == NULL) {
+        pthread_mutex_lock(&dir_indexes_mutex);
+        if (dir_indexes[inumber] == NULL) {
+            dir_index_build(inumber);
+        }
+        index = dir_indexes[inumber];
+        pthread_mutex_unlock(&dir_indexes_mutex);
+    }
+
+    return index;
+}
+
+/**
+ * Compute the layout of an image for the geometry in fs_params.
+ *
+ * Input:
+ *   - sb: superblock to fill (every field but free_block_count)
+ */
+static void image_layout(superblock_t *sb) {
+    size_t offset = sizeof(superblock_t);
+
+    sb->magic = IMAGE_MAGIC;
+    sb->version = IMAGE_VERSION;
+    sb->inode_count = INODE_TABLE_SIZE;
+    sb->block_count = DATA_BLOCKS;
+    sb->block_size = BLOCK_SIZE;
+
+    sb->inode_table_offset = offset;
+    offset += INODE_TABLE_SIZE * sizeof(inode_t);
+
+    sb->free_inodes_offset = offset;
+    offset += INODE_TABLE_SIZE * sizeof(allocation_state_t);
+
+    offset = (offset + sizeof(uint64_t) - 1) / sizeof(uint64_t) *
+             sizeof(uint64_t);
+    sb->free_blocks_offset = offset;
+    offset += FREE_BLOCKS_WORDS * sizeof(uint64_t);
+
+    offset = (offset + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    sb->data_offset = offset;
+    offset += DATA_BLOCKS * BLOCK_SIZE;
+
+    sb->image_size = offset;
+}
+
+/**
+ * Point the persistent state variables to their place in the image.
+ */
+static void image_attach(void) {
+    superblock = (superblock_t *)image;
+    inode_table = (inode_t *)(image + superblock->inode_table_offset);
+    freeinode_ts =
+        (allocation_state_t *)(image + superblock->free_inodes_offset);
+    free_blocks = (uint64_t *)(image + superblock->free_blocks_offset);
+    fs_data = image + superblock->data_offset;
+}
+
+/**
+ * Format the image: every inode and data block is free.
+ *
+ * The data blocks and the inode table are left as they are.
+ */
+static void image_format(void) {
+    image_layout(superblock);
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        freeinode_ts[i] = FREE;
+    }
+
+    for (size_t i = 0; i < FREE_BLOCKS_WORDS; i++) {
+        free_blocks[i] = 0;
+    }
+    // The bits past the last block are never free
+    if (DATA_BLOCKS % BITMAP_WORD_BITS != 0) {
+        free_blocks[FREE_BLOCKS_WORDS - 1] =
+            ~((UINT64_C(1) << (DATA_BLOCKS % BITMAP_WORD_BITS)) - 1);
+    }
+    superblock->free_block_count = DATA_BLOCKS;
+}
+
+/**
+ * Map the image in a backing file.
+ *
+ * The geometry of the FS (inode count, block count and block size) is taken
+ * from the superblock of the image, replacing the one in fs_params.
+ *
+ * Input:
+ *   - path: path of the backing file (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * If the image is journaled, it is first recovered from the journal, and then
+ * mapped privately (changes reach the file through the journal only).
+ *
+ * Possible errors:
+ *   - The file cannot be opened or mapped.
+ *   - The file is not a formatted image (see state_format).
+ *   - The journal cannot be opened or replayed.
+ */
+static int image_map(char const *path) {
+    image_fd = open(path, O_RDWR);
+    if (image_fd == -1) {
+        return -1;
+    }
+
+    superblock_t sb;
+    struct stat st;
+    if (pread(image_fd, &sb, sizeof(sb), 0) != sizeof(sb) ||
+        sb.magic != IMAGE_MAGIC || sb.version != IMAGE_VERSION ||
+        fstat(image_fd, &st) == -1 || (uint64_t)st.st_size != sb.image_size) {
+        close(image_fd);
+        image_fd = -1;
+        return -1; // not an image
+    }
+
+    int flags = MAP_SHARED;
+    if (fs_params.journal_path != NULL) {
+        if (journal_recover(fs_params.journal_path, image_fd, sb.image_size) ==
+            -1) {
+            close(image_fd);
+            image_fd = -1;
+            return -1;
+        }
+        flags = MAP_PRIVATE;
+    }
+
+    void *mapped =
+        mmap(NULL, sb.image_size, PROT_READ | PROT_WRITE, flags, image_fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(image_fd);
+        image_fd = -1;
+        return -1;
+    }
+
+    image = mapped;
+    fs_params.max_inode_count = sb.inode_count;
+    fs_params.max_block_count = sb.block_count;
+    fs_params.block_size = sb.block_size;
+
+    return 0;
+}
 
 /**
- * Artifically delay execution (busy loop).
+ * Create a formatted (empty) image in a backing file.
  *
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
+ * Input:
+ *   - path: path of the backing file (in the OS' file system), which is
+ *     created, or overwritten if it exists
+ *   - params: TécnicoFS parameters (only the geometry is used)
+ *
+ * Returns 0 if successful, -1 otherwise.
  */
-static void insert_delay(void) {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
+int state_format(char const *path, tfs_params params) {
+    if (image != NULL) {
+        return -1; // the state variables are in use
     }
+    if (params.block_size < tfs_min_block_size()) {
+        return -1; // a block must hold a directory entry
+    }
+
+    fs_params = params;
+
+    superblock_t sb;
+    image_layout(&sb);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // The file starts out sparse; only the metadata gets written
+    if (ftruncate(fd, (off_t)sb.image_size) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    void *mapped = mmap(NULL, sb.image_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    image = mapped;
+    *(superblock_t *)image = sb;
+    image_attach();
+    image_format();
+
+    int ret = msync(image, sb.data_offset, MS_SYNC);
+    munmap(image, sb.image_size);
+    close(fd);
+
+    image = NULL;
+    superblock = NULL;
+    inode_table = NULL;
+    freeinode_ts = NULL;
+    free_blocks = NULL;
+    fs_data = NULL;
+
+    return ret;
 }
 
 /**
@@ -96,80 +882,217 @@ static void insert_delay(void) {
  * Possible errors:
  *   - TFS already initialized.
  *   - malloc failure when allocating TFS structures.
+ *   - params.image_path is set, but is not a formatted image.
  */
 int state_init(tfs_params params) {
+    if (image != NULL) {
+        return -1; // already initialized
+    }
+
+    if (params.image_path == NULL &&
+        params.block_size < tfs_min_block_size()) {
+        return -1; // a block must hold a directory entry
+    }
+
     fs_params = params;
 
-    if (inode_table != NULL) {
-        return -1; // already initialized
+    if (params.image_path != NULL) {
+        // Reattaches to the persistent state, as it was left
+        if (image_map(params.image_path) == -1) {
+            return -1;
+        }
+        image_attach();
+
+        if (params.journal_path != NULL &&
+            journal_start(image, superblock->image_size,
+                          params.journal_commit_interval_us,
+                          params.journal_commit_bytes) == -1) {
+            return -1;
+        }
+    } else {
+        superblock_t sb;
+        image_layout(&sb);
+
+        image = malloc(sb.image_size);
+        if (image == NULL) {
+            return -1; // allocation failed
+        }
+        *(superblock_t *)image = sb;
+        image_attach();
+        image_format();
     }
 
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
+    // The remaining state is volatile, and rebuilt lazily (directory indexes)
     inode_rwlocks = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    open_file_entry_mutex = malloc(MAX_OPEN_FILES * sizeof(pthread_mutex_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
-
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !inode_rwlocks || !open_file_entry_mutex || !open_file_table ||
-        !free_open_file_entries) {
+    inode_appends = malloc(INODE_TABLE_SIZE * sizeof(inode_appends_t));
+    dir_indexes = calloc(INODE_TABLE_SIZE, sizeof(dir_index_t *));
+    block_pins = calloc(DATA_BLOCKS, sizeof(uint32_t));
+
+    if (!inode_rwlocks || !inode_appends || !dir_indexes || !block_pins ||
+        table_init(&open_file_table, sizeof(open_file_slot_t), MAX_OPEN_FILES,
+                   open_file_slot_init) != 0) {
         return -1; // allocation failed
     }
 
     for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
         pthread_rwlock_init(&inode_rwlocks[i], NULL);
-        freeinode_ts[i] = FREE;
-    }
-
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+        pthread_mutex_init(&inode_appends[i].mutex, NULL);
+        pthread_cond_init(&inode_appends[i].turn, NULL);
+        atomic_init(&inode_appends[i].generation, 0);
+        inode_appends[i].waiters = 0;
+        // Appends to the files of an image start at their end
+        inode_appends_reset((int)i, inode_table[i].i_size);
     }
+    freeinode_ts_hint = 0;
+    free_blocks_hint = 0;
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        pthread_mutex_init(&open_file_entry_mutex[i], NULL);
-        free_open_file_entries[i] = FREE;
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        if (ALLOC_BATCH == 0 ||
+            pthread_key_create(&magazine_key, magazine_release) != 0) {
+            return -1;
+        }
+        // Magazines of a previous initialization are no longer valid
+        state_generation++;
     }
 
     return 0;
 }
 
+/**
+ * Check whether the FS is empty (no inodes, not even the root directory), as
+ * after being formatted.
+ */
+bool state_is_empty(void) { return freeinode_ts[ROOT_DIR_INUM] == FREE; }
+
+/**
+ * Obtain the parameters in use (with the geometry of the image, if it was
+ * mapped from a backing file).
+ */
+tfs_params state_params(void) { return fs_params; }
+
 /**
  * Destroy FS state.
  *
+ * If the image is in a backing file, it is written back to it (or, if it is
+ * journaled, the journal is committed and checkpointed).
+ *
  * Returns 0 if succesful, -1 otherwise.
  */
 int state_destroy(void) {
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        // The items in the magazines go back to the free maps, which may
+        // outlive this process
+        pthread_key_delete(magazine_key);
+        journal_op_begin();
+        while (magazines != NULL) {
+            alloc_magazine_t *next = magazines->next;
+            for (int kind = 0; kind < MAGAZINE_KINDS; kind++) {
+                pool_put[kind](magazines->items[kind], magazines->count[kind]);
+                free(magazines->items[kind]);
+            }
+            pthread_mutex_destroy(&magazines->lock);
+            free(magazines);
+            magazines = next;
+        }
+        journal_op_end();
+    }
+
+    int ret = 0;
+    if (image_fd != -1) {
+        // A journaled image is written back by its last checkpoint
+        if (fs_params.journal_path != NULL) {
+            ret = journal_stop();
+        } else if (msync(image, superblock->image_size, MS_SYNC) == -1) {
+            ret = -1;
+        }
+        munmap(image, superblock->image_size);
+        close(image_fd);
+        image_fd = -1;
+    } else {
+        free(image);
+    }
+
+    table_destroy(&open_file_table, open_file_slot_fini);
 
     for (int i = 0; i < INODE_TABLE_SIZE; i++) {
         pthread_rwlock_destroy(&inode_rwlocks[i]);
+        pthread_mutex_destroy(&inode_appends[i].mutex);
+        pthread_cond_destroy(&inode_appends[i].turn);
+        dir_index_free(i);
     }
     free(inode_rwlocks);
+    free(inode_appends);
+    free(dir_indexes);
+    free(block_pins);
+
+    image = NULL;
+    superblock = NULL;
+    inode_table = NULL;
+    inode_rwlocks = NULL;
+    inode_appends = NULL;
+    freeinode_ts = NULL;
+    fs_data = NULL;
+    free_blocks = NULL;
+    dir_indexes = NULL;
+    block_pins = NULL;
 
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        pthread_mutex_destroy(&open_file_entry_mutex[i]);
+    return ret;
+}
+
+/**
+ * Take free inodes from the global inode table.
+ *
+ * The table is scanned starting where the previous allocation left off
+ * (next-fit), so that filling a large table is not quadratic.
+ *
+ * Input:
+ *   - inumbers: where to store the inumbers of the inodes taken
+ *   - n: maximum number of inodes to take
+ *
+ * Returns the number of inodes taken (lower than n if the table fills up).
+ */
+static size_t inode_pool_take(int *inumbers, size_t n) {
+    size_t taken = 0;
+
+    pthread_mutex_lock(&freeinode_ts_mutex);
+
+    size_t inumber = freeinode_ts_hint;
+    storage_access(LATENCY_META, &freeinode_ts[inumber]);
+    for (size_t i = 0; i < INODE_TABLE_SIZE && taken < n; i++) {
+        // Finds the next free entries in inode table
+        if (freeinode_ts[inumber] == FREE) {
+            //  Found a free entry, so takes it for a new inode
+            freeinode_ts[inumber] = TAKEN;
+            journal_dirty(&freeinode_ts[inumber], sizeof(allocation_state_t));
+            inumbers[taken++] = (int)inumber;
+        }
+
+        inumber = (inumber + 1) % INODE_TABLE_SIZE;
+        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
+            storage_access(LATENCY_META, &freeinode_ts[inumber]);
+        }
     }
-    free(open_file_entry_mutex);
+    freeinode_ts_hint = inumber;
+
+    pthread_mutex_unlock(&freeinode_ts_mutex);
 
-    inode_table = NULL;
-    inode_rwlocks = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    open_file_entry_mutex = NULL;
-    free_open_file_entries = NULL;
+    return taken;
+}
 
-    return 0;
+/**
+ * Return inodes to the global inode table.
+ *
+ * Input:
+ *   - inumbers: inumbers of the inodes
+ *   - n: number of inodes
+ */
+static void inode_pool_put(int const *inumbers, size_t n) {
+    pthread_mutex_lock(&freeinode_ts_mutex);
+    for (size_t i = 0; i < n; i++) {
+        freeinode_ts[inumbers[i]] = FREE;
+        journal_dirty(&freeinode_ts[inumbers[i]], sizeof(allocation_state_t));
+    }
+    pthread_mutex_unlock(&freeinode_ts_mutex);
 }
 
 /**
@@ -182,36 +1105,28 @@ int state_destroy(void) {
  *   - No free slots in inode table.
  */
 static int inode_alloc(void) {
-    pthread_mutex_lock(&freeinode_ts_mutex);
-
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        alloc_magazine_t *magazine = magazine_get();
+        if (magazine != NULL) {
+            return magazine_alloc(magazine, MAGAZINE_INODES);
         }
+    }
 
-        // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
-
-            pthread_mutex_unlock(&freeinode_ts_mutex);
-
-            return (int)inumber;
-        }
+    int inumber;
+    if (inode_pool_take(&inumber, 1) == 0) {
+        return -1; // no free inodes
     }
 
-    pthread_mutex_unlock(&freeinode_ts_mutex);
-    // no free inodes
-    return -1;
+    return inumber;
 }
 
 /**
  * Create a new inode in the inode table.
  *
  * Allocates and initializes a new inode.
- * Directories will have their data block allocated and initialized, with i_size
- * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
+ * Directories will have their first data block allocated and initialized, with
+ * i_size set to BLOCK_SIZE. Regular files will not have any data block
+ * allocated (i_size will be set to 0, with every block map entry set to -1).
  *
  * Input:
  *   - i_type: the type of the node (file or directory)
@@ -229,20 +1144,27 @@ int inode_create(inode_type i_type) {
     }
 
     inode_t *inode = &inode_table[inumber];
-    insert_delay(); // simulate storage access delay (to inode)
+    storage_access(LATENCY_META, inode);
 
     pthread_rwlock_wrlock(&inode_rwlocks[inumber]);
 
     inode->i_node_type = i_type;
+
+    // No blocks are mapped yet
+    for (size_t i = 0; i < INODE_DIRECT_BLOCKS; i++) {
+        inode->i_data_blocks[i] = -1;
+    }
+    inode->i_indirect_block = -1;
+    inode->i_double_indirect_block = -1;
+
     switch (i_type) {
     case T_DIRECTORY: {
         // Initializes directory (filling its block with empty entries, labeled
         // with inumber==-1)
-        int b = data_block_alloc();
+        int b = inode_block_alloc(inode, 0);
         if (b == -1) {
             // ensure fields are initialized
             inode->i_size = 0;
-            inode->i_data_block = -1;
 
             // run regular deletion process
             inode_delete(inumber);
@@ -251,37 +1173,65 @@ int inode_create(inode_type i_type) {
         }
 
         inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
+        inode_table[inumber].number_hard_links = 1;
 
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
+        dir_entry_t *dir_entry = (dir_entry_t *)metadata_block_get(b);
         ALWAYS_ASSERT(dir_entry != NULL,
                       "inode_create: data block freed while in use");
 
         for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
             dir_entry[i].d_inumber = -1;
         }
+        journal_dirty(dir_entry, BLOCK_SIZE);
+
+        if (dir_index_build(inumber) == -1) {
+            inode_delete(inumber);
+            pthread_rwlock_unlock(&inode_rwlocks[inumber]);
+            return -1;
+        }
     } break;
     case T_FILE:
         // In case of a new file, simply sets its size to 0
         inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
         inode_table[inumber].number_hard_links = 1;
         break;
     case T_SYMLINK:
         inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
         inode_table[inumber].number_hard_links = 1;
         break;
     default:
         pthread_rwlock_unlock(&inode_rwlocks[inumber]);
         PANIC("inode_create: unknown file type");
     }
+    journal_dirty(inode, sizeof(inode_t));
+    inode_appends_reset(inumber, inode->i_size);
 
     pthread_rwlock_unlock(&inode_rwlocks[inumber]);
 
     return inumber;
 }
 
+/**
+ * Reset the appends to an inode, as its size is set other than by them (the
+ * appends in progress, if any, are given up); the inode must be locked for
+ * writing.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - size: size of the inode
+ */
+void inode_appends_reset(int inumber, size_t size) {
+    inode_appends_t *appends = &inode_appends[inumber];
+
+    pthread_mutex_lock(&appends->mutex);
+    atomic_store(&appends->reserved, size);
+    atomic_store(&appends->committed, size);
+    appends->failed = false;
+    atomic_fetch_add(&appends->generation, 1);
+    pthread_cond_broadcast(&appends->turn);
+    pthread_mutex_unlock(&appends->mutex);
+}
+
 /**
  * Delete an inode.
  *
@@ -289,22 +1239,26 @@ int inode_create(inode_type i_type) {
  *   - inumber: inode's number
  */
 void inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
 
+    storage_access(LATENCY_META, &inode_table[inumber]);
+    storage_access(LATENCY_META, &freeinode_ts[inumber]);
+
     ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
                   "inode_delete: inode already freed");
 
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
+    inode_blocks_free(&inode_table[inumber]);
+    dir_index_free(inumber);
+
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        alloc_magazine_t *magazine = magazine_get();
+        if (magazine != NULL) {
+            magazine_free(magazine, MAGAZINE_INODES, inumber);
+            return;
+        }
     }
 
-    pthread_mutex_lock(&freeinode_ts_mutex);
-    freeinode_ts[inumber] = FREE;
-    pthread_mutex_unlock(&freeinode_ts_mutex);
+    inode_pool_put(&inumber, 1);
 }
 
 /**
@@ -318,13 +1272,183 @@ void inode_delete(int inumber) {
 inode_t *inode_get(int inumber) {
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
 
-    insert_delay(); // simulate storage access delay to inode
+    storage_access(LATENCY_META, &inode_table[inumber]);
     return &inode_table[inumber];
 }
 
+/**
+ * Allocate a data block to be used as an indirect block, with all of its
+ * entries marked as unused (-1).
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ */
+static int indirect_block_alloc(void) {
+    int b = data_block_alloc();
+    if (b == -1) {
+        return -1;
+    }
+
+    int *entries = (int *)metadata_block_get(b);
+    for (size_t i = 0; i < BLOCK_MAP_ENTRIES; i++) {
+        entries[i] = -1;
+    }
+    journal_dirty(entries, BLOCK_SIZE);
+
+    return b;
+}
+
+/**
+ * Locate the entry of an inode's block map that holds the number of one of its
+ * blocks.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - block_index: index of the block inside the file
+ *   - alloc: whether missing indirect blocks should be allocated on the way
+ *
+ * Returns a pointer to the entry (which is -1 if the block is not mapped), or
+ * NULL if the entry cannot be reached.
+ *
+ * Possible errors:
+ *   - block_index is beyond the maximum file size.
+ *   - An indirect block is missing (and alloc is false, or there are no free
+ *     data blocks).
+ */
+static int *inode_block_entry(inode_t *inode, size_t block_index, bool alloc) {
+    if (block_index < INODE_DIRECT_BLOCKS) {
+        return &inode->i_data_blocks[block_index];
+    }
+    block_index -= INODE_DIRECT_BLOCKS;
+
+    int *indirect = &inode->i_indirect_block;
+    if (block_index >= BLOCK_MAP_ENTRIES) {
+        block_index -= BLOCK_MAP_ENTRIES;
+        if (block_index >= BLOCK_MAP_ENTRIES * BLOCK_MAP_ENTRIES) {
+            return NULL; // beyond the maximum file size
+        }
+
+        int *double_indirect = &inode->i_double_indirect_block;
+        if (*double_indirect == -1) {
+            if (!alloc || (*double_indirect = indirect_block_alloc()) == -1) {
+                return NULL;
+            }
+            journal_dirty(double_indirect, sizeof(int));
+        }
+
+        int *entries = (int *)metadata_block_get(*double_indirect);
+        indirect = &entries[block_index / BLOCK_MAP_ENTRIES];
+        block_index %= BLOCK_MAP_ENTRIES;
+    }
+
+    if (*indirect == -1) {
+        if (!alloc || (*indirect = indirect_block_alloc()) == -1) {
+            return NULL;
+        }
+        journal_dirty(indirect, sizeof(int));
+    }
+
+    int *entries = (int *)metadata_block_get(*indirect);
+    return &entries[block_index];
+}
+
+/**
+ * Obtain the number of the data block that holds a given block of a file.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - block_index: index of the block inside the file
+ *
+ * Returns block number/index, or -1 if the block is not mapped.
+ */
+int inode_block_get(inode_t const *inode, size_t block_index) {
+    // without alloc, the block map is never modified
+    int *entry = inode_block_entry((inode_t *)inode, block_index, false);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    return *entry;
+}
+
+/**
+ * Obtain the number of the data block that holds a given block of a file,
+ * allocating it (and any indirect block needed to reach it) if it is not
+ * mapped yet.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - block_index: index of the block inside the file
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - block_index is beyond the maximum file size.
+ *   - No free data blocks.
+ */
+int inode_block_alloc(inode_t *inode, size_t block_index) {
+    int *entry = inode_block_entry(inode, block_index, true);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    if (*entry == -1) {
+        *entry = data_block_alloc();
+        journal_dirty(entry, sizeof(int));
+    }
+
+    return *entry;
+}
+
+/**
+ * Free a block of the block map and, if it is an indirect block, every block it
+ * references.
+ *
+ * Input:
+ *   - block_number: the block number/index (or -1, if not mapped)
+ *   - depth: levels of indirection below the block (0 for data blocks)
+ */
+static void block_map_free(int block_number, int depth) {
+    if (block_number == -1) {
+        return;
+    }
+
+    if (depth > 0) {
+        int const *entries = (int const *)metadata_block_get(block_number);
+        for (size_t i = 0; i < BLOCK_MAP_ENTRIES; i++) {
+            block_map_free(entries[i], depth - 1);
+        }
+    }
+
+    data_block_free(block_number);
+}
+
+/**
+ * Free all the data blocks of an inode, leaving its block map empty.
+ *
+ * Input:
+ *   - inode: the inode
+ */
+void inode_blocks_free(inode_t *inode) {
+    for (size_t i = 0; i < INODE_DIRECT_BLOCKS; i++) {
+        block_map_free(inode->i_data_blocks[i], 0);
+        inode->i_data_blocks[i] = -1;
+    }
+
+    block_map_free(inode->i_indirect_block, 1);
+    inode->i_indirect_block = -1;
+
+    block_map_free(inode->i_double_indirect_block, 2);
+    inode->i_double_indirect_block = -1;
+
+    journal_dirty(inode, sizeof(inode_t));
+}
+
 /**
  * Clear the directory entry associated with a sub file.
  *
+ * Only the directory index shard of sub_name is locked, so operations on other
+ * names of the same directory proceed in parallel.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -337,37 +1461,97 @@ inode_t *inode_get(int inumber) {
  */
 int clear_dir_entry(inode_t *inode, char const *sub_name) {
 
-    insert_delay();
+    storage_access(LATENCY_META, inode);
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
 
-    pthread_rwlock_wrlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    dir_index_t *index = dir_index_get(inode);
+    ALWAYS_ASSERT(index != NULL, "clear_dir_entry: failed to index directory");
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "clear_dir_entry: directory must have a data block");
+    uint64_t hash = dir_name_hash(sub_name);
+    dir_index_shard_t *shard = dir_index_shard(index, hash);
+    pthread_rwlock_wrlock(&shard->lock);
 
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-            dir_entry[i].d_inumber = -1;
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+    // Locates the entry through the directory index
+    dir_index_entry_t **link = dir_index_find(shard, hash, sub_name);
+    dir_index_entry_t *entry = *link;
+    if (entry == NULL) {
+        pthread_rwlock_unlock(&shard->lock);
+
+        return -1; // sub_name not found
+    }
 
-            pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    // The slot belongs to this entry until it is freed below
+    dir_entry_t *dir_entry = dir_slot_get(inode, entry->slot);
+    dir_entry->d_inumber = -1;
+    memset(dir_entry->d_name, 0, MAX_FILE_NAME);
+    journal_dirty(dir_entry, sizeof(dir_entry_t));
 
-            return 0;
+    *link = entry->next;
+    shard->n_entries--;
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    // free_slots has room for every slot, so this push cannot fail
+    pthread_mutex_lock(&index->slots_lock);
+    index->free_slots[index->n_free_slots++] = entry->slot;
+    pthread_mutex_unlock(&index->slots_lock);
+
+    free(entry);
+
+    return 0;
+}
+
+/**
+ * Take a free slot of a directory, adding a new block of empty entries to the
+ * directory if every slot is taken.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - index: directory index
+ *
+ * Returns the slot if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Directory is full and cannot grow (no free data blocks).
+ */
+static ssize_t dir_slot_alloc(inode_t *inode, dir_index_t *index) {
+    pthread_mutex_lock(&index->slots_lock);
+
+    if (index->n_free_slots == 0) {
+        // Grows the directory by one block of empty entries
+        int b = inode_block_alloc(inode, inode->i_size / BLOCK_SIZE);
+        if (b == -1 || dir_index_add_slots(index, index->n_slots,
+                                           MAX_DIR_ENTRIES) == -1) {
+            pthread_mutex_unlock(&index->slots_lock);
+
+            return -1; // no space for entry
+        }
+
+        dir_entry_t *dir_entry = (dir_entry_t *)metadata_block_get(b);
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            dir_entry[i].d_inumber = -1;
         }
+        journal_dirty(dir_entry, BLOCK_SIZE);
+        inode->i_size += BLOCK_SIZE;
+        journal_dirty(&inode->i_size, sizeof(size_t));
     }
 
-    pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    size_t slot = index->free_slots[--index->n_free_slots];
+
+    pthread_mutex_unlock(&index->slots_lock);
 
-    return -1; // sub_name not found
+    return (ssize_t)slot;
 }
 
 /**
  * Store the inumber for a sub file in a directory.
  *
+ * If every entry of the directory is taken, a new block is added to it. Only
+ * the directory index shard of sub_name is locked, so operations on other names
+ * of the same directory proceed in parallel.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -378,41 +1562,57 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
  * Possible errors:
  *   - inode is not a directory inode.
  *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
- *   - Directory is already full of entries.
+ *   - Directory already contains an entry for sub_name.
+ *   - Directory is full and cannot grow (no free data blocks).
  */
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
     if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
         return -1; // invalid sub_name
     }
 
-    insert_delay(); // simulate storage access delay to inode with inumber
+    storage_access(LATENCY_META, inode);
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
 
-    pthread_rwlock_wrlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    dir_index_t *index = dir_index_get(inode);
+    ALWAYS_ASSERT(index != NULL, "add_dir_entry: failed to index directory");
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "add_dir_entry: directory must have a data block");
+    uint64_t hash = dir_name_hash(sub_name);
+    dir_index_shard_t *shard = dir_index_shard(index, hash);
+    pthread_rwlock_wrlock(&shard->lock);
 
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+    // Holding the shard lock, no one else can add the same name meanwhile
+    if (*dir_index_find(shard, hash, sub_name) != NULL) {
+        pthread_rwlock_unlock(&shard->lock);
 
-            pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+        return -1; // sub_name already exists
+    }
 
-            return 0;
+    ssize_t slot = dir_slot_alloc(inode, index);
+    if (slot == -1 ||
+        dir_index_insert(shard, hash, sub_name, sub_inumber, (size_t)slot) ==
+            -1) {
+        if (slot != -1) {
+            pthread_mutex_lock(&index->slots_lock);
+            index->free_slots[index->n_free_slots++] = (size_t)slot;
+            pthread_mutex_unlock(&index->slots_lock);
         }
+        pthread_rwlock_unlock(&shard->lock);
+
+        return -1;
     }
 
-    pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    // Fills the empty entry
+    dir_entry_t *dir_entry = dir_slot_get(inode, (size_t)slot);
+    dir_entry->d_inumber = sub_inumber;
+    strncpy(dir_entry->d_name, sub_name, MAX_FILE_NAME - 1);
+    dir_entry->d_name[MAX_FILE_NAME - 1] = '\0';
+    journal_dirty(dir_entry, sizeof(dir_entry_t));
+
+    pthread_rwlock_unlock(&shard->lock);
 
-    return -1; // no space for entry
+    return 0;
 }
 
 /**
@@ -433,34 +1633,179 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
     ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
-    insert_delay(); // simulate storage access delay to inode with inumber
+    storage_access(LATENCY_META, inode);
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
 
-    pthread_rwlock_rdlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    dir_index_t *index = dir_index_get(inode);
+    ALWAYS_ASSERT(index != NULL, "find_in_dir: failed to index directory");
+
+    uint64_t hash = dir_name_hash(sub_name);
+    dir_index_shard_t *shard = dir_index_shard(index, hash);
+    pthread_rwlock_rdlock(&shard->lock);
+
+    // Looks the name up in the directory index, instead of scanning the
+    // directory blocks
+    dir_index_entry_t *entry = *dir_index_find(shard, hash, sub_name);
+    int sub_inumber = entry != NULL ? entry->inumber : -1;
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    return sub_inumber;
+}
+
+/**
+ * Count the entries of a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *
+ * Returns the number of entries, or 0 if inode is not a directory.
+ */
+size_t dir_entry_count(inode_t const *inode) {
+    if (inode->i_node_type != T_DIRECTORY) {
+        return 0;
+    }
+
+    dir_index_t *index = dir_index_get(inode);
+    ALWAYS_ASSERT(index != NULL, "dir_entry_count: failed to index directory");
+
+    size_t count = 0;
+    for (size_t s = 0; s < DIR_INDEX_SHARDS; s++) {
+        pthread_rwlock_rdlock(&index->shards[s].lock);
+        count += index->shards[s].n_entries;
+        pthread_rwlock_unlock(&index->shards[s].lock);
+    }
+
+    return count;
+}
+
+/**
+ * Obtain the next entry of a directory, in the order of its slots.
+ *
+ * Entries added or removed concurrently may or may not be seen, but an entry
+ * is never seen half written: entries are filled and cleared under the lock
+ * of the shard of their name (which is not known before reading it), so every
+ * shard is locked, and the directory grows under slots_lock (taken after
+ * them, as in add_dir_entry).
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - slot: slot where the search starts (0 for the first entry), which is
+ *     advanced past the entry found
+ *   - sub_name: where to store the name of the entry (MAX_FILE_NAME bytes)
+ *
+ * Returns the inumber of the entry, or -1 if there are no more entries (or
+ * inode is not a directory).
+ */
+int dir_entry_next(inode_t const *inode, size_t *slot, char *sub_name) {
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    dir_index_t *index = dir_index_get(inode);
+    ALWAYS_ASSERT(index != NULL, "dir_entry_next: failed to index directory");
+
+    for (size_t s = 0; s < DIR_INDEX_SHARDS; s++) {
+        pthread_rwlock_rdlock(&index->shards[s].lock);
+    }
+    pthread_mutex_lock(&index->slots_lock);
+
+    int sub_inumber = -1;
+    size_t n_slots = inode->i_size / BLOCK_SIZE * MAX_DIR_ENTRIES;
+    while (sub_inumber == -1 && *slot < n_slots) {
+        dir_entry_t const *dir_entry = dir_slot_get(inode, (*slot)++);
+        sub_inumber = dir_entry->d_inumber;
+        if (sub_inumber != -1) {
+            memcpy(sub_name, dir_entry->d_name, MAX_FILE_NAME);
+            sub_name[MAX_FILE_NAME - 1] = '\0';
+        }
+    }
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "find_in_dir: directory inode must have a data block");
+    pthread_mutex_unlock(&index->slots_lock);
+    for (size_t s = 0; s < DIR_INDEX_SHARDS; s++) {
+        pthread_rwlock_unlock(&index->shards[s].lock);
+    }
 
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+    return sub_inumber;
+}
 
-            int sub_inumber = dir_entry[i].d_inumber;
+/**
+ * Take free data blocks from the global free block bitmap.
+ *
+ * The bitmap is scanned a word (64 blocks) at a time, starting where the
+ * previous allocation left off (next-fit).
+ *
+ * Input:
+ *   - blocks: where to store the numbers of the blocks taken
+ *   - n: maximum number of blocks to take
+ *
+ * Returns the number of blocks taken (lower than n if the FS fills up).
+ */
+static size_t block_pool_take(int *blocks, size_t n) {
+    pthread_mutex_lock(&free_blocks_mutex);
 
-            pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+    if (n > superblock->free_block_count) {
+        n = superblock->free_block_count;
+    }
 
-            return sub_inumber;
+    size_t word = free_blocks_hint;
+    if (n > 0) {
+        storage_access(LATENCY_META, &free_blocks[word]);
+    }
+    for (size_t taken = 0; taken < n;) {
+        if (free_blocks[word] == UINT64_MAX) {
+            word = (word + 1) % FREE_BLOCKS_WORDS;
+            if (word % BITMAP_WORDS_PER_BLOCK == 0) {
+                storage_access(LATENCY_META, &free_blocks[word]);
+            }
+            continue;
         }
 
-    pthread_rwlock_unlock(&inode_rwlocks[ROOT_DIR_INUM]);
+        // Takes the lowest free bit of the word
+        int bit = __builtin_ctzll(~free_blocks[word]);
+        free_blocks[word] |= UINT64_C(1) << bit;
+        journal_dirty(&free_blocks[word], sizeof(uint64_t));
+        blocks[taken++] = (int)(word * BITMAP_WORD_BITS + (size_t)bit);
+    }
+    free_blocks_hint = word;
+    superblock->free_block_count -= n;
+    journal_dirty(&superblock->free_block_count, sizeof(uint64_t));
+
+    pthread_mutex_unlock(&free_blocks_mutex);
+
+    return n;
+}
+
+/**
+ * Return data blocks to the global free block bitmap.
+ *
+ * Input:
+ *   - blocks: numbers of the blocks
+ *   - n: number of blocks
+ */
+static void block_pool_put(int const *blocks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    storage_access(LATENCY_META,
+                   &free_blocks[(size_t)blocks[0] / BITMAP_WORD_BITS]);
 
-    return -1; // entry not found
+    pthread_mutex_lock(&free_blocks_mutex);
+    for (size_t i = 0; i < n; i++) {
+        size_t word = (size_t)blocks[i] / BITMAP_WORD_BITS;
+        uint64_t mask = UINT64_C(1) << (blocks[i] % BITMAP_WORD_BITS);
+
+        ALWAYS_ASSERT(free_blocks[word] & mask,
+                      "data_block_free: block already freed");
+        free_blocks[word] &= ~mask;
+        journal_dirty(&free_blocks[word], sizeof(uint64_t));
+    }
+    superblock->free_block_count += n;
+    journal_dirty(&superblock->free_block_count, sizeof(uint64_t));
+    pthread_mutex_unlock(&free_blocks_mutex);
 }
 
 /**
@@ -472,28 +1817,42 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
  *   - No free data blocks.
  */
 int data_block_alloc(void) {
-    pthread_mutex_lock(&free_blocks_mutex);
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        alloc_magazine_t *magazine = magazine_get();
+        if (magazine != NULL) {
+            return magazine_alloc(magazine, MAGAZINE_BLOCKS);
         }
+    }
 
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
+    int block_number;
+    if (block_pool_take(&block_number, 1) == 0) {
+        return -1; // no free blocks
+    }
 
-            pthread_mutex_unlock(&free_blocks_mutex);
+    return block_number;
+}
 
-            return (int)i;
+/**
+ * Return a data block to the free blocks.
+ */
+static void data_block_release(int block_number) {
+    if (ALLOC_MODE == TFS_ALLOC_PER_THREAD) {
+        alloc_magazine_t *magazine = magazine_get();
+        if (magazine != NULL) {
+            magazine_free(magazine, MAGAZINE_BLOCKS, block_number);
+            return;
         }
     }
 
-    pthread_mutex_unlock(&free_blocks_mutex);
-    return -1;
+    block_pool_put(&block_number, 1);
 }
 
 /**
  * Free a data block.
  *
+ * If the block is pinned, it is only freed once the last pin is released (see
+ * data_block_unpin).
+ *
  * Input:
  *   - block_number: the block number/index
  */
@@ -501,11 +1860,57 @@ void data_block_free(int block_number) {
     ALWAYS_ASSERT(valid_block_number(block_number),
                   "data_block_free: invalid block number");
 
-    insert_delay(); // simulate storage access delay to free_blocks
+    // Blocks are only pinned through an inode that maps them, and they are
+    // unmapped with the inode locked for writing, so no pin can be added now
+    uint32_t *pins = &block_pins[block_number];
+    if (__atomic_load_n(pins, __ATOMIC_ACQUIRE) != 0 &&
+        __atomic_fetch_or(pins, BLOCK_FREE_DEFERRED, __ATOMIC_ACQ_REL) != 0) {
+        return; // freed by the last unpin
+    }
 
-    pthread_mutex_lock(&free_blocks_mutex);
-    free_blocks[block_number] = FREE;
-    pthread_mutex_unlock(&free_blocks_mutex);
+    __atomic_store_n(pins, 0, __ATOMIC_RELAXED);
+    data_block_release(block_number);
+}
+
+/**
+ * Pin a data block, so that it is not reused (its freeing is deferred) until
+ * it is unpinned.
+ *
+ * The block must be mapped by an inode that is locked (for reading, at least).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_pin(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_pin: invalid block number");
+
+    __atomic_fetch_add(&block_pins[block_number], 1, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Unpin a data block, freeing it if it was freed while pinned.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_unpin(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_unpin: invalid block number");
+
+    uint32_t *pins = &block_pins[block_number];
+    uint32_t old = __atomic_fetch_sub(pins, 1, __ATOMIC_ACQ_REL);
+    ALWAYS_ASSERT((old & ~BLOCK_FREE_DEFERRED) != 0,
+                  "data_block_unpin: block not pinned");
+
+    if (old == (BLOCK_FREE_DEFERRED | 1)) {
+        __atomic_store_n(pins, 0, __ATOMIC_RELAXED);
+
+        // Changes the free maps, like any operation
+        journal_op_begin();
+        data_block_release(block_number);
+        journal_op_end();
+    }
 }
 
 /**
@@ -520,8 +1925,9 @@ void *data_block_get(int block_number) {
     ALWAYS_ASSERT(valid_block_number(block_number),
                   "data_block_get: invalid block number");
 
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    void *block = &fs_data[(size_t)block_number * BLOCK_SIZE];
+    storage_access(LATENCY_DATA, block);
+    return block;
 }
 
 /**
@@ -538,22 +1944,27 @@ void *data_block_get(int block_number) {
  */
 int add_to_open_file_table(int inumber, size_t offset) {
     pthread_mutex_lock(&free_open_file_entries_mutex);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
+    size_t size = table_size(&open_file_table);
+    size_t i = 0;
+    while (i < size && open_file_slot((int)i)->state != FREE) {
+        i++;
+    }
+    // The table grows (by a chunk) once all its entries are taken
+    if (i == size && table_grow(&open_file_table, size + 1) != 0) {
+        pthread_mutex_unlock(&free_open_file_entries_mutex);
+        return -1;
+    }
 
-            pthread_mutex_lock(&open_file_entry_mutex[i]);
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            pthread_mutex_unlock(&open_file_entry_mutex[i]);
+    open_file_slot_t *slot = open_file_slot((int)i);
+    slot->state = TAKEN;
 
-            pthread_mutex_unlock(&free_open_file_entries_mutex);
-            return i;
-        }
-    }
+    pthread_mutex_lock(&slot->entry.of_mutex);
+    slot->entry.of_inumber = inumber;
+    slot->entry.of_offset = offset;
+    pthread_mutex_unlock(&slot->entry.of_mutex);
 
     pthread_mutex_unlock(&free_open_file_entries_mutex);
-    return -1;
+    return (int)i;
 }
 
 /**
@@ -566,16 +1977,18 @@ void remove_from_open_file_table(int fhandle) {
     ALWAYS_ASSERT(valid_file_handle(fhandle),
                   "remove_from_open_file_table: file handle must be valid");
 
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
+    open_file_slot_t *slot = open_file_slot(fhandle);
+    ALWAYS_ASSERT(slot->state == TAKEN,
                   "remove_from_open_file_table: file handle must be taken");
 
     pthread_mutex_lock(&free_open_file_entries_mutex);
-    free_open_file_entries[fhandle] = FREE;
+    slot->state = FREE;
     pthread_mutex_unlock(&free_open_file_entries_mutex);
 }
 
 void remove_inode_from_open_file_table(int inum) {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+    size_t size = table_size(&open_file_table);
+    for (int i = 0; i < size; i++) {
         open_file_entry_t *entry = get_open_file_entry(i);
         if (entry != NULL && entry->of_inumber == inum) {
             remove_from_open_file_table(i);
@@ -597,10 +2010,11 @@ open_file_entry_t *get_open_file_entry(int fhandle) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] != TAKEN) {
+    open_file_slot_t *slot = open_file_slot(fhandle);
+    if (slot->state != TAKEN) {
         return NULL;
     }
-    return &open_file_table[fhandle];
+    return &slot->entry;
 }
 
 /* Finds the first entry in the open file table that has a specific inumber.
@@ -609,9 +2023,10 @@ open_file_entry_t *get_open_file_entry(int fhandle) {
 int open_file_table_lookup(int inum) {
     pthread_mutex_lock(&free_open_file_entries_mutex);
 
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == TAKEN &&
-            open_file_table[i].of_inumber == inum) {
+    size_t size = table_size(&open_file_table);
+    for (int i = 0; i < size; i++) {
+        open_file_slot_t *slot = open_file_slot(i);
+        if (slot->state == TAKEN && slot->entry.of_inumber == inum) {
 
             pthread_mutex_unlock(&free_open_file_entries_mutex);
             return i;
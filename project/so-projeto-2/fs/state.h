@@ -5,6 +5,7 @@
 #include "operations.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,9 +15,27 @@
 extern pthread_rwlock_t *inode_rwlocks;
 extern pthread_mutex_t freeinode_ts_mutex;
 extern pthread_mutex_t free_blocks_mutex;
-extern pthread_mutex_t *open_file_entry_mutex;
 extern pthread_mutex_t free_open_file_entries_mutex;
 
+/**
+ * Appends in progress to an inode (see tfs_append), which reserve their ranges
+ * of the file with a fetch-add, and then commit them in order of reservation.
+ */
+typedef struct {
+    atomic_size_t reserved;  // end of the ranges reserved
+    atomic_size_t committed; // end of the ranges committed (or given up)
+    // A range could not be written, so the ones after it are given up too
+    // (until no more are in progress)
+    bool failed;
+    // Changes as the inode is reset, giving up the appends in progress
+    atomic_uint generation;
+    size_t waiters; // appends waiting for their turn to commit
+    pthread_mutex_t mutex;
+    pthread_cond_t turn; // signalled as ranges are committed
+} inode_appends_t;
+
+extern inode_appends_t *inode_appends;
+
 /**
  * Directory entry
  */
@@ -34,7 +53,9 @@ typedef struct {
     inode_type i_node_type;
 
     size_t i_size;
-    int i_data_block;
+    int i_data_blocks[INODE_DIRECT_BLOCKS]; // direct block map
+    int i_indirect_block;        // block holding further block numbers
+    int i_double_indirect_block; // block holding indirect block numbers
     int number_hard_links;
     // in a more complete FS, more fields could exist here
 } inode_t;
@@ -47,23 +68,37 @@ typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 typedef struct {
     int of_inumber;
     size_t of_offset;
+    pthread_mutex_t of_mutex; // for the offset
 } open_file_entry_t;
 
+int state_format(char const *path, tfs_params params);
 int state_init(tfs_params);
 int state_destroy(void);
+bool state_is_empty(void);
+tfs_params state_params(void);
 
 size_t state_block_size(void);
+size_t state_max_file_size(void);
 
 int inode_create(inode_type n_type);
 void inode_delete(int inumber);
+void inode_appends_reset(int inumber, size_t size);
 inode_t *inode_get(int inumber);
 
 int clear_dir_entry(inode_t *inode, char const *sub_name);
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
 int find_in_dir(inode_t const *inode, char const *sub_name);
+size_t dir_entry_count(inode_t const *inode);
+int dir_entry_next(inode_t const *inode, size_t *slot, char *sub_name);
+
+int inode_block_get(inode_t const *inode, size_t block_index);
+int inode_block_alloc(inode_t *inode, size_t block_index);
+void inode_blocks_free(inode_t *inode);
 
 int data_block_alloc(void);
 void data_block_free(int block_number);
+void data_block_pin(int block_number);
+void data_block_unpin(int block_number);
 void *data_block_get(int block_number);
 
 int add_to_open_file_table(int inumber, size_t offset);
@@ -0,0 +1,70 @@
+#include "table.h"
+
+#include <stdlib.h>
+
+int table_init(table_t *table, size_t elem_size, size_t max_elems,
+               int (*init)(void *elem)) {
+    table->elem_size = elem_size;
+    table->max_elems = max_elems;
+    table->init = init;
+    atomic_init(&table->size, 0);
+
+    size_t n_chunks = (max_elems + TABLE_CHUNK - 1) / TABLE_CHUNK;
+    table->chunks = calloc(n_chunks == 0 ? 1 : n_chunks, sizeof(char *));
+    if (table->chunks == NULL ||
+        pthread_mutex_init(&table->lock, NULL) != 0) {
+        free(table->chunks);
+        return -1;
+    }
+    return 0;
+}
+
+void table_destroy(table_t *table, void (*fini)(void *elem)) {
+    size_t size = table_size(table);
+    for (size_t i = 0; i < size; i += TABLE_CHUNK) {
+        char *chunk = table_at(table, i);
+        for (size_t j = 0; fini != NULL && j < TABLE_CHUNK; j++) {
+            fini(chunk + j * table->elem_size);
+        }
+        free(chunk);
+    }
+    free(table->chunks);
+    table->chunks = NULL;
+    pthread_mutex_destroy(&table->lock);
+}
+
+int table_grow(table_t *table, size_t n) {
+    if (n > table->max_elems) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&table->lock);
+    size_t size = atomic_load_explicit(&table->size, memory_order_relaxed);
+    while (size < n) {
+        char *chunk = calloc(TABLE_CHUNK, table->elem_size);
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&table->lock);
+            return -1;
+        }
+        for (size_t j = 0; table->init != NULL && j < TABLE_CHUNK; j++) {
+            if (table->init(chunk + j * table->elem_size) == -1) {
+                free(chunk); // the elements before it are leaked
+                pthread_mutex_unlock(&table->lock);
+                return -1;
+            }
+        }
+
+        // Published before the size, so that any element under the size is
+        // in a chunk already published
+        atomic_store_explicit(&table->chunks[size / TABLE_CHUNK], chunk,
+                              memory_order_release);
+        size += TABLE_CHUNK;
+        if (size > table->max_elems) {
+            size = table->max_elems; // the rest of the chunk is not used
+        }
+        atomic_store_explicit(&table->size, size, memory_order_release);
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Elements in each chunk of a table
+#define TABLE_CHUNK (64)
+
+/*
+ * A table that grows on demand, one chunk of elements at a time, up to a
+ * maximum number of elements. Elements never move once created, so they are
+ * used (and may hold locks) without the lock of the table, which only
+ * serializes its growth: an element is reached through table_at once its
+ * index was obtained after the table grew to hold it (e.g., under a lock also
+ * taken by whoever grew it, or from table_size).
+ */
+typedef struct {
+    size_t elem_size;
+    size_t max_elems;
+    int (*init)(void *elem); // for each new element (zeroed), NULL if none
+    char *_Atomic *chunks;   // max_elems / TABLE_CHUNK of them, rounded up
+    atomic_size_t size;      // elements created
+    pthread_mutex_t lock;
+} table_t;
+
+/**
+ * Initialize an empty table, for up to max_elems elements of elem_size
+ * bytes, each initialized by init (which returns 0, or -1 if it failed) as it
+ * is created.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int table_init(table_t *table, size_t elem_size, size_t max_elems,
+               int (*init)(void *elem));
+
+/**
+ * Destroy a table, finalizing each of its elements with fini (unless it is
+ * NULL).
+ */
+void table_destroy(table_t *table, void (*fini)(void *elem));
+
+/**
+ * Grow a table so that it holds at least n elements.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - n is over the maximum of the table.
+ *   - malloc failure, or an element failed to initialize.
+ */
+int table_grow(table_t *table, size_t n);
+
+/**
+ * Obtain the number of elements in a table.
+ */
+static inline size_t table_size(table_t *table) {
+    return atomic_load_explicit(&table->size, memory_order_acquire);
+}
+
+/**
+ * Obtain a pointer to an element of a table, which must hold it.
+ */
+static inline void *table_at(table_t *table, size_t i) {
+    char *chunk = atomic_load_explicit(&table->chunks[i / TABLE_CHUNK],
+                                       memory_order_acquire);
+    return chunk + (i % TABLE_CHUNK) * table->elem_size;
+}
+
+#endif // TABLE_H
@@ -12,6 +12,7 @@
 
 char tmp_pipe_name[P_PIPE_NAME_SIZE + 5]; // Full name of the pipe
 int pipe_existance = 0; // If the pipe associated to the client exists
+int version = P_V2;     // Version of the protocol used with mbroker
 
 /*Comparator to sort the boxes through their names in alphabetical order*/
 int compare_box(const void *a, const void *b) {
@@ -19,6 +20,17 @@ int compare_box(const void *a, const void *b) {
                   ((p_box_response *)b)->box_name);
 }
 
+/*Comparator to sort the members of consumer groups by their box, group and
+ * name*/
+int compare_member(const void *a, const void *b) {
+    p_group_member const *x = a, *y = b;
+    int cmp = strcmp(x->box_name, y->box_name);
+    if (cmp == 0) {
+        cmp = strcmp(x->group, y->group);
+    }
+    return cmp != 0 ? cmp : strcmp(x->member, y->member);
+}
+
 /*function to open the register pipe*/
 int open_register_pipe(char *register_pipename) {
     char register_pn[P_PIPE_NAME_SIZE + 5];
@@ -57,36 +69,104 @@ void close_pipe(int fd) {
     }
 }
 
-/*Function that sends the request to mbroker for the creation of a box*/
-void request_box_creation(char *register_pipe_name, char *pipe_name,
-                          char *box_name) {
-    char register_code[P_BOX_CREATION_SIZE];
-
-    // Creating the protocol message to send to mbroker
-    p_build_box_creation(register_code, pipe_name, box_name);
+/*Function that sends a request to mbroker through the register pipe, in the
+ * version of the protocol used (box_name is NULL for the listing request)*/
+void send_request(char *register_pipe_name, uint8_t code, char *v1_request,
+                  size_t v1_size, char *pipe_name, char *box_name) {
+    char v2_request[P_V2_FRAME_MAX_SIZE];
+    char *request = v1_request;
+    size_t size = v1_size;
+    if (version == P_V2) {
+        size = p_v2_build_request(v2_request, code, pipe_name, box_name);
+        request = v2_request;
+    }
 
     int register_pipe_fd =
         open_register_pipe(register_pipe_name); // Opening the register pipe
 
-    if (write(register_pipe_fd, register_code, P_BOX_CREATION_SIZE) !=
-        P_BOX_CREATION_SIZE) { // Sending the message and verifying if it was
-                               // sent correctly
+    if (write(register_pipe_fd, request, size) !=
+        size) { // Sending the message and verifying if it was sent correctly
         exit(-1);
     }
 
     close_register_pipe(register_pipe_fd); // Closing the register pipe
+}
 
-    int pipe_fd = open_pipe(); // Opening the pipe associated to the client
+/*Function that reads exactly size bytes from the pipe*/
+void read_exactly(int fd, void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes_read = read(fd, (char *)buffer + done, size - done);
+        if (bytes_read <= 0) {
+            exit(-1);
+        }
+        done += (size_t)bytes_read;
+    }
+}
 
+/*Function that reads a v2 frame from the pipe, whose code is one of the two
+ * given (which may be the same), setting the code it has; returns the length
+ * of its payload*/
+size_t read_v2_frame_of(int fd, uint8_t code, uint8_t other_code,
+                        uint8_t *frame_code,
+                        char payload[P_V2_PAYLOAD_MAX_SIZE]) {
+    p_v2_header header;
+    read_exactly(fd, &header, P_V2_HEADER_SIZE);
+    // Veryfing if the code sent is not corrupted
+    if (header.magic != P_V2_MAGIC ||
+        (header.protocol_code != code && header.protocol_code != other_code) ||
+        header.length > P_V2_PAYLOAD_MAX_SIZE) {
+        exit(-1);
+    }
+    read_exactly(fd, payload, header.length);
+    *frame_code = header.protocol_code;
+    return header.length;
+}
+
+/*Function that reads a v2 frame of the given code from the pipe, returning the
+ * length of its payload*/
+size_t read_v2_frame(int fd, uint8_t code,
+                     char payload[P_V2_PAYLOAD_MAX_SIZE]) {
+    uint8_t frame_code;
+    return read_v2_frame_of(fd, code, code, &frame_code, payload);
+}
+
+/*Function that reads the response to a creation or removal request*/
+p_response read_response(int pipe_fd, uint8_t code) {
     p_response response; // Struct for the response from the mbroker
+    if (version == P_V2) {
+        char payload[P_V2_PAYLOAD_MAX_SIZE];
+        size_t length = read_v2_frame(pipe_fd, code, payload);
+        if (p_v2_parse_response(payload, length, code, &response) == -1) {
+            exit(-1);
+        }
+        return response;
+    }
+
     // Reading the response from the pipe associated to the client
     if (read(pipe_fd, &response, sizeof(p_response)) != sizeof(p_response)) {
         exit(-1);
     }
     // Veryfing if the code sent is not corrupted
-    if (response.protocol_code != P_BOX_CREATION_RESPONSE_CODE) {
+    if (response.protocol_code != code) {
         exit(-1);
     }
+    return response;
+}
+
+/*Function that sends the request to mbroker for the creation of a box*/
+void request_box_creation(char *register_pipe_name, char *pipe_name,
+                          char *box_name) {
+    char register_code[P_BOX_CREATION_SIZE];
+
+    // Creating the protocol message to send to mbroker
+    p_build_box_creation(register_code, pipe_name, box_name);
+    send_request(register_pipe_name, P_BOX_CREATION_CODE, register_code,
+                 P_BOX_CREATION_SIZE, pipe_name, box_name);
+
+    int pipe_fd = open_pipe(); // Opening the pipe associated to the client
+
+    p_response response = read_response(pipe_fd, P_BOX_CREATION_RESPONSE_CODE);
     /*Veryfing the status of the request, is it is 0,
     it was done sucessfully, if it is -1, an error was caused*/
     if (response.return_code == 0) {
@@ -107,30 +187,12 @@ void request_box_removal(char *register_pipe_name, char *pipe_name,
 
     // Creating the protocol message to send to mbroker
     p_build_box_removal(register_code, pipe_name, box_name);
-
-    int register_pipe_fd =
-        open_register_pipe(register_pipe_name); // Opening the register pipe
-
-    if (write(register_pipe_fd, register_code, P_BOX_REMOVAL_SIZE) !=
-        P_BOX_REMOVAL_SIZE) { // Sending the message and verifying if it was
-                              // sent correctly
-        exit(-1);
-    }
-
-    close_register_pipe(register_pipe_fd); // Closing the register pipe
+    send_request(register_pipe_name, P_BOX_REMOVAL_CODE, register_code,
+                 P_BOX_REMOVAL_SIZE, pipe_name, box_name);
 
     int pipe_fd = open_pipe(); // Opening the pipe associated to the client
 
-    p_response response; // Struct for the response from the mbroker
-    // Reading the response from the pipe associated to the client
-    if (read(pipe_fd, &response, P_BOX_REMOVAL_RESPONSE_SIZE) !=
-        P_BOX_REMOVAL_RESPONSE_SIZE) {
-        exit(-1);
-    }
-    // Veryfing if the code sent is not corrupted
-    if (response.protocol_code != P_BOX_REMOVAL_RESPONSE_CODE) {
-        exit(-1);
-    }
+    p_response response = read_response(pipe_fd, P_BOX_REMOVAL_RESPONSE_CODE);
     /*Veryfing the status of the request, is it is 0,
     it was done sucessfully, if it is -1, an error was caused*/
     if (response.return_code == 0) {
@@ -150,17 +212,8 @@ void request_box_list(char *pipe_name, char *register_pipe_name) {
 
     // Creating the protocol message to send to mbroker
     p_build_box_listing(register_code, pipe_name);
-
-    int register_pipe_fd =
-        open_register_pipe(register_pipe_name); // Opening the register pipe
-
-    if (write(register_pipe_fd, register_code, P_BOX_LISTING_SIZE) !=
-        P_BOX_LISTING_SIZE) { // Sending the message and verifying if it was
-                              // sent correctly
-        exit(-1);
-    }
-
-    close_register_pipe(register_pipe_fd); // Closing the register pipe
+    send_request(register_pipe_name, P_BOX_LISTING_CODE, register_code,
+                 P_BOX_LISTING_SIZE, pipe_name, NULL);
 
     int pipe_fd = open_pipe(); // Opening the pipe associated to the client
 
@@ -169,12 +222,42 @@ void request_box_list(char *pipe_name, char *register_pipe_name) {
     unsigned int size = 0; // Current capacity occupied in the array
     unsigned int cap = 1;  // Total capacity of the array
 
+    // And the members of the consumer groups of the boxes (only sent in v2,
+    // before their box)
+    p_group_member *members = NULL;
+    size_t n_members = 0, max_members = 0;
+
     p_box_response
         response; // Struct which will hold the response from the mbroker
     while (1) {
-        if (read(pipe_fd, &response, sizeof(p_box_response)) !=
-            sizeof(p_box_response)) { // Reading the response from the pipe
-                                      // associated to the client
+        if (version == P_V2) {
+            char payload[P_V2_PAYLOAD_MAX_SIZE];
+            uint8_t code;
+            size_t length = read_v2_frame_of(
+                pipe_fd, P_BOX_LISTING_RESPONSE_CODE,
+                P_GROUP_MEMBER_RESPONSE_CODE, &code, payload);
+            if (code == P_GROUP_MEMBER_RESPONSE_CODE) {
+                if (n_members == max_members) {
+                    max_members = max_members == 0 ? 4 : 2 * max_members;
+                    members = (p_group_member *)realloc(
+                        members, max_members * sizeof(p_group_member));
+                    if (members == NULL) {
+                        exit(-1);
+                    }
+                }
+                if (p_v2_parse_group_member_response(
+                        payload, length, &members[n_members++]) == -1) {
+                    exit(-1);
+                }
+                continue;
+            }
+            if (p_v2_parse_box_listing_response(payload, length, &response) ==
+                -1) {
+                exit(-1);
+            }
+        } else if (read(pipe_fd, &response, sizeof(p_box_response)) !=
+                   sizeof(p_box_response)) { // Reading the response from the
+                                             // pipe associated to the client
             exit(-1);
         }
         // Veryfing if the code sent is not corrupted
@@ -205,15 +288,32 @@ void request_box_list(char *pipe_name, char *register_pipe_name) {
 
     // Sort the boxes through their names in alphabetical order
     qsort(array, (size_t)size, sizeof(p_box_response), compare_box);
+    if (n_members > 0) {
+        qsort(members, n_members, sizeof(p_group_member), compare_member);
+    }
 
+    size_t member = 0;
     for (int i = 0; i < size;
          i++) { // Print to stdout the boxes and their attributes
         fprintf(stdout, "%s %zu %zu %zu\n", array[i].box_name,
                 (size_t)array[i].box_size, (size_t)array[i].n_publishers,
                 (size_t)array[i].n_subscribers);
+
+        // Followed by the members of its groups: the group, the member, the
+        // messages it has not yet delivered and the ones of the group not
+        // yet given out
+        while (member < n_members &&
+               strcmp(members[member].box_name, array[i].box_name) <= 0) {
+            p_group_member *m = &members[member++];
+            if (strcmp(m->box_name, array[i].box_name) == 0) {
+                fprintf(stdout, "  %s %s %zu %zu\n", m->group, m->member,
+                        (size_t)m->backlog, (size_t)m->pending);
+            }
+        }
     }
 
     free(array);
+    free(members);
 }
 
 /*Hanler to finalise this session, destroying the pipe associated to the
@@ -238,16 +338,36 @@ void signal_handler(int sig) {
 /*Function that in case of incorrect usage, shows the various usages otf the
  * client*/
 static void print_usage() {
-    fprintf(stderr, "usage: \n"
-                    "   manager <register_pipe> <pipe_name> create <box_name>\n"
-                    "   manager <register_pipe> <pipe_name> remove <box_name>\n"
-                    "   manager <register_pipe> <pipe_name> list\n");
+    fprintf(stderr,
+            "usage: \n"
+            "   manager [-v 1|2] <register_pipe> <pipe_name> create <box>\n"
+            "   manager [-v 1|2] <register_pipe> <pipe_name> remove <box>\n"
+            "   manager [-v 1|2] <register_pipe> <pipe_name> list\n");
 }
 
 int main(int argc, char **argv) {
     char pipe_name[P_PIPE_NAME_SIZE] = {0};
     pid_t pid;
 
+    int opt;
+    while ((opt = getopt(argc, argv, "v:")) != -1) {
+        switch (opt) {
+        case 'v': // Version of the protocol
+            version = p_version_parse(optarg);
+            if (version == -1) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    // The positional arguments are left as if there were no options
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 4 ||
         argc > 5) { // Checks if the number of arguments are incorrect
         print_usage();
@@ -0,0 +1,210 @@
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest line of a config file (and option), with its \0
+#define CONFIG_LINE_SIZE 1024
+
+// A setting that is a size: where it is in the config, and its least value
+typedef struct {
+    char const *name;
+    size_t offset;
+    size_t min;
+} size_setting_t;
+
+static size_setting_t const size_settings[] = {
+    {"max_boxes", offsetof(broker_config_t, max_boxes), 1},
+    {"max_inode_count", offsetof(broker_config_t, tfs.max_inode_count), 1},
+    {"max_block_count", offsetof(broker_config_t, tfs.max_block_count), 1},
+    {"max_open_files_count",
+     offsetof(broker_config_t, tfs.max_open_files_count), 1},
+    {"block_size", offsetof(broker_config_t, tfs.block_size), 1},
+    {"alloc_batch_size", offsetof(broker_config_t, tfs.alloc_batch_size), 1},
+    {"dentry_cache_size", offsetof(broker_config_t, tfs.dentry_cache_size),
+     0},
+    {"journal_commit_interval_us",
+     offsetof(broker_config_t, tfs.journal_commit_interval_us), 0},
+    {"journal_commit_bytes",
+     offsetof(broker_config_t, tfs.journal_commit_bytes), 1},
+    {"latency_ns", offsetof(broker_config_t, tfs.latency_ns), 0},
+    {"spin_count", offsetof(broker_config_t, pcq.spin_count), 0},
+};
+
+static char const *const alloc_modes[] = {
+    [TFS_ALLOC_GLOBAL] = "global",
+    [TFS_ALLOC_PER_THREAD] = "per_thread",
+};
+
+static char const *const switches[] = {"off", "on"};
+
+static char const *const latency_models[] = {
+    [TFS_LATENCY_NONE] = "none",
+    [TFS_LATENCY_FIXED] = "fixed",
+    [TFS_LATENCY_DEVICE] = "device",
+};
+
+/*Function that parses a decimal size, up to where it ends (at *end); returns
+ * 0, or -1 if there is none (or it does not fit in a size_t)*/
+static int parse_size(char const *value, size_t *size, char const **end) {
+    if (!isdigit((unsigned char)*value)) {
+        return -1; // strtoull would take a sign
+    }
+    char *parsed_end;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &parsed_end, 10);
+    if (errno == ERANGE || parsed > SIZE_MAX) {
+        return -1;
+    }
+    *size = (size_t)parsed;
+    *end = parsed_end;
+    return 0;
+}
+
+/*Function that finds a name among the names of the values of an enum;
+ * returns its value, or -1*/
+static int parse_name(char const *value, char const *const *names,
+                      size_t n_names) {
+    for (size_t i = 0; i < n_names; i++) {
+        if (strcmp(value, names[i]) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int config_set(broker_config_t *config, char const *name, char const *value) {
+    char const *end;
+
+    for (size_t i = 0; i < sizeof(size_settings) / sizeof(*size_settings);
+         i++) {
+        if (strcmp(name, size_settings[i].name) == 0) {
+            size_t size;
+            if (parse_size(value, &size, &end) == -1 || *end != '\0' ||
+                size < size_settings[i].min) {
+                return -1;
+            }
+            // A block must hold a directory entry of the TFS
+            if (size_settings[i].offset ==
+                    offsetof(broker_config_t, tfs.block_size) &&
+                size < tfs_min_block_size()) {
+                return -1;
+            }
+            *(size_t *)((char *)config + size_settings[i].offset) = size;
+            return 0;
+        }
+    }
+
+    if (strcmp(name, "alloc_mode") == 0) {
+        int mode = parse_name(value, alloc_modes,
+                              sizeof(alloc_modes) / sizeof(*alloc_modes));
+        if (mode == -1) {
+            return -1;
+        }
+        config->tfs.alloc_mode = (tfs_alloc_mode_t)mode;
+    } else if (strcmp(name, "latency_model") == 0) {
+        int model = parse_name(value, latency_models,
+                               sizeof(latency_models) /
+                                   sizeof(*latency_models));
+        if (model == -1) {
+            return -1;
+        }
+        config->tfs.latency_model = (tfs_latency_model_t)model;
+    } else if (strcmp(name, "handoff_histogram") == 0) {
+        int on =
+            parse_name(value, switches, sizeof(switches) / sizeof(*switches));
+        if (on == -1) {
+            return -1;
+        }
+        config->pcq.handoff_histogram = on;
+    } else if (strcmp(name, "latency_class_ns") == 0) {
+        size_t costs[TFS_ACCESS_CLASSES];
+        for (size_t i = 0; i < TFS_ACCESS_CLASSES; i++) {
+            if (parse_size(value, &costs[i], &end) == -1 ||
+                *end != (i == TFS_ACCESS_CLASSES - 1 ? '\0' : ',')) {
+                return -1;
+            }
+            value = end + 1;
+        }
+        memcpy(config->tfs.latency_class_ns, costs, sizeof(costs));
+    } else if (strcmp(name, "image_path") == 0 ||
+               strcmp(name, "journal_path") == 0) {
+        // Kept while the broker runs
+        char *path = strdup(value);
+        if (path == NULL || *path == '\0') {
+            free(path);
+            return -1;
+        }
+        if (name[0] == 'i') {
+            config->tfs.image_path = path;
+        } else {
+            config->tfs.journal_path = path;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*Function that removes the whitespace around a string (in place); returns
+ * where it starts*/
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+int config_parse(broker_config_t *config, char const *option) {
+    char line[CONFIG_LINE_SIZE];
+    if (strlen(option) >= CONFIG_LINE_SIZE) {
+        return -1;
+    }
+    strcpy(line, option);
+
+    char *value = strchr(line, '=');
+    if (value == NULL) {
+        return -1;
+    }
+    *value++ = '\0';
+    return config_set(config, trim(line), trim(value));
+}
+
+int config_load(broker_config_t *config, char const *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "[ERR]: cannot open %s\n", path);
+        return -1;
+    }
+
+    char line[CONFIG_LINE_SIZE];
+    int line_number = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        if (*trim(line) != '\0' && config_parse(config, line) == -1) {
+            fprintf(stderr, "[ERR]: %s:%d: not a valid setting\n", path,
+                    line_number);
+            ret = -1;
+        }
+    }
+
+    if (ferror(file)) {
+        fprintf(stderr, "[ERR]: cannot read %s\n", path);
+        ret = -1;
+    }
+    fclose(file);
+    return ret;
+}
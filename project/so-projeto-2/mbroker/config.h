@@ -0,0 +1,32 @@
+#pragma once
+
+#include "operations.h"
+#include "pcq-wait.h"
+
+#include <stddef.h>
+
+// The settings of the broker that are not its arguments: the parameters of
+// the TFS (see tfs_params), the boxes it holds at most, and how the
+// dispatchers wait for requests (see pcq_wait_params_t). Each is set by the
+// name of its field (max_boxes, or one of tfs_params or pcq_wait_params_t),
+// either as an option (-o <name>=<value>) or in a config file (-c <path>),
+// with a <name> = <value> on each line, where # starts a comment. Sizes are
+// decimal; alloc_mode is global or per_thread, latency_model none, fixed or
+// device, latency_class_ns the cost of each class of access, separated by
+// commas, and handoff_histogram on or off
+typedef struct {
+    tfs_params tfs;
+    size_t max_boxes;
+    pcq_wait_params_t pcq;
+} broker_config_t;
+
+// Sets a setting by its name; returns 0, or -1 if there is no such setting,
+// or the value is not valid for it
+int config_set(broker_config_t *config, char const *name, char const *value);
+
+// Sets a setting given as <name>=<value>; returns 0, or -1 if it is not valid
+int config_parse(broker_config_t *config, char const *option);
+
+// Sets the settings of a config file; returns 0, or -1 (telling why in
+// stderr) if it cannot be read, or one of its lines is not valid
+int config_load(broker_config_t *config, char const *path);
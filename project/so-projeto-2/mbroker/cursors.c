@@ -0,0 +1,93 @@
+#include "cursors.h"
+#include "operations.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Cursors are only opened as subscribers join, so one lock for all the boxes
+// is enough to add each consumer once
+static pthread_mutex_t cursors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*Function that writes the path of the file with the cursors of a box*/
+static void cursors_path(char *path, char const *box_name) {
+    sprintf(path, "%s%s", CURSORS_DIR, box_name);
+}
+
+int cursors_init() {
+    size_t cursor = 0;
+    char name[MAX_FILE_NAME];
+    if (tfs_mkdir(CURSORS_DIR) == -1 &&
+        tfs_readdir(CURSORS_DIR, &cursor, name) == -1) {
+        return -1; // Neither created nor already there
+    }
+    return 0;
+}
+
+int cursor_open(char const *box_name, char const *consumer, cursor_t *cursor,
+                int *found) {
+    char path[sizeof(CURSORS_DIR) + P_BOX_NAME_SIZE + 1];
+    cursors_path(path, box_name);
+
+    pthread_mutex_lock(&cursors_lock);
+    int fd = tfs_open(path, TFS_O_CREAT);
+    if (fd == -1) {
+        pthread_mutex_unlock(&cursors_lock);
+        return -1;
+    }
+
+    cursor_record_t record;
+    int index = 0;
+    *found = 0;
+    while (tfs_pread(fd, &record, sizeof(record),
+                     (size_t)index * sizeof(record)) == sizeof(record)) {
+        if (strncmp(record.consumer, consumer, P_BOX_NAME_SIZE) == 0) {
+            *found = 1;
+            *cursor = record.cursor;
+            break;
+        }
+        index++;
+    }
+
+    if (!*found) { // The consumer is new to the box
+        memset(&record, 0, sizeof(record));
+        strncpy(record.consumer, consumer, P_BOX_NAME_SIZE - 1);
+        if (tfs_pwrite(fd, &record, sizeof(record),
+                       (size_t)index * sizeof(record)) != sizeof(record)) {
+            index = -1;
+        }
+    }
+
+    if (tfs_close(fd) == -1) {
+        index = -1;
+    }
+    pthread_mutex_unlock(&cursors_lock);
+
+    return index;
+}
+
+int cursor_commit(char const *box_name, int index, cursor_t cursor) {
+    char path[sizeof(CURSORS_DIR) + P_BOX_NAME_SIZE + 1];
+    cursors_path(path, box_name);
+
+    int fd = tfs_open(path, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t offset = (size_t)index * sizeof(cursor_record_t) +
+                    offsetof(cursor_record_t, cursor);
+    ssize_t written = tfs_pwrite(fd, &cursor, sizeof(cursor), offset);
+    if (tfs_close(fd) == -1 || written != sizeof(cursor)) {
+        return -1;
+    }
+    return 0;
+}
+
+void cursors_remove(char const *box_name) {
+    char path[sizeof(CURSORS_DIR) + P_BOX_NAME_SIZE + 1];
+    cursors_path(path, box_name);
+
+    tfs_unlink(path); // The box may have had no consumers
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <stdint.h>
+
+// Directory of the TFS where the cursors of the named consumers are kept, in a
+// file for each box (named as the box), so that they survive restarts
+#define CURSORS_DIR "/.cursors"
+
+// Where a consumer is in a box: the number of messages of the box it has
+// received, and the offset of the box where the next one starts
+typedef struct {
+    uint64_t seq;
+    uint64_t offset;
+} cursor_t;
+
+// A cursor, as kept in the file of its box
+typedef struct {
+    char consumer[P_BOX_NAME_SIZE];
+    cursor_t cursor;
+} cursor_record_t;
+
+// Creates the directory of the cursors, unless it already exists; returns 0,
+// or -1 if it cannot be created
+int cursors_init();
+
+// Looks for the cursor of a consumer in a box (named with its /), getting it
+// if found, or else adding one (at the beginning of the box) for the consumer
+// to commit where it starts; returns the index of the cursor in the file of
+// the box, or -1 if it cannot be kept
+int cursor_open(char const *box_name, char const *consumer, cursor_t *cursor,
+                int *found);
+
+// Commits a cursor opened before; returns 0, or -1 if the box has no cursors
+// (as it was removed)
+int cursor_commit(char const *box_name, int index, cursor_t cursor);
+
+// Removes the cursors of a box
+void cursors_remove(char const *box_name);
@@ -1,74 +1,108 @@
 #include "mbroker.h"
+#include "config.h"
+#include "cursors.h"
+#include "delivery.h"
 #include "logging.h"
 #include "operations.h"
+#include "pcq-batch.h"
+#include "pcq-wait.h"
 #include "producer-consumer.h"
 #include "protocol.h"
+#include "registry.h"
+#include "sessions.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 int register_pipe_fd;         // File descriptor por the register pipe
 pc_queue_t producer_consumer; // Producer_consumer queue
-p_box_info *box_info;         // Array which holds the various boxes information
-pthread_mutex_t *box_info_mutex; // Array which holds the mutex for each box
-box_usage_state_t
-    *box_usage; // Array which holds the information if the box is in use or not
+table_t boxes;                // The boxes, by their index
 pthread_mutex_t box_usage_mutex =
-    PTHREAD_MUTEX_INITIALIZER; // Mutex for the Array box_usage
-pthread_cond_t *box_cond; // Array which holds the conditional locks for each
-                          // box
-pthread_mutex_t *box_cond_lock; // Array which holds the lock associated with
-                                // conditional locks for each box
-long unsigned int box_max_number; // The max number of boxes
-
-/*Function that creates a box*/
+    PTHREAD_MUTEX_INITIALIZER; // Mutex for the usage of the boxes
+size_t box_max_number = BOX_MAX_DEFAULT; // The max number of boxes
+delivery_mode_t delivery_mode =
+    DELIVERY_BATCH; // How messages are delivered to subscribers
+
+/*Function that initializes a box of the table, as the table grows*/
+int box_init(void *elem) {
+    box_t *box = elem;
+    if (pthread_mutex_init(&box->mutex, NULL) != 0 ||
+        pthread_mutex_init(&box->waiters_lock, NULL) != 0) {
+        return -1;
+    }
+    box->usage = FREE;
+    return 0;
+}
+
+/*Function that creates a box, taking a free index from the registry (and
+ * growing the table of the boxes to hold it)*/
 int box_alloc() {
-    pthread_mutex_lock(&box_usage_mutex);
+    int i = registry_alloc();
+    if (i == -1) {
+        return -1;
+    }
+    if (table_grow(&boxes, (size_t)i + 1) == -1) {
+        registry_free(i);
+        return -1;
+    }
 
-    for (int i = 0; i < box_max_number; i++) {
-        if (box_usage[i] == FREE) { // Allocs a space for the box
-            box_usage[i] = TAKEN;
+    pthread_mutex_lock(&box_usage_mutex);
+    box_get(i)->usage = TAKEN;
+    pthread_mutex_unlock(&box_usage_mutex);
 
-            pthread_mutex_unlock(&box_usage_mutex);
+    return i; // Return the index for the box
+}
 
-            return i; // Return the index for the box
+/*Function that starts the ring of a new box, which already has the given
+ * number of messages, of size bytes*/
+void box_ring_open(int box_id, uint64_t messages, uint64_t size) {
+    box_t *box = box_get(box_id);
+    if (box->ring == NULL) {
+        box->ring = ring_create();
+        if (box->ring == NULL) {
+            exit(-1);
         }
     }
-    pthread_mutex_unlock(&box_usage_mutex);
-    return -1;
+    ring_open(box->ring, messages, size);
 }
 
-/*Function that deletes the box*/
+/*Function that deletes the box, giving its index back to the registry*/
 void box_delete(int i) {
     pthread_mutex_lock(&box_usage_mutex);
-    box_usage[i] = FREE; // Changes to free the box_usage for that index
+    box_get(i)->usage = FREE; // Changes to free the box_usage for that index
     pthread_mutex_unlock(&box_usage_mutex);
+    registry_free(i);
 }
 
-/*Function that searches for the box*/
-int box_info_lookup(char *box_name) {
-    char box_name_slash[P_BOX_NAME_SIZE + 1]; // Each box name is saved with /
-                                              // in the beginning of their names
-    sprintf(box_name_slash, "/%s", box_name);
-    for (int i = 0; i < box_max_number; i++) {
-        // If the name is the same and the box is taken, returns the index
-        if (box_usage[i] == TAKEN &&
-            !strcmp(box_name_slash, box_info[i].box_name))
-            return i;
+/*Function that send the response to the manager for the creation or removal
+ * request, in the version of the protocol of the request*/
+void send_response_client_manager(int fd, char *message, u_int8_t choice,
+                                  int version) {
+    if (version == P_V2) {
+        char frame[P_V2_FRAME_MAX_SIZE];
+        size_t size = p_v2_build_response(
+            frame, choice, strlen(message) == 0 ? 0 : -1, message);
+        if (write(fd, frame, size) != (ssize_t)size) {
+            exit(-1);
+        }
+        if (close(fd) < 0) {
+            exit(-1);
+        }
+        return;
     }
-    return -1;
-}
 
-/*Function that send the response to the manager for the creation or removal
- * request*/
-void send_response_client_manager(int fd, char *message, u_int8_t choice) {
     p_response response;
     strcpy(response.error_message, message);
 
@@ -93,182 +127,8 @@ void send_response_client_manager(int fd, char *message, u_int8_t choice) {
     }
 }
 
-/*Function that treats the session for a publisher client*/
-void publisher(char *pipe_name, char *box_name) {
-    char tmp_pipe_name[P_PIPE_NAME_SIZE + 5] = {0};
-    sprintf(tmp_pipe_name, "/tmp/%s", pipe_name);
-
-    int pipe_fd = open(tmp_pipe_name, O_RDONLY);
-
-    if (pipe_fd < 0) {
-        return;
-    }
-
-    // Searchs for the box
-    int box_id = box_info_lookup(box_name);
-
-    if (box_id < 0 || box_info[box_id].n_publishers >= 1) {
-        // In case the box does not exist, or there is already a publisher
-        // associated with the box
-        if (close(pipe_fd) < 0) {
-            exit(-1);
-        }
-
-        return;
-    }
-
-    // Opens the box at the end of its text
-    int box_fd = tfs_open(box_info[box_id].box_name, O_APPEND);
-
-    if (box_fd < 0) {
-        exit(-1);
-    }
-
-    char buffer[P_PUB_MESSAGE_SIZE]; // Buffer which will hold the messages
-    while (1) {
-        ssize_t code =
-            read(pipe_fd, &buffer, P_PUB_MESSAGE_SIZE); // Reads from buffer
-        if (code != P_PUB_MESSAGE_SIZE) { // In case the message is not of the
-                                          // size required
-            if (code == 0) {
-                // If it does not read, it means that the publisher has finished
-                // and the pipe is broken
-                if (close(pipe_fd) < 0) {
-                    exit(-1);
-                }
-
-                return;
-            }
-
-            exit(-1);
-        }
-
-        if (buffer[0] != P_PUB_MESSAGE_CODE) {
-            exit(-1);
-        }
-
-        size_t size = strlen(buffer + 1) + 1; // To include a /0d
-
-        // Writes the message to the box
-        size_t bytes_writen = (size_t)tfs_write(box_fd, buffer + 1, size);
-
-        if (bytes_writen == -1) { // if it fails, the box has been removed
-            if (close(pipe_fd) < 0) {
-                exit(-1);
-            }
-            // Wakes all the subscribers associated with this box, to finish
-            // their sessions
-            pthread_cond_broadcast(&box_cond[box_id]);
-            return;
-        }
-
-        pthread_mutex_lock(&box_info_mutex[box_id]);
-        box_info[box_id].box_size += bytes_writen;
-        pthread_mutex_unlock(&box_info_mutex[box_id]);
-
-        pthread_cond_broadcast(&box_cond[box_id]);
-    }
-}
-
-/*Function that sends the various message to the subscriber*/
-int send_message_to_subscriber(int pipe_fd, char *mes) {
-    size_t aux = 0; // This variable will "acumulate" the various message sizes
-
-    while (1) {
-        size_t size = strlen(mes + aux); // Checks the size until it hits a \0,
-                                         // which signifies the end of a message
-
-        if (size == 0) { // There is no message
-            break;
-        }
-
-        char message[P_MESSAGE_SIZE];
-        strcpy(message, mes + aux);
-
-        char buffer[P_SUB_MESSAGE_SIZE];
-        p_build_sub_message(
-            buffer,
-            message); // Builds the protocol message to send to the subscriber
-
-        ssize_t bytes_wr =
-            write(pipe_fd, buffer, P_SUB_MESSAGE_SIZE); // Sends to the pipe
-        if (bytes_wr != P_SUB_MESSAGE_SIZE) {
-            if (bytes_wr == -1) { // In case the pipe is broken, causes SIGPIPE,
-                                  // but we ignore it
-                return -1;
-            }
-
-            exit(-1);
-        }
-        aux += size + 1; // To read the next message
-    }
-
-    return 0;
-}
-
-/*Function that will treat the session for a subscriber*/
-void subscriber(char *pipe_name, char *box_name) {
-    char tmp_pipe_name[P_PIPE_NAME_SIZE + 5] = {0};
-    sprintf(tmp_pipe_name, "/tmp/%s", pipe_name);
-
-    int pipe_fd = open(tmp_pipe_name, O_WRONLY);
-
-    if (pipe_fd < 0) {
-        return;
-    }
-
-    int box_id =
-        box_info_lookup(box_name); // Searches for the box and returns its index
-
-    if (box_id < 0) { // In case the box does not exist
-        if (close(pipe_fd) < 0) {
-            exit(-1);
-        }
-
-        return;
-    }
-
-    int box_fd = tfs_open(box_info[box_id].box_name,
-                          0); // Opens the box in its beggining to read
-
-    if (box_fd < 0) {
-        exit(-1);
-    }
-
-    char message[P_MESSAGE_SIZE + 1] = {0};
-    while (1) {
-        ssize_t bytes_read;
-
-        memset(message, 0, P_MESSAGE_SIZE + 1); // Resets the buffer
-
-        pthread_mutex_lock(&box_cond_lock[box_id]);
-
-        while ((bytes_read = tfs_read(box_fd, message, P_MESSAGE_SIZE)) == 0)
-            // If the box has no messages to read, the session is blocked
-            pthread_cond_wait(&box_cond[box_id], &box_cond_lock[box_id]);
-
-        pthread_mutex_unlock(&box_cond_lock[box_id]);
-
-        if (bytes_read == -1) { // In case the box no longer exists
-            break;
-        }
-        // Send the message to the subscriber
-        if (send_message_to_subscriber(pipe_fd, message) == -1) {
-            // In case the pipe is broken
-            if (tfs_close(box_fd) < 0) {
-                exit(-1);
-            }
-            break;
-        }
-    }
-
-    if (close(pipe_fd) < 0) {
-        exit(-1);
-    }
-}
-
 /*Function that treats the creation of boxes*/
-void manager_box_creation(char *pipe_name, char *box_name) {
+void manager_box_creation(char *pipe_name, char *box_name, int version) {
     char box_name_slash[P_BOX_NAME_SIZE +
                         1]; // Box names are saved with a / at their beginning
     sprintf(box_name_slash, "/%s", box_name);
@@ -282,10 +142,10 @@ void manager_box_creation(char *pipe_name, char *box_name) {
         return;
     }
 
-    if (box_info_lookup(box_name) != -1) { // Looks for the box
+    if (registry_lookup(box_name) != -1) { // Looks for the box
         // Enters here if the box exists
         send_response_client_manager(pipe_fd, "Box already exits",
-                                     P_BOX_CREATION_RESPONSE_CODE);
+                                     P_BOX_CREATION_RESPONSE_CODE, version);
         return;
     }
 
@@ -294,17 +154,27 @@ void manager_box_creation(char *pipe_name, char *box_name) {
     if (box_id == -1) { // In case there is no more space to create the box
         send_response_client_manager(pipe_fd,
                                      "No more space to create new boxes",
-                                     P_BOX_CREATION_RESPONSE_CODE);
+                                     P_BOX_CREATION_RESPONSE_CODE, version);
+        return;
+    }
+
+    // The name is reserved while the box is created, so that it is only
+    // created once, and only found once it is ready
+    if (registry_reserve(box_name, box_id) == -1) {
+        box_delete(box_id);
+        send_response_client_manager(pipe_fd, "Box already exits",
+                                     P_BOX_CREATION_RESPONSE_CODE, version);
         return;
     }
 
     int fd = tfs_open(box_name_slash, TFS_O_CREAT); // Creates the box in TFS
     if (fd == -1) {
         // In case we cannot create the box in TFS
+        registry_cancel(box_id);
         box_delete(box_id);
         send_response_client_manager(pipe_fd,
                                      "No more space to create new boxes",
-                                     P_BOX_CREATION_RESPONSE_CODE);
+                                     P_BOX_CREATION_RESPONSE_CODE, version);
         return;
     }
 
@@ -312,21 +182,26 @@ void manager_box_creation(char *pipe_name, char *box_name) {
         exit(-1);
     }
 
-    // Initializing the box
-    pthread_mutex_lock(&box_info_mutex[box_id]);
-    strcpy(box_info[box_id].box_name, box_name_slash);
-    box_info[box_id].box_size = 0;
-    box_info[box_id].n_publishers = 0;
-    box_info[box_id].n_subscribers = 0;
-    pthread_mutex_unlock(&box_info_mutex[box_id]);
+    // Initializing the box, without the cursors of a box of the same name (left
+    // if the broker stopped while it was being removed)
+    cursors_remove(box_name_slash);
+    box_ring_open(box_id, 0, 0);
+    box_t *box = box_get(box_id);
+    pthread_mutex_lock(&box->mutex);
+    strcpy(box->info.box_name, box_name_slash);
+    box->info.box_size = 0;
+    box->info.n_publishers = 0;
+    box->info.n_subscribers = 0;
+    pthread_mutex_unlock(&box->mutex);
+    registry_publish(box_id);
 
     send_response_client_manager(
-        pipe_fd, "",
-        P_BOX_CREATION_RESPONSE_CODE); // If the box created succesfully
+        pipe_fd, "", P_BOX_CREATION_RESPONSE_CODE,
+        version); // If the box created succesfully
 }
 
 /*Function that treats the removal requests*/
-void manager_box_removal(char *pipe_name, char *box_name) {
+void manager_box_removal(char *pipe_name, char *box_name, int version) {
     char tmp_pipe_name[P_PIPE_NAME_SIZE + 5];
     sprintf(tmp_pipe_name, "/tmp/%s", pipe_name);
 
@@ -336,28 +211,66 @@ void manager_box_removal(char *pipe_name, char *box_name) {
         return;
     }
 
-    int box_id = box_info_lookup(box_name); // Searches for the boxes
-    if (box_id == -1) {                     // In case the box does not exist
+    // Takes the box out of the registry, so that it is removed once
+    int box_id = registry_remove(box_name);
+    if (box_id == -1) { // In case the box does not exist
         send_response_client_manager(pipe_fd, "Such box does not exist",
-                                     P_BOX_REMOVAL_RESPONSE_CODE);
+                                     P_BOX_REMOVAL_RESPONSE_CODE, version);
         return;
     }
 
-    if (tfs_unlink(box_info[box_id].box_name) ==
-        -1) { // Deletes the box from TFS
+    box_t *box = box_get(box_id);
+    if (tfs_unlink(box->info.box_name) == -1) { // Deletes the box from TFS
         exit(-1);
     }
+    cursors_remove(box->info.box_name);
 
-    box_delete(box_id);
-    pthread_cond_broadcast(
-        &box_cond[box_id]); // Broadcast to all sessions taht the box is deleted
+    ring_close(box->ring);
+    box_groups_close(box_id);
+    box_wake(box_id); // Wakes all sessions waiting, as the box is deleted
+    box_delete(box_id); // Its index is only reused after its ring is closed
     send_response_client_manager(
-        pipe_fd, "",
-        P_BOX_REMOVAL_RESPONSE_CODE); // In case it removed the box sucessfully
+        pipe_fd, "", P_BOX_REMOVAL_RESPONSE_CODE,
+        version); // In case it removed the box sucessfully
+}
+
+/*Function that sends one of the boxes listed to the manager, in the version of
+ * the protocol of the request*/
+void send_box_listing_response(int fd, uint8_t last, p_box_info info,
+                               int version) {
+    if (version == P_V2) {
+        char frame[P_V2_FRAME_MAX_SIZE];
+        size_t size = p_v2_build_box_listing_response(frame, last, info);
+        if (write(fd, frame, size) != (ssize_t)size) {
+            exit(-1);
+        }
+        return;
+    }
+
+    p_box_response response = p_build_box_listing_response(last, info);
+    if (write(fd, &response, sizeof(p_box_response)) !=
+        sizeof(p_box_response)) {
+        exit(-1);
+    }
+}
+
+/*Function that sends the members of the consumer groups of a box, before the
+ * box, in a listing (only in v2)*/
+void send_group_members(int fd, int box_id) {
+    p_group_member *members;
+    size_t count = box_group_members(box_id, &members);
+    for (size_t i = 0; i < count; i++) {
+        char frame[P_V2_FRAME_MAX_SIZE];
+        size_t size = p_v2_build_group_member_response(frame, &members[i]);
+        if (write(fd, frame, size) != (ssize_t)size) {
+            exit(-1);
+        }
+    }
+    free(members);
 }
 
 /*Fucntion that treats the listing boxes request*/
-void manager_box_listing(char *pipe_name) {
+void manager_box_listing(char *pipe_name, int version) {
     char tmp_pipe_name[P_PIPE_NAME_SIZE + 5];
     sprintf(tmp_pipe_name, "/tmp/%s", pipe_name);
 
@@ -368,27 +281,23 @@ void manager_box_listing(char *pipe_name) {
     }
 
     int last = -1;
-    for (int i = 0; i < box_max_number; i++) {
-        if (box_usage[i] == TAKEN) { // Searches for the index of the last box
+    int n_boxes = (int)table_size(&boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        if (box_get(i)->usage == TAKEN) { // Searches for the last box
             last = i;
         }
     }
 
     if (last == -1) { // In case there are no boxes
-        p_box_response response;
-
-        // Initializing the structure
-        response.protocol_code = P_BOX_LISTING_RESPONSE_CODE;
-        response.last = 1;
-        memset(response.box_name, 0, P_BOX_NAME_SIZE);
-        response.box_size = 0;
-        response.n_publishers = 0;
-        response.n_subscribers = 0;
-
-        if (write(pipe_fd, &response, sizeof(p_box_response)) !=
-            sizeof(p_box_response)) { // Writes to the pipe
-            exit(-1);
-        }
+        p_box_info info;
+
+        // Initializing the structure, with an empty name (after its /)
+        memset(info.box_name, 0, P_BOX_NAME_SIZE + 1);
+        info.box_size = 0;
+        info.n_publishers = 0;
+        info.n_subscribers = 0;
+
+        send_box_listing_response(pipe_fd, 1, info, version);
 
         if (close(pipe_fd) < 0) {
             exit(-1);
@@ -397,20 +306,19 @@ void manager_box_listing(char *pipe_name) {
         return;
     }
 
-    for (int i = 0; i < box_max_number; i++) {
+    for (int i = 0; i < n_boxes; i++) {
         uint8_t last_info = 0;
 
         if (i == last) {
             last_info = 1;
         }
 
-        if (box_usage[i] == TAKEN) { // Send all the boxes to the pipe
-            p_box_response response =
-                p_build_box_listing_response(last_info, box_info[i]);
-            if (write(pipe_fd, &response, sizeof(p_box_response)) !=
-                sizeof(p_box_response)) {
-                exit(-1);
+        if (box_get(i)->usage == TAKEN) { // Send all the boxes to the pipe
+            if (version == P_V2) { // Only v2 shows the consumer groups
+                send_group_members(pipe_fd, i);
             }
+            send_box_listing_response(pipe_fd, last_info, box_get(i)->info,
+                                      version);
         }
 
         if (i == last) {
@@ -423,47 +331,326 @@ void manager_box_listing(char *pipe_name) {
     }
 }
 
-/*Main function for all threads that treat sessions*/
+/*Function that treats a request from the register pipe*/
+void treat_request(char *command) {
+    int version = command[REQUEST_VERSION];
+
+    switch (command[0]) { // Chooses the function that treats the request
+    case P_PUB_REGISTER_CODE:
+        publisher_session_start(command + 1, command + P_PIPE_NAME_SIZE + 1,
+                                version);
+        break;
+    case P_SUB_REGISTER_CODE: {
+        p_sub_options options;
+        memcpy(&options, command + REQUEST_OPTIONS, sizeof(options));
+        subscriber_session_start(command + 1, command + P_PIPE_NAME_SIZE + 1,
+                                 version, &options);
+        break;
+    }
+    case P_BOX_CREATION_CODE:
+        manager_box_creation(command + 1, command + P_PIPE_NAME_SIZE + 1,
+                             version);
+        break;
+    case P_BOX_REMOVAL_CODE:
+        manager_box_removal(command + 1, command + P_PIPE_NAME_SIZE + 1,
+                            version);
+        break;
+    case P_BOX_LISTING_CODE:
+        manager_box_listing(command + 1, version);
+        break;
+    default:
+        break;
+    }
+}
+
+/*Main function for the threads that treat the requests*/
 void *thread_main(void *i) {
     (void)i;
+    char *commands[DISPATCH_BATCH];
+    while (1) {
+        // Remove the requests waiting in the pcq (a few at a time) to treat
+        // them
+        size_t n = pcq_dequeue_batch(&producer_consumer, (void **)commands,
+                                     DISPATCH_BATCH);
+        for (size_t j = 0; j < n; j++) {
+            treat_request(commands[j]);
+        }
+    }
+    return NULL;
+}
+
+/*Function that counts the messages of a box (each ends with a \0)*/
+uint64_t box_count_messages(char *box_name) {
+    int fd = tfs_open(box_name, 0);
+    if (fd == -1) {
+        exit(-1);
+    }
+
+    uint64_t messages = 0;
+    char buffer[4096];
+    ssize_t bytes_read;
+    while ((bytes_read = tfs_read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < bytes_read; i++) {
+            messages += buffer[i] == '\0';
+        }
+    }
+
+    if (bytes_read == -1 || tfs_close(fd) == -1) {
+        exit(-1);
+    }
+    return messages;
+}
+
+/*Function that rebuilds the boxes from the files kept in the TFS image, after
+ * a restart*/
+void recover_boxes() {
+    char name[MAX_FILE_NAME];
+    size_t cursor = 0;
+
+    while (tfs_readdir("/", &cursor, name) == 1) {
+        if (strlen(name) > P_BOX_NAME_SIZE - 1) {
+            continue; // not a box
+        }
+
+        char box_name_slash[P_BOX_NAME_SIZE + 1];
+        sprintf(box_name_slash, "/%s", name);
+
+        ssize_t box_size = tfs_file_size(box_name_slash);
+        if (box_size == -1) {
+            continue; // not a box
+        }
+
+        int box_id = box_alloc();
+        if (box_id == -1 || registry_reserve(name, box_id) == -1) {
+            exit(-1);
+        }
+
+        box_ring_open(box_id, box_count_messages(box_name_slash),
+                      (uint64_t)box_size);
+        box_t *box = box_get(box_id);
+        pthread_mutex_lock(&box->mutex);
+        strcpy(box->info.box_name, box_name_slash);
+        box->info.box_size = (uint64_t)box_size;
+        box->info.n_publishers = 0;
+        box->info.n_subscribers = 0;
+        pthread_mutex_unlock(&box->mutex);
+        registry_publish(box_id);
+    }
+}
+
+// Size of the v1 requests, by their code
+static size_t const request_sizes[] = {
+    [P_PUB_REGISTER_CODE] = P_PUB_REGISTER_SIZE,
+    [P_SUB_REGISTER_CODE] = P_SUB_REGISTER_SIZE,
+    [P_BOX_CREATION_CODE] = P_BOX_CREATION_SIZE,
+    [P_BOX_REMOVAL_CODE] = P_BOX_REMOVAL_SIZE,
+    [P_BOX_LISTING_CODE] = P_BOX_LISTING_SIZE,
+};
+
+/*Function that tells if there is something to read in the register pipe
+ * right away; as the clients write each request at once, the rest of a
+ * request is there, unless it is not valid (so that reading it does not block,
+ * and take the requests after it)*/
+int request_pending(int fd) {
+    struct pollfd pending = {.fd = fd, .events = POLLIN};
+    return poll(&pending, 1, 0) == 1 && (pending.revents & POLLIN);
+}
+
+/*Function that reads the rest of a v2 request from the register pipe (after
+ * its first byte), converting it to the layout of v1 requests (followed by the
+ * options of a subscriber); returns NULL if it is not valid*/
+char *read_v2_request(int fd) {
+    p_v2_header header;
+    char payload[P_V2_PAYLOAD_MAX_SIZE];
+
+    if (!request_pending(fd) ||
+        read(fd, (char *)&header + 1, P_V2_HEADER_SIZE - 1) !=
+            P_V2_HEADER_SIZE - 1 ||
+        header.length > sizeof(payload) ||
+        (header.length > 0 && !request_pending(fd)) ||
+        read(fd, payload, header.length) != header.length) {
+        return NULL;
+    }
+
+    char pipe_name[P_PIPE_NAME_SIZE];
+    char box_name[P_BOX_NAME_SIZE];
+    p_sub_options options;
+    p_sub_options_init(&options);
+    int parsed =
+        header.protocol_code == P_SUB_REGISTER_CODE
+            ? p_v2_parse_sub_register(payload, header.length, pipe_name,
+                                      box_name, &options)
+            : p_v2_parse_request(payload, header.length, pipe_name, box_name);
+    if (parsed == -1) {
+        return NULL;
+    }
+
+    char *command = (char *)calloc(REQUEST_SIZE, sizeof(char));
+    if (command == NULL) {
+        exit(-1);
+    }
+    command[0] = (char)header.protocol_code;
+    memcpy(command + 1, pipe_name, P_PIPE_NAME_SIZE);
+    memcpy(command + P_PIPE_NAME_SIZE + 1, box_name, P_BOX_NAME_SIZE);
+    command[REQUEST_VERSION] = P_V2;
+    memcpy(command + REQUEST_OPTIONS, &options, sizeof(options));
+
+    return command;
+}
+
+/*Function that reads a request from the register pipe, in the layout of v1
+ * requests; returns NULL if it is not valid*/
+char *read_request(int fd) {
+    uint8_t code;
+    char *command_message;
+    // Read the code, or the first byte of the header of a v2 request
+    if (read(fd, &code, 1) != 1) {
+        code = 0;
+    }
+    if (code == P_V2_MAGIC) {
+        command_message = read_v2_request(fd);
+    } else if (code >= P_PUB_REGISTER_CODE && code <= P_BOX_LISTING_CODE &&
+               request_sizes[code] != 0) {
+        // Depending on the code, the rest of the request may vary in size
+        command_message = (char *)calloc(REQUEST_SIZE, sizeof(char));
+        if (command_message == NULL) {
+            exit(-1);
+        }
+
+        command_message[0] = (char)code;
+        command_message[REQUEST_VERSION] = P_V1;
+
+        if (!request_pending(fd) ||
+            read(fd, command_message + 1, request_sizes[code] - 1) !=
+                (ssize_t)request_sizes[code] - 1) {
+            free(command_message);
+            command_message = NULL;
+        }
+    } else {
+        command_message = NULL;
+    }
+    return command_message;
+}
+
+/*Function that opens the register pipe, for reading, and for writing, so that
+ * the program does not crash, in case the register pipe is broken by one of
+ * the clients (the end for reading is opened without blocking, as there may
+ * be no writer yet)*/
+void register_pipe_open(char const *register_pipe, int *write_fd) {
+    register_pipe_fd = open(register_pipe, O_RDONLY | O_NONBLOCK);
+    if (register_pipe_fd < 0) {
+        exit(-1);
+    }
+
+    *write_fd = open(register_pipe, O_WRONLY);
+    if (*write_fd < 0) {
+        exit(-1);
+    }
+
+    // Reading it blocks, once there is a writer
+    int flags = fcntl(register_pipe_fd, F_GETFL);
+    if (flags == -1 ||
+        fcntl(register_pipe_fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        exit(-1);
+    }
+}
+
+/*Function of the thread that prints the counters of the engine to stderr, each
+ * time the broker gets SIGUSR1 (blocked in the other threads)*/
+void *stats_main(void *arg) {
+    sigset_t *signals = arg;
+
     while (1) {
-        // Remove a request to treat it from de pcq
-        char *command = (char *)pcq_dequeue(&producer_consumer);
+        int sig;
+        if (sigwait(signals, &sig) != 0) {
+            exit(-1);
+        }
 
-        switch (command[0]) { // Chooses the function that treats the request
-        case P_PUB_REGISTER_CODE:
-            publisher(command + 1, command + P_PIPE_NAME_SIZE + 1);
-            break;
-        case P_SUB_REGISTER_CODE:
-            subscriber(command + 1, command + P_PIPE_NAME_SIZE + 1);
-            break;
-        case P_BOX_CREATION_CODE:
-            manager_box_creation(command + 1, command + P_PIPE_NAME_SIZE + 1);
-            break;
-        case P_BOX_REMOVAL_CODE:
-            manager_box_removal(command + 1, command + P_PIPE_NAME_SIZE + 1);
-            break;
-        case P_BOX_LISTING_CODE:
-            manager_box_listing(command + 1);
-            break;
-        default:
-            break;
+        engine_stats_t stats = engine_get_stats();
+        fprintf(stderr,
+                "[STATS]: messages %zu wakeups %zu signals %zu notifies %zu "
+                "wakeups/message %.4f\n",
+                stats.messages, stats.wakeups, stats.signals, stats.notifies,
+                stats.messages == 0
+                    ? 0.0
+                    : (double)stats.wakeups / (double)stats.messages);
+
+        // And how the requests were handed to the dispatchers (the histogram
+        // of handoff times only if it is recorded)
+        pcq_wait_stats_t pcq = pcq_get_wait_stats(&producer_consumer);
+        fprintf(stderr, "[STATS]: dispatch parks %zu wakes %zu\n", pcq.parks,
+                pcq.wakes);
+        for (size_t i = 0; i < PCQ_HANDOFF_BUCKETS; i++) {
+            if (pcq.handoffs[i] != 0) {
+                fprintf(stderr, "[STATS]: handoff <%lluns %zu\n",
+                        1ULL << i, pcq.handoffs[i]);
+            }
         }
     }
+
     return NULL;
 }
 
+/*Function that prints how to run the broker*/
+void print_usage() {
+    fprintf(stderr, "usage: mbroker [-d write|batch|splice] [-w <workers>] "
+                    "[-c <config>] [-o <name>=<value>]... <pipename> "
+                    "<max_sessions> [<tfs_image>]\n");
+}
+
 int main(int argc, char **argv) {
     char register_pipe[P_PIPE_NAME_SIZE + 5];
     int max_sessions = 0;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN); // Threads running sessions
+    broker_config_t config = {
+        .tfs = tfs_default_params(),
+        .max_boxes = BOX_MAX_DEFAULT,
+        .pcq = pcq_default_wait_params(),
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:c:o:")) != -1) {
+        switch (opt) {
+        case 'd': // How messages are delivered to subscribers
+            if (delivery_mode_parse(optarg, &delivery_mode) == -1) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'w':
+            if (sscanf(optarg, "%ld", &workers) != 1 || workers <= 0) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'c': // Settings from a config file (see config.h)
+            if (config_load(&config, optarg) == -1) {
+                exit(-1);
+            }
+            break;
+        case 'o': // A setting, after the ones before it
+            if (config_parse(&config, optarg) == -1) {
+                fprintf(stderr, "[ERR]: not a valid setting: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    // The positional arguments are left as if there were no options
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    if (argc != 3) { // Verifying if the number of arguments is correct
-        fprintf(stderr, "usage: mbroker <pipename> <max_sessions>\n");
+    if (argc != 3 &&
+        argc != 4) { // Verifying if the number of arguments is correct
+        print_usage();
         exit(-1);
     }
 
     if (strlen(argv[1]) > P_PIPE_NAME_SIZE - 1) {
-        fprintf(stderr, "usage: mbroker <pipename> <max_sessions>\n");
+        print_usage();
         exit(-1);
     }
 
@@ -472,68 +659,86 @@ int main(int argc, char **argv) {
     sscanf(argv[2], "%d", &max_sessions);
 
     if (max_sessions <= 0) {
-        fprintf(stderr, "usage: mbroker <pipename> <max_sessions>\n");
+        print_usage();
         exit(-1);
     }
 
-    if (tfs_init(NULL) == -1) { // Initialize the TFS
-        exit(-1);
+    if (workers <= 0) {
+        workers = 1;
     }
 
-    if (signal(SIGPIPE, SIG_IGN) ==
-        SIG_ERR) { // Handler for SIGPIPE, so we can ignore it
-        fprintf(stderr, "signal\n");
-        exit(-1);
+    // Each session holds a pipe, and subscribers a file of the TFS
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 &&
+        files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
     }
 
-    tfs_params params = tfs_default_params();
-    box_max_number = params.max_inode_count; // The number of inodes corresponds
-                                             // to the maximum number of boxes
+    // The open file table only grows as files are opened, up to its maximum
+    tfs_params params = config.tfs;
+    if (params.max_open_files_count < (size_t)max_sessions) {
+        params.max_open_files_count = (size_t)max_sessions;
+    }
+    char journal_path[PATH_MAX];
+    if (argc == 4) {
+        // The boxes are kept in an image (formatted with mkfs), across
+        // restarts; its journal (<tfs_image>.journal) commits the messages
+        // in groups, and recovers them after a crash (this takes the place of
+        // the image_path and journal_path settings)
+        params.image_path = argv[3];
+        params.journal_path = journal_path;
+        snprintf(journal_path, sizeof(journal_path), "%s.journal", argv[3]);
+    }
 
-    box_info = (p_box_info *)malloc(sizeof(p_box_info) * box_max_number);
-    if (box_info == NULL) {
+    // SIGUSR1 is only taken by the thread printing the statistics, so it is
+    // blocked before any other thread is created (the TFS starts the flusher
+    // of the journal), and they all keep it blocked
+    static sigset_t stats_signals;
+    sigemptyset(&stats_signals);
+    sigaddset(&stats_signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &stats_signals, NULL) != 0) {
         exit(-1);
     }
-    box_info_mutex =
-        (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t) * box_max_number);
-    if (box_info_mutex == NULL) {
+
+    if (tfs_init(&params) == -1) { // Initialize the TFS
+        fprintf(stderr, "[ERR]: failed to initialize the TFS\n");
         exit(-1);
     }
-    box_usage =
-        (box_usage_state_t *)malloc(sizeof(box_usage_state_t) * box_max_number);
-    if (box_usage == NULL) {
+
+    if (signal(SIGPIPE, SIG_IGN) ==
+        SIG_ERR) { // Handler for SIGPIPE, so we can ignore it
+        fprintf(stderr, "signal\n");
         exit(-1);
     }
-    box_cond =
-        (pthread_cond_t *)malloc(sizeof(pthread_cond_t) * box_max_number);
-    if (box_cond == NULL) {
+
+    // The tables of the boxes grow as boxes are created, up to max_boxes
+    // (each box also takes an inode of the TFS)
+    box_max_number = config.max_boxes;
+    if (table_init(&boxes, sizeof(box_t), box_max_number, box_init) == -1 ||
+        registry_init(box_max_number) == -1) {
         exit(-1);
     }
-    box_cond_lock =
-        (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t) * box_max_number);
-    if (box_cond_lock == NULL) {
+
+    recover_boxes();
+    if (cursors_init() == -1) { // Kept with the boxes
         exit(-1);
     }
 
-    for (int i = 0; i < box_max_number;
-         i++) { // Initializes the locks for each box
-        if (pthread_mutex_init(&box_info_mutex[i], NULL) != 0) {
-            exit(-1);
-        }
-
-        if (pthread_mutex_init(&box_cond_lock[i], NULL) != 0) {
-            exit(-1);
-        }
-
-        if (pthread_cond_init(&box_cond[i], NULL) != 0) {
-            exit(-1);
-        }
+    if (pcq_create(&producer_consumer, (size_t)(2 * max_sessions)) ==
+        -1) { // Creating the pcq
+        exit(-1);
+    }
+    pcq_set_wait_params(&producer_consumer, &config.pcq);
 
-        box_usage[i] = FREE;
+    pthread_t stats_thread;
+    if (pthread_create(&stats_thread, NULL, stats_main, &stats_signals) != 0) {
+        exit(-1);
     }
 
-    if (pcq_create(&producer_consumer, (size_t)(2 * max_sessions)) ==
-        -1) { // Creating the pcq
+    // The sessions are run by a few workers, each multiplexing the pipes of
+    // many sessions
+    if (engine_start((size_t)workers, (size_t)max_sessions) == -1) {
         exit(-1);
     }
 
@@ -550,93 +755,39 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    register_pipe_fd = open(register_pipe, O_RDONLY);
-    if (register_pipe_fd < 0) {
-        exit(-1);
-    }
-
-    int write_fd = open(register_pipe, O_WRONLY);
-    /*We only open the pipe for write so that the
-    program does not crash, in case the register pipe is broken by one of the
-    clients*/
-    if (write_fd < 0) {
-        exit(-1);
-    }
+    int write_fd;
+    register_pipe_open(register_pipe, &write_fd);
 
-    pthread_t threads[max_sessions];
+    pthread_t threads[DISPATCHER_THREADS];
 
-    for (int i = 0; i < max_sessions; i++) { // Initializing each thread
+    for (int i = 0; i < DISPATCHER_THREADS; i++) { // Initializing each thread
         if (pthread_create(&threads[i], NULL, thread_main, NULL) != 0) {
             exit(-1);
         }
     }
 
+    char *commands[ACCEPT_BATCH];
     while (1) { // Cicle to read the request from the register pipe
-        char code;
-        char *command_message;
-        // Read the code
-        if (read(register_pipe_fd, &code, 1) != 1) {
-            code = 0;
-        }
-        // Depending on the code, the rest of the request may vary in size
-        if (code == P_PUB_REGISTER_CODE) {
-            command_message =
-                (char *)malloc(P_PUB_REGISTER_SIZE * sizeof(char));
-
-            command_message[0] = P_PUB_REGISTER_CODE;
-
-            if (read(register_pipe_fd, command_message + 1,
-                     P_PUB_REGISTER_SIZE - 1) != P_PUB_REGISTER_SIZE - 1) {
-                exit(-1);
-            }
-        } else if (code == P_SUB_REGISTER_CODE) {
-            command_message =
-                (char *)malloc(P_SUB_REGISTER_SIZE * sizeof(char));
-
-            command_message[0] = P_SUB_REGISTER_CODE;
-
-            if (read(register_pipe_fd, command_message + 1,
-                     P_SUB_REGISTER_SIZE - 1) != P_SUB_REGISTER_SIZE - 1) {
-                exit(-1);
-            }
-        } else if (code == P_BOX_CREATION_CODE) {
-            command_message =
-                (char *)malloc(P_BOX_CREATION_SIZE * sizeof(char));
-
-            command_message[0] = P_BOX_CREATION_CODE;
-
-            if (read(register_pipe_fd, command_message + 1,
-                     P_BOX_CREATION_SIZE - 1) != P_BOX_CREATION_SIZE - 1) {
-                exit(-1);
-            }
-        } else if (code == P_BOX_REMOVAL_CODE) {
-            command_message = (char *)malloc(P_BOX_REMOVAL_SIZE * sizeof(char));
-
-            command_message[0] = P_BOX_REMOVAL_CODE;
-
-            if (read(register_pipe_fd, command_message + 1,
-                     P_BOX_REMOVAL_SIZE - 1) != P_BOX_REMOVAL_SIZE - 1) {
-                exit(-1);
+        // Read the requests already waiting in the pipe (sleeping only for
+        // the first), and send them to the pcq at once
+        size_t n = 0;
+        do {
+            char *command_message = read_request(register_pipe_fd);
+            if (command_message == NULL) {
+                // Where the requests after one that is not valid start is
+                // not known, so the pipe is opened again (dropping what is
+                // left in it, unless a client still has it open)
+                if (close(register_pipe_fd) < 0 || close(write_fd) < 0) {
+                    exit(-1);
+                }
+                register_pipe_open(register_pipe, &write_fd);
+                break;
             }
-        } else if (code == P_BOX_LISTING_CODE) {
-            command_message = (char *)malloc(P_BOX_LISTING_SIZE * sizeof(char));
-
-            command_message[0] = P_BOX_LISTING_CODE;
+            commands[n++] = command_message;
+        } while (n < ACCEPT_BATCH && request_pending(register_pipe_fd));
 
-            if (read(register_pipe_fd, command_message + 1,
-                     P_BOX_LISTING_SIZE - 1) != P_BOX_LISTING_SIZE - 1) {
-                exit(-1);
-            }
-        } else {
-            command_message = NULL;
-            if (close(register_pipe_fd) < 0) {
-                exit(-1);
-            }
-            if (close(write_fd) < 0) {
-                exit(-1);
-            }
+        if (n > 0) {
+            pcq_enqueue_batch(&producer_consumer, (void **)commands, n);
         }
-        // After the command message is created, send it to the pcq
-        pcq_enqueue(&producer_consumer, command_message);
     }
 }
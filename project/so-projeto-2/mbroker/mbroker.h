@@ -1,6 +1,80 @@
 #pragma once
 
+#include "delivery.h"
 #include "protocol.h"
+#include "ring.h"
+#include "table.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 typedef enum { FREE = 0, TAKEN = 1 } box_usage_state_t;
+
+// Views of a box a subscriber session batches before delivering them
+#define SUB_BATCH_VIEWS 16
+
+// Messages a consumer group gives a member at most at a time, so that the
+// messages waiting are shared by its members
+#define GROUP_CLAIM_MESSAGES 64
+
+// Frames a publisher session writes before letting other sessions run
+#define PUB_BATCH_FRAMES 64
+
+// Bytes of frames a publisher session reads at a time (PUB_BATCH_FRAMES of
+// v1, and more of the smaller frames of v2), which holds a whole batch
+#define PUB_BUFFER_SIZE (PUB_BATCH_FRAMES * P_PUB_MESSAGE_SIZE)
+_Static_assert(PUB_BUFFER_SIZE >= P_V2_HEADER_SIZE + P_PUB_BATCH_MAX_SIZE,
+               "a publisher batch must fit in the buffer of its session");
+
+// Size of the requests given to the dispatchers: the fixed layout of v1 (that
+// v2 requests are also converted to), followed by the version of the protocol
+// and the options of a subscriber (which only v2 requests carry, so they are
+// all 0 otherwise)
+#define REQUEST_VERSION P_PUB_REGISTER_SIZE
+#define REQUEST_OPTIONS (REQUEST_VERSION + 1)
+#define REQUEST_SIZE (REQUEST_OPTIONS + sizeof(p_sub_options))
+
+// Events a worker takes from its epoll at a time
+#define ENGINE_EVENTS 64
+
+// Threads that treat the requests from the register pipe (opening the pipes
+// of the sessions, and treating the requests of managers)
+#define DISPATCHER_THREADS 4
+
+// Requests the register pipe is read for (those already in it) before they
+// are sent to the dispatchers at once, and requests a dispatcher takes at a
+// time (few, as a session being opened delays the ones it took after it)
+#define ACCEPT_BATCH 32
+#define DISPATCH_BATCH 4
+
+// The pipe of a subscriber can only be opened once its client opened it to
+// read, which a dispatcher waits for (SESSION_OPEN_RETRY_MS apart, for
+// SESSION_OPEN_TRIES tries) before refusing the session
+#define SESSION_OPEN_TRIES 200
+#define SESSION_OPEN_RETRY_MS 1
+
+// Boxes the broker holds at most, unless configured otherwise (the TFS
+// must also have an inode for each)
+#define BOX_MAX_DEFAULT (1 << 20)
+
+// A box, kept in the table of the boxes by its index (which grows as boxes are
+// created, and keeps the boxes in place, with their locks)
+typedef struct {
+    p_box_info info;
+    pthread_mutex_t mutex; // For its info, and its consumer groups
+    box_usage_state_t usage;
+    box_ring_t *ring; // The ring of recent messages (kept for the next box in
+                      // its place)
+    struct session *waiters;      // Subscriber sessions waiting for messages
+    pthread_mutex_t waiters_lock; // Lock for the list of waiters
+    atomic_size_t waiting;        // Length of the list of waiters
+    struct consumer_group *groups; // Its consumer groups
+} box_t;
+
+extern table_t boxes;                 // The boxes, by their index
+extern delivery_mode_t delivery_mode; // How subscribers get messages
+
+// Gets a box by its index (which was given by the registry)
+static inline box_t *box_get(int box_id) {
+    return table_at(&boxes, (size_t)box_id);
+}
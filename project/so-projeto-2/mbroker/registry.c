@@ -0,0 +1,223 @@
+#include "registry.h"
+#include "protocol.h"
+#include "table.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char name[P_BOX_NAME_SIZE];
+    int next; // The next box in its bucket, or -1
+    atomic_int published;
+} registry_entry_t;
+
+static table_t entries;    // By index, grown as indexes are taken
+static int *buckets;       // The first box of each bucket, or -1
+static size_t bucket_mask; // The number of buckets (a power of 2) - 1
+static atomic_size_t n_entries;
+// A bucket is in the stripe of the lowest bits of its number, which are the
+// same for a name however many buckets there are
+static pthread_rwlock_t stripes[REGISTRY_STRIPES];
+
+static int *free_ids; // The stack of the indexes given back
+static size_t n_free, max_free;
+static size_t next_id; // The indexes from here on were never taken
+static size_t max_ids;
+static pthread_mutex_t free_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*Function that hashes a name (FNV-1a)*/
+static size_t registry_hash(char const *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < P_BOX_NAME_SIZE && name[i] != '\0'; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/*Function that gets the entry of a box*/
+static registry_entry_t *entry_get(int box_id) {
+    return table_at(&entries, (size_t)box_id);
+}
+
+int registry_init(size_t max_boxes) {
+    size_t n_buckets = REGISTRY_STRIPES;
+    bucket_mask = n_buckets - 1;
+    buckets = malloc(n_buckets * sizeof(int));
+    if (buckets == NULL ||
+        table_init(&entries, sizeof(registry_entry_t), max_boxes, NULL) ==
+            -1) {
+        return -1;
+    }
+    memset(buckets, -1, n_buckets * sizeof(int));
+    atomic_init(&n_entries, 0);
+
+    for (size_t i = 0; i < REGISTRY_STRIPES; i++) {
+        if (pthread_rwlock_init(&stripes[i], NULL) != 0) {
+            return -1;
+        }
+    }
+
+    // Taken from the lowest index up
+    free_ids = NULL;
+    n_free = max_free = 0;
+    next_id = 0;
+    max_ids = max_boxes;
+
+    return 0;
+}
+
+void registry_destroy() {
+    for (size_t i = 0; i < REGISTRY_STRIPES; i++) {
+        pthread_rwlock_destroy(&stripes[i]);
+    }
+    table_destroy(&entries, NULL);
+    free(buckets);
+    free(free_ids);
+}
+
+int registry_alloc() {
+    int box_id = -1;
+    pthread_mutex_lock(&free_lock);
+    if (n_free > 0) {
+        box_id = free_ids[--n_free];
+    } else if (next_id < max_ids &&
+               table_grow(&entries, next_id + 1) == 0) {
+        box_id = (int)next_id++;
+    }
+    pthread_mutex_unlock(&free_lock);
+    return box_id;
+}
+
+void registry_free(int box_id) {
+    pthread_mutex_lock(&free_lock);
+    if (n_free == max_free) { // Room for every index taken so far
+        max_free = next_id;
+        int *grown = realloc(free_ids, max_free * sizeof(int));
+        if (grown == NULL) {
+            exit(-1);
+        }
+        free_ids = grown;
+    }
+    free_ids[n_free++] = box_id;
+    pthread_mutex_unlock(&free_lock);
+}
+
+/*Function that doubles the buckets once there are more boxes than buckets,
+ * taking every stripe (which keeps the boxes of a stripe in it)*/
+static void registry_grow() {
+    for (size_t i = 0; i < REGISTRY_STRIPES; i++) {
+        pthread_rwlock_wrlock(&stripes[i]);
+    }
+
+    size_t n_buckets = bucket_mask + 1;
+    int *grown;
+    if (atomic_load(&n_entries) > n_buckets &&
+        (grown = malloc(2 * n_buckets * sizeof(int))) != NULL) {
+        memset(grown, -1, 2 * n_buckets * sizeof(int));
+        for (size_t bucket = 0; bucket < n_buckets; bucket++) {
+            int box_id = buckets[bucket];
+            while (box_id != -1) {
+                registry_entry_t *entry = entry_get(box_id);
+                int next = entry->next;
+                size_t to = registry_hash(entry->name) & (2 * n_buckets - 1);
+                entry->next = grown[to];
+                grown[to] = box_id;
+                box_id = next;
+            }
+        }
+        free(buckets);
+        buckets = grown;
+        bucket_mask = 2 * n_buckets - 1;
+    } // Otherwise the chains only get longer
+
+    for (size_t i = REGISTRY_STRIPES; i > 0; i--) {
+        pthread_rwlock_unlock(&stripes[i - 1]);
+    }
+}
+
+int registry_reserve(char const *name, int box_id) {
+    size_t hash = registry_hash(name);
+    pthread_rwlock_t *stripe = &stripes[hash % REGISTRY_STRIPES];
+
+    pthread_rwlock_wrlock(stripe);
+    size_t bucket = hash & bucket_mask;
+    for (int i = buckets[bucket]; i != -1; i = entry_get(i)->next) {
+        if (strncmp(entry_get(i)->name, name, P_BOX_NAME_SIZE) == 0) {
+            pthread_rwlock_unlock(stripe);
+            return -1; // Published, or being created
+        }
+    }
+
+    registry_entry_t *entry = entry_get(box_id);
+    memset(entry->name, 0, P_BOX_NAME_SIZE);
+    strncpy(entry->name, name, P_BOX_NAME_SIZE - 1);
+    atomic_store(&entry->published, 0);
+    entry->next = buckets[bucket];
+    buckets[bucket] = box_id;
+    size_t n_buckets = bucket_mask + 1;
+    pthread_rwlock_unlock(stripe);
+
+    if (atomic_fetch_add(&n_entries, 1) + 1 > n_buckets) {
+        registry_grow();
+    }
+
+    return 0;
+}
+
+void registry_publish(int box_id) {
+    atomic_store(&entry_get(box_id)->published, 1);
+}
+
+/*Function that takes a box out of its bucket, if it is there (and published,
+ * if asked); returns its index, or -1*/
+static int registry_unlink(char const *name, int published) {
+    size_t hash = registry_hash(name);
+    pthread_rwlock_t *stripe = &stripes[hash % REGISTRY_STRIPES];
+
+    pthread_rwlock_wrlock(stripe);
+    int *at = &buckets[hash & bucket_mask];
+    while (*at != -1 &&
+           strncmp(entry_get(*at)->name, name, P_BOX_NAME_SIZE) != 0) {
+        at = &entry_get(*at)->next;
+    }
+
+    int box_id = *at;
+    if (box_id != -1 &&
+        atomic_load(&entry_get(box_id)->published) == published) {
+        *at = entry_get(box_id)->next;
+        atomic_fetch_sub(&n_entries, 1);
+    } else {
+        box_id = -1;
+    }
+    pthread_rwlock_unlock(stripe);
+
+    return box_id;
+}
+
+void registry_cancel(int box_id) {
+    registry_unlink(entry_get(box_id)->name, 0);
+}
+
+int registry_lookup(char const *name) {
+    size_t hash = registry_hash(name);
+    pthread_rwlock_t *stripe = &stripes[hash % REGISTRY_STRIPES];
+
+    pthread_rwlock_rdlock(stripe);
+    int box_id = buckets[hash & bucket_mask];
+    while (box_id != -1 &&
+           strncmp(entry_get(box_id)->name, name, P_BOX_NAME_SIZE) != 0) {
+        box_id = entry_get(box_id)->next;
+    }
+    if (box_id != -1 && !atomic_load(&entry_get(box_id)->published)) {
+        box_id = -1; // Still being created
+    }
+    pthread_rwlock_unlock(stripe);
+
+    return box_id;
+}
+
+int registry_remove(char const *name) { return registry_unlink(name, 1); }
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+// Stripes of the locks of the buckets of the registry
+#define REGISTRY_STRIPES 64
+
+// The registry of the boxes: a hash table from the name of a box (without its
+// /) to its index (in the table of the boxes), and the indexes given back,
+// kept in a stack. Looking up a box only takes the (read) lock of the stripe
+// of its bucket, so lookups of different boxes, and of the same box, run at
+// once. It grows with the boxes: indexes are taken from the lowest up, and the
+// buckets double once there are more boxes than buckets
+
+// Creates an empty registry, for up to max_boxes boxes; returns 0, or -1 if
+// there is no memory for it
+int registry_init(size_t max_boxes);
+
+// Frees the registry
+void registry_destroy();
+
+// Takes an index not in use; returns it, or -1 if all are in use
+int registry_alloc();
+
+// Gives back an index, once its box is gone
+void registry_free(int box_id);
+
+// Reserves a name for the box of the given index, which is not found until it
+// is published (once the box is ready); returns 0, or -1 if the name is taken
+int registry_reserve(char const *name, int box_id);
+
+// Publishes a box reserved before, so that it is found by its name
+void registry_publish(int box_id);
+
+// Gives up on a name reserved before (and not published)
+void registry_cancel(int box_id);
+
+// Looks up a box by its name; returns its index, or -1 if it is not published
+int registry_lookup(char const *name);
+
+// Removes a published box, so that it is no longer found and its name can be
+// reserved again; returns its index, or -1 if it is not published
+int registry_remove(char const *name);
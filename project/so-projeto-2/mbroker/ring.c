@@ -0,0 +1,67 @@
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+box_ring_t *ring_create() {
+    // Its slots are only touched as messages are published, so the memory of
+    // the rings of boxes without messages is not used
+    return calloc(1, sizeof(box_ring_t));
+}
+
+void ring_open(box_ring_t *ring, uint64_t messages, uint64_t size) {
+    // Only the manager creating the box changes it, before it can be found
+    ring->base = atomic_load(&ring->head);
+    atomic_store(&ring->head, ring->base + messages);
+    atomic_store(&ring->size, size);
+}
+
+void ring_close(box_ring_t *ring) { atomic_fetch_add(&ring->generation, 1); }
+
+void ring_publish(box_ring_t *ring, char const *message, size_t size) {
+    uint64_t seq = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring_slot_t *slot = &ring->slots[seq % RING_SLOTS];
+
+    // The slot is invalidated before checking for pins, and a subscriber pins
+    // it before checking it is valid, so at least one of them sees the other
+    atomic_store(&slot->version, 0);
+    if (atomic_load(&slot->pins) == 0) {
+        slot->frame[0] = P_SUB_MESSAGE_CODE;
+        memcpy(slot->frame + 1, message, size);
+        memset(slot->frame + 1 + size, 0, P_MESSAGE_SIZE - size);
+        slot->len = (uint32_t)size;
+        atomic_store_explicit(&slot->version, seq + 1, memory_order_release);
+    }
+
+    // The head and the size of the box change together, for ring_end
+    uint64_t changes = atomic_load_explicit(&ring->changes,
+                                            memory_order_relaxed);
+    atomic_store(&ring->changes, changes + 1);
+    atomic_store(&ring->size, atomic_load(&ring->size) + size);
+    atomic_store(&ring->head, seq + 1);
+    atomic_store(&ring->changes, changes + 2);
+}
+
+void ring_end(box_ring_t *ring, uint64_t *seq, uint64_t *offset) {
+    uint64_t changes;
+    do {
+        changes = atomic_load(&ring->changes);
+        *seq = atomic_load(&ring->head);
+        *offset = atomic_load(&ring->size);
+    } while ((changes & 1) != 0 || atomic_load(&ring->changes) != changes);
+}
+
+ring_slot_t *ring_pin(box_ring_t *ring, uint64_t seq) {
+    ring_slot_t *slot = &ring->slots[seq % RING_SLOTS];
+
+    atomic_fetch_add(&slot->pins, 1);
+    if (atomic_load(&slot->version) != seq + 1) {
+        atomic_fetch_sub(&slot->pins, 1);
+        return NULL;
+    }
+    return slot;
+}
+
+void ring_unpin(ring_slot_t *slot) {
+    atomic_fetch_sub_explicit(&slot->pins, 1, memory_order_release);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recent messages kept in memory, for each box
+#define RING_SLOTS 64
+
+// A message of the ring, kept as the frame subscribers receive, so that it is
+// delivered straight from the ring (to every subscriber of the box)
+typedef struct {
+    _Atomic uint64_t version; // Sequence number of the message, plus 1, or 0
+    atomic_uint pins;         // Subscribers with the frame in a batch
+    uint32_t len;             // Length of the message, with its \0
+    char frame[P_SUB_MESSAGE_SIZE];
+} ring_slot_t;
+
+// The ring of a box, indexed by the sequence numbers of its messages, which
+// keep increasing across the boxes that use it. A message is published in it
+// after being written to the box, and subscribers read it without locks: a
+// slot they pinned is not overwritten (the new message is left out of the
+// ring, for them to read from the box)
+typedef struct {
+    _Atomic uint64_t head;       // Sequence number of the next message
+    _Atomic uint64_t generation; // Incremented as the box is removed
+    uint64_t base;               // Sequence number of the first message
+    // Size of the box up to head, and how many times the two changed (odd
+    // while they are being changed)
+    _Atomic uint64_t size;
+    _Atomic uint64_t changes;
+    ring_slot_t slots[RING_SLOTS];
+} box_ring_t;
+
+// Creates an empty ring
+box_ring_t *ring_create();
+
+// Starts the ring for a new box, which already has messages of size bytes
+// (recovered from an image); they are numbered from the base of the ring, but
+// only in the box
+void ring_open(box_ring_t *ring, uint64_t messages, uint64_t size);
+
+// Ends the ring for its box, which is removed
+void ring_close(box_ring_t *ring);
+
+// Publishes the next message of the box (of size bytes, including its \0)
+void ring_publish(box_ring_t *ring, char const *message, size_t size);
+
+// Gets the sequence number of the next message of the box, and where it
+// will start in the box
+void ring_end(box_ring_t *ring, uint64_t *seq, uint64_t *offset);
+
+// Pins the slot holding a message, until it is unpinned; returns NULL if the
+// message is no longer (or was never) in the ring
+ring_slot_t *ring_pin(box_ring_t *ring, uint64_t seq);
+
+// Unpins a slot, once its frame is delivered
+void ring_unpin(ring_slot_t *slot);
@@ -0,0 +1,1173 @@
+#include "sessions.h"
+#include "cursors.h"
+#include "mbroker.h"
+#include "registry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static engine_worker_t *workers;
+static size_t n_workers;
+static atomic_size_t next_worker; // Sessions are given to workers in turn
+static size_t session_limit;
+static atomic_size_t session_count;
+
+// Messages of a box, from seq up to end, which are in the box from offset up
+// to end_offset
+typedef struct {
+    uint64_t seq, end;
+    size_t offset, end_offset;
+} msg_range_t;
+
+// A consumer group of a box, whose members share its messages: the group gives
+// them out in ranges, each to one member, as the members ask for more. It is
+// kept while its box exists, even without members
+struct consumer_group {
+    char name[P_BOX_NAME_SIZE];
+    uint64_t generation; // Of the ring of its box
+    pthread_mutex_t lock; // For what follows
+    uint64_t seq;         // The next message it has not given out
+    size_t offset;        // Where it is in the box
+    msg_range_t *released; // Given back by members that left, given out first
+    size_t n_released, max_released;
+    session_t *members;
+    size_t n_members;
+    consumer_group_t *next; // In the groups of its box
+};
+
+
+static atomic_size_t signals;  // Writes to the event of a worker
+static atomic_size_t notifies; // Calls to box_wake that found waiters
+
+/*Function that adds the messages a subscriber delivered since the last time to
+ * the counters of its worker*/
+static void session_count_delivered(session_t *s) {
+    atomic_fetch_add_explicit(&s->worker->delivered,
+                              s->delivery.messages - s->counted,
+                              memory_order_relaxed);
+    s->counted = s->delivery.messages;
+}
+
+/*Function that counts a session in the publishers or subscribers of its box,
+ * as it joins or leaves it (unless the box was removed meanwhile)*/
+static void box_count_session(session_t *s, int joined) {
+    box_t *box = box_get(s->box_id);
+    pthread_mutex_lock(&box->mutex);
+    p_box_info *info = &box->info;
+    int same_box = atomic_load(&s->ring->generation) == s->generation;
+    if (same_box && s->type == SESSION_PUBLISHER) {
+        info->n_publishers = joined ? info->n_publishers + 1
+                                    : info->n_publishers - 1;
+    } else if (same_box) {
+        info->n_subscribers = joined ? info->n_subscribers + 1
+                                     : info->n_subscribers - 1;
+    }
+    pthread_mutex_unlock(&box->mutex);
+}
+
+/*Function that gives a session to a worker, which runs it on the events of its
+ * pipe*/
+static void session_add(session_t *s, uint32_t events) {
+    s->worker = &workers[atomic_fetch_add(&next_worker, 1) % n_workers];
+
+    struct epoll_event event = {.events = events, .data.ptr = s};
+    if (epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_ADD, s->pipe_fd, &event) ==
+        -1) {
+        exit(-1);
+    }
+}
+
+/*Function that changes the events of its pipe a session waits for*/
+static void session_watch(session_t *s, uint32_t events) {
+    struct epoll_event event = {.events = events, .data.ptr = s};
+    if (epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_MOD, s->pipe_fd, &event) ==
+        -1) {
+        exit(-1);
+    }
+}
+
+/*Function that counts up to the given number of messages in a box, from the
+ * one at offset (where they are all whole); returns the offset after them,
+ * setting counted to how many there were*/
+static size_t box_skip(int box_fd, size_t offset, uint64_t messages,
+                       uint64_t *counted) {
+    size_t read = offset;
+    *counted = 0;
+    while (*counted < messages) {
+        tfs_view view;
+        if (tfs_read_view(box_fd, read, SIZE_MAX, &view) <= 0) {
+            break; // The box was removed
+        }
+
+        char const *data = view.data;
+        char const *zero = data;
+        while (*counted < messages &&
+               (zero = memchr(zero, '\0', view.len - (size_t)(zero - data))) !=
+                   NULL) {
+            zero++;
+            (*counted)++;
+            offset = read + (size_t)(zero - data);
+        }
+        read += view.len;
+        tfs_release_view(&view);
+    }
+
+    return offset;
+}
+
+/*Function that finds where a subscriber starts in its box, as its options ask,
+ * counting the messages from the first of the box*/
+static cursor_t subscriber_start(session_t *s, p_sub_options const *options) {
+    cursor_t end;
+    ring_end(s->ring, &end.seq, &end.offset);
+    end.seq -= s->ring->base;
+
+    cursor_t start = {0, 0};
+    if (options->from == P_SUB_FROM_LATEST ||
+        (options->from == P_SUB_FROM_SEQ && options->seq >= end.seq)) {
+        return end;
+    }
+    if (options->from != P_SUB_FROM_SEQ) {
+        return start;
+    }
+
+    // The messages before the one asked for are counted in the box (they
+    // are before end)
+    start.offset = box_skip(s->box_fd, 0, options->seq, &start.seq);
+    return start;
+}
+
+/*Function that commits the cursor of the consumer of a subscriber, at the
+ * messages delivered so far (unless the box was removed)*/
+static void subscriber_commit(session_t *s) {
+    if (s->consumer == -1 || s->seq == s->committed ||
+        atomic_load(&s->ring->generation) != s->generation) {
+        return;
+    }
+
+    cursor_t cursor = {s->seq - s->ring->base, s->offset};
+    if (cursor_commit(s->box_name, s->consumer, cursor) == 0) {
+        s->committed = s->seq;
+    }
+}
+
+/*Function that places a subscriber where its consumer left off (unless it is
+ * new to the box, or the box is not the one it left), or else where its
+ * options ask*/
+static void subscriber_position(session_t *s, p_sub_options const *options) {
+    cursor_t start;
+    int found = 0;
+    if (options->consumer[0] != '\0') {
+        s->consumer =
+            cursor_open(s->box_name, options->consumer, &start, &found);
+    }
+    uint64_t head = atomic_load(&s->ring->head) - s->ring->base;
+    if (!found || start.seq > head) {
+        start = subscriber_start(s, options);
+    }
+
+    s->seq = s->ring->base + start.seq;
+    s->cursor = s->offset = start.offset;
+    s->committed = s->seq;
+    if (s->consumer != -1 && !found) { // Its cursor is where it starts
+        cursor_commit(s->box_name, s->consumer, start);
+    }
+}
+
+/*Function that adds a subscriber to its consumer group, creating the group
+ * (from where the subscriber asks to start) if it is the first member*/
+static void group_join(session_t *s, p_sub_options const *options) {
+    box_t *box = box_get(s->box_id);
+    pthread_mutex_lock(&box->mutex);
+    consumer_group_t *g = box->groups;
+    while (g != NULL && (g->generation != s->generation ||
+                         strcmp(g->name, options->group) != 0)) {
+        g = g->next;
+    }
+
+    if (g == NULL) {
+        g = calloc(1, sizeof(consumer_group_t));
+        if (g == NULL || pthread_mutex_init(&g->lock, NULL) != 0) {
+            exit(-1);
+        }
+        strcpy(g->name, options->group);
+        g->generation = s->generation;
+        cursor_t start = subscriber_start(s, options);
+        g->seq = s->ring->base + start.seq;
+        g->offset = start.offset;
+        g->next = box->groups;
+        box->groups = g;
+    }
+
+    pthread_mutex_lock(&g->lock);
+    s->group = g;
+    s->group_prev = NULL;
+    s->group_next = g->members;
+    if (g->members != NULL) {
+        g->members->group_prev = s;
+    }
+    g->members = s;
+    g->n_members++;
+    pthread_mutex_unlock(&g->lock);
+    pthread_mutex_unlock(&box->mutex);
+}
+
+/*Function that frees a consumer group, out of the groups of its box*/
+static void group_free(int box_id, consumer_group_t *g) {
+    box_t *box = box_get(box_id);
+    consumer_group_t **at = &box->groups;
+    while (*at != g) {
+        at = &(*at)->next;
+    }
+    *at = g->next;
+
+    pthread_mutex_destroy(&g->lock);
+    free(g->released);
+    free(g);
+}
+
+/*Function that takes a subscriber out of its consumer group, giving back the
+ * messages it took and did not deliver, for the other members to take (as the
+ * messages of a group are rebalanced as its members change)*/
+static void group_leave(session_t *s) {
+    consumer_group_t *g = s->group;
+    uint64_t delivered = atomic_load(&s->delivered_seq);
+    int released = 0;
+    box_t *box = box_get(s->box_id);
+
+    pthread_mutex_lock(&box->mutex);
+    pthread_mutex_lock(&g->lock);
+    if (s->group_prev != NULL) {
+        s->group_prev->group_next = s->group_next;
+    } else {
+        g->members = s->group_next;
+    }
+    if (s->group_next != NULL) {
+        s->group_next->group_prev = s->group_prev;
+    }
+    g->n_members--;
+
+    if (delivered < s->claim_end) {
+        if (g->n_released == g->max_released) {
+            g->max_released = g->max_released == 0 ? 4 : 2 * g->max_released;
+            g->released =
+                realloc(g->released, g->max_released * sizeof(msg_range_t));
+            if (g->released == NULL) {
+                exit(-1);
+            }
+        }
+        g->released[g->n_released++] = (msg_range_t){
+            delivered, s->claim_end, s->delivered_offset, s->claim_offset};
+        released = 1;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    // A group of a removed box goes with its last member
+    if (g->n_members == 0 &&
+        atomic_load(&s->ring->generation) != g->generation) {
+        group_free(s->box_id, g);
+    }
+    pthread_mutex_unlock(&box->mutex);
+
+    if (released) { // The members waiting take them
+        box_wake(s->box_id);
+    }
+}
+
+/*Function that gives a member of a consumer group the next messages of the
+ * group: the ones members that left gave back, or else its share of the ones
+ * waiting (up to GROUP_CLAIM_MESSAGES); returns whether it got any*/
+static int group_claim(session_t *s) {
+    consumer_group_t *g = s->group;
+    msg_range_t claim;
+    int claimed = 0;
+
+    pthread_mutex_lock(&g->lock);
+    if (g->n_released > 0) {
+        claim = g->released[--g->n_released];
+        claimed = 1;
+    } else {
+        uint64_t head, size;
+        ring_end(s->ring, &head, &size);
+        if (g->seq < head) {
+            uint64_t waiting = head - g->seq;
+            uint64_t share = (waiting + g->n_members - 1) / g->n_members;
+            if (share > GROUP_CLAIM_MESSAGES) {
+                share = GROUP_CLAIM_MESSAGES;
+            }
+
+            claim = (msg_range_t){g->seq, g->seq + share, g->offset, size};
+            uint64_t counted = share;
+            if (share < waiting) { // They end before head
+                claim.end_offset = box_skip(s->box_fd, g->offset, share,
+                                            &counted);
+            }
+            if (counted == share) { // Unless the box was removed
+                g->seq = claim.end;
+                g->offset = claim.end_offset;
+                claimed = 1;
+            }
+        }
+    }
+
+    if (claimed) {
+        s->seq = claim.seq;
+        s->cursor = s->offset = s->delivered_offset = claim.offset;
+        atomic_store(&s->delivered_seq, claim.seq);
+        s->claim_end = claim.end;
+        s->claim_offset = claim.end_offset;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    return claimed;
+}
+
+/*Function that checks whether a subscriber has messages waiting: the ones of
+ * its box after the last it delivered, or else the ones its consumer group
+ * has not given out*/
+static int subscriber_has_messages(session_t *s) {
+    uint64_t head = atomic_load(&s->ring->head);
+    if (s->group == NULL) {
+        return head > s->seq;
+    }
+
+    pthread_mutex_lock(&s->group->lock);
+    int waiting = s->group->n_released > 0 || s->group->seq < head;
+    pthread_mutex_unlock(&s->group->lock);
+    return waiting;
+}
+
+/*Function that ends a session; it is freed by its worker once the events
+ * at hand are handled, as they may refer to it*/
+static void session_end(session_t *s) {
+    if (epoll_ctl(s->worker->epoll_fd, EPOLL_CTL_DEL, s->pipe_fd, NULL) == -1) {
+        exit(-1);
+    }
+
+    if (s->type == SESSION_SUBSCRIBER) {
+        session_count_delivered(s);
+        delivery_destroy(&s->delivery);
+        for (size_t i = 0; i < s->n_views; i++) {
+            tfs_release_view(&s->views[i]);
+        }
+        for (size_t i = 0; i < s->n_pins; i++) {
+            ring_unpin(s->pins[i]);
+        }
+        free(s->views);
+        free(s->pieces);
+        if (s->group != NULL) {
+            group_leave(s);
+        }
+    } else {
+        free(s->in);
+    }
+    box_count_session(s, 0);
+    // A removed box has no handle to close (and the handle it had may be
+    // another box's by now, even if the session did not notice the removal)
+    if (atomic_load(&s->ring->generation) != s->generation) {
+        s->removed = 1;
+    }
+    if (!s->removed && tfs_close(s->box_fd) < 0) {
+        exit(-1);
+    }
+
+    if (close(s->pipe_fd) < 0) {
+        exit(-1);
+    }
+    atomic_fetch_sub(&session_count, 1);
+
+    s->ended = 1;
+    s->next = s->worker->ended;
+    s->worker->ended = s;
+}
+
+/*Function that opens the pipe of a client and reserves a session for it, in
+ * the version of the protocol of its request; returns the session, or NULL if
+ * the pipe cannot be opened or the broker has no more sessions. The pipe does
+ * not block (not even to be opened, so that a client that never opens its end
+ * cannot hold the dispatcher)*/
+static session_t *session_open(session_type_t type, char *pipe_name,
+                               int flags, int version) {
+    char tmp_pipe_name[P_PIPE_NAME_SIZE + 5] = {0};
+    sprintf(tmp_pipe_name, "/tmp/%s", pipe_name);
+
+    int pipe_fd;
+    for (int tries = 1;; tries++) {
+        pipe_fd = open(tmp_pipe_name, flags | O_NONBLOCK);
+        // A pipe to write to fails (ENXIO) until its client opens it to read
+        if (pipe_fd >= 0 || errno != ENXIO || tries == SESSION_OPEN_TRIES) {
+            break;
+        }
+        struct timespec delay = {0, SESSION_OPEN_RETRY_MS * 1000000};
+        nanosleep(&delay, NULL);
+    }
+
+    if (pipe_fd < 0) {
+        return NULL;
+    }
+
+    session_t *s = NULL;
+    if (atomic_fetch_add(&session_count, 1) < session_limit) {
+        s = calloc(1, sizeof(session_t));
+        if (s == NULL) {
+            exit(-1);
+        }
+    }
+    if (s == NULL) { // In case the broker has no more sessions
+        atomic_fetch_sub(&session_count, 1);
+        if (close(pipe_fd) < 0) {
+            exit(-1);
+        }
+        return NULL;
+    }
+
+    s->type = type;
+    s->version = version;
+    strcpy(s->pipe_name, pipe_name);
+    s->pipe_fd = pipe_fd;
+    s->box_fd = -1;
+    s->removed = 1; // Until the box is opened
+
+    return s;
+}
+
+/*Function that gives up on a session whose box cannot be used*/
+static void session_refuse(session_t *s) {
+    if (close(s->pipe_fd) < 0) {
+        exit(-1);
+    }
+    atomic_fetch_sub(&session_count, 1);
+    free(s);
+}
+
+void publisher_session_start(char *pipe_name, char *box_name, int version) {
+    session_t *s =
+        session_open(SESSION_PUBLISHER, pipe_name, O_RDONLY, version);
+
+    if (s == NULL) {
+        return;
+    }
+
+    // Searchs for the box
+    int box_id = registry_lookup(box_name);
+
+    if (box_id < 0) { // In case the box does not exist
+        session_refuse(s);
+        return;
+    }
+
+    // Opens the box to append to it, along with its other publishers
+    s->box_id = box_id;
+    s->ring = box_get(box_id)->ring;
+    s->generation = atomic_load(&s->ring->generation);
+    box_count_session(s, 1);
+    s->box_fd = tfs_open(box_get(box_id)->info.box_name, TFS_O_APPEND);
+
+    if (s->box_fd < 0) {
+        exit(-1);
+    }
+    s->removed = 0;
+
+    s->in = malloc(PUB_BUFFER_SIZE);
+    if (s->in == NULL) {
+        exit(-1);
+    }
+
+    session_add(s, EPOLLIN);
+}
+
+/*Function that takes the next messages from the frames read by a publisher
+ * session, from offset at of its buffer (which is moved past their frame): one
+ * message, or all of those of a batch. They are left one after the other,
+ * each ended by a \0, in place. Returns their size (with their \0s), 0 if
+ * the frame has not fully arrived, or -1 if it is not valid*/
+static ssize_t publisher_next(session_t *s, size_t *at, char **messages,
+                             size_t *count) {
+    char *frame = s->in + *at;
+    size_t left = s->filled - *at;
+
+    if (s->version == P_V1) {
+        if (left < P_PUB_MESSAGE_SIZE) {
+            return 0;
+        }
+        if (frame[0] != P_PUB_MESSAGE_CODE) {
+            return -1;
+        }
+
+        size_t size = strnlen(frame + 1, P_MESSAGE_SIZE - 1) + 1;
+        frame[size] = '\0';
+        *messages = frame + 1;
+        *count = 1;
+        *at += P_PUB_MESSAGE_SIZE;
+        return (ssize_t)size;
+    }
+
+    p_v2_header header;
+    if (left < P_V2_HEADER_SIZE) {
+        return 0;
+    }
+    memcpy(&header, frame, P_V2_HEADER_SIZE);
+    if (header.magic != P_V2_MAGIC ||
+        (header.protocol_code == P_PUB_MESSAGE_CODE &&
+         header.length > P_MESSAGE_SIZE - 1) ||
+        (header.protocol_code == P_PUB_BATCH_CODE &&
+         (header.length == 0 || header.length > P_PUB_BATCH_MAX_SIZE)) ||
+        (header.protocol_code != P_PUB_MESSAGE_CODE &&
+         header.protocol_code != P_PUB_BATCH_CODE)) {
+        return -1;
+    }
+    if (left < P_V2_HEADER_SIZE + (size_t)header.length) {
+        return 0;
+    }
+    *at += P_V2_HEADER_SIZE + (size_t)header.length;
+
+    if (header.protocol_code == P_PUB_MESSAGE_CODE) {
+        // The message is moved over the last byte of the header, which leaves
+        // room in the frame for its \0
+        *messages = frame + P_V2_HEADER_SIZE - 1;
+        memmove(*messages, frame + P_V2_HEADER_SIZE, header.length);
+        (*messages)[header.length] = '\0';
+        *count = 1;
+        return (ssize_t)header.length + 1;
+    }
+
+    // The messages of a batch already end with their \0, and are only
+    // checked (and counted)
+    *messages = frame + P_V2_HEADER_SIZE;
+    *count = 0;
+    for (size_t off = 0; off < header.length; (*count)++) {
+        size_t size = strnlen(*messages + off, header.length - off);
+        if (size == header.length - off || size > P_MESSAGE_SIZE - 1) {
+            return -1;
+        }
+        off += size + 1;
+    }
+    return (ssize_t)header.length;
+}
+
+typedef struct { // Messages appended to a box, to publish to its ring
+    box_ring_t *ring;
+    char const *messages;
+    size_t count;
+} publisher_commit_t;
+
+/*Function that publishes the messages appended to a box to its ring, as they
+ * are committed (so in the order they are in the box, whichever its
+ * publisher)*/
+static void publisher_commit(void *arg) {
+    publisher_commit_t *commit = arg;
+    char const *message = commit->messages;
+    for (size_t i = 0; i < commit->count; i++) {
+        size_t message_size = strlen(message) + 1;
+        ring_publish(commit->ring, message, message_size);
+        message += message_size;
+    }
+}
+
+/*Function that runs a publisher session, when its pipe has frames (or was
+ * closed): reads what fits in its buffer, up to PUB_BATCH_FRAMES frames of
+ * v1, and appends their messages to the box, those of a batch at once*/
+static void publisher_resume(session_t *s) {
+    size_t written = 0;
+    int ended = 0;
+
+    ssize_t bytes_read;
+    do {
+        bytes_read =
+            read(s->pipe_fd, s->in + s->filled, PUB_BUFFER_SIZE - s->filled);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1 && errno != EAGAIN) {
+        exit(-1);
+    }
+    if (bytes_read == 0) {
+        // The publisher has finished and the pipe is closed
+        ended = 1;
+    }
+    if (bytes_read > 0) {
+        s->filled += (size_t)bytes_read;
+    }
+
+    size_t at = 0;
+    char *messages;
+    size_t count;
+    ssize_t size;
+    while (!ended && (size = publisher_next(s, &at, &messages, &count)) != 0) {
+        if (size == -1) { // A frame that is not valid ends only this session
+            ended = 1;
+            break;
+        }
+
+        // Appends the messages to the box, in parallel with its other
+        // publishers
+        publisher_commit_t commit = {
+            .ring = s->ring, .messages = messages, .count = count};
+        if (tfs_append(s->box_fd, messages, (size_t)size, publisher_commit,
+                       &commit) == -1) {
+            // If it fails, the box has been removed
+            s->removed = 1;
+            ended = 1;
+            break;
+        }
+        written += (size_t)size;
+    }
+
+    // The rest of a frame that has not fully arrived is kept for later
+    memmove(s->in, s->in + at, s->filled - at);
+    s->filled -= at;
+
+    if (written > 0) { // The subscribers are woken once for all the messages
+        box_t *box = box_get(s->box_id);
+        pthread_mutex_lock(&box->mutex);
+        box->info.box_size += written;
+        pthread_mutex_unlock(&box->mutex);
+
+        box_wake(s->box_id);
+    }
+    if (ended) {
+        session_end(s);
+    }
+}
+
+void subscriber_session_start(char *pipe_name, char *box_name, int version,
+                              p_sub_options const *options) {
+    session_t *s =
+        session_open(SESSION_SUBSCRIBER, pipe_name, O_WRONLY, version);
+
+    if (s == NULL) {
+        return;
+    }
+
+    int box_id =
+        registry_lookup(box_name); // Searches for the box and returns its index
+
+    if (box_id < 0) { // In case the box does not exist
+        session_refuse(s);
+        return;
+    }
+
+    // Messages are delivered from the ring of the box, while they are in it
+    // (and the box while the ring is of its generation)
+    s->box_id = box_id;
+    s->ring = box_get(box_id)->ring;
+    s->generation = atomic_load(&s->ring->generation);
+    box_count_session(s, 1);
+
+    s->box_fd = tfs_open(box_get(box_id)->info.box_name,
+                         0); // Opens the box in its beggining to read
+
+    if (s->box_fd < 0) {
+        exit(-1);
+    }
+    s->removed = 0;
+
+    // A member of a consumer group delivers the messages the group gives it
+    // (none until it asks), and others start where they ask
+    s->consumer = -1;
+    strcpy(s->box_name, box_get(box_id)->info.box_name);
+    if (options->group[0] != '\0') {
+        group_join(s, options);
+    } else {
+        subscriber_position(s, options);
+    }
+
+    // Otherwise, they are delivered straight from the blocks of the box
+    // (through views, which are kept until they are delivered), and a message
+    // may span several blocks
+    size_t max_pieces = P_MESSAGE_SIZE / tfs_get_params().block_size + 2;
+    s->max_views = max_pieces + SUB_BATCH_VIEWS;
+    s->views = malloc(s->max_views * sizeof(tfs_view));
+    s->pieces = malloc(max_pieces * sizeof(struct iovec));
+    if (s->views == NULL || s->pieces == NULL) {
+        exit(-1);
+    }
+    s->state = SUB_ACTIVE;
+    delivery_init(&s->delivery, s->pipe_fd, delivery_mode, s->version);
+
+    session_add(s, EPOLLOUT); // Runs once the pipe has room
+}
+
+/*Function that delivers the messages batched for a subscriber, and then
+ * unpins the slots of the ring and releases the views they were in, except for
+ * the views holding the message being read (from index first on), which are
+ * moved to the beginning; returns as delivery_flush*/
+static int subscriber_flush(session_t *s) {
+    int ret = delivery_flush(&s->delivery);
+    if (ret != 0) { // The batch still refers to the slots and views
+        return ret;
+    }
+    session_count_delivered(s);
+    subscriber_commit(s);
+    atomic_store_explicit(&s->delivered_seq, s->seq, memory_order_relaxed);
+    s->delivered_offset = s->offset;
+
+    for (size_t i = 0; i < s->n_pins; i++) {
+        ring_unpin(s->pins[i]);
+    }
+    s->n_pins = 0;
+
+    for (size_t i = 0; i < s->first; i++) {
+        tfs_release_view(&s->views[i]);
+    }
+    memmove(s->views, s->views + s->first,
+            (s->n_views - s->first) * sizeof(tfs_view));
+    s->n_views -= s->first;
+    s->cur -= s->first;
+    s->first = 0;
+
+    return 0;
+}
+
+/*Function that batches the messages in the views of a subscriber, delivering
+ * the batch when it is full; returns as delivery_flush, or -1 if the box holds
+ * a message that is not valid (which ends only this session)*/
+static int subscriber_batch(session_t *s) {
+    while (s->cur < s->n_views) {
+        tfs_view *view = &s->views[s->cur];
+        char const *data = (char const *)view->data + s->off;
+        size_t left = view->len - s->off;
+
+        // Checks the size until it hits a \0, which signifies the end of a
+        // message
+        size_t size = strnlen(data, left);
+        if (s->len + size >= P_MESSAGE_SIZE) {
+            return -1; // Not a valid message
+        }
+
+        if (size == left) { // The message continues in the next view
+            s->pieces[s->n_pieces].iov_base = (void *)data;
+            s->pieces[s->n_pieces++].iov_len = size;
+            s->len += size;
+            s->cur++;
+            s->off = 0;
+            continue;
+        }
+
+        if (!delivery_room(&s->delivery, s->n_pieces + 1)) {
+            int ret = subscriber_flush(s);
+            if (ret != 0) {
+                return ret;
+            }
+            continue; // The views were moved
+        }
+
+        s->pieces[s->n_pieces].iov_base = (void *)data;
+        s->pieces[s->n_pieces].iov_len = size;
+        int ret = delivery_add(&s->delivery, s->pieces, s->n_pieces + 1,
+                               s->len + size);
+
+        // The next message starts after this one
+        s->seq++;
+        s->offset += s->len + size + 1;
+        s->n_pieces = 0;
+        s->len = 0;
+        s->off += size + 1;
+        if (s->off == view->len) {
+            s->cur++;
+            s->off = 0;
+        }
+        s->first = s->cur;
+
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*Function that batches the messages of a subscriber that are in the ring, up
+ * to the one before head, delivering the batch when it is full; returns as
+ * delivery_flush, having batched all of them unless one is not in the ring*/
+static int subscriber_ring(session_t *s, uint64_t head) {
+    while (s->seq < head) {
+        if (!delivery_room(&s->delivery, 0) ||
+            s->n_pins == DELIVERY_BATCH_IOVS) {
+            int ret = subscriber_flush(s);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+
+        ring_slot_t *slot = ring_pin(s->ring, s->seq);
+        if (slot == NULL) { // It has to be read from the box
+            return 0;
+        }
+        s->pins[s->n_pins++] = slot;
+        s->seq++;
+        s->cursor += slot->len;
+        s->offset += slot->len;
+
+        int ret = delivery_add_frame(&s->delivery, slot->frame, slot->len);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*Function that delivers the messages of the box to a subscriber, from the ring
+ * or up to SUB_BATCH_VIEWS views of the box at a time; returns 0 if it has no
+ * more messages, 1 if the pipe is full (or other sessions should run first),
+ * or -1 if the session is over*/
+static int subscriber_deliver(session_t *s) {
+    int ret = subscriber_batch(s);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (size_t i = 0; i < SUB_BATCH_VIEWS && s->n_views < s->max_views; i++) {
+        // The messages up to head (written to the box before it) belong to the
+        // box if it was not removed before them
+        uint64_t head = atomic_load_explicit(&s->ring->head,
+                                             memory_order_acquire);
+        if (atomic_load(&s->ring->generation) != s->generation) {
+            s->removed = 1;
+        }
+        if (s->removed) { // Only the messages already read are delivered
+            return subscriber_flush(s) == 1 ? 1 : -1;
+        }
+
+        // A member of a consumer group only delivers the messages the group
+        // gave it, and asks for more once they are delivered
+        size_t len = SIZE_MAX;
+        int between = s->n_pieces == 0 && s->cur == s->n_views;
+        if (s->group != NULL) {
+            if (between && s->seq == s->claim_end) {
+                ret = subscriber_flush(s);
+                if (ret != 0 || !group_claim(s)) {
+                    return ret;
+                }
+            }
+            head = s->claim_end;
+            len = s->claim_offset - s->cursor;
+        }
+
+        // Between messages, the next one is looked for in the ring
+        if (between) {
+            ret = subscriber_ring(s, head);
+            if (ret != 0) {
+                return ret;
+            }
+            if (s->seq >= head && s->group != NULL) {
+                continue; // It asks for more
+            }
+            if (s->seq >= head) {
+                return subscriber_flush(s);
+            }
+            len = s->group != NULL ? s->claim_offset - s->cursor : len;
+        }
+
+        tfs_view view;
+        ssize_t bytes_read = tfs_read_view(s->box_fd, s->cursor, len, &view);
+
+        if (bytes_read == -1) { // In case the box no longer exists
+            s->removed = 1;
+            return subscriber_flush(s) == 1 ? 1 : -1;
+        }
+
+        if (bytes_read == 0) {
+            return subscriber_flush(s);
+        }
+
+        s->cursor += view.len;
+        s->views[s->n_views++] = view;
+
+        ret = subscriber_batch(s);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    ret = subscriber_flush(s);
+    return ret == 0 ? 1 : ret;
+}
+
+/*Function that ends a subscriber session, wherever it is*/
+static void subscriber_end(session_t *s) {
+    box_t *box = box_get(s->box_id);
+    pthread_mutex_lock(&box->waiters_lock);
+    if (s->state == SUB_WAITING) {
+        if (s->prev != NULL) {
+            s->prev->next = s->next;
+        } else {
+            box->waiters = s->next;
+        }
+        if (s->next != NULL) {
+            s->next->prev = s->prev;
+        }
+        atomic_fetch_sub(&box->waiting, 1);
+    } else if (s->state == SUB_READY) {
+        s->closing = 1; // Its worker frees it, when resuming it
+    }
+    pthread_mutex_unlock(&box->waiters_lock);
+
+    if (!s->closing) {
+        session_end(s);
+    }
+}
+
+/*Function that runs a subscriber session, when its pipe has room or it was
+ * woken up*/
+static void subscriber_resume(session_t *s) {
+    box_t *box = box_get(s->box_id);
+    while (1) {
+        int ret = subscriber_deliver(s);
+
+        if (ret == -1) {
+            subscriber_end(s);
+            return;
+        }
+
+        if (ret == 1) {
+            session_watch(s, EPOLLOUT);
+            return;
+        }
+
+        // Waits for more messages, unless they arrived meanwhile (the
+        // publisher wakes the waiters after publishing them). It counts as
+        // waiting before checking, and the publisher checks for waiters after
+        // publishing, so at least one of them sees the other
+        pthread_mutex_lock(&box->waiters_lock);
+        atomic_fetch_add(&box->waiting, 1);
+        if (!subscriber_has_messages(s) &&
+            atomic_load(&s->ring->generation) == s->generation) {
+            s->state = SUB_WAITING;
+            s->prev = NULL;
+            s->next = box->waiters;
+            if (s->next != NULL) {
+                s->next->prev = s;
+            }
+            box->waiters = s;
+            pthread_mutex_unlock(&box->waiters_lock);
+
+            // Only errors are reported, once the subscriber leaves
+            session_watch(s, 0);
+            return;
+        }
+        atomic_fetch_sub(&box->waiting, 1);
+        pthread_mutex_unlock(&box->waiters_lock);
+    }
+}
+
+void box_wake(int box_id) {
+    box_t *box = box_get(box_id);
+    // Subscribers still delivering earlier messages are not waiting, and will
+    // find the new ones before waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&box->waiting) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&box->waiters_lock);
+    session_t *s = box->waiters;
+    box->waiters = NULL;
+    atomic_store(&box->waiting, 0);
+    if (s != NULL) {
+        atomic_fetch_add_explicit(&notifies, 1, memory_order_relaxed);
+    }
+
+    while (s != NULL) {
+        session_t *next = s->next;
+        engine_worker_t *w = s->worker;
+        s->state = SUB_READY;
+
+        pthread_mutex_lock(&w->ready_lock);
+        int was_empty = w->ready == NULL;
+        s->next = w->ready;
+        w->ready = s;
+        pthread_mutex_unlock(&w->ready_lock);
+
+        if (was_empty) { // Otherwise the worker was already signaled
+            uint64_t one = 1;
+            if (write(w->event_fd, &one, sizeof(one)) != sizeof(one)) {
+                exit(-1);
+            }
+            atomic_fetch_add_explicit(&signals, 1, memory_order_relaxed);
+        }
+        s = next;
+    }
+    pthread_mutex_unlock(&box->waiters_lock);
+}
+
+size_t box_group_members(int box_id, p_group_member **members) {
+    box_t *box = box_get(box_id);
+    pthread_mutex_lock(&box->mutex);
+    uint64_t generation = atomic_load(&box->ring->generation);
+    size_t count = 0;
+    for (consumer_group_t *g = box->groups; g != NULL; g = g->next) {
+        count += g->generation == generation ? g->n_members : 0;
+    }
+    *members = malloc((count > 0 ? count : 1) * sizeof(p_group_member));
+    if (*members == NULL) {
+        exit(-1);
+    }
+
+    size_t i = 0;
+    for (consumer_group_t *g = box->groups; g != NULL; g = g->next) {
+        if (g->generation != generation) {
+            continue; // Of a box removed before
+        }
+
+        pthread_mutex_lock(&g->lock);
+        uint64_t head = atomic_load(&box->ring->head);
+        uint64_t pending = head > g->seq ? head - g->seq : 0;
+        for (size_t j = 0; j < g->n_released; j++) {
+            pending += g->released[j].end - g->released[j].seq;
+        }
+
+        for (session_t *s = g->members; s != NULL; s = s->group_next) {
+            p_group_member *member = &(*members)[i++];
+            memset(member, 0, sizeof(p_group_member));
+            strcpy(member->box_name, box->info.box_name + 1);
+            strcpy(member->group, g->name);
+            strcpy(member->member, s->pipe_name);
+            uint64_t delivered = atomic_load_explicit(&s->delivered_seq,
+                                                      memory_order_relaxed);
+            member->backlog =
+                s->claim_end > delivered ? s->claim_end - delivered : 0;
+            member->pending = pending;
+        }
+        pthread_mutex_unlock(&g->lock);
+    }
+    pthread_mutex_unlock(&box->mutex);
+
+    return count;
+}
+
+void box_groups_close(int box_id) {
+    box_t *box = box_get(box_id);
+    pthread_mutex_lock(&box->mutex);
+    consumer_group_t *g = box->groups;
+    while (g != NULL) {
+        consumer_group_t *next = g->next;
+        if (g->n_members == 0) { // The others go with their last member
+            group_free(box_id, g);
+        }
+        g = next;
+    }
+    pthread_mutex_unlock(&box->mutex);
+}
+
+/*Function that resumes the subscriber sessions woken up for a worker*/
+static void worker_resume_ready(engine_worker_t *w) {
+    uint64_t count;
+    if (read(w->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        exit(-1);
+    }
+
+    pthread_mutex_lock(&w->ready_lock);
+    session_t *s = w->ready;
+    w->ready = NULL;
+    pthread_mutex_unlock(&w->ready_lock);
+
+    while (s != NULL) {
+        session_t *next = s->next;
+        s->state = SUB_ACTIVE;
+        if (s->closing) {
+            session_end(s);
+        } else {
+            atomic_fetch_add_explicit(&w->wakeups, 1, memory_order_relaxed);
+            subscriber_resume(s);
+        }
+        s = next;
+    }
+}
+
+/*Main function of the workers, which run the sessions given to them as the
+ * events of their pipes arrive*/
+static void *worker_main(void *arg) {
+    engine_worker_t *w = arg;
+    struct epoll_event events[ENGINE_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(w->epoll_fd, events, ENGINE_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            exit(-1);
+        }
+
+        for (int i = 0; i < n; i++) {
+            session_t *s = events[i].data.ptr;
+
+            if (s == NULL) { // The event of the ready list
+                worker_resume_ready(w);
+            } else if (s->ended) {
+                continue;
+            } else if (s->type == SESSION_PUBLISHER) {
+                publisher_resume(s);
+            } else if (events[i].events & EPOLLERR) {
+                subscriber_end(s); // The subscriber left
+            } else {
+                subscriber_resume(s);
+            }
+        }
+
+        while (w->ended != NULL) {
+            session_t *s = w->ended;
+            w->ended = s->next;
+            free(s);
+        }
+    }
+
+    return NULL;
+}
+
+int engine_start(size_t workers_count, size_t max_sessions) {
+    n_workers = workers_count;
+    session_limit = max_sessions;
+
+    workers = calloc(n_workers, sizeof(engine_worker_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n_workers; i++) {
+        engine_worker_t *w = &workers[i];
+
+        w->epoll_fd = epoll_create1(0);
+        w->event_fd = eventfd(0, EFD_NONBLOCK);
+        if (w->epoll_fd == -1 || w->event_fd == -1 ||
+            pthread_mutex_init(&w->ready_lock, NULL) != 0) {
+            return -1;
+        }
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &event) == -1) {
+            return -1;
+        }
+
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+engine_stats_t engine_get_stats() {
+    engine_stats_t stats = {
+        .signals = atomic_load_explicit(&signals, memory_order_relaxed),
+        .notifies = atomic_load_explicit(&notifies, memory_order_relaxed),
+    };
+
+    for (size_t i = 0; i < n_workers; i++) {
+        stats.messages += atomic_load_explicit(&workers[i].delivered,
+                                               memory_order_relaxed);
+        stats.wakeups += atomic_load_explicit(&workers[i].wakeups,
+                                              memory_order_relaxed);
+    }
+    return stats;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "delivery.h"
+#include "operations.h"
+#include "protocol.h"
+#include "ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef enum { SESSION_PUBLISHER = 0, SESSION_SUBSCRIBER = 1 } session_type_t;
+
+// Where a subscriber session is, when it is not being run
+typedef enum {
+    SUB_ACTIVE = 0,  // Delivering, or waiting for room in its pipe
+    SUB_WAITING = 1, // Waiting for messages, in the list of its box
+    SUB_READY = 2,   // Woken up, in the list of its worker
+} sub_state_t;
+
+typedef struct engine_worker engine_worker_t;
+typedef struct consumer_group consumer_group_t;
+
+// The state of a session, kept between the events of its pipe (the pipe does
+// not block, and a session is only run by its worker)
+typedef struct session {
+    session_type_t type;
+    int version; // Of the protocol, as asked by the client
+    char pipe_name[P_PIPE_NAME_SIZE];
+    int pipe_fd;
+    int box_fd;
+    int box_id;
+    int removed; // Whether the box was removed (its handle is gone)
+    box_ring_t *ring;
+    uint64_t generation; // Of the ring of the box, while the box exists
+    int ended;   // Whether it ended, waiting to be freed
+    engine_worker_t *worker;
+
+    // Publisher: the frames read from its pipe, of PUB_BUFFER_SIZE bytes, the
+    // last of which may have only partly arrived
+    char *in;
+    size_t filled;
+
+    // Subscriber: the next message to deliver (seq), taken from the ring of
+    // the box while it is there, and otherwise from the views of the box not
+    // yet delivered, the message being read from them (from view first, the
+    // current one being cur, at offset off); and the batch of messages on
+    // their way to the pipe, with the slots of the ring it refers to
+    sub_state_t state;
+    int closing; // Ended while ready, to be freed by its worker
+    struct session *prev, *next;
+    tfs_view *views;
+    size_t n_views, max_views;
+    size_t first, cur, off;
+    struct iovec *pieces;
+    size_t n_pieces, len;
+    size_t cursor; // Offset of the box up to where it has read messages
+    uint64_t seq;
+    size_t offset; // Of the box, where the next message to deliver starts
+    // Index of the cursor of its consumer (-1 if it is not named), kept as
+    // its messages are delivered, and the sequence number committed in it
+    int consumer;
+    uint64_t committed;
+    char box_name[P_BOX_NAME_SIZE + 1]; // With its /, for the cursor
+    // Member of a consumer group: the messages the group gave it (up to
+    // claim_end, which ends at claim_offset of the box), and where the ones
+    // delivered end (the others are given back if it leaves)
+    consumer_group_t *group;
+    struct session *group_prev, *group_next;
+    uint64_t claim_end;
+    size_t claim_offset;
+    _Atomic uint64_t delivered_seq;
+    size_t delivered_offset;
+    size_t counted; // Messages of the delivery added to the statistics
+    ring_slot_t *pins[DELIVERY_BATCH_IOVS];
+    size_t n_pins;
+    delivery_t delivery;
+} session_t;
+
+struct engine_worker {
+    pthread_t thread;
+    int epoll_fd;
+    int event_fd; // Signaled when sessions are added to the ready list
+    pthread_mutex_t ready_lock;
+    session_t *ready; // Subscriber sessions woken up, to be resumed
+    session_t *ended; // Sessions ended, to be freed
+    atomic_size_t delivered; // Messages delivered to subscribers
+    atomic_size_t wakeups;   // Subscriber sessions resumed once woken up
+};
+
+// Counters of the engine, to measure how subscribers are woken up
+typedef struct {
+    size_t messages; // Delivered to subscribers
+    size_t wakeups;  // Of subscriber sessions waiting for messages
+    size_t signals;  // Of workers, to resume the sessions woken up
+    size_t notifies; // Of boxes that had subscriber sessions waiting
+} engine_stats_t;
+
+// Starts the workers that run the sessions, for up to max_sessions at a time
+int engine_start(size_t workers, size_t max_sessions);
+
+// Starts a session for a publisher, which will be run by a worker, in the
+// given version of the protocol
+void publisher_session_start(char *pipe_name, char *box_name, int version);
+
+// Starts a session for a subscriber, which will be run by a worker, in the
+// given version of the protocol, from where its options ask (or where its
+// consumer left off)
+void subscriber_session_start(char *pipe_name, char *box_name, int version,
+                              p_sub_options const *options);
+
+// Gets the members of the consumer groups of a box, as the listing shows them,
+// in an array to be freed; returns how many there are
+size_t box_group_members(int box_id, p_group_member **members);
+
+// Frees the consumer groups of a box being removed (the ones with members are
+// freed as their last member leaves)
+void box_groups_close(int box_id);
+
+// Wakes the subscriber sessions waiting for messages in a box, once it has
+// new messages or is removed; it only takes the lock of the box if some are
+// waiting
+void box_wake(int box_id);
+
+// Returns the counters of the engine so far
+engine_stats_t engine_get_stats();
@@ -0,0 +1,53 @@
+#include "operations.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*Formats a backing file with an empty TFS image (and empties its journal,
+ * <image_path>.journal), to be used by mbroker*/
+
+static void print_usage() {
+    fprintf(stderr, "usage: mkfs <image_path> [<max_inode_count> "
+                    "<max_block_count> <block_size>]\n");
+}
+
+/*Parses a positive size argument*/
+static int parse_size(char const *arg, size_t *value) {
+    char *end;
+    unsigned long long parsed = strtoull(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed == 0) {
+        return -1;
+    }
+    *value = (size_t)parsed;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 5) {
+        print_usage();
+        exit(-1);
+    }
+
+    tfs_params params = tfs_default_params();
+    if (argc == 5 && (parse_size(argv[2], &params.max_inode_count) == -1 ||
+                      parse_size(argv[3], &params.max_block_count) == -1 ||
+                      parse_size(argv[4], &params.block_size) == -1)) {
+        print_usage();
+        exit(-1);
+    }
+
+    char journal_path[PATH_MAX];
+    snprintf(journal_path, sizeof(journal_path), "%s.journal", argv[1]);
+    params.journal_path = journal_path;
+
+    if (tfs_mkfs(argv[1], &params) == -1) {
+        fprintf(stderr, "[ERR]: failed to format %s\n", argv[1]);
+        exit(-1);
+    }
+
+    printf("%s: %zu inodes, %zu blocks of %zu bytes\n", argv[1],
+           params.max_inode_count, params.max_block_count, params.block_size);
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __PCQ_BATCH_H__
+#define __PCQ_BATCH_H__
+
+#include "producer-consumer.h"
+
+#include <stddef.h>
+
+// The batch operations of the producer-consumer queue (in a header of their
+// own, as producer-consumer.h must not change): they move as many elements
+// as they can with each CAS of the queue, and wake the threads sleeping on
+// the other side once for each of those
+
+// pcq_enqueue_batch: insert n elements at the front of the queue, in order
+//
+// If the queue is full, sleep until the queue has space (for some of them)
+int pcq_enqueue_batch(pc_queue_t *queue, void **elems, size_t n);
+
+// pcq_dequeue_batch: remove up to max elements from the back of the queue,
+// in order, returning how many (0 on error)
+//
+// If the queue is empty, sleep until the queue has an element
+size_t pcq_dequeue_batch(pc_queue_t *queue, void **elems, size_t max);
+
+#endif // __PCQ_BATCH_H__
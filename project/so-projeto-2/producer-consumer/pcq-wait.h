@@ -0,0 +1,48 @@
+#ifndef __PCQ_WAIT_H__
+#define __PCQ_WAIT_H__
+
+#include "producer-consumer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// How the threads of a producer-consumer queue wait: a thread that finds the
+// queue empty (or full) tries again spin_count times, pausing between tries,
+// and then parks on a futex. The other side only makes the system call to
+// wake it when some thread of its side is parked (or about to)
+
+// Tries before parking, by default (none with a single CPU, where the thread
+// that would end the wait cannot run while the other spins)
+#define PCQ_SPIN_DEFAULT 256
+
+// Buckets of the histogram of handoff times: bucket i counts the handoffs
+// that took less than 2^i ns (and at least 2^(i-1)), and the last one also
+// the longer ones
+#define PCQ_HANDOFF_BUCKETS 32
+
+typedef struct {
+    size_t spin_count;
+    // Whether the time each element waits in the queue (from being enqueued
+    // to being dequeued) is recorded
+    bool handoff_histogram;
+} pcq_wait_params_t;
+
+typedef struct {
+    size_t parks; // Times a thread slept on the futex
+    size_t wakes; // Times a thread made the system call to wake others
+    size_t handoffs[PCQ_HANDOFF_BUCKETS];
+} pcq_wait_stats_t;
+
+// pcq_default_wait_params: the parameters a queue is created with
+pcq_wait_params_t pcq_default_wait_params(void);
+
+// pcq_set_wait_params: set how the threads of a queue wait
+//
+// Must be called before the queue is used
+void pcq_set_wait_params(pc_queue_t *queue, pcq_wait_params_t const *params);
+
+// pcq_get_wait_stats: the times the threads of a queue parked and were
+// woken, and the histogram of handoff times (if they are recorded)
+pcq_wait_stats_t pcq_get_wait_stats(pc_queue_t *queue);
+
+#endif // __PCQ_WAIT_H__
@@ -1,152 +1,378 @@
+#define _GNU_SOURCE // syscall (futex)
 #include "producer-consumer.h"
 #include "betterassert.h"
+#include "pcq-batch.h"
+#include "pcq-wait.h"
 
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*The queue is a bounded lock-free ring for many producers and consumers
+ * (Vyukov's): pcq_head and pcq_tail are the positions where the next element
+ * is enqueued and dequeued, which only increase (a position is in the slot of
+ * its remainder by the capacity), and are taken with a CAS. Each slot has a
+ * sequence number that says whose turn it is: the producer of a position
+ * while it is twice the position, and its consumer once it is that plus 1
+ * (set as the element is in the slot), until the consumer sets it to twice
+ * the position of the next lap (twice, so that they differ even when the
+ * next lap is the next position, in a queue of a single slot). Threads only
+ * wait when the queue is empty or full, spinning for a while and then parking
+ * on the futex of their side (an eventcount: a thread counts itself as a
+ * waiter and marks the futex as parked before its last try, so a change made
+ * after that try also changes the futex, and it does not sleep). The other
+ * side only wakes them while the futex is marked, and a wake that wakes all
+ * the waiters unmarks it. pcq_buffer holds the ring; the locks, condvars
+ * and size of the struct (kept, as it must not change) are not used*/
+
+// A slot of the ring
+typedef struct {
+    size_t seq;
+    void *elem;
+    uint64_t stamp; // When the element was enqueued (if handoffs are recorded)
+} pcq_slot_t;
+
+// Where the threads of a side (producers or consumers) park
+typedef struct {
+    uint32_t futex;   // PCQ_PARKED, and a count of the wakes above it
+    uint32_t waiters; // Threads parked, or about to
+} pcq_park_t;
+
+// The bit of the futex set while threads may be parked on it
+#define PCQ_PARKED (1u)
+
+// Waiters a wake wakes all of (even if fewer elements, or slots, were made
+// available), so that it unmarks the futex, and the threads woken are not
+// woken again before they run (the ones that find nothing park again)
+#define PCQ_WAKE_ALL (16)
+
+// The ring, which pcq_buffer points to
+typedef struct {
+    pcq_wait_params_t params;
+    pcq_park_t producers; // Waiting for a free slot
+    pcq_park_t consumers; // Waiting for an element
+    size_t parks;
+    size_t wakes;
+    size_t handoffs[PCQ_HANDOFF_BUCKETS];
+    pcq_slot_t slots[];
+} pcq_ring_t;
+
+static pcq_ring_t *pcq_ring(pc_queue_t *queue) {
+    return (pcq_ring_t *)queue->pcq_buffer;
+}
 
-/*Functions that initialises the producer-consumer queue*/
-int pcq_create(pc_queue_t *queue, size_t capacity) {
-    // Creating the buffer which will hold the pointers
-    queue->pcq_buffer = (void **)malloc(capacity * sizeof(void *));
-
-    if (queue->pcq_buffer == NULL) { // Checks if it was created correctly
-        return -1;
-    }
-
-    queue->pcq_capacity = capacity;
-
-    // Initializes the various locks in the queue
-    if (pthread_mutex_init(&queue->pcq_current_size_lock, NULL) != 0)
-        return -1;
-    queue->pcq_current_size = 0;
+/*Function that reads the sequence number of the slot of a position*/
+static size_t pcq_seq(pc_queue_t *queue, size_t pos) {
+    return __atomic_load_n(
+        &pcq_ring(queue)->slots[pos % queue->pcq_capacity].seq,
+        __ATOMIC_ACQUIRE);
+}
 
-    if (pthread_mutex_init(&queue->pcq_head_lock, NULL) != 0)
-        return -1;
-    queue->pcq_head = 0;
+/*Function that tells the CPU the thread is spinning*/
+static inline void pcq_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
 
-    if (pthread_mutex_init(&queue->pcq_tail_lock, NULL) != 0)
-        return -1;
-    queue->pcq_tail = 0;
+static uint64_t pcq_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
 
-    if (pthread_mutex_init(&queue->pcq_pusher_condvar_lock, NULL) != 0)
-        return -1;
+/*Function that counts a handoff that took the given time in its bucket of
+ * the histogram*/
+static void pcq_record_handoff(pcq_ring_t *ring, uint64_t ns) {
+    size_t bucket = ns == 0 ? 0 : (size_t)(64 - __builtin_clzll(ns));
+    if (bucket >= PCQ_HANDOFF_BUCKETS) {
+        bucket = PCQ_HANDOFF_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&ring->handoffs[bucket], 1, __ATOMIC_RELAXED);
+}
 
-    if (pthread_cond_init(&queue->pcq_pusher_condvar, NULL) != 0)
-        return -1;
+/*Function that tries to add up to n pointers to the queue, in order, taking
+ * the positions of all of them with one CAS (those whose slots are free);
+ * returns how many it added, or 0 if it is full*/
+static size_t pcq_try_enqueue(pc_queue_t *queue, void **elems, size_t n) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    pcq_slot_t *slots = ring->slots;
+    size_t pos = __atomic_load_n(&queue->pcq_head, __ATOMIC_RELAXED);
+
+    while (1) {
+        pcq_slot_t *slot = &slots[pos % queue->pcq_capacity];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)(seq - 2 * pos);
+
+        if (diff < 0) {
+            return 0; // The element of the last lap was not dequeued
+        } else if (diff > 0) {
+            pos = __atomic_load_n(&queue->pcq_head, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // The slot is free for this position, and so may be the next ones
+        // (a free slot only changes once its position is taken)
+        size_t count = 1;
+        while (count < n && count < queue->pcq_capacity &&
+               pcq_seq(queue, pos + count) == 2 * (pos + count)) {
+            count++;
+        }
+
+        if (__atomic_compare_exchange_n(&queue->pcq_head, &pos, pos + count, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            uint64_t now = ring->params.handoff_histogram ? pcq_now_ns() : 0;
+            for (size_t i = 0; i < count; i++) {
+                slot = &slots[(pos + i) % queue->pcq_capacity];
+                slot->elem = elems[i];
+                slot->stamp = now;
+                __atomic_store_n(&slot->seq, 2 * (pos + i) + 1,
+                                 __ATOMIC_RELEASE);
+            }
+            return count;
+        } // Otherwise another producer took it, and pos is reloaded
+    }
+}
 
-    if (pthread_mutex_init(&queue->pcq_popper_condvar_lock, NULL) != 0)
-        return -1;
+/*Function that tries to remove up to n pointers from the queue, in order,
+ * taking the positions of all of them with one CAS (those whose elements are
+ * in their slots); returns how many it removed, or 0 if it is empty*/
+static size_t pcq_try_dequeue(pc_queue_t *queue, void **elems, size_t n) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    pcq_slot_t *slots = ring->slots;
+    size_t pos = __atomic_load_n(&queue->pcq_tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        pcq_slot_t *slot = &slots[pos % queue->pcq_capacity];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)(seq - (2 * pos + 1));
+
+        if (diff < 0) {
+            return 0; // No element was enqueued in this position yet
+        } else if (diff > 0) {
+            pos = __atomic_load_n(&queue->pcq_tail, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        size_t count = 1;
+        while (count < n && count < queue->pcq_capacity &&
+               pcq_seq(queue, pos + count) == 2 * (pos + count) + 1) {
+            count++;
+        }
+
+        if (__atomic_compare_exchange_n(&queue->pcq_tail, &pos, pos + count, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            uint64_t now = ring->params.handoff_histogram ? pcq_now_ns() : 0;
+            for (size_t i = 0; i < count; i++) {
+                slot = &slots[(pos + i) % queue->pcq_capacity];
+                elems[i] = slot->elem;
+                if (ring->params.handoff_histogram) {
+                    pcq_record_handoff(ring, now - slot->stamp);
+                }
+                __atomic_store_n(&slot->seq,
+                                 2 * (pos + i + queue->pcq_capacity),
+                                 __ATOMIC_RELEASE);
+            }
+            return count;
+        }
+    }
+}
 
-    if (pthread_cond_init(&queue->pcq_popper_condvar, NULL) != 0)
-        return -1;
+/*Function that moves some of the given elements with try (at least one),
+ * trying again spin_count times if it cannot, and then parking the thread on
+ * the given side until the other side changes the queue*/
+static size_t pcq_wait(pc_queue_t *queue,
+                       size_t (*try)(pc_queue_t *, void **, size_t),
+                       pcq_park_t *park, void **elems, size_t n) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    size_t moved;
+
+    for (size_t i = 0; i < ring->params.spin_count; i++) {
+        pcq_pause();
+        if ((moved = try(queue, elems, n)) > 0) {
+            return moved;
+        }
+    }
 
-    return 0;
+    while (1) {
+        // Counted as a waiter (and the futex marked) before the last try,
+        // so that the other side, if it changes the queue after it, changes
+        // the futex and wakes it
+        __atomic_fetch_add(&park->waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t futex =
+            __atomic_or_fetch(&park->futex, PCQ_PARKED, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        moved = try(queue, elems, n);
+        if (moved == 0) {
+            __atomic_fetch_add(&ring->parks, 1, __ATOMIC_RELAXED);
+            syscall(SYS_futex, &park->futex, FUTEX_WAIT_PRIVATE, futex, NULL,
+                    NULL, 0);
+        }
+
+        __atomic_fetch_sub(&park->waiters, 1, __ATOMIC_RELAXED);
+        if (moved > 0) {
+            return moved;
+        }
+    }
 }
 
-/*Functions that destroys the producer-consumer queue*/
-int pcq_destroy(pc_queue_t *queue) {
-    free(queue->pcq_buffer); // Frees the buffer which holds the pointers
+/*Function that wakes the threads parked on a side, one for each of the
+ * elements (or slots) made available; unless the futex is marked as parked,
+ * it makes no system call*/
+static void pcq_wake(pcq_ring_t *ring, pcq_park_t *park, size_t count) {
+    // Orders the change of the queue before reading the futex (which the
+    // waiters mark before trying)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t futex = __atomic_load_n(&park->futex, __ATOMIC_SEQ_CST);
+    uint32_t waiters, wake, next;
+    do {
+        if (!(futex & PCQ_PARKED)) {
+            return;
+        }
+
+        // A wake that wakes all the waiters unmarks the futex
+        waiters = __atomic_load_n(&park->waiters, __ATOMIC_SEQ_CST);
+        wake = count < waiters && waiters > PCQ_WAKE_ALL ? (uint32_t)count
+                                                         : waiters;
+        next = futex + 2;
+        if (wake == waiters) {
+            next &= ~PCQ_PARKED;
+        }
+    } while (!__atomic_compare_exchange_n(&park->futex, &futex, next, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    if (wake > 0) {
+        __atomic_fetch_add(&ring->wakes, 1, __ATOMIC_RELAXED);
+        syscall(SYS_futex, &park->futex, FUTEX_WAKE_PRIVATE, wake, NULL, NULL,
+                0);
+    }
+}
 
-    // Destroy the various locks of the queue
-    if (pthread_mutex_destroy(&queue->pcq_current_size_lock) != 0)
-        return -1;
+pcq_wait_params_t pcq_default_wait_params(void) {
+    return (pcq_wait_params_t){
+        .spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? PCQ_SPIN_DEFAULT : 0,
+        .handoff_histogram = false,
+    };
+}
 
-    if (pthread_mutex_destroy(&queue->pcq_head_lock) != 0)
-        return -1;
+void pcq_set_wait_params(pc_queue_t *queue, pcq_wait_params_t const *params) {
+    pcq_ring(queue)->params = *params;
+}
 
-    if (pthread_mutex_destroy(&queue->pcq_tail_lock) != 0)
-        return -1;
+pcq_wait_stats_t pcq_get_wait_stats(pc_queue_t *queue) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    pcq_wait_stats_t stats;
+    stats.parks = __atomic_load_n(&ring->parks, __ATOMIC_RELAXED);
+    stats.wakes = __atomic_load_n(&ring->wakes, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < PCQ_HANDOFF_BUCKETS; i++) {
+        stats.handoffs[i] =
+            __atomic_load_n(&ring->handoffs[i], __ATOMIC_RELAXED);
+    }
+    return stats;
+}
 
-    if (pthread_mutex_destroy(&queue->pcq_pusher_condvar_lock) != 0)
+/*Functions that initialises the producer-consumer queue*/
+int pcq_create(pc_queue_t *queue, size_t capacity) {
+    if (capacity == 0) {
         return -1;
+    }
 
-    if (pthread_cond_destroy(&queue->pcq_pusher_condvar) != 0)
-        return -1;
+    // Creating the ring, with each slot free for the position of the first
+    // lap
+    pcq_ring_t *ring = (pcq_ring_t *)calloc(
+        1, sizeof(pcq_ring_t) + capacity * sizeof(pcq_slot_t));
 
-    if (pthread_mutex_destroy(&queue->pcq_popper_condvar_lock) != 0)
+    if (ring == NULL) { // Checks if it was created correctly
         return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        ring->slots[i].seq = 2 * i;
+    }
+    ring->params = pcq_default_wait_params();
 
-    if (pthread_cond_destroy(&queue->pcq_popper_condvar) != 0)
-        return -1;
+    queue->pcq_buffer = (void **)ring;
+    queue->pcq_capacity = capacity;
+    queue->pcq_current_size = 0;
+    queue->pcq_head = 0;
+    queue->pcq_tail = 0;
 
     return 0;
 }
 
-/*Function that adds pointers to the queue*/
-int pcq_enqueue(pc_queue_t *queue, void *elem) {
-    // Locks the lock associated to the condvar pusher
-    if (pthread_mutex_lock(&queue->pcq_pusher_condvar_lock) != 0)
-        return -1;
-
-    // If the queue is full, the request will be blocked
-    while (queue->pcq_current_size == queue->pcq_capacity)
-        pthread_cond_wait(&queue->pcq_pusher_condvar,
-                          &queue->pcq_pusher_condvar_lock);
-
-    // Locks the head of the queue, to add the new element
-    if (pthread_mutex_lock(&queue->pcq_head_lock) != 0)
-        return -1;
-    queue->pcq_buffer[queue->pcq_head] = elem;
-
-    queue->pcq_head = (queue->pcq_head + 1) % queue->pcq_capacity;
-    pthread_mutex_unlock(&queue->pcq_head_lock);
-
-    // Locks to change the size of the pcq
-    if (pthread_mutex_lock(&queue->pcq_current_size_lock) != 0)
-        return -1;
+/*Functions that destroys the producer-consumer queue*/
+int pcq_destroy(pc_queue_t *queue) {
+    free(queue->pcq_buffer); // Frees the ring
 
-    queue->pcq_current_size++;
+    return 0;
+}
 
-    if (pthread_mutex_unlock(&queue->pcq_current_size_lock) != 0)
-        return -1;
+/*Function that adds some of the given pointers to the queue (at least one,
+ * waiting while it is full); returns how many*/
+static size_t pcq_enqueue_some(pc_queue_t *queue, void **elems, size_t n) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    size_t added = pcq_try_enqueue(queue, elems, n);
+    if (added == 0) {
+        added = pcq_wait(queue, pcq_try_enqueue, &ring->producers, elems, n);
+    }
 
-    // Signals the function pcq_dequeue, so that the request may continue
-    if (pthread_cond_signal(&queue->pcq_popper_condvar) != 0)
-        return -1;
+    // Wakes the consumers waiting for elements, so that the requests may
+    // continue
+    pcq_wake(ring, &ring->consumers, added);
+    return added;
+}
 
-    if (pthread_mutex_unlock(&queue->pcq_pusher_condvar_lock) != 0)
-        return -1;
+/*Function that removes some pointers from the queue (at least one, waiting
+ * while it is empty), up to n; returns how many*/
+static size_t pcq_dequeue_some(pc_queue_t *queue, void **elems, size_t n) {
+    pcq_ring_t *ring = pcq_ring(queue);
+    size_t removed = pcq_try_dequeue(queue, elems, n);
+    if (removed == 0) {
+        removed = pcq_wait(queue, pcq_try_dequeue, &ring->consumers, elems, n);
+    }
 
-    return 0;
+    // Wakes the producers waiting for free slots
+    pcq_wake(ring, &ring->producers, removed);
+    return removed;
+}
+/*Function that adds pointers to the queue*/
+int pcq_enqueue(pc_queue_t *queue, void *elem) {
+    return pcq_enqueue_some(queue, &elem, 1) == 1 ? 0 : -1;
 }
 
 /*Function that removers pointers from the queue*/
 void *pcq_dequeue(pc_queue_t *queue) {
     void *res;
-    // Locks the lock associated to the condvar popper
-    if (pthread_mutex_lock(&queue->pcq_popper_condvar_lock) != 0)
-        return NULL;
-
-    // If the queue is empty, the request will be blocked
-    while (queue->pcq_current_size == 0)
-        pthread_cond_wait(&queue->pcq_popper_condvar,
-                          &queue->pcq_popper_condvar_lock);
-
-    // Locks the tail so that it acqueires the pointer
-    if (pthread_mutex_lock(&queue->pcq_tail_lock) != 0)
+    if (pcq_dequeue_some(queue, &res, 1) != 1)
         return NULL;
 
-    res = queue->pcq_buffer[queue->pcq_tail];
-
-    queue->pcq_tail = (queue->pcq_tail + 1) % queue->pcq_capacity;
-
-    pthread_mutex_unlock(&queue->pcq_tail_lock);
-
-    // Locks the size to reduce it
-    if (pthread_mutex_lock(&queue->pcq_current_size_lock) != 0)
-        return NULL;
-
-    queue->pcq_current_size--;
+    return res;
+}
 
-    if (pthread_mutex_unlock(&queue->pcq_current_size_lock) != 0)
-        return NULL;
+/*Function that adds many pointers to the queue, a batch at a time*/
+int pcq_enqueue_batch(pc_queue_t *queue, void **elems, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        size_t added = pcq_enqueue_some(queue, elems + done, n - done);
+        if (added == 0)
+            return -1;
 
-    // Signals the function pcq_enqueue, so that the request may continue
-    if (pthread_cond_signal(&queue->pcq_pusher_condvar) != 0)
-        return NULL;
+        done += added;
+    }
+    return 0;
+}
 
-    if (pthread_mutex_unlock(&queue->pcq_popper_condvar_lock) != 0)
-        return NULL;
+/*Function that removes the pointers waiting in the queue, up to max*/
+size_t pcq_dequeue_batch(pc_queue_t *queue, void **elems, size_t max) {
+    if (max == 0)
+        return 0;
 
-    return res;
-}
\ No newline at end of file
+    return pcq_dequeue_some(queue, elems, max);
+}
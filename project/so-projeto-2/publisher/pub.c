@@ -3,26 +3,46 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 char tmp_pipe_name[P_PIPE_NAME_SIZE + 5]; // Full name of the pipe
 int pipe_status = 0;                      // If the pipe is open or not
 int pipe_fd;                              // File descriptor of the pipe
+int version = P_V2; // Version of the protocol used with mbroker
+
+// In v2, messages are sent in batches, once they take batch_size bytes (0 to
+// send each on its own), or the first has waited linger_ms for others
+size_t batch_size = 16 * 1024;
+long linger_ms = 5;
+p_pub_batch batch;
+struct timespec batch_deadline; // When the batch is sent
+
+char in[64 * 1024];      // What was read from stdin, split in lines as needed
+size_t in_start, in_end; // What is left of it to be taken
+int in_eof = 0;          // Whether stdin has ended
 
 /*Function that register the publisher in mbroker*/
 void register_in_mbroker(char *register_pipename, char *pipe_name,
                          char *box_name) {
-    char register_code[P_PUB_REGISTER_SIZE];
+    char register_code[P_V2_FRAME_MAX_SIZE];
     char register_pn[P_PIPE_NAME_SIZE + 5] = {
         0}; // Pipe name of the register pipe
 
     // Creating the code according to the protocol
-    p_build_pub_register(register_code, pipe_name, box_name);
+    size_t register_size = P_PUB_REGISTER_SIZE;
+    if (version == P_V2) {
+        register_size = p_v2_build_request(register_code, P_PUB_REGISTER_CODE,
+                                           pipe_name, box_name);
+    } else {
+        p_build_pub_register(register_code, pipe_name, box_name);
+    }
     // To open the pipe in tmp directory
     sprintf(register_pn, "/tmp/%s", register_pipename);
 
@@ -32,10 +52,9 @@ void register_in_mbroker(char *register_pipename, char *pipe_name,
         exit(-1);
     }
     // Writing the code to the register pipe
-    ssize_t bytes_wr =
-        write(register_pipe_fd, register_code, P_PUB_REGISTER_SIZE);
+    ssize_t bytes_wr = write(register_pipe_fd, register_code, register_size);
 
-    if (bytes_wr != P_PUB_REGISTER_SIZE) { // Chekcks if the code was fully sent
+    if (bytes_wr != register_size) { // Chekcks if the code was fully sent
         exit(-1);
     }
 
@@ -45,18 +64,124 @@ void register_in_mbroker(char *register_pipename, char *pipe_name,
 }
 /*Function that creates the code to send the message*/
 void send_message_to_mbroker(char *message) {
-    char message_code[P_PUB_MESSAGE_SIZE] = {0};
+    char message_code[P_V2_FRAME_MAX_SIZE] = {0};
 
-    // Creating the code
-    p_build_pub_message(message_code, message);
+    // Creating the code, which in v2 only takes the length of the message
+    size_t message_size = P_PUB_MESSAGE_SIZE;
+    if (version == P_V2) {
+        message_size =
+            p_v2_build_message(message_code, P_PUB_MESSAGE_CODE, message);
+    } else {
+        p_build_pub_message(message_code, message);
+    }
 
     // Writing the code to the associated pipe
-    ssize_t bytes_wr = write(pipe_fd, message_code, P_PUB_MESSAGE_SIZE);
-    if (bytes_wr != P_PUB_MESSAGE_SIZE) {
+    ssize_t bytes_wr = write(pipe_fd, message_code, message_size);
+    if (bytes_wr != message_size) {
         exit(-1);
     };
 }
 
+/*Function that sends the batch of messages, if it has any*/
+void send_batch() {
+    if (batch.messages == 0) {
+        return;
+    }
+
+    size_t size = p_pub_batch_finish(&batch);
+    if (write(pipe_fd, batch.frame, size) != size) {
+        exit(-1);
+    }
+    p_pub_batch_init(&batch);
+}
+
+/*Function that sends a message, in the batch unless batches are not used*/
+void queue_message(char *message) {
+    if (version == P_V1 || batch_size == 0) {
+        send_message_to_mbroker(message);
+        return;
+    }
+
+    if (p_pub_batch_add(&batch, message) == -1) { // In case it is full
+        send_batch();
+        p_pub_batch_add(&batch, message);
+    }
+    if (batch.messages == 1) { // The first message waits up to linger_ms
+        clock_gettime(CLOCK_MONOTONIC, &batch_deadline);
+        batch_deadline.tv_sec += linger_ms / 1000;
+        batch_deadline.tv_nsec += (linger_ms % 1000) * 1000000;
+        if (batch_deadline.tv_nsec >= 1000000000) {
+            batch_deadline.tv_sec++;
+            batch_deadline.tv_nsec -= 1000000000;
+        }
+    }
+    if (batch.length >= batch_size) {
+        send_batch();
+    }
+}
+
+/*Function that returns the milliseconds left until the batch is sent*/
+int batch_timeout() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (batch_deadline.tv_sec - now.tv_sec) * 1000 +
+              (batch_deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+    return ms < 0 ? 0 : (int)ms;
+}
+
+/*Function that takes the next line read from stdin as a message (as fgets
+ * would, up to P_MESSAGE_SIZE - 1 bytes, leaving out its last character);
+ * returns 0 if there is no whole line to take*/
+int next_line(char message[P_MESSAGE_SIZE]) {
+    size_t left = in_end - in_start;
+    size_t max = left < P_MESSAGE_SIZE - 1 ? left : P_MESSAGE_SIZE - 1;
+    char *new_line = memchr(in + in_start, '\n', max);
+
+    size_t len;
+    if (new_line != NULL) {
+        len = (size_t)(new_line - (in + in_start)) + 1;
+    } else if (max == P_MESSAGE_SIZE - 1 || (in_eof && max > 0)) {
+        len = max;
+    } else {
+        return 0;
+    }
+
+    memcpy(message, in + in_start, len - 1);
+    message[len - 1] = '\0';
+    in_start += len;
+    return 1;
+}
+
+/*Function that reads from stdin, waiting up to timeout milliseconds (or
+ * forever, if -1); returns 0 if nothing arrived in time*/
+int read_stdin(int timeout) {
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    int ret = poll(&pfd, 1, timeout);
+    if (ret == 0 || (ret == -1 && errno == EINTR)) {
+        return 0;
+    }
+    if (ret == -1) {
+        exit(-1);
+    }
+
+    memmove(in, in + in_start, in_end - in_start);
+    in_end -= in_start;
+    in_start = 0;
+
+    ssize_t bytes_read = read(STDIN_FILENO, in + in_end, sizeof(in) - in_end);
+    if (bytes_read == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        exit(-1);
+    }
+    if (bytes_read == 0) {
+        in_eof = 1;
+    }
+    in_end += (size_t)bytes_read;
+    return 1;
+}
+
 /*Signal handler to handle the signals SIGPIPE AND SIGINT
 (SIGINT was not specified to be handled in publisher,
 but we did for simplicity)*/
@@ -84,6 +209,12 @@ static void signal_handler(int sig) {
     }
 }
 
+/*Function that shows how to run the publisher*/
+static void print_usage() {
+    fprintf(stderr, "usage: pub [-v 1|2] [-b <batch_bytes>] [-l <linger_ms>] "
+                    "<register_pipe_name> <box_name>\n");
+}
+
 int main(int argc, char **argv) {
     char pipe_name[P_PIPE_NAME_SIZE];
     pid_t pid;
@@ -100,8 +231,39 @@ int main(int argc, char **argv) {
         exit(-1);
     }
 
+    int opt;
+    while ((opt = getopt(argc, argv, "v:b:l:")) != -1) {
+        switch (opt) {
+        case 'v': // Version of the protocol
+            version = p_version_parse(optarg);
+            if (version == -1) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'b': // Bytes of messages a batch is sent at
+            if (sscanf(optarg, "%zu", &batch_size) != 1) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'l': // Time the first message of a batch waits for others
+            if (sscanf(optarg, "%ld", &linger_ms) != 1 || linger_ms < 0) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    // The positional arguments are left as if there were no options
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc != 4) { // Verifying the correct usage of arguments
-        fprintf(stderr, "usage: pub <register_pipe_name> <box_name>\n");
+        print_usage();
         exit(-1);
     }
 
@@ -109,7 +271,7 @@ int main(int argc, char **argv) {
         (strlen(argv[2]) > P_PIPE_NAME_SIZE - 6) ||
         (strlen(argv[3]) >
          P_BOX_NAME_SIZE - 1)) { // Verifying the correct usage of arguments
-        fprintf(stderr, "usage: pub <register_pipe_name> <box_name>\n");
+        print_usage();
         exit(-1);
     }
 
@@ -146,17 +308,24 @@ int main(int argc, char **argv) {
     pipe_status = 1; // Changes to 1 if the pipe is open
 
     char message[P_MESSAGE_SIZE];
+    p_pub_batch_init(&batch);
     while (1) {
         // Read the message from stdin
-        memset(message, 0, P_MESSAGE_SIZE);
-        // Fails if it reads EOF
-        if (fgets(message, P_MESSAGE_SIZE, stdin) == NULL) {
+        if (next_line(message)) {
+            queue_message(message);
+            continue;
+        }
+        if (in_eof) {
             break;
         }
-        size_t new_line = strlen(message);
-        message[new_line - 1] = '\0';
-        send_message_to_mbroker(message);
+
+        // Waits for more lines, up to when the batch has to be sent
+        int timeout = batch.messages > 0 ? batch_timeout() : -1;
+        if (timeout == 0 || !read_stdin(timeout)) {
+            send_batch();
+        }
     }
+    send_batch();
 
     raise(SIGINT); // To close the publisher session in the manner we want
 
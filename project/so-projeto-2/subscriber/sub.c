@@ -3,6 +3,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,16 +15,28 @@ char tmp_pipe_name[P_PIPE_NAME_SIZE + 5]; // Full name of the pipe
 char number_of_messages[20] = "0"; // String with the total number of messages
 int pipe_status = 0;               // If the pipe is open or not
 int pipe_fd;                       // File descriptor of the pipe
+int version = P_V2; // Version of the protocol used with mbroker
+p_sub_options options; // Where it starts in the box, and its consumer name
+int has_options = 0;   // If any were given (only v2 carries them)
+
+char in[64 * 1024]; // Frames read from the pipe, which arrive in batches
+size_t in_start, in_end; // What is left of them to be taken
 
 /*Funtion that register the subscriber in mbroker*/
 void register_in_mbroker(char *register_pipename, char *pipe_name,
                          char *box_name) {
 
-    char register_code[P_SUB_REGISTER_SIZE];
+    char register_code[P_V2_FRAME_MAX_SIZE];
     char register_pn[P_PIPE_NAME_SIZE + 5] = {0};
 
     // Creating the code according to the protocol
-    p_build_sub_register(register_code, pipe_name, box_name);
+    size_t register_size = P_SUB_REGISTER_SIZE;
+    if (version == P_V2) {
+        register_size = p_v2_build_sub_register(register_code, pipe_name,
+                                                box_name, &options);
+    } else {
+        p_build_sub_register(register_code, pipe_name, box_name);
+    }
     sprintf(register_pn, "/tmp/%s", register_pipename);
 
     // Open register pipe
@@ -32,11 +45,10 @@ void register_in_mbroker(char *register_pipename, char *pipe_name,
         exit(-1);
     }
     // Writing the code to the register pipe
-    ssize_t bytes_wr =
-        write(register_pipe_fd, register_code, P_SUB_REGISTER_SIZE);
+    ssize_t bytes_wr = write(register_pipe_fd, register_code, register_size);
 
-    if (bytes_wr != P_SUB_REGISTER_SIZE) { // Verifying if the code was sent
-                                           // completely to the pipe
+    if (bytes_wr != register_size) { // Verifying if the code was sent
+                                     // completely to the pipe
         exit(-1);
     }
 
@@ -45,6 +57,77 @@ void register_in_mbroker(char *register_pipename, char *pipe_name,
     }
 }
 
+/*Function that takes the next size bytes read from the pipe, reading as many
+ * as fit in the buffer when it has fewer, as frames delivered in batches may
+ * arrive in parts; returns the bytes taken (pointing bytes to them), 0 if the
+ * pipe was closed, or -1 on error*/
+ssize_t read_bytes(int fd, size_t size, char **bytes) {
+    if (in_end - in_start < size) {
+        memmove(in, in + in_start, in_end - in_start);
+        in_end -= in_start;
+        in_start = 0;
+    }
+    while (in_end - in_start < size) {
+        ssize_t bytes_read = read(fd, in + in_end, sizeof(in) - in_end);
+        if (bytes_read == 0) {
+            return 0;
+        }
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        in_end += (size_t)bytes_read;
+    }
+
+    *bytes = in + in_start;
+    in_start += size;
+    return (ssize_t)size;
+}
+
+/*Function that reads the next message from the pipe, in the version of the
+ * protocol used, pointing message to it (of the given length, without a \0);
+ * returns 1, 0 if the pipe was closed, or -1 on error*/
+int read_message(int fd, char **message, size_t *length) {
+    char *frame;
+    ssize_t bytes_read;
+
+    if (version == P_V2) {
+        p_v2_header header;
+        bytes_read = read_bytes(fd, P_V2_HEADER_SIZE, &frame);
+        if (bytes_read <= 0) {
+            return (int)bytes_read;
+        }
+        memcpy(&header, frame, P_V2_HEADER_SIZE);
+        // Checks if the header is not corrupted
+        if (header.magic != P_V2_MAGIC ||
+            header.protocol_code != P_SUB_MESSAGE_CODE ||
+            header.length > P_MESSAGE_SIZE - 1) {
+            exit(-1);
+        }
+        *length = header.length;
+        if (header.length == 0) {
+            *message = frame;
+            return 1;
+        }
+        bytes_read = read_bytes(fd, header.length, message);
+        return bytes_read <= 0 ? (int)bytes_read : 1;
+    }
+
+    bytes_read = read_bytes(fd, P_SUB_MESSAGE_SIZE, &frame);
+    if (bytes_read <= 0) {
+        return (int)bytes_read;
+    }
+    // Checks if the code is not corrupted
+    if (frame[0] != P_SUB_MESSAGE_CODE) {
+        exit(-1);
+    }
+    *message = frame + 1;
+    *length = strnlen(*message, P_MESSAGE_SIZE);
+    return 1;
+}
+
 /*Signal handler to handle the signals SIGPIPE AND SIGINT*/
 static void signal_handler(int sig) {
     if (pipe_status == 1) { // if the pipe is open, closes it
@@ -76,6 +159,13 @@ static void signal_handler(int sig) {
     }
 }
 
+/*Function that shows how to run the subscriber*/
+static void print_usage() {
+    fprintf(stderr, "usage: sub [-v 1|2] [-f earliest|latest|<seq>] "
+                    "[-c <consumer> | -g <group>] <register_pipe_name> "
+                    "<pipe_name> <box_name>\n");
+}
+
 int main(int argc, char **argv) {
     char pipe_name[P_PIPE_NAME_SIZE] = {0};
     pid_t pid;
@@ -90,8 +180,63 @@ int main(int argc, char **argv) {
         exit(-1);
     }
 
+    p_sub_options_init(&options);
+    int opt;
+    while ((opt = getopt(argc, argv, "v:f:c:g:")) != -1) {
+        switch (opt) {
+        case 'v': // Version of the protocol
+            version = p_version_parse(optarg);
+            if (version == -1) {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'f': // Where it starts in the box
+            has_options = 1;
+            if (strcmp(optarg, "earliest") == 0) {
+                options.from = P_SUB_FROM_EARLIEST;
+            } else if (strcmp(optarg, "latest") == 0) {
+                options.from = P_SUB_FROM_LATEST;
+            } else if (sscanf(optarg, "%" SCNu64, &options.seq) == 1) {
+                options.from = P_SUB_FROM_SEQ;
+            } else {
+                print_usage();
+                exit(-1);
+            }
+            break;
+        case 'c': // Name of the consumer, to resume where it left off
+            has_options = 1;
+            if (strlen(optarg) > P_BOX_NAME_SIZE - 1) {
+                print_usage();
+                exit(-1);
+            }
+            strcpy(options.consumer, optarg);
+            break;
+        case 'g': // Consumer group, whose members share the messages
+            has_options = 1;
+            if (strlen(optarg) == 0 || strlen(optarg) > P_BOX_NAME_SIZE - 1) {
+                print_usage();
+                exit(-1);
+            }
+            strcpy(options.group, optarg);
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    // v1 has no room for options, and members of a group start where it is
+    if ((has_options && version != P_V2) ||
+        (options.consumer[0] != '\0' && options.group[0] != '\0')) {
+        print_usage();
+        exit(-1);
+    }
+    // The positional arguments are left as if there were no options
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc != 4) { // Verifying the correct usage of arguments
-        fprintf(stderr, "usage: sub <register_pipe_name> <box_name>\n");
+        print_usage();
         exit(-1);
     }
 
@@ -99,7 +244,7 @@ int main(int argc, char **argv) {
         (strlen(argv[2]) > P_PIPE_NAME_SIZE - 6) ||
         (strlen(argv[3]) >
          P_BOX_NAME_SIZE - 1)) { // Verifying the correct usage of arguments
-        fprintf(stderr, "usage: sub <register_pipe_name> <box_name>\n");
+        print_usage();
         exit(-1);
     }
 
@@ -135,33 +280,13 @@ int main(int argc, char **argv) {
 
     pipe_status = 1; // Changes to one if the pipe is opened
 
-    char message[P_MESSAGE_SIZE]; // Array that will hold the messages
-    memset(message, 0, P_MESSAGE_SIZE);
     while (1) {
-        uint8_t code;
         int msg_count;
-        // reads from the pipe the protocol code
-        ssize_t bytes_read = read(pipe_fd, &code, 1);
-        if (bytes_read != 1) {
-            if (bytes_read == 0) { // if the pipe is closed, exits the program
-                raise(SIGINT);
-            }
-
-            // If an error ocurred in mbroker, most likely a problem with the
-            // box chosen
-            fprintf(stderr, "Unable to read from the box\n");
-            exit(-1);
-        }
-
-        // Checks if the code is not corrupted
-        if (code != P_SUB_MESSAGE_CODE) {
-            exit(-1);
-        }
-
-        // Reads the message
-        bytes_read = read(pipe_fd, message, P_MESSAGE_SIZE);
-        if (bytes_read != P_MESSAGE_SIZE) {
-            if (bytes_read == 0) { // if the pipe is closed, exits the program
+        char *message;
+        size_t length;
+        int ret = read_message(pipe_fd, &message, &length);
+        if (ret != 1) {
+            if (ret == 0) { // if the pipe is closed, exits the program
                 raise(SIGINT);
             }
 
@@ -171,7 +296,7 @@ int main(int argc, char **argv) {
             exit(-1);
         }
 
-        printf("%s\n", message);
+        printf("%.*s\n", (int)length, message);
         // Augments by one the number of messages read
         sscanf(number_of_messages, "%d", &msg_count);
         sprintf(number_of_messages, "%d", msg_count + 1);
@@ -0,0 +1,101 @@
+#include "mbroker/registry.h"
+#include "protocol.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test registers boxes, checking that they are only found once published,
+ * that a name is only taken once, that indexes are taken from the lowest up
+ * and reused once given back, and that they run out. Then threads look up
+ * boxes that stay while others are removed and created again, and must
+ * always find the ones that stay*/
+
+#define BOXES (256)
+#define THREADS (4)
+#define ROUNDS (2000)
+
+static atomic_int done;
+
+static void name_of(char *name, int i) {
+    snprintf(name, P_BOX_NAME_SIZE, "box%d", i);
+}
+
+void *looker(void *arg) {
+    (void)arg;
+    char name[P_BOX_NAME_SIZE];
+    while (!atomic_load(&done)) {
+        for (int i = 0; i < BOXES; i += 2) { // The boxes that stay
+            name_of(name, i);
+            assert(registry_lookup(name) == i);
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    assert(registry_init(BOXES) == 0);
+    char name[P_BOX_NAME_SIZE];
+
+    // A box is found once published
+    assert(registry_alloc() == 0);
+    assert(registry_reserve("box0", 0) == 0);
+    assert(registry_lookup("box0") == -1);
+    assert(registry_reserve("box0", 1) == -1); // Being created
+    assert(registry_remove("box0") == -1);
+    registry_publish(0);
+    assert(registry_lookup("box0") == 0);
+    assert(registry_lookup("box") == -1 && registry_lookup("box00") == -1);
+
+    // A reservation given up on leaves the name free
+    assert(registry_alloc() == 1);
+    assert(registry_reserve("other", 1) == 0);
+    registry_cancel(1);
+    assert(registry_lookup("other") == -1);
+    assert(registry_reserve("other", 1) == 0);
+    registry_cancel(1);
+    registry_free(1);
+
+    // The indexes run out, and are reused
+    for (int i = 1; i < BOXES; i++) {
+        assert(registry_alloc() == i);
+        name_of(name, i);
+        assert(registry_reserve(name, i) == 0);
+        registry_publish(i);
+    }
+    assert(registry_alloc() == -1);
+    assert(registry_remove("box7") == 7);
+    assert(registry_remove("box7") == -1);
+    assert(registry_lookup("box7") == -1);
+    registry_free(7);
+    assert(registry_alloc() == 7);
+    assert(registry_reserve("box7", 7) == 0);
+    registry_publish(7);
+
+    // Lookups run while other boxes come and go
+    pthread_t threads[THREADS];
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, looker, NULL) == 0);
+    }
+    for (int round = 0; round < ROUNDS; round++) {
+        int i = 1 + 2 * (round % (BOXES / 2)); // One of the boxes that go
+        name_of(name, i);
+        int box_id = registry_remove(name);
+        assert(box_id == i);
+        registry_free(box_id);
+        box_id = registry_alloc();
+        assert(box_id == i && registry_reserve(name, box_id) == 0);
+        registry_publish(box_id);
+    }
+    atomic_store(&done, 1);
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    registry_destroy();
+
+    printf("Successful test.\n");
+
+    return 0;
+}
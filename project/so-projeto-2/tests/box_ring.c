@@ -0,0 +1,115 @@
+#include "mbroker/ring.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*This test publishes messages in the ring of a box, and checks that they are
+ * found by their sequence numbers while they are in it, that a pinned slot is
+ * not overwritten (its new message is left out of the ring), that the end of
+ * the box follows them, and that the numbers keep increasing for the next
+ * box. Then a subscriber thread follows a publisher, and must only ever see
+ * the messages it asked for*/
+
+#define MESSAGES (100000)
+
+static void message(uint64_t seq, char *buffer) {
+    snprintf(buffer, 32, "message %llu", (unsigned long long)seq);
+}
+
+// Publishes the next message, which tells its sequence number
+static void publish(box_ring_t *ring) {
+    char buffer[32];
+    message(atomic_load(&ring->head), buffer);
+    ring_publish(ring, buffer, strlen(buffer) + 1);
+}
+
+static int holds(ring_slot_t const *slot, uint64_t seq) {
+    char buffer[32];
+    message(seq, buffer);
+    return slot->frame[0] == P_SUB_MESSAGE_CODE &&
+           slot->len == strlen(buffer) + 1 &&
+           strcmp(slot->frame + 1, buffer) == 0;
+}
+
+static void *follow(void *arg) {
+    box_ring_t *ring = arg;
+    uint64_t seq = ring->base;
+
+    while (seq < ring->base + MESSAGES) {
+        if (seq >= atomic_load(&ring->head)) {
+            continue; // Waits for the publisher
+        }
+        ring_slot_t *slot = ring_pin(ring, seq);
+        if (slot != NULL) {
+            assert(holds(slot, seq));
+            ring_unpin(slot);
+        }
+        seq++;
+    }
+
+    return NULL;
+}
+
+int main() {
+    box_ring_t *ring = ring_create();
+    assert(ring != NULL);
+
+    // Messages recovered with the box are only in the box
+    ring_open(ring, 3, 30);
+    assert(ring->base == 0 && atomic_load(&ring->head) == 3);
+    assert(ring_pin(ring, 0) == NULL);
+    uint64_t end_seq, end_offset;
+    ring_end(ring, &end_seq, &end_offset);
+    assert(end_seq == 3 && end_offset == 30);
+
+    publish(ring); // "message 3", with its \0
+    ring_end(ring, &end_seq, &end_offset);
+    assert(end_seq == 4 && end_offset == 40);
+    for (uint64_t seq = 4; seq < 3 + RING_SLOTS; seq++) {
+        publish(ring);
+    }
+    ring_slot_t *pinned = ring_pin(ring, 3);
+    assert(pinned != NULL && holds(pinned, 3));
+    ring_slot_t *last = ring_pin(ring, 2 + RING_SLOTS);
+    assert(last != NULL && holds(last, 2 + RING_SLOTS));
+    ring_unpin(last);
+
+    // The pinned slot keeps its message, and the new one is left out
+    publish(ring);
+    assert(holds(pinned, 3));
+    assert(ring_pin(ring, 3 + RING_SLOTS) == NULL);
+    ring_unpin(pinned);
+    assert(ring_pin(ring, 3) == NULL); // It was invalidated
+
+    // Once unpinned, the slot is used again
+    for (uint64_t seq = 4 + RING_SLOTS; seq < 4 + 2 * RING_SLOTS; seq++) {
+        publish(ring);
+    }
+    last = ring_pin(ring, 3 + 2 * RING_SLOTS);
+    assert(last != NULL && holds(last, 3 + 2 * RING_SLOTS));
+    ring_unpin(last);
+
+    // The next box starts after the messages of the last one
+    uint64_t generation = atomic_load(&ring->generation);
+    ring_close(ring);
+    assert(atomic_load(&ring->generation) == generation + 1);
+    ring_open(ring, 0, 0);
+    assert(ring->base == 4 + 2 * RING_SLOTS);
+    ring_end(ring, &end_seq, &end_offset);
+    assert(end_seq == ring->base && end_offset == 0);
+
+    pthread_t subscriber;
+    assert(pthread_create(&subscriber, NULL, follow, ring) == 0);
+    for (size_t i = 0; i < MESSAGES; i++) {
+        publish(ring);
+    }
+    assert(pthread_join(subscriber, NULL) == 0);
+
+    free(ring);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "mbroker/config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test sets the settings of the broker as options and from a config
+ * file, checking every kind of value, and that settings that do not exist, or
+ * whose values are not valid (or out of range), are refused (leaving the
+ * setting as it was)*/
+
+#define CONFIG_PATH "/tmp/broker_config_test.conf"
+
+int main() {
+    broker_config_t config = {.tfs = tfs_default_params(), .max_boxes = 1};
+
+    // Options
+    assert(config_parse(&config, "max_boxes=100000") == 0);
+    assert(config.max_boxes == 100000);
+    assert(config_parse(&config, "max_inode_count = 50000") == 0);
+    assert(config.tfs.max_inode_count == 50000);
+    assert(config_parse(&config, "dentry_cache_size=0") == 0);
+    assert(config.tfs.dentry_cache_size == 0);
+    assert(config_parse(&config, "alloc_mode=per_thread") == 0);
+    assert(config.tfs.alloc_mode == TFS_ALLOC_PER_THREAD);
+    assert(config_parse(&config, "latency_model=device") == 0);
+    assert(config.tfs.latency_model == TFS_LATENCY_DEVICE);
+    assert(config_parse(&config, "latency_class_ns=1,2,30,400") == 0);
+    assert(config.tfs.latency_class_ns[0] == 1 &&
+           config.tfs.latency_class_ns[3] == 400);
+    assert(config_parse(&config, "spin_count=0") == 0);
+    assert(config.pcq.spin_count == 0);
+    assert(config_parse(&config, "handoff_histogram=on") == 0);
+    assert(config.pcq.handoff_histogram);
+    assert(config_parse(&config, "image_path=/tmp/image") == 0);
+    assert(strcmp(config.tfs.image_path, "/tmp/image") == 0);
+
+    // Not valid
+    assert(config_parse(&config, "max_boxes") == -1);
+    assert(config_parse(&config, "max_boxes=0") == -1);
+    assert(config_parse(&config, "max_boxes=-1") == -1);
+    assert(config_parse(&config, "max_boxes=12k") == -1);
+    assert(config_parse(&config, "max_boxes=99999999999999999999") == -1);
+    assert(config_parse(&config, "block_size=16") == -1);
+    assert(config_parse(&config, "max_sessions=4") == -1);
+    assert(config_parse(&config, "alloc_mode=local") == -1);
+    assert(config_parse(&config, "latency_class_ns=1,2,3") == -1);
+    assert(config_parse(&config, "latency_class_ns=1,2,3,4,5") == -1);
+    assert(config_parse(&config, "journal_path=") == -1);
+    assert(config_parse(&config, "handoff_histogram=yes") == -1);
+    assert(config.max_boxes == 100000);
+    assert(config.tfs.alloc_mode == TFS_ALLOC_PER_THREAD);
+    assert(config.tfs.latency_class_ns[2] == 30);
+    assert(config.pcq.handoff_histogram);
+
+    // A config file
+    FILE *file = fopen(CONFIG_PATH, "w");
+    assert(file != NULL);
+    fprintf(file, "# the TFS\n"
+                  "  max_block_count = 8192  # blocks\n"
+                  "\n"
+                  "block_size=4096\n"
+                  "journal_commit_interval_us = 0\n");
+    assert(fclose(file) == 0);
+    assert(config_load(&config, CONFIG_PATH) == 0);
+    assert(config.tfs.max_block_count == 8192);
+    assert(config.tfs.block_size == 4096);
+    assert(config.tfs.journal_commit_interval_us == 0);
+
+    file = fopen(CONFIG_PATH, "w");
+    assert(file != NULL);
+    fprintf(file, "block_size = 512\nblocks = 1\n");
+    assert(fclose(file) == 0);
+    assert(config_load(&config, CONFIG_PATH) == -1);
+    assert(config.tfs.block_size == 512); // Set before the line not valid
+
+    assert(remove(CONFIG_PATH) == 0);
+    assert(config_load(&config, CONFIG_PATH) == -1);
+
+    // Nor does the TFS take blocks smaller than a directory entry
+    tfs_params params = tfs_default_params();
+    params.block_size = tfs_min_block_size() - 1;
+    assert(tfs_init(&params) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
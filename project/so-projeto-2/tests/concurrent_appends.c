@@ -0,0 +1,168 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*This test appends records of several sizes to a file from several threads at
+ * once (each through its own handle), while another thread reads the file as
+ * it grows, checking that it only sees whole records, in the order their
+ * appends were committed. Then it fills the FS, checking that the appends that
+ * do not fit leave nothing behind, and that appends work again once there is
+ * room*/
+
+#define THREADS (8)
+#define RECORDS_PER_THREAD (200)
+#define RECORD_MAX_SIZE (4 + 255) // More than a block, for some
+#define BLOCK_SIZE (256)
+
+static atomic_int done;
+static size_t commits[THREADS * RECORDS_PER_THREAD]; // Sizes, in commit order
+static size_t n_commits;
+static size_t seen[THREADS];
+
+// A record is its size (a byte), the id of its thread, its number and then
+// the id again, until its size
+static size_t record_build(char *record, size_t id, size_t i) {
+    size_t size = 4 + (id * 37 + i * 11) % (RECORD_MAX_SIZE - 3);
+    record[0] = (char)(size - 4);
+    record[1] = (char)id;
+    record[2] = (char)(i % 256);
+    record[3] = (char)(i / 256);
+    memset(record + 4, (int)('a' + id), size - 4);
+    return size;
+}
+
+static void count_commit(void *arg) {
+    commits[n_commits++] = *(size_t *)arg; // Commits never run at once
+}
+
+void *appender(void *arg) {
+    size_t id = (size_t)arg;
+    int f = tfs_open("/file", TFS_O_APPEND);
+    assert(f != -1);
+
+    char record[RECORD_MAX_SIZE];
+    for (size_t i = 0; i < RECORDS_PER_THREAD; i++) {
+        size_t size = record_build(record, id, i);
+        assert(tfs_append(f, record, size, count_commit, &size) ==
+               (ssize_t)size);
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+// Checks the records read, from offset on, returning where the last whole one
+// ends
+static size_t records_check(char const *data, size_t offset, size_t len) {
+    while (offset + 4 <= len) {
+        size_t size = (size_t)(unsigned char)data[offset] + 4;
+        assert(offset + size <= len); // Only whole records are seen
+        size_t id = (size_t)data[offset + 1];
+        size_t i = (size_t)(unsigned char)data[offset + 2] +
+                   (size_t)(unsigned char)data[offset + 3] * 256;
+        assert(id < THREADS && i == seen[id]); // In order, for each thread
+
+        char record[RECORD_MAX_SIZE];
+        assert(record_build(record, id, i) == size);
+        assert(memcmp(data + offset, record, size) == 0);
+        seen[id]++;
+        offset += size;
+    }
+    assert(offset == len);
+    return offset;
+}
+
+void *reader(void *arg) {
+    (void)arg;
+    int f = tfs_open("/file", 0);
+    assert(f != -1);
+
+    char *data = malloc(THREADS * RECORDS_PER_THREAD * RECORD_MAX_SIZE);
+    assert(data != NULL);
+    size_t len = 0, checked = 0;
+    int last = 0;
+    while (!last) {
+        last = atomic_load(&done);
+        ssize_t bytes_read;
+        do { // Up to the size of the file, when it was read
+            bytes_read = tfs_pread(f, data + len, 4096, len);
+            assert(bytes_read != -1);
+            len += (size_t)bytes_read;
+        } while (bytes_read == 4096);
+        checked = records_check(data, checked, len);
+    }
+    for (size_t id = 0; id < THREADS; id++) {
+        assert(seen[id] == RECORDS_PER_THREAD);
+    }
+
+    // The records are in the order their appends were committed
+    size_t offset = 0;
+    for (size_t i = 0; i < n_commits; i++) {
+        assert((size_t)(unsigned char)data[offset] + 4 == commits[i]);
+        offset += commits[i];
+    }
+    assert(offset == len);
+
+    free(data);
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 4096;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/file", TFS_O_CREAT);
+    assert(f != -1);
+
+    pthread_t threads[THREADS], reader_thread;
+    assert(pthread_create(&reader_thread, NULL, reader, NULL) == 0);
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, appender, (void *)i) == 0);
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    atomic_store(&done, 1);
+    assert(pthread_join(reader_thread, NULL) == 0);
+    assert(n_commits == THREADS * RECORDS_PER_THREAD);
+
+    // Fills the FS, with the append that does not fit failing whole
+    assert(tfs_unlink("/file") != -1);
+    assert(tfs_close(f) == -1); // The handle was closed with the file
+    int other = tfs_open("/other", TFS_O_CREAT);
+    f = tfs_open("/full", TFS_O_CREAT);
+    assert(other != -1 && f != -1);
+
+    char block[BLOCK_SIZE];
+    memset(block, 'x', sizeof(block));
+    assert(tfs_append(other, block, sizeof(block), NULL, NULL) ==
+           sizeof(block));
+    size_t size = 0;
+    while (tfs_append(f, block, sizeof(block), NULL, NULL) != -1) {
+        size += sizeof(block);
+    }
+    assert(size > 0 && tfs_file_size("/full") == (ssize_t)size);
+    assert(tfs_append(f, block, 1, NULL, NULL) == -1);
+
+    // Once there is room, appends go on from the end of the file
+    assert(tfs_unlink("/other") != -1);
+    assert(tfs_append(f, "end", 3, NULL, NULL) == 3);
+    assert(tfs_file_size("/full") == (ssize_t)size + 3);
+    char end[4] = {0};
+    assert(tfs_pread(f, end, sizeof(end), size) == 3);
+    assert(strcmp(end, "end") == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
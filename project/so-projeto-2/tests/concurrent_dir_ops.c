@@ -0,0 +1,105 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test creates, looks up and unlinks files of the root directory from
+ * several threads at once, including creations of the same name, while
+ * another thread lists the directory (which must only ever see whole names),
+ * and checks that the directory stays consistent*/
+
+#define THREADS (8)
+#define FILES_PER_THREAD (32)
+
+void *worker(void *arg) {
+    size_t id = (size_t)arg;
+    char name[MAX_FILE_NAME];
+
+    for (size_t i = 0; i < FILES_PER_THREAD; i++) {
+        // Every thread races to create the shared file
+        int f = tfs_open("/shared", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+
+        snprintf(name, sizeof(name), "/t%zu_f%zu", id, i);
+        f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, name, strlen(name)) == strlen(name));
+        assert(tfs_close(f) != -1);
+    }
+
+    // Removes every other file of this thread
+    for (size_t i = 0; i < FILES_PER_THREAD; i += 2) {
+        snprintf(name, sizeof(name), "/t%zu_f%zu", id, i);
+        assert(tfs_unlink(name) != -1);
+    }
+
+    return NULL;
+}
+
+static atomic_int done;
+
+void *lister(void *arg) {
+    (void)arg;
+    char name[MAX_FILE_NAME];
+    while (!atomic_load(&done)) {
+        size_t cursor = 0;
+        while (tfs_readdir("/", &cursor, name) == 1) {
+            size_t id, i;
+            char end;
+            assert(strcmp(name, "shared") == 0 ||
+                   (sscanf(name, "t%zu_f%zu%c", &id, &i, &end) == 2 &&
+                    id < THREADS && i < FILES_PER_THREAD));
+        }
+    }
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = THREADS * FILES_PER_THREAD + THREADS + 2;
+    params.max_open_files_count = THREADS;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t threads[THREADS], lister_thread;
+    assert(pthread_create(&lister_thread, NULL, lister, NULL) == 0);
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_create(&threads[t], NULL, worker, (void *)t) == 0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+    atomic_store(&done, 1);
+    assert(pthread_join(lister_thread, NULL) == 0);
+
+    // The shared file has exactly one entry
+    assert(tfs_unlink("/shared") != -1);
+    assert(tfs_unlink("/shared") == -1);
+
+    char name[MAX_FILE_NAME];
+    for (size_t t = 0; t < THREADS; t++) {
+        for (size_t i = 0; i < FILES_PER_THREAD; i++) {
+            snprintf(name, sizeof(name), "/t%zu_f%zu", t, i);
+            int f = tfs_open(name, 0);
+            if (i % 2 == 0) {
+                assert(f == -1);
+                continue;
+            }
+
+            char buffer[MAX_FILE_NAME] = {0};
+            assert(f != -1);
+            assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(name));
+            assert(strcmp(buffer, name) == 0);
+            assert(tfs_close(f) != -1);
+        }
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "fs/operations.h"
+#include "mbroker/cursors.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test keeps the cursors of the consumers of two boxes, checking that a
+ * consumer finds the cursor it committed (and only in its own box), that new
+ * consumers are added after the others, and that the cursors of a box are gone
+ * once it is removed*/
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    assert(cursors_init() == 0);
+    assert(cursors_init() == 0); // As after a restart
+
+    // New consumers start with no cursor
+    cursor_t cursor;
+    int found;
+    assert(cursor_open("/box", "a", &cursor, &found) == 0 && !found);
+    assert(cursor_open("/box", "b", &cursor, &found) == 1 && !found);
+    assert(cursor_open("/other", "a", &cursor, &found) == 0 && !found);
+
+    // Each finds what it committed
+    assert(cursor_commit("/box", 0, (cursor_t){5, 50}) == 0);
+    assert(cursor_commit("/box", 1, (cursor_t){7, 64}) == 0);
+    assert(cursor_commit("/box", 0, (cursor_t){6, 57}) == 0);
+    assert(cursor_open("/box", "a", &cursor, &found) == 0 && found);
+    assert(cursor.seq == 6 && cursor.offset == 57);
+    assert(cursor_open("/box", "b", &cursor, &found) == 1 && found);
+    assert(cursor.seq == 7 && cursor.offset == 64);
+    assert(cursor_open("/other", "a", &cursor, &found) == 0 && found);
+    assert(cursor.seq == 0 && cursor.offset == 0);
+
+    // The longest consumer name fits
+    char name[P_BOX_NAME_SIZE];
+    memset(name, 'c', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    assert(cursor_open("/box", name, &cursor, &found) == 2 && !found);
+    assert(cursor_open("/box", name, &cursor, &found) == 2 && found);
+
+    // A removed box has no cursors to commit, and starts anew
+    cursors_remove("/box");
+    assert(cursor_commit("/box", 0, (cursor_t){8, 70}) == -1);
+    assert(cursor_open("/box", "b", &cursor, &found) == 0 && !found);
+    assert(cursor_open("/other", "a", &cursor, &found) == 0 && found);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test builds a directory tree, and checks that files are found through
+ * multi-component paths, also after their directories are renamed or removed*/
+
+void check_contents(char const *path, char const *contents) {
+    char buffer[64] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    assert(tfs_mkdir("/tenant1") != -1);
+    assert(tfs_mkdir("/tenant1/boxes") != -1);
+    assert(tfs_mkdir("/tenant1") == -1);          // already exists
+    assert(tfs_mkdir("/missing/boxes") == -1);    // no parent
+    assert(tfs_mkdir("/tenant1//boxes2") == -1);  // empty component
+    assert(tfs_open("/tenant1/boxes/", 0) == -1); // trailing '/'
+
+    write_file("/tenant1/boxes/a", "first box");
+    write_file("/tenant1/boxes/b", "second box");
+    write_file("/a", "root file");
+
+    check_contents("/tenant1/boxes/a", "first box");
+    check_contents("/tenant1/boxes/b", "second box");
+    check_contents("/a", "root file");
+
+    // Directories are not opened as files, and files do not hold entries
+    assert(tfs_open("/tenant1", 0) == -1);
+    assert(tfs_open("/a/b", TFS_O_CREAT) == -1);
+
+    // Links work across directories
+    assert(tfs_link("/tenant1/boxes/a", "/tenant1/link") != -1);
+    assert(tfs_sym_link("/tenant1/boxes/b", "/soft") != -1);
+    check_contents("/tenant1/link", "first box");
+    check_contents("/soft", "second box");
+
+    // Renaming a directory moves everything below it
+    assert(tfs_rename("/tenant1", "/tenant1/boxes/inside") == -1);
+    assert(tfs_mkdir("/tenant2") != -1);
+    assert(tfs_rename("/tenant1/boxes", "/tenant2/boxes") != -1);
+    assert(tfs_open("/tenant1/boxes/a", 0) == -1);
+    check_contents("/tenant2/boxes/a", "first box");
+
+    // Renaming a file, also onto an existing name
+    assert(tfs_rename("/tenant2/boxes/a", "/tenant2/boxes/b") == -1);
+    assert(tfs_rename("/tenant2/boxes/a", "/tenant1/a") != -1);
+    assert(tfs_open("/tenant2/boxes/a", 0) == -1);
+    check_contents("/tenant1/a", "first box");
+
+    // Only empty directories are removed
+    assert(tfs_unlink("/tenant2") == -1);
+    assert(tfs_unlink("/tenant2/boxes/b") != -1);
+    assert(tfs_unlink("/tenant2/boxes") != -1);
+    assert(tfs_open("/tenant2/boxes/b", TFS_O_CREAT) == -1);
+    assert(tfs_unlink("/tenant2") != -1);
+
+    // Removed directories give their inodes back
+    for (int i = 0; i < 2 * tfs_default_params().max_inode_count; i++) {
+        assert(tfs_mkdir("/scratch") != -1);
+        assert(tfs_unlink("/scratch") != -1);
+    }
+
+    // The removed name can be used again
+    assert(tfs_mkdir("/tenant2") != -1);
+    write_file("/tenant2/c", "third box");
+    check_contents("/tenant2/c", "third box");
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
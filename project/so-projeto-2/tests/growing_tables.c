@@ -0,0 +1,102 @@
+#include "fs/operations.h"
+#include "fs/table.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test grows a table while other threads read the elements it already
+ * had, which must stay where they were, and checks it stops at its maximum.
+ * Then it opens more files than the first chunk of the open file table holds,
+ * up to the maximum of the TFS, which is then out of handles until one is
+ * closed*/
+
+#define MAX_ELEMS (1000)
+#define READERS (4)
+#define OPEN_FILES (3 * TABLE_CHUNK / 2)
+
+static table_t table;
+static atomic_int done;
+
+static int init_elem(void *elem) {
+    atomic_init((atomic_int *)elem, 1);
+    return 0;
+}
+
+void *reader(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        size_t size = table_size(&table);
+        for (size_t i = 0; i < size; i++) {
+            int value = atomic_load((atomic_int *)table_at(&table, i));
+            assert(value == 1 || value == (int)i + 2);
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    assert(table_init(&table, sizeof(atomic_int), MAX_ELEMS, init_elem) ==
+           0);
+    assert(table_size(&table) == 0);
+
+    pthread_t threads[READERS];
+    for (size_t i = 0; i < READERS; i++) {
+        assert(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+    }
+
+    // Each element keeps its value (and place) as the table grows
+    atomic_int *first = NULL;
+    for (size_t n = 1; n <= MAX_ELEMS; n++) {
+        assert(table_grow(&table, n) == 0);
+        assert(table_size(&table) >= n);
+        atomic_int *elem = table_at(&table, n - 1);
+        assert(atomic_load(elem) == 1);
+        atomic_store(elem, (int)n + 1);
+        if (n == 1) {
+            first = elem;
+        }
+    }
+    assert(table_size(&table) == MAX_ELEMS);
+    assert(table_grow(&table, MAX_ELEMS + 1) == -1);
+    assert(table_at(&table, 0) == first && atomic_load(first) == 2);
+
+    atomic_store(&done, 1);
+    for (size_t i = 0; i < READERS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    table_destroy(&table, NULL);
+
+    // The open file table grows past its first chunk, up to its maximum
+    tfs_params params = tfs_default_params();
+    params.max_open_files_count = OPEN_FILES;
+    assert(tfs_init(&params) != -1);
+
+    int fds[OPEN_FILES];
+    char path[16];
+    for (int i = 0; i < OPEN_FILES; i++) {
+        sprintf(path, "/f%d", i % 8);
+        fds[i] = tfs_open(path, TFS_O_CREAT);
+        assert(fds[i] == i);
+    }
+    assert(tfs_open("/f0", 0) == -1);
+
+    assert(tfs_write(fds[OPEN_FILES - 1], "abc", 3) == 3);
+    assert(tfs_close(fds[TABLE_CHUNK]) != -1);
+    assert(tfs_open("/f1", 0) == TABLE_CHUNK);
+
+    char buffer[4];
+    int fd = fds[OPEN_FILES - 1];
+    assert(tfs_close(fd) != -1);
+    sprintf(path, "/f%d", (OPEN_FILES - 1) % 8);
+    assert((fd = tfs_open(path, 0)) == OPEN_FILES - 1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == 3);
+    assert(memcmp(buffer, "abc", 3) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
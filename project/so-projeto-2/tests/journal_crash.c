@@ -0,0 +1,140 @@
+#define _GNU_SOURCE // syscall (the write of the C library)
+#include "fs/operations.h"
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*This test appends messages to a file of a journaled image, syncing each one,
+ * and kills the process in the middle of writing a batch to the journal (the
+ * TFS writes it through the write below, which takes the place of the one of
+ * the C library). After recovery, the file must hold exactly the messages that
+ * were synced, and the FS must remain usable*/
+
+#define MESSAGES (200)
+#define CRASH_AT (60) // sequence number of the batch torn by the crash
+#define MESSAGE_LEN (16)
+
+// A batch of the journal starts with this magic and its sequence number
+#define JOURNAL_MAGIC UINT64_C(0x314C4E524A534654) // "TFSJRNL1"
+
+static bool crash; // Only in the process that crashes
+
+ssize_t write(int fd, void const *buffer, size_t size) {
+    uint64_t header[2];
+    if (crash && size >= sizeof(header)) {
+        memcpy(header, buffer, sizeof(header));
+        if (header[0] == JOURNAL_MAGIC && header[1] == CRASH_AT) {
+            // Tears the batch: only half of it reaches the journal
+            syscall(SYS_write, fd, buffer, size / 2);
+            raise(SIGKILL);
+        }
+    }
+    return (ssize_t)syscall(SYS_write, fd, buffer, size);
+}
+
+static void message(int i, char *buffer) {
+    i %= 1000000;
+    snprintf(buffer, MESSAGE_LEN + 1, "message %06d\n", i);
+}
+
+static void append_messages(tfs_params const *params, int first, int count,
+                            int ack_fd) {
+    assert(tfs_init(params) != -1);
+
+    char buffer[MESSAGE_LEN + 1];
+    for (int i = first; i < first + count; i++) {
+        int f = tfs_open("/log", TFS_O_CREAT | TFS_O_APPEND);
+        assert(f != -1);
+        message(i, buffer);
+        assert(tfs_write(f, buffer, MESSAGE_LEN) == MESSAGE_LEN);
+        assert(tfs_close(f) != -1);
+
+        // Only acknowledged once it would survive a crash
+        assert(tfs_sync() != -1);
+        if (ack_fd != -1) {
+            assert(write(ack_fd, &i, sizeof(i)) == sizeof(i));
+        }
+    }
+
+    assert(tfs_destroy() != -1);
+}
+
+static void check_messages(tfs_params const *params, int expected) {
+    assert(tfs_init(params) != -1);
+    assert(tfs_file_size("/log") == expected * MESSAGE_LEN);
+
+    int f = tfs_open("/log", 0);
+    assert(f != -1);
+    char buffer[MESSAGE_LEN + 1];
+    char read_buffer[MESSAGE_LEN];
+    for (int i = 0; i < expected; i++) {
+        message(i, buffer);
+        assert(tfs_read(f, read_buffer, MESSAGE_LEN) == MESSAGE_LEN);
+        assert(memcmp(read_buffer, buffer, MESSAGE_LEN) == 0);
+    }
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    char image_path[64];
+    char journal_path[80];
+    sprintf(image_path, "/tmp/tfs_journal_test_%d", getpid());
+    sprintf(journal_path, "%s.journal", image_path);
+
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 128;
+    params.block_size = 512;
+    params.journal_path = journal_path;
+    assert(tfs_mkfs(image_path, &params) != -1);
+
+    params.image_path = image_path;
+    params.journal_commit_interval_us = 0; // a batch per sync
+
+    int acks[2];
+    assert(pipe(acks) != -1);
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        close(acks[0]);
+        crash = true;
+        append_messages(&params, 0, MESSAGES, acks[1]);
+        _exit(0); // not reached
+    }
+    close(acks[1]);
+
+    int acked = 0;
+    int i;
+    while (read(acks[0], &i, sizeof(i)) == sizeof(i)) {
+        assert(i == acked);
+        acked++;
+    }
+    close(acks[0]);
+
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+    assert(acked > 0 && acked < MESSAGES);
+
+    // The torn batch held the first message that was not acknowledged
+    check_messages(&params, acked);
+
+    // The recovered FS keeps working, and persisting
+    append_messages(&params, acked, MESSAGES - acked, -1);
+    check_messages(&params, MESSAGES);
+
+    assert(unlink(image_path) != -1);
+    assert(unlink(journal_path) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test fills the root directory past its first block, and checks that
+ * entries can be found, removed and their slots reused*/
+
+#define FILES (200)
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILES + 1;
+    assert(tfs_init(&params) != -1);
+
+    char name[MAX_FILE_NAME];
+    for (int i = 0; i < FILES; i++) {
+        sprintf(name, "/f%d", i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, name, strlen(name)) == strlen(name));
+        assert(tfs_close(f) != -1);
+    }
+
+    // The inode table is full
+    assert(tfs_open("/extra", TFS_O_CREAT) == -1);
+
+    // Every file is found, with its own contents
+    for (int i = 0; i < FILES; i++) {
+        char buffer[MAX_FILE_NAME] = {0};
+        sprintf(name, "/f%d", i);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(name));
+        assert(strcmp(buffer, name) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    // Removes half of the files, and replaces them with new ones
+    for (int i = 0; i < FILES; i += 2) {
+        sprintf(name, "/f%d", i);
+        assert(tfs_unlink(name) != -1);
+        assert(tfs_open(name, 0) == -1);
+    }
+    for (int i = 0; i < FILES; i += 2) {
+        sprintf(name, "/g%d", i);
+        int f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    for (int i = 1; i < FILES; i += 2) {
+        sprintf(name, "/f%d", i);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
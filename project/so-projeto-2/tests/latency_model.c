@@ -0,0 +1,96 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*This test runs the same workload under each storage latency model, and checks
+ * the simulated accesses and stall time they report*/
+
+#define BLOCKS (32)
+#define BLOCK_SIZE (1024)
+
+static double elapsed_ns(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+/*Writes and reads back a file spanning several blocks, and returns the
+ * counters*/
+static tfs_stall_stats workload(tfs_params const *params, double *ns) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    assert(tfs_init(params) != -1);
+
+    char data[BLOCKS * BLOCK_SIZE];
+    memset(data, 'x', sizeof(data));
+    int f = tfs_open("/file", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, data, sizeof(data)) == sizeof(data));
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/file", 0);
+    assert(f != -1);
+    assert(tfs_read(f, data, sizeof(data)) == sizeof(data));
+    assert(tfs_close(f) != -1);
+
+    tfs_stall_stats stats = tfs_get_stall_stats();
+    assert(tfs_destroy() != -1);
+
+    *ns = elapsed_ns(start);
+    return stats;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    double ns;
+
+    // No model: nothing is simulated
+    tfs_stall_stats stats = workload(&params, &ns);
+    for (int c = 0; c < TFS_ACCESS_CLASSES; c++) {
+        assert(stats.accesses[c] == 0 && stats.stall_ns[c] == 0);
+    }
+
+    // Every access costs the same
+    params.latency_model = TFS_LATENCY_FIXED;
+    params.latency_ns = 1000;
+    stats = workload(&params, &ns);
+    size_t accesses = 0;
+    size_t stall = 0;
+    for (int c = 0; c < TFS_ACCESS_CLASSES; c++) {
+        assert(stats.stall_ns[c] == stats.accesses[c] * 1000);
+        accesses += stats.accesses[c];
+        stall += stats.stall_ns[c];
+    }
+    assert(accesses > 2 * BLOCKS);
+    assert(ns >= (double)stall);
+
+    // Per class costs; the file is accessed mostly sequentially
+    params.latency_model = TFS_LATENCY_DEVICE;
+    size_t costs[TFS_ACCESS_CLASSES] = {
+        [TFS_ACCESS_META_SEQ] = 100,
+        [TFS_ACCESS_META_RANDOM] = 200,
+        [TFS_ACCESS_DATA_SEQ] = 300,
+        [TFS_ACCESS_DATA_RANDOM] = 4000,
+    };
+    memcpy(params.latency_class_ns, costs, sizeof(costs));
+    stats = workload(&params, &ns);
+    for (int c = 0; c < TFS_ACCESS_CLASSES; c++) {
+        assert(stats.stall_ns[c] == stats.accesses[c] * costs[c]);
+    }
+    assert(stats.accesses[TFS_ACCESS_DATA_SEQ] >
+           stats.accesses[TFS_ACCESS_DATA_RANDOM]);
+    assert(stats.accesses[TFS_ACCESS_META_SEQ] > 0);
+
+    // Unknown models are rejected
+    params.latency_model = (tfs_latency_model_t)42;
+    assert(tfs_init(&params) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
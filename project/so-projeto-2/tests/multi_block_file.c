@@ -0,0 +1,77 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*This test writes a file that spans the direct, indirect and double indirect
+ * blocks of its inode, reads it back, and checks that all of its blocks are
+ * released when it is unlinked*/
+
+char const path[] = "/f1";
+char const other_path[] = "/f2";
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 128; // 32 entries per indirect block
+    params.max_block_count = 1100;
+    assert(tfs_init(&params) != -1);
+
+    // Goes past the direct (12) and indirect (32) blocks
+    size_t size = 100 * params.block_size + 17;
+    char *contents = malloc(size);
+    char *buffer = malloc(size);
+    assert(contents != NULL && buffer != NULL);
+    for (size_t i = 0; i < size; i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    // Writes in chunks that are not aligned with the blocks
+    for (size_t done = 0; done < size;) {
+        size_t chunk = size - done < 50 ? size - done : 50;
+        assert(tfs_write(f, contents + done, chunk) == chunk);
+        done += chunk;
+    }
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, size + 10) == size);
+    assert(memcmp(buffer, contents, size) == 0);
+    assert(tfs_read(f, buffer, size) == 0);
+    assert(tfs_close(f) != -1);
+
+    // Appending continues where the file ended
+    f = tfs_open(path, TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "!", 1) == 1);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, size) == size);
+    assert(tfs_read(f, buffer, size) == 1 && buffer[0] == '!');
+    assert(tfs_close(f) != -1);
+
+    // Filling the FS with another file only succeeds once the first is gone
+    assert(tfs_unlink(path) != -1);
+    size_t big_size = 1000 * params.block_size;
+    char *big = calloc(big_size, 1);
+    assert(big != NULL);
+    f = tfs_open(other_path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, big, big_size) == big_size);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    free(contents);
+    free(buffer);
+    free(big);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "pcq-batch.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*This test moves batches through a queue: a batch larger than the queue is
+ * enqueued a part at a time (sleeping while it is full), a consumer takes
+ * only the elements there are (sleeping while there are none), and the
+ * batches of many producers and consumers, mixed with single elements, are
+ * all dequeued once, and those of each producer in order*/
+
+#define CAPACITY (5)
+#define PRODUCERS (4)
+#define CONSUMERS (4)
+#define PER_PRODUCER (21000)
+#define PRODUCER_BATCH (7)
+#define CONSUMER_BATCH (3)
+
+#include "pcq_common.h"
+
+void *batch_producer(void *arg) {
+    size_t p = (size_t)(uintptr_t)arg;
+    void *batch[PRODUCER_BATCH];
+    for (size_t i = 0; i < PER_PRODUCER; i += PRODUCER_BATCH) {
+        for (size_t j = 0; j < PRODUCER_BATCH; j++) {
+            batch[j] = element(p, i + j);
+        }
+        if (p % 2 == 0) {
+            assert(pcq_enqueue_batch(&queue, batch, PRODUCER_BATCH) == 0);
+        } else { // Some producers enqueue one at a time
+            for (size_t j = 0; j < PRODUCER_BATCH; j++) {
+                assert(pcq_enqueue(&queue, batch[j]) == 0);
+            }
+        }
+    }
+    return NULL;
+}
+
+void *batch_consumer(void *arg) {
+    (void)arg;
+    size_t last[PRODUCERS] = {0};
+    void *batch[CONSUMER_BATCH];
+    while (1) {
+        size_t n = pcq_dequeue_batch(&queue, batch, CONSUMER_BATCH);
+        assert(n >= 1 && n <= CONSUMER_BATCH);
+        for (size_t j = 0; j < n; j++) {
+            if (batch[j] == NULL) { // Ends the consumer
+                // The ones taken after it end others, so they are put back
+                for (j++; j < n; j++) {
+                    assert(batch[j] == NULL);
+                    assert(pcq_enqueue(&queue, NULL) == 0);
+                }
+                return NULL;
+            }
+            consumed(batch[j], last);
+        }
+    }
+}
+
+void *blocked_enqueue(void *arg) {
+    void **batch = arg;
+    assert(pcq_enqueue_batch(&queue, batch, 3 * CAPACITY) == 0);
+    return NULL;
+}
+
+void *blocked_dequeue(void *arg) {
+    return (void *)(uintptr_t)pcq_dequeue_batch(&queue, arg, CAPACITY);
+}
+
+int main() {
+    assert(pcq_create(&queue, CAPACITY) == 0);
+
+    // A batch larger than the queue
+    void *batch[3 * CAPACITY];
+    for (size_t i = 0; i < 3 * CAPACITY; i++) {
+        batch[i] = element(0, i);
+    }
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, blocked_enqueue, batch) == 0);
+    void *out[3 * CAPACITY];
+    size_t got = 0;
+    while (got < 3 * CAPACITY) {
+        size_t n = pcq_dequeue_batch(&queue, out + got, CONSUMER_BATCH);
+        assert(n >= 1 && n <= CONSUMER_BATCH);
+        got += n;
+    }
+    assert(pthread_join(thread, NULL) == 0);
+    for (size_t i = 0; i < 3 * CAPACITY; i++) {
+        assert(out[i] == element(0, i));
+    }
+
+    // Only the elements there are, and none for a batch of 0
+    assert(pcq_enqueue_batch(&queue, batch, 2) == 0);
+    assert(pcq_dequeue_batch(&queue, out, 0) == 0);
+    assert(pcq_dequeue_batch(&queue, out, CAPACITY) == 2);
+    assert(out[0] == element(0, 0) && out[1] == element(0, 1));
+    assert(pcq_enqueue_batch(&queue, batch, 0) == 0);
+
+    // A consumer sleeps while the queue is empty
+    void *taken;
+    assert(pthread_create(&thread, NULL, blocked_dequeue, out) == 0);
+    sleep_ms(50);
+    assert(pcq_enqueue_batch(&queue, batch, 3) == 0);
+    assert(pthread_join(thread, &taken) == 0);
+    size_t n = (size_t)(uintptr_t)taken;
+    assert(n >= 1 && n <= 3 && out[0] == element(0, 0));
+    while (n < 3) {
+        assert(pcq_dequeue(&queue) == element(0, n++));
+    }
+
+    // Many producers and consumers
+    move_all_elements(batch_producer, batch_consumer);
+
+    assert(pcq_destroy(&queue) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
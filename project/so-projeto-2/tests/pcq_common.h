@@ -0,0 +1,91 @@
+#ifndef __PCQ_COMMON_H__
+#define __PCQ_COMMON_H__
+
+#include "producer-consumer.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// What the tests of the producer-consumer queue share: each of them defines
+// PRODUCERS, CONSUMERS and PER_PRODUCER before including it, and moves the
+// elements of the producers through the queue, to the consumers, which must
+// see each of them once
+
+static pc_queue_t queue;
+static int seen[PRODUCERS][PER_PRODUCER];
+
+// Elements are (producer << 24) | (index + 1), so none is NULL
+static inline void *element(size_t producer, size_t i) {
+    return (void *)(uintptr_t)((producer << 24) | (i + 1));
+}
+
+static inline void sleep_ms(long ms) {
+    struct timespec delay = {0, ms * 1000000};
+    nanosleep(&delay, NULL);
+}
+
+// Records that a consumer dequeued elem, checking that the elements of each
+// producer come in order, for this consumer (last[p] is the index + 1 of the
+// last element of producer p it dequeued)
+static inline void consumed(void *elem, size_t last[PRODUCERS]) {
+    uintptr_t value = (uintptr_t)elem;
+    size_t p = value >> 24, i = (value & 0xFFFFFF) - 1;
+    assert(p < PRODUCERS && i < PER_PRODUCER);
+    assert(i + 1 > last[p]);
+    last[p] = i + 1;
+    __atomic_fetch_add(&seen[p][i], 1, __ATOMIC_RELAXED);
+}
+
+// A producer that enqueues its elements one at a time
+static inline void *producer(void *arg) {
+    size_t p = (size_t)(uintptr_t)arg;
+    for (size_t i = 0; i < PER_PRODUCER; i++) {
+        assert(pcq_enqueue(&queue, element(p, i)) == 0);
+    }
+    return NULL;
+}
+
+// A consumer that dequeues one element at a time, until a NULL
+static inline void *consumer(void *arg) {
+    (void)arg;
+    size_t last[PRODUCERS] = {0};
+    void *elem;
+    while ((elem = pcq_dequeue(&queue)) != NULL) {
+        consumed(elem, last);
+    }
+    return NULL;
+}
+
+// Runs the producers and the consumers at once, then ends the consumers (a
+// NULL each) and checks that every element was seen once (clearing seen, for
+// another run)
+static inline void move_all_elements(void *(*produce)(void *),
+                                     void *(*consume)(void *)) {
+    pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+    for (size_t i = 0; i < CONSUMERS; i++) {
+        assert(pthread_create(&consumers[i], NULL, consume, NULL) == 0);
+    }
+    for (size_t i = 0; i < PRODUCERS; i++) {
+        assert(pthread_create(&producers[i], NULL, produce,
+                              (void *)(uintptr_t)i) == 0);
+    }
+    for (size_t i = 0; i < PRODUCERS; i++) {
+        assert(pthread_join(producers[i], NULL) == 0);
+    }
+    for (size_t i = 0; i < CONSUMERS; i++) {
+        assert(pcq_enqueue(&queue, NULL) == 0); // Ends a consumer
+    }
+    for (size_t i = 0; i < CONSUMERS; i++) {
+        assert(pthread_join(consumers[i], NULL) == 0);
+    }
+
+    for (size_t p = 0; p < PRODUCERS; p++) {
+        for (size_t i = 0; i < PER_PRODUCER; i++) {
+            assert(seen[p][i] == 1);
+            seen[p][i] = 0;
+        }
+    }
+}
+
+#endif // __PCQ_COMMON_H__
@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*This test fills a queue, checking that a producer blocks while it is full
+ * (and a consumer while it is empty) until the other side makes room (or
+ * enqueues). Then producers and consumers move many elements through a small
+ * queue, with several laps of its slots: every element must be dequeued once,
+ * and the elements of each producer in the order they were enqueued. Last, a
+ * queue of a single slot (where each lap is a single position) blocks a
+ * producer until its element is dequeued*/
+
+#define CAPACITY (5) // Not a power of 2
+#define PRODUCERS (4)
+#define CONSUMERS (4)
+#define PER_PRODUCER (20000)
+
+#include "pcq_common.h"
+
+void *blocked_enqueue(void *arg) {
+    assert(pcq_enqueue(&queue, arg) == 0);
+    return NULL;
+}
+
+void *blocked_dequeue(void *arg) {
+    (void)arg;
+    return pcq_dequeue(&queue);
+}
+
+int main() {
+    assert(pcq_create(&queue, 0) == -1);
+    assert(pcq_create(&queue, CAPACITY) == 0);
+
+    // A producer blocks while the queue is full
+    for (size_t i = 0; i < CAPACITY; i++) {
+        assert(pcq_enqueue(&queue, element(0, i)) == 0);
+    }
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, blocked_enqueue,
+                          element(0, CAPACITY)) == 0);
+    sleep_ms(50);
+    assert(pcq_dequeue(&queue) == element(0, 0));
+    assert(pthread_join(thread, NULL) == 0);
+    for (size_t i = 1; i <= CAPACITY; i++) {
+        assert(pcq_dequeue(&queue) == element(0, i));
+    }
+
+    // A consumer blocks while the queue is empty
+    void *elem;
+    assert(pthread_create(&thread, NULL, blocked_dequeue, NULL) == 0);
+    sleep_ms(50);
+    assert(pcq_enqueue(&queue, element(1, 0)) == 0);
+    assert(pthread_join(thread, &elem) == 0);
+    assert(elem == element(1, 0));
+
+    // Many producers and consumers
+    move_all_elements(producer, consumer);
+
+    assert(pcq_destroy(&queue) == 0);
+
+    // A queue of a single slot
+    assert(pcq_create(&queue, 1) == 0);
+    for (size_t i = 0; i < 3; i++) { // Some laps
+        assert(pcq_enqueue(&queue, element(2, i)) == 0);
+        assert(pcq_dequeue(&queue) == element(2, i));
+    }
+    assert(pcq_enqueue(&queue, element(2, 3)) == 0);
+    assert(pthread_create(&thread, NULL, blocked_enqueue, element(2, 4)) ==
+           0);
+    sleep_ms(50);
+    assert(pcq_dequeue(&queue) == element(2, 3));
+    assert(pthread_join(thread, NULL) == 0);
+    assert(pcq_dequeue(&queue) == element(2, 4));
+    assert(pcq_destroy(&queue) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
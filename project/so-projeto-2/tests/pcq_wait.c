@@ -0,0 +1,94 @@
+#include "pcq-batch.h"
+#include "pcq-wait.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*This test checks how the threads of a queue wait: without waiters, no
+ * thread makes a system call to wake others; a thread that finds the queue
+ * empty parks (without spinning) until it is woken; the handoff times are
+ * recorded in their buckets. Then producers and consumers, spinning or
+ * parking right away, move many elements through a queue of a single slot,
+ * which must all be dequeued once*/
+
+#define PRODUCERS (3)
+#define CONSUMERS (3)
+#define PER_PRODUCER (10000)
+
+#include "pcq_common.h"
+
+static size_t handoffs(pcq_wait_stats_t const *stats, size_t from) {
+    size_t count = 0;
+    for (size_t i = from; i < PCQ_HANDOFF_BUCKETS; i++) {
+        count += stats->handoffs[i];
+    }
+    return count;
+}
+
+void *blocked_dequeue(void *arg) {
+    (void)arg;
+    return pcq_dequeue(&queue);
+}
+
+// Moves the elements of all producers through a queue of a single slot
+static void move_all(size_t spin_count) {
+    pcq_wait_params_t params = {.spin_count = spin_count};
+    assert(pcq_create(&queue, 1) == 0);
+    pcq_set_wait_params(&queue, &params);
+
+    move_all_elements(producer, consumer);
+    assert(pcq_destroy(&queue) == 0);
+}
+
+int main() {
+    pcq_wait_params_t params = pcq_default_wait_params();
+    assert(params.spin_count == 0 || params.spin_count == PCQ_SPIN_DEFAULT);
+    assert(!params.handoff_histogram);
+
+    // Without waiters, no wakes (nor handoffs recorded, by default)
+    assert(pcq_create(&queue, 4) == 0);
+    for (size_t i = 0; i < 1000; i++) {
+        void *batch[2] = {element(0, i), element(1, i)};
+        assert(pcq_enqueue_batch(&queue, batch, 2) == 0);
+        assert(pcq_dequeue(&queue) == element(0, i));
+        assert(pcq_dequeue(&queue) == element(1, i));
+    }
+    pcq_wait_stats_t stats = pcq_get_wait_stats(&queue);
+    assert(stats.parks == 0 && stats.wakes == 0 && handoffs(&stats, 0) == 0);
+    assert(pcq_destroy(&queue) == 0);
+
+    // A consumer parks right away, until it is woken
+    params = (pcq_wait_params_t){.spin_count = 0, .handoff_histogram = true};
+    assert(pcq_create(&queue, 4) == 0);
+    pcq_set_wait_params(&queue, &params);
+
+    void *elem;
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, blocked_dequeue, NULL) == 0);
+    sleep_ms(50);
+    stats = pcq_get_wait_stats(&queue);
+    assert(stats.parks >= 1 && stats.wakes == 0);
+    assert(pcq_enqueue(&queue, element(0, 0)) == 0);
+    assert(pthread_join(thread, &elem) == 0);
+    assert(elem == element(0, 0));
+    stats = pcq_get_wait_stats(&queue);
+    assert(stats.wakes == 1 && handoffs(&stats, 0) == 1);
+
+    // An element that waits 5ms in the queue takes more than 2^22 ns
+    assert(pcq_enqueue(&queue, element(0, 1)) == 0);
+    sleep_ms(5);
+    assert(pcq_dequeue(&queue) == element(0, 1));
+    stats = pcq_get_wait_stats(&queue);
+    assert(handoffs(&stats, 0) == 2 && handoffs(&stats, 23) == 1);
+    assert(pcq_destroy(&queue) == 0);
+
+    // Many producers and consumers, parking right away or after spinning
+    move_all(0);
+    move_all(PCQ_SPIN_DEFAULT);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
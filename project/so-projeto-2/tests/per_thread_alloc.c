@@ -0,0 +1,67 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*This test fills the FS from several threads using per-thread allocation
+ * pools, and checks that no data block is lost in the threads' magazines*/
+
+#define THREADS (4)
+#define BLOCKS (256)
+
+int blocks[THREADS][BLOCKS];
+size_t n_blocks[THREADS];
+
+void *fill(void *arg) {
+    size_t id = (size_t)arg;
+    int b;
+
+    // Allocates blocks until none is left, neither in the global pool nor in
+    // the magazines of the other threads
+    while ((b = data_block_alloc()) != -1) {
+        blocks[id][n_blocks[id]++] = b;
+    }
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = BLOCKS;
+    params.alloc_mode = TFS_ALLOC_PER_THREAD;
+    params.alloc_batch_size = 16;
+    assert(tfs_init(&params) != -1);
+
+    // The root directory must still get the first inode
+    assert(tfs_open("/f1", TFS_O_CREAT) != -1);
+
+    pthread_t threads[THREADS];
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, fill, (void *)i) == 0);
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        total += n_blocks[i];
+    }
+    assert(total == BLOCKS - 1); // the root directory holds one block
+
+    // Every block comes back to the main thread once freed
+    for (size_t i = 0; i < THREADS; i++) {
+        for (size_t j = 0; j < n_blocks[i]; j++) {
+            data_block_free(blocks[i][j]);
+        }
+    }
+    for (size_t i = 0; i < BLOCKS - 1; i++) {
+        assert(data_block_alloc() != -1);
+    }
+    assert(data_block_alloc() == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*This test formats an image in a backing file, fills it, and checks that files,
+ * directories and free space are found as they were left after reattaching*/
+
+#define FILES (16)
+
+int main() {
+    char image_path[64];
+    sprintf(image_path, "/tmp/tfs_image_test_%d", getpid());
+
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILES + 2;
+    params.max_block_count = 64;
+    params.block_size = 512;
+    assert(tfs_mkfs(image_path, &params) != -1);
+
+    // The geometry comes from the image, not from the parameters
+    tfs_params attach = tfs_default_params();
+    attach.image_path = image_path;
+    assert(tfs_init(&attach) != -1);
+    assert(tfs_get_params().block_size == 512);
+    assert(tfs_get_params().max_inode_count == FILES + 2);
+
+    // A file spanning several blocks, in a directory
+    char data[2000];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+    assert(tfs_mkdir("/dir") != -1);
+    int f = tfs_open("/dir/big", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, data, sizeof(data)) == sizeof(data));
+    assert(tfs_close(f) != -1);
+
+    char name[MAX_FILE_NAME];
+    for (int i = 1; i < FILES; i++) {
+        sprintf(name, "/f%d", i);
+        f = tfs_open(name, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, name, strlen(name)) == strlen(name));
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_destroy() != -1);
+
+    assert(tfs_init(&attach) != -1);
+
+    char buffer[sizeof(data)];
+    f = tfs_open("/dir/big", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(data));
+    assert(memcmp(buffer, data, sizeof(data)) == 0);
+    assert(tfs_close(f) != -1);
+    assert(tfs_file_size("/dir/big") == sizeof(data));
+
+    // Every entry of the root directory is listed
+    size_t cursor = 0;
+    int entries = 0;
+    while (tfs_readdir("/", &cursor, name) == 1) {
+        entries++;
+    }
+    assert(entries == FILES);
+
+    // The inode table is still full, until a file is removed
+    assert(tfs_open("/extra", TFS_O_CREAT) == -1);
+    assert(tfs_unlink("/f1") != -1);
+    f = tfs_open("/extra", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+
+    // Files that are not images are rejected
+    assert(truncate(image_path, 100) != -1);
+    assert(tfs_init(&attach) == -1);
+
+    assert(unlink(image_path) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
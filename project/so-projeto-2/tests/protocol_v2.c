@@ -0,0 +1,224 @@
+#include "delivery.h"
+#include "protocol.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*This test builds the frames of protocol v2 and parses them back, checking
+ * that they only take the bytes they use, that their first byte tells them
+ * apart from v1 frames, that subscribers register with or without options,
+ * and that malformed requests are refused. Then it
+ * delivers messages to a pipe in v2 frames (from pieces and from v1 frames, as
+ * the broker does), and reads them back, also once spliced (when the pipe must
+ * not see the messages change after they are delivered). Last, it fills a
+ * batch of publisher messages*/
+
+static p_v2_header header_of(char const *frame) {
+    p_v2_header header;
+    memcpy(&header, frame, P_V2_HEADER_SIZE);
+    assert(header.magic == P_V2_MAGIC);
+    return header;
+}
+
+int main() {
+    char frame[P_V2_FRAME_MAX_SIZE];
+    char pipe_name[P_PIPE_NAME_SIZE];
+    char box_name[P_BOX_NAME_SIZE];
+
+    // No v1 frame starts with the first byte of v2 frames
+    assert(P_V2_MAGIC > P_SUB_MESSAGE_CODE);
+
+    // A register request, with both names and their \0
+    size_t size =
+        p_v2_build_request(frame, P_SUB_REGISTER_CODE, "sub123", "box");
+    p_v2_header header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 7 + 4 && header.length == 11);
+    assert(header.protocol_code == P_SUB_REGISTER_CODE);
+    assert(p_v2_parse_request(frame + P_V2_HEADER_SIZE, header.length,
+                              pipe_name, box_name) == 0);
+    assert(strcmp(pipe_name, "sub123") == 0 && strcmp(box_name, "box") == 0);
+
+    // A listing request has no box name
+    size = p_v2_build_request(frame, P_BOX_LISTING_CODE, "manager", NULL);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 8);
+    assert(p_v2_parse_request(frame + P_V2_HEADER_SIZE, header.length,
+                              pipe_name, box_name) == 0);
+    assert(strcmp(pipe_name, "manager") == 0 && box_name[0] == '\0');
+
+    // Malformed requests: names without their \0, or with extra bytes
+    assert(p_v2_parse_request("pipe", 4, pipe_name, box_name) == -1);
+    assert(p_v2_parse_request("pipe\0box", 8, pipe_name, box_name) == -1);
+    assert(p_v2_parse_request("pipe\0box\0x", 10, pipe_name, box_name) == -1);
+
+    // A subscriber registers with its options after the names, or without
+    // them (and then they are left at their defaults)
+    p_sub_options options, parsed;
+    p_sub_options_init(&options);
+    options.from = P_SUB_FROM_SEQ;
+    options.seq = 1234567890123;
+    strcpy(options.consumer, "reader");
+    size = p_v2_build_sub_register(frame, "sub123", "box", &options);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 11 + 1 + 8 + 7);
+    assert(header.protocol_code == P_SUB_REGISTER_CODE);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE, header.length,
+                                   pipe_name, box_name, &parsed) == 0);
+    assert(strcmp(pipe_name, "sub123") == 0 && strcmp(box_name, "box") == 0);
+    assert(parsed.from == P_SUB_FROM_SEQ && parsed.seq == options.seq);
+    assert(strcmp(parsed.consumer, "reader") == 0);
+
+    size = p_v2_build_sub_register(frame, "sub123", "box", NULL);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 11);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE, header.length,
+                                   pipe_name, box_name, &parsed) == 0);
+    assert(parsed.from == P_SUB_FROM_EARLIEST && parsed.consumer[0] == '\0');
+    assert(parsed.group[0] == '\0');
+
+    // The name of its consumer group follows, if it has one
+    p_sub_options member;
+    p_sub_options_init(&member);
+    strcpy(member.group, "workers");
+    size = p_v2_build_sub_register(frame, "sub123", "box", &member);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 11 + 1 + 8 + 1 + 8);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE, header.length,
+                                   pipe_name, box_name, &parsed) == 0);
+    assert(parsed.consumer[0] == '\0' && strcmp(parsed.group, "workers") == 0);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE,
+                                   header.length - 1, pipe_name, box_name,
+                                   &parsed) == -1);
+
+    // Malformed options: cut short, from where no one starts, or a consumer
+    // name without its \0
+    size = p_v2_build_sub_register(frame, "sub123", "box", &options);
+    header = header_of(frame);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE, 11 + 5,
+                                   pipe_name, box_name, &parsed) == -1);
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE,
+                                   header.length - 1, pipe_name, box_name,
+                                   &parsed) == -1);
+    frame[P_V2_HEADER_SIZE + 11] = 3;
+    assert(p_v2_parse_sub_register(frame + P_V2_HEADER_SIZE, header.length,
+                                   pipe_name, box_name, &parsed) == -1);
+
+    // The members of consumer groups, in a listing
+    p_group_member group_member = {.backlog = 12, .pending = 345};
+    strcpy(group_member.box_name, "box");
+    strcpy(group_member.group, "workers");
+    strcpy(group_member.member, "sub123");
+    p_group_member parsed_member;
+    size = p_v2_build_group_member_response(frame, &group_member);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 16 + 4 + 8 + 7);
+    assert(header.protocol_code == P_GROUP_MEMBER_RESPONSE_CODE);
+    assert(p_v2_parse_group_member_response(frame + P_V2_HEADER_SIZE,
+                                            header.length,
+                                            &parsed_member) == 0);
+    assert(memcmp(&parsed_member, &group_member, sizeof(p_group_member)) ==
+           0);
+    assert(p_v2_parse_group_member_response(frame + P_V2_HEADER_SIZE,
+                                            header.length - 1,
+                                            &parsed_member) == -1);
+
+    // Responses
+    p_response response;
+    size = p_v2_build_response(frame, P_BOX_REMOVAL_RESPONSE_CODE, -1,
+                               "Such box does not exist");
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + P_UINT32_SIZE + 23);
+    assert(p_v2_parse_response(frame + P_V2_HEADER_SIZE, header.length,
+                               header.protocol_code, &response) == 0);
+    assert(response.protocol_code == P_BOX_REMOVAL_RESPONSE_CODE);
+    assert(response.return_code == -1);
+    assert(strcmp(response.error_message, "Such box does not exist") == 0);
+
+    p_box_info info = {.box_name = "/box", .box_size = 1234,
+                       .n_publishers = 1, .n_subscribers = 7};
+    p_box_response box;
+    size = p_v2_build_box_listing_response(frame, 1, info);
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + P_UINT8_SIZE + 3 * P_UINT64_SIZE + 3);
+    assert(p_v2_parse_box_listing_response(frame + P_V2_HEADER_SIZE,
+                                           header.length, &box) == 0);
+    assert(box.last == 1 && strcmp(box.box_name, "box") == 0);
+    assert(box.box_size == 1234 && box.n_publishers == 1 &&
+           box.n_subscribers == 7);
+
+    // Messages are sent without their \0
+    size = p_v2_build_message(frame, P_PUB_MESSAGE_CODE, "hello");
+    header = header_of(frame);
+    assert(size == P_V2_HEADER_SIZE + 5 && header.length == 5);
+    assert(memcmp(frame + P_V2_HEADER_SIZE, "hello", 5) == 0);
+
+    // Delivered messages, from the pieces of a message and from a v1 frame
+    int fds[2];
+    assert(pipe(fds) == 0);
+    delivery_t delivery;
+    delivery_init(&delivery, fds[1], DELIVERY_BATCH, P_V2);
+
+    struct iovec pieces[2] = {{.iov_base = "hel", .iov_len = 3},
+                              {.iov_base = "lo", .iov_len = 2}};
+    assert(delivery_room(&delivery, 2));
+    assert(delivery_add(&delivery, pieces, 2, 5) == 0);
+    char message[P_MESSAGE_SIZE] = "world!";
+    char v1_frame[P_SUB_MESSAGE_SIZE];
+    char empty_frame[P_SUB_MESSAGE_SIZE] = {P_SUB_MESSAGE_CODE};
+    p_build_sub_message(v1_frame, message);
+    assert(delivery_add_frame(&delivery, v1_frame, 7) == 0);
+    assert(delivery_add_frame(&delivery, empty_frame, 1) == 0);
+    assert(delivery_flush(&delivery) == 0 && delivery.messages == 3);
+
+    char out[64];
+    assert(read(fds[0], out, sizeof(out)) == 3 * P_V2_HEADER_SIZE + 5 + 6);
+    header = header_of(out);
+    assert(header.protocol_code == P_SUB_MESSAGE_CODE && header.length == 5);
+    assert(memcmp(out + P_V2_HEADER_SIZE, "hello", 5) == 0);
+    header = header_of(out + P_V2_HEADER_SIZE + 5);
+    assert(header.length == 6);
+    assert(memcmp(out + 2 * P_V2_HEADER_SIZE + 5, "world!", 6) == 0);
+    header = header_of(out + 2 * P_V2_HEADER_SIZE + 11);
+    assert(header.length == 0);
+
+    // A spliced message is not changed by what is written where it was,
+    // before it is read
+    delivery_init(&delivery, fds[1], DELIVERY_SPLICE, P_V2);
+    assert(delivery_add_frame(&delivery, v1_frame, 7) == 0);
+    assert(delivery_flush(&delivery) == 0);
+    memset(v1_frame, 'x', sizeof(v1_frame));
+    assert(read(fds[0], out, sizeof(out)) == P_V2_HEADER_SIZE + 6);
+    assert(memcmp(out + P_V2_HEADER_SIZE, "world!", 6) == 0);
+    delivery_destroy(&delivery);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    // A batch holds its messages one after the other, each with its \0
+    static p_pub_batch batch;
+    p_pub_batch_init(&batch);
+    assert(p_pub_batch_add(&batch, "hello") == 0);
+    assert(p_pub_batch_add(&batch, "") == 0);
+    assert(p_pub_batch_add(&batch, "world!") == 0);
+    size = p_pub_batch_finish(&batch);
+    header = header_of(batch.frame);
+    assert(header.protocol_code == P_PUB_BATCH_CODE && header.length == 14);
+    assert(size == P_V2_HEADER_SIZE + 14 && batch.messages == 3);
+    assert(memcmp(batch.frame + P_V2_HEADER_SIZE, "hello\0\0world!\0", 14) ==
+           0);
+
+    // Until it has no room for more
+    memset(message, 'x', P_MESSAGE_SIZE - 1);
+    message[P_MESSAGE_SIZE - 1] = '\0';
+    p_pub_batch_init(&batch);
+    while (p_pub_batch_add(&batch, message) == 0) {
+    }
+    assert(batch.messages == P_PUB_BATCH_MAX_SIZE / P_MESSAGE_SIZE);
+    assert(batch.length == P_PUB_BATCH_MAX_SIZE);
+    assert(p_pub_batch_add(&batch, "") == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test takes views of a file, and checks that a viewed block keeps its
+ * contents, and is not reused, after the file is unlinked, until the view is
+ * released*/
+
+#define BLOCK_SIZE (256)
+#define BLOCKS (16)
+
+/*Fills a new file with as much as fits, and returns its size*/
+static size_t fill(char const *name, char c) {
+    char buffer[BLOCK_SIZE];
+    memset(buffer, c, sizeof(buffer));
+
+    int f = tfs_open(name, TFS_O_CREAT);
+    assert(f != -1);
+    size_t size = 0;
+    ssize_t written;
+    while ((written = tfs_write(f, buffer, sizeof(buffer))) > 0) {
+        size += (size_t)written;
+    }
+    assert(tfs_close(f) != -1);
+    return size;
+}
+
+static int all(void const *data, size_t len, char c) {
+    for (size_t i = 0; i < len; i++) {
+        if (((char const *)data)[i] != c) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCKS;
+    assert(tfs_init(&params) != -1);
+
+    size_t capacity = fill("/a", 'a');
+    int f = tfs_open("/a", 0);
+    assert(f != -1);
+
+    // A view ends at the end of its block, or where asked
+    tfs_view view;
+    assert(tfs_read_view(f, BLOCK_SIZE + 10, SIZE_MAX, &view) ==
+           BLOCK_SIZE - 10);
+    assert(view.len == BLOCK_SIZE - 10 && all(view.data, view.len, 'a'));
+    tfs_view small;
+    assert(tfs_read_view(f, 0, 5, &small) == 5);
+    tfs_release_view(&small);
+    assert(tfs_read_view(f, capacity, SIZE_MAX, &small) == 0);
+
+    // The handle offset is not used
+    char buffer[4];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(all(buffer, sizeof(buffer), 'a'));
+
+    // The viewed block outlives the file
+    assert(tfs_unlink("/a") != -1);
+    assert(tfs_read_view(f, 0, SIZE_MAX, &small) == -1);
+    assert(fill("/b", 'b') == capacity - BLOCK_SIZE);
+    assert(all(view.data, view.len, 'a'));
+
+    // Once released, the block is reused
+    tfs_release_view(&view);
+    assert(tfs_unlink("/b") != -1);
+    assert(fill("/c", 'c') == capacity);
+
+    // Views of a truncated file
+    f = tfs_open("/c", 0);
+    assert(f != -1);
+    assert(tfs_read_view(f, 0, SIZE_MAX, &view) == BLOCK_SIZE);
+    int g = tfs_open("/c", TFS_O_TRUNC);
+    assert(g != -1);
+    assert(tfs_read_view(f, 0, SIZE_MAX, &small) == 0);
+    assert(all(view.data, view.len, 'c'));
+    assert(tfs_close(g) != -1);
+    assert(tfs_close(f) != -1);
+    tfs_release_view(&view);
+
+    assert(tfs_unlink("/c") != -1);
+    assert(fill("/d", 'd') == capacity);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*This test writes message frames with tfs_writev and tfs_pwrite, and reads them
+ * back with tfs_readv and tfs_pread from independent cursors, checking that
+ * positional calls leave the handle offset alone*/
+
+#define FRAMES (64)
+#define FRAME_SIZE (48) // Frames cross block boundaries
+
+static void frame(int i, char *buffer) {
+    memset(buffer, 'a' + i % 26, FRAME_SIZE);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 256;
+    assert(tfs_init(&params) != -1);
+
+    // All the frames in a single call
+    char frames[FRAMES][FRAME_SIZE];
+    struct iovec iov[FRAMES];
+    for (int i = 0; i < FRAMES; i++) {
+        frame(i, frames[i]);
+        iov[i].iov_base = frames[i];
+        iov[i].iov_len = FRAME_SIZE;
+    }
+    int f = tfs_open("/box", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_writev(f, iov, FRAMES) == FRAMES * FRAME_SIZE);
+
+    // Positional reads from two cursors, and the handle offset is unchanged
+    char buffer[FRAME_SIZE];
+    char expected[FRAME_SIZE];
+    for (int i = 0; i < FRAMES; i++) {
+        frame(i, expected);
+        assert(tfs_pread(f, buffer, FRAME_SIZE, (size_t)i * FRAME_SIZE) ==
+               FRAME_SIZE);
+        assert(memcmp(buffer, expected, FRAME_SIZE) == 0);
+
+        int j = FRAMES - 1 - i;
+        frame(j, expected);
+        assert(tfs_pread(f, buffer, FRAME_SIZE, (size_t)j * FRAME_SIZE) ==
+               FRAME_SIZE);
+        assert(memcmp(buffer, expected, FRAME_SIZE) == 0);
+    }
+    assert(tfs_pread(f, buffer, FRAME_SIZE, FRAMES * FRAME_SIZE) == 0);
+    assert(tfs_pread(f, buffer, FRAME_SIZE, 2 * FRAMES * FRAME_SIZE) == 0);
+
+    // Appending through the handle continues after the vectored write
+    assert(tfs_write(f, "end", 3) == 3);
+    assert(tfs_file_size("/box") == FRAMES * FRAME_SIZE + 3);
+
+    // Overwriting a frame in place does not move the offset either
+    char overwrite[FRAME_SIZE];
+    memset(overwrite, '#', FRAME_SIZE);
+    assert(tfs_pwrite(f, overwrite, FRAME_SIZE, FRAME_SIZE) == FRAME_SIZE);
+    assert(tfs_write(f, "!", 1) == 1);
+    assert(tfs_file_size("/box") == FRAMES * FRAME_SIZE + 4);
+    assert(tfs_close(f) != -1);
+
+    // Scattered read of every frame; the last buffer is filled partially
+    char read_frames[FRAMES][FRAME_SIZE];
+    char tail[8];
+    struct iovec read_iov[FRAMES + 1];
+    for (int i = 0; i < FRAMES; i++) {
+        read_iov[i].iov_base = read_frames[i];
+        read_iov[i].iov_len = FRAME_SIZE;
+    }
+    read_iov[FRAMES].iov_base = tail;
+    read_iov[FRAMES].iov_len = sizeof(tail);
+
+    f = tfs_open("/box", 0);
+    assert(f != -1);
+    assert(tfs_readv(f, read_iov, FRAMES + 1) == FRAMES * FRAME_SIZE + 4);
+    assert(memcmp(read_frames[1], overwrite, FRAME_SIZE) == 0);
+    for (int i = 0; i < FRAMES; i++) {
+        if (i != 1) {
+            frame(i, expected);
+            assert(memcmp(read_frames[i], expected, FRAME_SIZE) == 0);
+        }
+    }
+    assert(memcmp(tail, "end!", 4) == 0);
+    assert(tfs_readv(f, read_iov, 1) == 0);
+
+    // A write past the end leaves a gap that reads as zeros
+    assert(tfs_pwrite(f, "x", 1, 4096) == 1);
+    assert(tfs_pread(f, buffer, FRAME_SIZE, 4096 - FRAME_SIZE + 1) ==
+           FRAME_SIZE);
+    for (int i = 0; i < FRAME_SIZE - 1; i++) {
+        assert(buffer[i] == '\0');
+    }
+    assert(buffer[FRAME_SIZE - 1] == 'x');
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_pread(f, buffer, 1, 0) == -1);
+    assert(tfs_pwrite(f, "x", 1, 0) == -1);
+    assert(tfs_unlink("/box") != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
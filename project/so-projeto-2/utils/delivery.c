@@ -0,0 +1,223 @@
+#define _GNU_SOURCE // vmsplice
+#include "delivery.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Frames of subscriber messages are made of the code, the message (in
+// pieces) and the padding, which are shared by every frame
+static char const code = P_SUB_MESSAGE_CODE;
+static char const padding[P_MESSAGE_SIZE] = {0};
+
+// In v2, frames are made of a header and the message, and the header of each
+// length is shared by every frame (they are never changed once built)
+static p_v2_header headers[P_MESSAGE_SIZE];
+static pthread_once_t headers_once = PTHREAD_ONCE_INIT;
+
+static void headers_init() {
+    for (size_t len = 0; len < P_MESSAGE_SIZE; len++) {
+        headers[len] = p_v2_build_header(P_SUB_MESSAGE_CODE, len);
+    }
+}
+
+// Largest pipe requested for spliced deliveries, so that a batch takes fewer
+// calls (each piece of a frame takes a slot of the pipe)
+#define DELIVERY_PIPE_SIZE (1024 * 1024)
+
+int delivery_mode_parse(char const *name, delivery_mode_t *mode) {
+    if (strcmp(name, "write") == 0) {
+        *mode = DELIVERY_WRITE;
+    } else if (strcmp(name, "batch") == 0) {
+        *mode = DELIVERY_BATCH;
+    } else if (strcmp(name, "splice") == 0) {
+        *mode = DELIVERY_SPLICE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void delivery_init(delivery_t *delivery, int fd, delivery_mode_t mode,
+                   int version) {
+    delivery->fd = fd;
+    delivery->mode = mode;
+    delivery->version = version;
+    delivery->n_iov = 0;
+    delivery->copy = NULL;
+    delivery->copy_size = 0;
+    delivery->messages = 0;
+    delivery->syscalls = 0;
+
+    if (version == P_V2 && pthread_once(&headers_once, headers_init) != 0) {
+        delivery->version = P_V1;
+    }
+
+    if (mode == DELIVERY_SPLICE) {
+        // Best effort, the pipe is only limited by its default size otherwise
+        for (int size = DELIVERY_PIPE_SIZE; size > 4096; size /= 2) {
+            if (fcntl(fd, F_SETPIPE_SZ, size) != -1) {
+                break;
+            }
+        }
+    }
+}
+
+/*Function that unmaps the pages a batch was copied to; the pipe keeps the
+ * ones it took until they are read*/
+static void delivery_uncopy(delivery_t *delivery) {
+    if (delivery->copy != NULL) {
+        munmap(delivery->copy, delivery->copy_size);
+        delivery->copy = NULL;
+    }
+}
+
+/*Function that copies the batch to pages of its own, to be spliced (unless it
+ * is only the rest of the last copy); returns -1 if they cannot be mapped*/
+static int delivery_copy(delivery_t *delivery) {
+    struct iovec *iov = delivery->iov;
+    if (delivery->n_iov == 1 && delivery->copy != NULL &&
+        (char *)iov->iov_base >= delivery->copy &&
+        (char *)iov->iov_base < delivery->copy + delivery->copy_size) {
+        return 0;
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < delivery->n_iov; i++) {
+        len += iov[i].iov_len;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (len + page - 1) / page * page;
+    char *copy = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) {
+        return -1;
+    }
+
+    size_t at = 0;
+    for (int i = 0; i < delivery->n_iov; i++) {
+        memcpy(copy + at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+    delivery_uncopy(delivery);
+    delivery->copy = copy;
+    delivery->copy_size = size;
+    iov[0].iov_base = copy;
+    iov[0].iov_len = len;
+    delivery->n_iov = 1;
+    return 0;
+}
+
+void delivery_destroy(delivery_t *delivery) {
+    delivery->n_iov = 0;
+    delivery_uncopy(delivery);
+}
+
+int delivery_flush(delivery_t *delivery) {
+    if (delivery->mode == DELIVERY_SPLICE && delivery->n_iov > 0 &&
+        delivery_copy(delivery) == -1) {
+        delivery_destroy(delivery);
+        return -1;
+    }
+
+    struct iovec *iov = delivery->iov;
+    int n_iov = delivery->n_iov;
+    int ret = 0;
+
+    while (n_iov > 0) {
+        ssize_t done;
+        if (delivery->mode == DELIVERY_SPLICE) {
+            done = vmsplice(delivery->fd, iov, (unsigned long)n_iov, 0);
+        } else {
+            done = writev(delivery->fd, iov, n_iov);
+        }
+        delivery->syscalls++;
+
+        if (done == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                ret = 1; // The pipe is full
+                break;
+            }
+            delivery_destroy(delivery);
+            return -1; // In case the pipe is broken (SIGPIPE is ignored)
+        }
+
+        // Skips what was delivered, as a full pipe may take only part of it
+        size_t left = (size_t)done;
+        while (n_iov > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (left > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+
+    // What was not delivered is kept for the next flush
+    memmove(delivery->iov, iov, (size_t)n_iov * sizeof(struct iovec));
+    delivery->n_iov = n_iov;
+    if (n_iov == 0) {
+        delivery_uncopy(delivery);
+    }
+    return ret;
+}
+
+int delivery_room(delivery_t const *delivery, size_t n_pieces) {
+    return (size_t)delivery->n_iov + n_pieces + 2 <= DELIVERY_BATCH_IOVS;
+}
+
+int delivery_add_frame(delivery_t *delivery, char const *frame, size_t size) {
+    struct iovec *iov = delivery->iov;
+    if (delivery->version == P_V2) { // The message, without its \0
+        iov[delivery->n_iov].iov_base = (void *)&headers[size - 1];
+        iov[delivery->n_iov++].iov_len = P_V2_HEADER_SIZE;
+        if (size > 1) { // Empty pieces would take a slot
+            iov[delivery->n_iov].iov_base = (void *)(frame + 1);
+            iov[delivery->n_iov++].iov_len = size - 1;
+        }
+    } else {
+        iov[delivery->n_iov].iov_base = (void *)frame;
+        iov[delivery->n_iov++].iov_len = P_SUB_MESSAGE_SIZE;
+    }
+    delivery->messages++;
+
+    if (delivery->mode == DELIVERY_WRITE) {
+        return delivery_flush(delivery);
+    }
+    return 0;
+}
+
+int delivery_add(delivery_t *delivery, struct iovec const *pieces,
+                 size_t n_pieces, size_t len) {
+    struct iovec *iov = delivery->iov;
+    if (delivery->version == P_V2) {
+        iov[delivery->n_iov].iov_base = (void *)&headers[len];
+        iov[delivery->n_iov++].iov_len = P_V2_HEADER_SIZE;
+    } else {
+        iov[delivery->n_iov].iov_base = (void *)&code;
+        iov[delivery->n_iov++].iov_len = 1;
+    }
+    for (size_t i = 0; i < n_pieces; i++) {
+        if (pieces[i].iov_len > 0) { // Empty pieces would take a slot
+            iov[delivery->n_iov++] = pieces[i];
+        }
+    }
+    if (delivery->version == P_V1 && len < P_MESSAGE_SIZE) {
+        iov[delivery->n_iov].iov_base = (void *)padding;
+        iov[delivery->n_iov++].iov_len = P_MESSAGE_SIZE - len;
+    }
+    delivery->messages++;
+
+    if (delivery->mode == DELIVERY_WRITE) {
+        return delivery_flush(delivery);
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "protocol.h"
+#include <stddef.h>
+#include <sys/uio.h>
+
+// How messages are delivered to a subscriber's pipe
+typedef enum {
+    DELIVERY_WRITE = 0,  // One write per message, as it is added
+    DELIVERY_BATCH = 1,  // Messages are batched, and written with writev
+    DELIVERY_SPLICE = 2, // Messages are batched, copied to pages of their own,
+                         // and spliced with vmsplice
+} delivery_mode_t;
+
+// Most iovecs in a batch (each message takes its pieces, plus 2)
+#define DELIVERY_BATCH_IOVS 256
+
+// Subscriber messages on their way to a pipe. A batch refers to the memory of
+// the messages it holds, which must stay valid (and unchanged) until it is
+// flushed. A pipe that does not block may take only part of a batch, the rest
+// staying in it. With DELIVERY_SPLICE, the pipe keeps referring to what it
+// takes until the subscriber reads it, so the batch is first copied to pages
+// only the pipe is left with (and not to the memory of the messages, which
+// may be reused meanwhile).
+typedef struct {
+    int fd;
+    delivery_mode_t mode;
+    int version; // Of the protocol of the subscriber
+    struct iovec iov[DELIVERY_BATCH_IOVS];
+    int n_iov;
+    char *copy; // Pages the batch was copied to, while it is being spliced
+    size_t copy_size;
+    size_t messages; // Delivered so far
+    size_t syscalls; // Made so far
+} delivery_t;
+
+// Parses a delivery mode name (write, batch or splice), returns -1 if unknown
+int delivery_mode_parse(char const *name, delivery_mode_t *mode);
+
+// Prepares the delivery of messages to a pipe, in frames of the given
+// version of the protocol
+void delivery_init(delivery_t *delivery, int fd, delivery_mode_t mode,
+                   int version);
+
+// Releases what the delivery holds (the messages not delivered are dropped)
+void delivery_destroy(delivery_t *delivery);
+
+// Whether the batch has room for a message of n_pieces pieces
+int delivery_room(delivery_t const *delivery, size_t n_pieces);
+
+// Adds a subscriber message, given by its pieces (of total length len), to
+// the batch, which must have room for it; with DELIVERY_WRITE, the batch is
+// then flushed, returning as delivery_flush
+int delivery_add(delivery_t *delivery, struct iovec const *pieces,
+                 size_t n_pieces, size_t len);
+
+// Adds a subscriber message, already framed as in v1 (P_SUB_MESSAGE_SIZE
+// bytes, the message being of size bytes with its \0), to the batch, which
+// must have room for it (as a message of no pieces); with DELIVERY_WRITE, the
+// batch is then flushed, returning as delivery_flush
+int delivery_add_frame(delivery_t *delivery, char const *frame, size_t size);
+
+// Delivers the messages in the batch; returns 0 once they are all delivered,
+// 1 if the pipe is full (and does not block), or -1 if the pipe is broken
+int delivery_flush(delivery_t *delivery);
@@ -98,4 +98,312 @@ void p_build_sub_message(char dest[P_SUB_MESSAGE_SIZE],
 
     dest[0] = P_SUB_MESSAGE_CODE;
     memcpy(dest + 1, message, P_MESSAGE_SIZE);
-}
\ No newline at end of file
+}
+
+int p_version_parse(char const *name) {
+    if (strcmp(name, "1") == 0) {
+        return P_V1;
+    }
+    if (strcmp(name, "2") == 0) {
+        return P_V2;
+    }
+    return -1;
+}
+
+p_v2_header p_v2_build_header(uint8_t protocol_code, size_t length) {
+    p_v2_header header;
+
+    header.magic = P_V2_MAGIC;
+    header.protocol_code = protocol_code;
+    header.length = (uint16_t)length;
+
+    return header;
+}
+
+size_t p_v2_build_request(char *dest, uint8_t protocol_code,
+                          char const *pipe_name, char const *box_name) {
+    // The names are sent with their \0
+    size_t length = strnlen(pipe_name, P_PIPE_NAME_SIZE - 1) + 1;
+    memcpy(dest + P_V2_HEADER_SIZE, pipe_name, length - 1);
+    dest[P_V2_HEADER_SIZE + length - 1] = '\0';
+
+    if (box_name != NULL) {
+        size_t box_length = strnlen(box_name, P_BOX_NAME_SIZE - 1) + 1;
+        memcpy(dest + P_V2_HEADER_SIZE + length, box_name, box_length - 1);
+        length += box_length;
+        dest[P_V2_HEADER_SIZE + length - 1] = '\0';
+    }
+
+    p_v2_header header = p_v2_build_header(protocol_code, length);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+
+    return P_V2_HEADER_SIZE + length;
+}
+
+/*Function that takes a name, ended by its \0, from the front of a payload,
+ * moving past it; returns -1 if it has no \0 or is longer than size - 1*/
+static int parse_name(char const **payload, size_t *length, char *name,
+                      size_t size) {
+    size_t name_length = strnlen(*payload, *length);
+    if (name_length == *length || name_length > size - 1) {
+        return -1;
+    }
+    memcpy(name, *payload, name_length);
+
+    *payload += name_length + 1;
+    *length -= name_length + 1;
+    return 0;
+}
+
+/*Function that writes a name with its \0 (cut to fit in size bytes),
+ * returning the bytes written*/
+static size_t build_name(char *dest, char const *name, size_t size) {
+    size_t name_length = strnlen(name, size - 1);
+    memcpy(dest, name, name_length);
+    dest[name_length] = '\0';
+    return name_length + 1;
+}
+
+int p_v2_parse_request(char const *payload, size_t length,
+                       char pipe_name[P_PIPE_NAME_SIZE],
+                       char box_name[P_BOX_NAME_SIZE]) {
+    memset(pipe_name, 0, P_PIPE_NAME_SIZE);
+    memset(box_name, 0, P_BOX_NAME_SIZE);
+
+    if (parse_name(&payload, &length, pipe_name, P_PIPE_NAME_SIZE) == -1) {
+        return -1;
+    }
+    if (length == 0) { // A listing request
+        return 0;
+    }
+
+    if (parse_name(&payload, &length, box_name, P_BOX_NAME_SIZE) == -1 ||
+        length != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void p_sub_options_init(p_sub_options *options) {
+    memset(options, 0, sizeof(p_sub_options));
+    options->from = P_SUB_FROM_EARLIEST;
+}
+
+size_t p_v2_build_sub_register(char *dest, char const *pipe_name,
+                               char const *box_name,
+                               p_sub_options const *options) {
+    size_t size =
+        p_v2_build_request(dest, P_SUB_REGISTER_CODE, pipe_name, box_name);
+    if (options == NULL) {
+        return size;
+    }
+
+    // Followed by where it starts, the name of the consumer with its \0, and
+    // the name of the group with its \0 (only if it has one)
+    dest[size] = (char)options->from;
+    memcpy(dest + size + P_UINT8_SIZE, &options->seq, P_UINT64_SIZE);
+    size += P_UINT8_SIZE + P_UINT64_SIZE;
+    size += build_name(dest + size, options->consumer, P_BOX_NAME_SIZE);
+    if (options->group[0] != '\0') {
+        size += build_name(dest + size, options->group, P_BOX_NAME_SIZE);
+    }
+
+    p_v2_header header =
+        p_v2_build_header(P_SUB_REGISTER_CODE, size - P_V2_HEADER_SIZE);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+
+    return size;
+}
+
+int p_v2_parse_sub_register(char const *payload, size_t length,
+                            char pipe_name[P_PIPE_NAME_SIZE],
+                            char box_name[P_BOX_NAME_SIZE],
+                            p_sub_options *options) {
+    memset(pipe_name, 0, P_PIPE_NAME_SIZE);
+    memset(box_name, 0, P_BOX_NAME_SIZE);
+    p_sub_options_init(options);
+
+    if (parse_name(&payload, &length, pipe_name, P_PIPE_NAME_SIZE) == -1 ||
+        parse_name(&payload, &length, box_name, P_BOX_NAME_SIZE) == -1) {
+        return -1;
+    }
+    if (length == 0) { // Without options
+        return 0;
+    }
+
+    if (length < P_UINT8_SIZE + P_UINT64_SIZE) {
+        return -1;
+    }
+    options->from = (uint8_t)payload[0];
+    memcpy(&options->seq, payload + P_UINT8_SIZE, P_UINT64_SIZE);
+    payload += P_UINT8_SIZE + P_UINT64_SIZE;
+    length -= P_UINT8_SIZE + P_UINT64_SIZE;
+
+    if (options->from > P_SUB_FROM_SEQ ||
+        parse_name(&payload, &length, options->consumer, P_BOX_NAME_SIZE) ==
+            -1) {
+        return -1;
+    }
+    if (length != 0 && // With a group
+        (parse_name(&payload, &length, options->group, P_BOX_NAME_SIZE) ==
+             -1 ||
+         options->group[0] == '\0' || length != 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t p_v2_build_response(char *dest, uint8_t protocol_code,
+                           int32_t return_code, char const *error_message) {
+    size_t message_length = strnlen(error_message, P_MESSAGE_SIZE - 1);
+    size_t length = P_UINT32_SIZE + message_length;
+
+    p_v2_header header = p_v2_build_header(protocol_code, length);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+    memcpy(dest + P_V2_HEADER_SIZE, &return_code, P_UINT32_SIZE);
+    memcpy(dest + P_V2_HEADER_SIZE + P_UINT32_SIZE, error_message,
+           message_length);
+
+    return P_V2_HEADER_SIZE + length;
+}
+
+int p_v2_parse_response(char const *payload, size_t length,
+                        uint8_t protocol_code, p_response *response) {
+    if (length < P_UINT32_SIZE || length > P_V2_PAYLOAD_MAX_SIZE - 1) {
+        return -1;
+    }
+
+    response->protocol_code = protocol_code;
+    memcpy(&response->return_code, payload, P_UINT32_SIZE);
+    memcpy(response->error_message, payload + P_UINT32_SIZE,
+           length - P_UINT32_SIZE);
+    response->error_message[length - P_UINT32_SIZE] = '\0';
+
+    return 0;
+}
+
+size_t p_v2_build_box_listing_response(char *dest, uint8_t last,
+                                       p_box_info info) {
+    // The last flag and the counters, followed by the name (without the /)
+    char *payload = dest + P_V2_HEADER_SIZE;
+    size_t name_length = strnlen(info.box_name + 1, P_BOX_NAME_SIZE - 1);
+
+    payload[0] = (char)last;
+    memcpy(payload + P_UINT8_SIZE, &info.box_size, P_UINT64_SIZE);
+    memcpy(payload + P_UINT8_SIZE + P_UINT64_SIZE, &info.n_publishers,
+           P_UINT64_SIZE);
+    memcpy(payload + P_UINT8_SIZE + 2 * P_UINT64_SIZE, &info.n_subscribers,
+           P_UINT64_SIZE);
+    memcpy(payload + P_UINT8_SIZE + 3 * P_UINT64_SIZE, info.box_name + 1,
+           name_length);
+
+    size_t length = P_UINT8_SIZE + 3 * P_UINT64_SIZE + name_length;
+    p_v2_header header =
+        p_v2_build_header(P_BOX_LISTING_RESPONSE_CODE, length);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+
+    return P_V2_HEADER_SIZE + length;
+}
+
+int p_v2_parse_box_listing_response(char const *payload, size_t length,
+                                    p_box_response *response) {
+    size_t fixed = P_UINT8_SIZE + 3 * P_UINT64_SIZE;
+    if (length < fixed || length - fixed > P_BOX_NAME_SIZE - 1) {
+        return -1;
+    }
+
+    response->protocol_code = P_BOX_LISTING_RESPONSE_CODE;
+    response->last = (uint8_t)payload[0];
+    memcpy(&response->box_size, payload + P_UINT8_SIZE, P_UINT64_SIZE);
+    memcpy(&response->n_publishers, payload + P_UINT8_SIZE + P_UINT64_SIZE,
+           P_UINT64_SIZE);
+    memcpy(&response->n_subscribers,
+           payload + P_UINT8_SIZE + 2 * P_UINT64_SIZE, P_UINT64_SIZE);
+    memset(response->box_name, 0, P_BOX_NAME_SIZE);
+    memcpy(response->box_name, payload + fixed, length - fixed);
+
+    return 0;
+}
+
+size_t p_v2_build_group_member_response(char *dest,
+                                        p_group_member const *member) {
+    // The counters, followed by the names of the box, the group and the
+    // member, each with its \0
+    char *payload = dest + P_V2_HEADER_SIZE;
+    memcpy(payload, &member->backlog, P_UINT64_SIZE);
+    memcpy(payload + P_UINT64_SIZE, &member->pending, P_UINT64_SIZE);
+    size_t length = 2 * P_UINT64_SIZE;
+    length += build_name(payload + length, member->box_name, P_BOX_NAME_SIZE);
+    length += build_name(payload + length, member->group, P_BOX_NAME_SIZE);
+    length += build_name(payload + length, member->member, P_PIPE_NAME_SIZE);
+
+    p_v2_header header =
+        p_v2_build_header(P_GROUP_MEMBER_RESPONSE_CODE, length);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+
+    return P_V2_HEADER_SIZE + length;
+}
+
+int p_v2_parse_group_member_response(char const *payload, size_t length,
+                                     p_group_member *member) {
+    memset(member, 0, sizeof(p_group_member));
+    if (length < 2 * P_UINT64_SIZE) {
+        return -1;
+    }
+    memcpy(&member->backlog, payload, P_UINT64_SIZE);
+    memcpy(&member->pending, payload + P_UINT64_SIZE, P_UINT64_SIZE);
+    payload += 2 * P_UINT64_SIZE;
+    length -= 2 * P_UINT64_SIZE;
+
+    if (parse_name(&payload, &length, member->box_name, P_BOX_NAME_SIZE) ==
+            -1 ||
+        parse_name(&payload, &length, member->group, P_BOX_NAME_SIZE) == -1 ||
+        parse_name(&payload, &length, member->member, P_PIPE_NAME_SIZE) ==
+            -1 ||
+        length != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t p_v2_build_message(char *dest, uint8_t protocol_code,
+                          char const *message) {
+    // The message is sent without its \0
+    size_t length = strnlen(message, P_MESSAGE_SIZE - 1);
+
+    p_v2_header header = p_v2_build_header(protocol_code, length);
+    memcpy(dest, &header, P_V2_HEADER_SIZE);
+    memcpy(dest + P_V2_HEADER_SIZE, message, length);
+
+    return P_V2_HEADER_SIZE + length;
+}
+
+void p_pub_batch_init(p_pub_batch *batch) {
+    batch->length = 0;
+    batch->messages = 0;
+}
+
+int p_pub_batch_add(p_pub_batch *batch, char const *message) {
+    size_t size = strnlen(message, P_MESSAGE_SIZE - 1) + 1;
+    if (batch->length + size > P_PUB_BATCH_MAX_SIZE) {
+        return -1;
+    }
+
+    char *dest = batch->frame + P_V2_HEADER_SIZE + batch->length;
+    memcpy(dest, message, size - 1);
+    dest[size - 1] = '\0';
+    batch->length += size;
+    batch->messages++;
+
+    return 0;
+}
+
+size_t p_pub_batch_finish(p_pub_batch *batch) {
+    p_v2_header header = p_v2_build_header(P_PUB_BATCH_CODE, batch->length);
+    memcpy(batch->frame, &header, P_V2_HEADER_SIZE);
+
+    return P_V2_HEADER_SIZE + batch->length;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define P_PUB_REGISTER_CODE 1
@@ -12,6 +13,8 @@
 #define P_BOX_LISTING_RESPONSE_CODE 8
 #define P_PUB_MESSAGE_CODE 9
 #define P_SUB_MESSAGE_CODE 10
+#define P_PUB_BATCH_CODE 11 // Only in v2
+#define P_GROUP_MEMBER_RESPONSE_CODE 12 // Only in v2
 
 #define P_PUB_REGISTER_SIZE 289
 #define P_SUB_REGISTER_SIZE 289
@@ -32,6 +35,24 @@
 #define P_UINT32_SIZE 4
 #define P_UINT64_SIZE 8
 
+// Protocol v2: every frame is a header (whose first byte tells it apart from
+// the codes of v1 frames) followed by a payload of the length it gives, so
+// that frames only take the bytes they use. A client asks for v2 by sending
+// its request in v2, and the broker answers (and runs its session) in the
+// version of the request
+#define P_V1 1
+#define P_V2 2
+#define P_V2_MAGIC 0xF2
+
+#define P_V2_HEADER_SIZE 4
+// Largest payload: a response, with its return code and error message
+#define P_V2_PAYLOAD_MAX_SIZE (P_UINT32_SIZE + P_MESSAGE_SIZE)
+#define P_V2_FRAME_MAX_SIZE (P_V2_HEADER_SIZE + P_V2_PAYLOAD_MAX_SIZE)
+
+// Largest payload of a batch of publisher messages, which holds them one after
+// the other, each with its \0 (as they are kept in the box)
+#define P_PUB_BATCH_MAX_SIZE (32 * 1024)
+
 typedef struct __attribute__((
     __packed__)) { // Struct that holds the info of the boxes in the program
     char box_name[P_BOX_NAME_SIZE + 1];
@@ -50,6 +71,47 @@ typedef struct __attribute__((
     uint64_t n_subscribers;
 } p_box_response;
 
+typedef struct __attribute__((__packed__)) { // Header of the v2 frames
+    uint8_t magic;
+    uint8_t protocol_code;
+    uint16_t length; // Of the payload
+} p_v2_header;
+
+// Where a subscriber starts in its box (only in v2): at its first message, at
+// the messages published after it registers, or at the message with the given
+// sequence number (counted from 0, in the box; past the last message, it is
+// as from latest)
+typedef enum {
+    P_SUB_FROM_EARLIEST = 0,
+    P_SUB_FROM_LATEST = 1,
+    P_SUB_FROM_SEQ = 2,
+} p_sub_from_t;
+
+typedef struct { // Options of a subscriber, in its register request
+    uint8_t from; // A p_sub_from_t
+    uint64_t seq; // With P_SUB_FROM_SEQ
+    // Name of the consumer, whose cursor the broker keeps, so that it resumes
+    // where it left off (from is only used the first time); empty for none
+    char consumer[P_BOX_NAME_SIZE];
+    // Name of its consumer group, whose members share the messages of the box
+    // (from is only used by the member that creates it); empty for none
+    char group[P_BOX_NAME_SIZE];
+} p_sub_options;
+
+typedef struct { // A member of a consumer group, in the listing of its box
+    char box_name[P_BOX_NAME_SIZE];
+    char group[P_BOX_NAME_SIZE];
+    char member[P_PIPE_NAME_SIZE]; // The name of its pipe
+    uint64_t backlog; // Messages it took from the group, not yet delivered
+    uint64_t pending; // Messages of the box the group has not yet given out
+} p_group_member;
+
+typedef struct { // A batch of publisher messages being built, as a v2 frame
+    char frame[P_V2_HEADER_SIZE + P_PUB_BATCH_MAX_SIZE];
+    size_t length; // Of the payload
+    size_t messages;
+} p_pub_batch;
+
 typedef struct __attribute__((__packed__)) { // Structure tht is the response to
                                              // create and remove requests
     uint8_t protocol_code;
@@ -98,4 +160,90 @@ void p_build_pub_message(char dest[P_PUB_MESSAGE_SIZE],
 
 // Builds the protocol receive message for the subscriber
 void p_build_sub_message(char dest[P_SUB_MESSAGE_SIZE],
-                         char message[P_MESSAGE_SIZE]);
\ No newline at end of file
+                         char message[P_MESSAGE_SIZE]);
+
+// Parses the version of the protocol a client asks for (1 or 2); returns -1
+// if it is unknown
+int p_version_parse(char const *name);
+
+// Builds the header of a v2 frame
+p_v2_header p_v2_build_header(uint8_t protocol_code, size_t length);
+
+// Builds a v2 request (register, creation, removal or listing, which has no
+// box name, given as NULL) in dest, of P_V2_FRAME_MAX_SIZE bytes; returns the
+// size of the frame
+size_t p_v2_build_request(char *dest, uint8_t protocol_code,
+                          char const *pipe_name, char const *box_name);
+
+// Parses the payload of a v2 request into the names (the box name is left
+// empty if it has none); returns -1 if it is malformed
+int p_v2_parse_request(char const *payload, size_t length,
+                       char pipe_name[P_PIPE_NAME_SIZE],
+                       char box_name[P_BOX_NAME_SIZE]);
+
+// Sets the options of a subscriber to their defaults (from earliest, with no
+// consumer name)
+void p_sub_options_init(p_sub_options *options);
+
+// Builds a v2 register request of a subscriber in dest, of P_V2_FRAME_MAX_SIZE
+// bytes, with its options after the names (unless they are NULL); returns the
+// size of the frame
+size_t p_v2_build_sub_register(char *dest, char const *pipe_name,
+                               char const *box_name,
+                               p_sub_options const *options);
+
+// Parses the payload of a v2 register request of a subscriber, with or
+// without options (which are left at their defaults); returns -1 if it is
+// malformed
+int p_v2_parse_sub_register(char const *payload, size_t length,
+                            char pipe_name[P_PIPE_NAME_SIZE],
+                            char box_name[P_BOX_NAME_SIZE],
+                            p_sub_options *options);
+
+// Builds a v2 response to a creation or removal request in dest, of
+// P_V2_FRAME_MAX_SIZE bytes; returns the size of the frame
+size_t p_v2_build_response(char *dest, uint8_t protocol_code,
+                           int32_t return_code, char const *error_message);
+
+// Parses the payload of a v2 response to a creation or removal request;
+// returns -1 if it is malformed
+int p_v2_parse_response(char const *payload, size_t length,
+                        uint8_t protocol_code, p_response *response);
+
+// Builds a v2 response to the list request in dest, of P_V2_FRAME_MAX_SIZE
+// bytes; returns the size of the frame
+size_t p_v2_build_box_listing_response(char *dest, uint8_t last,
+                                       p_box_info info);
+
+// Parses the payload of a v2 response to the list request; returns -1 if it
+// is malformed
+int p_v2_parse_box_listing_response(char const *payload, size_t length,
+                                    p_box_response *response);
+
+// Builds a v2 response to the list request in dest, of P_V2_FRAME_MAX_SIZE
+// bytes, for a member of a consumer group (sent before the box it is in);
+// returns the size of the frame
+size_t p_v2_build_group_member_response(char *dest,
+                                        p_group_member const *member);
+
+// Parses the payload of a v2 response for a member of a consumer group;
+// returns -1 if it is malformed
+int p_v2_parse_group_member_response(char const *payload, size_t length,
+                                     p_group_member *member);
+
+// Builds a v2 message (of the given code, for the publisher or the
+// subscriber) in dest, of P_V2_FRAME_MAX_SIZE bytes; returns the size of the
+// frame
+size_t p_v2_build_message(char *dest, uint8_t protocol_code,
+                          char const *message);
+
+// Empties a batch of publisher messages
+void p_pub_batch_init(p_pub_batch *batch);
+
+// Adds a message to a batch of publisher messages; returns -1 if it has no
+// room for it
+int p_pub_batch_add(p_pub_batch *batch, char const *message);
+
+// Builds the header of a batch of publisher messages, returning the size of
+// its frame
+size_t p_pub_batch_finish(p_pub_batch *batch);